@@ -1,4 +1,14 @@
 COMPONENT_ADD_INCLUDEDIRS = src
 COMPONENT_SRCDIRS = src
 COMPONENT_DEPENDS = log esp_http_server
-COMPONENT_EMBED_FILES := src/style.css src/code.js src/index.html
+
+# the web assets are minified, fingerprinted and gzipped at build time, then embedded as is
+WEB_ASSETS_DIR := $(COMPONENT_BUILD_DIR)/web_assets
+COMPONENT_EMBED_FILES := $(WEB_ASSETS_DIR)/style.css.gz $(WEB_ASSETS_DIR)/code.js.gz $(WEB_ASSETS_DIR)/index.html.gz
+COMPONENT_EXTRA_CLEAN := web_assets
+CFLAGS += -I$(WEB_ASSETS_DIR)
+
+$(COMPONENT_EMBED_FILES) $(WEB_ASSETS_DIR)/web_assets.h: $(COMPONENT_PATH)/tools/build_assets.py $(COMPONENT_PATH)/src/index.html $(COMPONENT_PATH)/src/code.js $(COMPONENT_PATH)/src/style.css
+	$(PYTHON) $(COMPONENT_PATH)/tools/build_assets.py --src $(COMPONENT_PATH)/src --out $(WEB_ASSETS_DIR)
+
+src/http_app.o: $(WEB_ASSETS_DIR)/web_assets.h
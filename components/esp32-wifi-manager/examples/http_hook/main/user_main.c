@@ -36,6 +36,7 @@ SOFTWARE.
 
 #include "wifi_manager.h"
 #include "http_app.h"
+#include "http_async.h"
 
 /* @brief tag used for ESP serial console messages */
 static const char TAG[] = "main";
@@ -43,34 +44,62 @@ static const char TAG[] = "main";
 
 static esp_err_t my_get_handler(httpd_req_t *req){
 
-	/* our custom page sits at /helloworld in this example */
-	if(strcmp(req->uri, "/helloworld") == 0){
+	ESP_LOGI(TAG, "Serving page /helloworld");
 
-		ESP_LOGI(TAG, "Serving page /helloworld");
+	const char* response = "<html><body><h1>Hello World!</h1></body></html>";
 
-		const char* response = "<html><body><h1>Hello World!</h1></body></html>";
+	/* the Content-Type was already set by the route */
+	httpd_resp_set_status(req, "200 OK");
+	httpd_resp_send(req, response, strlen(response));
 
-		httpd_resp_set_status(req, "200 OK");
-		httpd_resp_set_type(req, "text/html");
-		httpd_resp_send(req, response, strlen(response));
-	}
-	else{
-		/* send a 404 otherwise */
-		httpd_resp_send_404(req);
+	return ESP_OK;
+}
+
+/* our custom page sits at /helloworld in this example */
+static const struct http_route_t my_route = {
+	.method = HTTP_GET,
+	.uri = "/helloworld",
+	.handler = my_get_handler,
+	.content_type = "text/html",
+	.cache_policy = HTTP_CACHE_NO_STORE
+};
+
+
+static esp_err_t my_slow_handler(struct http_async_req_t *req){
+
+	ESP_LOGI(TAG, "Serving page /slow");
+
+	/* runs on a worker: the http server keeps serving the other clients in the meantime */
+	for(int i=0; i<10 && !http_async_is_abandoned(req); i++){
+		vTaskDelay(pdMS_TO_TICKS(200));
 	}
 
-	return ESP_OK;
+	const char* response = "<html><body><h1>That took a while</h1></body></html>";
+
+	http_async_resp_set_status(req, "200 OK");
+	return http_async_resp_append(req, response, strlen(response));
 }
 
+/* a page that takes two seconds to compute sits at /slow */
+static const struct http_route_t my_slow_route = {
+	.method = HTTP_GET,
+	.uri = "/slow",
+	.async_handler = my_slow_handler,
+	.content_type = "text/html",
+	.cache_policy = HTTP_CACHE_NO_STORE,
+	.timeout = 3000
+};
+
 
 void app_main()
 {
 	/* start the wifi manager */
 	wifi_manager_start();
 
-	/* set custom handler for the http server
+	/* add a route to the http server
 	 * Now navigate to /helloworld to see the custom page
 	 * */
-	http_app_set_handler_hook(HTTP_GET, &my_get_handler);
+	http_app_register_route(&my_route);
+	http_app_register_route(&my_slow_route);
 
 }
@@ -0,0 +1,111 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file ap_list.c
+@brief Operations on the lists of access points returned by scans
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ap_list.h"
+
+
+/* @brief open addressing hash table used by ap_list_filter_unique. Each slot holds an index in the output list + 1, 0 is empty */
+static uint16_t ap_list_hash_table[AP_LIST_HASH_SIZE];
+
+/**
+ * @brief FNV-1a hash of an SSID and its auth mode.
+ */
+static uint32_t ap_list_hash(const wifi_ap_record_t *ap){
+	uint32_t hash = 2166136261u;
+	for(size_t i=0; i<sizeof(ap->ssid) && ap->ssid[i] != '\0'; i++){
+		hash = (hash ^ ap->ssid[i]) * 16777619u;
+	}
+	return (hash ^ (uint32_t)ap->authmode) * 16777619u;
+}
+
+void ap_list_sort(wifi_ap_record_t *aplist, uint16_t aps){
+
+	/* the driver mostly returns the list already sorted by RSSI, which makes a stable insertion sort close
+	 * to linear here. Merging duplicates or the channels of a sweep is what can put a few records out of order. */
+	for(uint16_t i=1; i<aps; i++) {
+		if(aplist[i].rssi <= aplist[i-1].rssi) continue;
+		wifi_ap_record_t tmp;
+		memcpy(&tmp, &aplist[i], sizeof(wifi_ap_record_t));
+		uint16_t j = i;
+		while(j > 0 && aplist[j-1].rssi < tmp.rssi){
+			memcpy(&aplist[j], &aplist[j-1], sizeof(wifi_ap_record_t));
+			j--;
+		}
+		memcpy(&aplist[j], &tmp, sizeof(wifi_ap_record_t));
+	}
+}
+
+void ap_list_filter_unique(wifi_ap_record_t *aplist, uint16_t *aps) {
+	uint16_t total_unique = 0;
+
+	memset(ap_list_hash_table, 0x00, sizeof(ap_list_hash_table));
+
+	/* single pass: keep the first occurrence of each SSID+authmode, in place and in order.
+	 * Identical SSIDs with a different auth mode are different networks and are kept. */
+	for(uint16_t i=0; i<*aps; i++) {
+		wifi_ap_record_t * ap = &aplist[i];
+
+		/* hidden networks have no name to display */
+		if (ap->ssid[0] == 0) continue;
+
+		uint32_t slot = ap_list_hash(ap) % AP_LIST_HASH_SIZE;
+		bool duplicate = false;
+		while(ap_list_hash_table[slot] != 0){
+			wifi_ap_record_t * ap1 = &aplist[ap_list_hash_table[slot] - 1];
+			if ( (strncmp((const char *)ap->ssid, (const char *)ap1->ssid, sizeof(ap->ssid))==0) &&
+			     (ap->authmode == ap1->authmode) ) {
+				/* save the rssi for the display */
+				if ((ap->rssi) > (ap1->rssi)) ap1->rssi=ap->rssi;
+				duplicate = true;
+				break;
+			}
+			slot = (slot + 1) % AP_LIST_HASH_SIZE;
+		}
+		if(duplicate) continue;
+
+		if(total_unique != i){
+			memcpy(&aplist[total_unique], ap, sizeof(wifi_ap_record_t));
+		}
+		ap_list_hash_table[slot] = total_unique + 1;
+		total_unique++;
+	}
+
+	/* strongest first */
+	ap_list_sort(aplist, total_unique);
+
+	/* clear the records left behind */
+	if(total_unique < *aps){
+		memset(&aplist[total_unique], 0x00, sizeof(wifi_ap_record_t) * (*aps - total_unique));
+	}
+
+	/* update the length of the list */
+	*aps = total_unique;
+}
@@ -0,0 +1,68 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file ap_list.h
+@brief Operations on the lists of access points returned by scans
+
+The scan results are kept one record per BSSID, which is what the connection logic needs: a network made of
+several access points is seen on each of their channels. The page only shows one line per network, so the
+list it gets is a copy with the duplicates removed.
+These functions only depend on the record type of the wifi driver, so that they can be built and
+benchmarked on a host (see tools/ap_list_bench.c).
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_AP_LIST_H_INCLUDED
+#define WIFI_MANAGER_AP_LIST_H_INCLUDED
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include <esp_wifi_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of slots of the hash table used to remove duplicate SSIDs from a list.
+ * Twice the largest list keeps the probe sequences short.
+ */
+#define AP_LIST_HASH_SIZE					(2 * CONFIG_WIFI_MANAGER_MAX_AP_NUM)
+
+/**
+ * @brief Sorts a list by RSSI, strongest first. The sort is stable.
+ */
+void ap_list_sort(wifi_ap_record_t *aplist, uint16_t aps);
+
+/**
+ * @brief Filters a list to unique SSIDs, strongest signal first.
+ * Hidden networks are removed. aps is updated to the number of records left.
+ * @warning aps must not exceed CONFIG_WIFI_MANAGER_MAX_AP_NUM.
+ */
+void ap_list_filter_unique(wifi_ap_record_t *aplist, uint16_t *aps);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_AP_LIST_H_INCLUDED */
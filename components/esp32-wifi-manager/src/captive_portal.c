@@ -0,0 +1,140 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file captive_portal.c
+@brief Answers the requests the fake DNS sends to the access point, and the connectivity probes of the OSes
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <esp_log.h>
+
+#include "wifi_manager.h"
+#include "http_app.h"
+#include "captive_portal.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "captive_portal";
+
+/* @brief where the clients are sent: the wifi manager, on the access point */
+#define CAPTIVE_PORTAL_URL					"http://" DEFAULT_AP_IP WEBAPP_LOCATION
+
+/**
+ * @brief Page the probes get. It is not the answer any OS expects, so all of them open their login window, and
+ * as it is shown there straight away, it sends the window on to the wifi manager: a redirect would cost the OS
+ * another request before anything is shown.
+ */
+static const char captive_portal_probe_page[] =
+		"<!DOCTYPE html><html><head>"
+		"<meta http-equiv=\"refresh\" content=\"0;url=" CAPTIVE_PORTAL_URL "\">"
+		"<title>Wifi setup</title></head>"
+		"<body><a href=\"" CAPTIVE_PORTAL_URL "\">Wifi setup</a></body></html>";
+
+/**
+ * @brief Answer to the probes, headers and page in a single write, built once. It must not be cached: once the
+ * device is configured the same network may well have internet access.
+ */
+static char captive_portal_probe_response[sizeof(captive_portal_probe_page) + 160];
+static int captive_portal_probe_response_len = 0;
+
+/**
+ * @brief Answer to any other page: a browser the user is looking at, which follows the redirect and may reuse
+ * the connection.
+ */
+static const char captive_portal_page_response[] =
+		"HTTP/1.1 302 Found\r\n"
+		"Location: " CAPTIVE_PORTAL_URL "\r\n"
+		"Cache-Control: no-store\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n";
+
+struct captive_portal_probe_t{
+	const char *path;
+	const char *os;
+};
+
+/* @brief paths the OSes probe, whatever the host: the hosts change between versions, the paths rarely do */
+static const struct captive_portal_probe_t captive_portal_probes[] = {
+	{ "/generate_204", "Android" },
+	{ "/gen_204", "Android" },
+	{ "/hotspot-detect.html", "Apple" },
+	{ "/library/test/success.html", "Apple" },
+	{ "/connecttest.txt", "Windows" },
+	{ "/ncsi.txt", "Windows" },
+	{ "/redirect", "Windows" },					/* opened in the browser once a portal is detected */
+	{ "/canonical.html", "Firefox" },
+	{ "/success.txt", "Firefox" },
+	{ "/check_network_status.txt", "Kindle" },
+};
+
+
+/**
+ * @brief Finds the probe a path belongs to. The query string, if any, is ignored.
+ */
+static const struct captive_portal_probe_t* captive_portal_find_probe(const char *uri){
+
+	size_t len = strcspn(uri, "?");
+
+	for(size_t i=0; i<sizeof(captive_portal_probes)/sizeof(captive_portal_probes[0]); i++){
+		const char *path = captive_portal_probes[i].path;
+		if(strncmp(path, uri, len) == 0 && path[len] == '\0'){
+			return &captive_portal_probes[i];
+		}
+	}
+
+	return NULL;
+}
+
+esp_err_t captive_portal_redirect(httpd_req_t *req){
+
+	const struct captive_portal_probe_t *probe = captive_portal_find_probe(req->uri);
+
+	if(probe == NULL){
+		return httpd_send(req, captive_portal_page_response, sizeof(captive_portal_page_response) - 1) < 0 ? ESP_FAIL : ESP_OK;
+	}
+
+	ESP_LOGD(TAG, "%s probe %s", probe->os, req->uri);
+
+	/* only ever called on the task of the http server */
+	if(captive_portal_probe_response_len == 0){
+		captive_portal_probe_response_len = snprintf(captive_portal_probe_response, sizeof(captive_portal_probe_response),
+				"HTTP/1.1 200 OK\r\n"
+				"Content-Type: text/html\r\n"
+				"Cache-Control: no-store\r\n"
+				"Content-Length: %u\r\n"
+				"Connection: close\r\n"
+				"\r\n"
+				"%s",
+				(unsigned)(sizeof(captive_portal_probe_page) - 1), captive_portal_probe_page);
+	}
+
+	if(httpd_send(req, captive_portal_probe_response, captive_portal_probe_response_len) < 0){
+		return ESP_FAIL;
+	}
+
+	/* the OS is done with this connection: the socket goes back to the server right away */
+	httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+	return ESP_OK;
+}
@@ -0,0 +1,57 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file captive_portal.h
+@brief Answers the requests the fake DNS sends to the access point, and the connectivity probes of the OSes
+
+While the fake DNS is active, every name resolves to the access point, so every page a client asks for lands
+on the http server with a foreign Host. These requests are redirected to the wifi manager.
+
+Phones and laptops joining a network first fetch a well-known URL and compare the answer with the one they
+expect (an empty 204, "Success", "Microsoft Connect Test"...). Anything else means there is a portal, and its
+login window is opened. The probes are recognised by their path and answered with a small page that sends
+the window on to the wifi manager, so that it shows something on the first answer instead of following a
+redirect first. The answer is built once, sent in a single write and closes the connection: the OSes open one
+connection per probe and retry them, and the server only has a handful of sockets to share with the page itself.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_CAPTIVE_PORTAL_H_INCLUDED
+#define WIFI_MANAGER_CAPTIVE_PORTAL_H_INCLUDED
+
+#include <esp_http_server.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Sends a request made for another host to the wifi manager: a page for the probes, a redirect otherwise.
+ */
+esp_err_t captive_portal_redirect(httpd_req_t *req);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_CAPTIVE_PORTAL_H_INCLUDED */
@@ -22,9 +22,15 @@ function docReady(fn) {
 
 var selectedSSID = "";
 var refreshAPInterval = null;
+var apETag = null;
 var checkStatusInterval = null;
+// status and access points are pushed by the device through /events when the browser supports it
+var eventSource = null;
+var statusPaused = false;
+var lastStatus = null;
 
 function stopCheckStatusInterval() {
+  statusPaused = true;
   if (checkStatusInterval != null) {
     clearInterval(checkStatusInterval);
     checkStatusInterval = null;
@@ -39,11 +45,51 @@ function stopRefreshAPInterval() {
 }
 
 function startCheckStatusInterval() {
-  checkStatusInterval = setInterval(checkStatus, 950);
+  statusPaused = false;
+  if (eventSource != null) {
+    // catch up with a status pushed while paused
+    if (lastStatus != null) {
+      applyStatus(lastStatus);
+    }
+  } else {
+    checkStatusInterval = setInterval(checkStatus, 950);
+  }
 }
 
 function startRefreshAPInterval() {
-  refreshAPInterval = setInterval(refreshAP, 3800);
+  // the access points are pushed after each scan
+  if (eventSource == null) {
+    refreshAPInterval = setInterval(refreshAP, 3800);
+  }
+}
+
+function startEvents() {
+  if (!window.EventSource) {
+    return false;
+  }
+  eventSource = new EventSource("events");
+  eventSource.addEventListener("status", (e) => {
+    lastStatus = JSON.parse(e.data);
+    if (!statusPaused) {
+      applyStatus(lastStatus);
+    }
+  });
+  eventSource.addEventListener("ap", (e) => {
+    applyAP(JSON.parse(e.data));
+  });
+  eventSource.addEventListener("error", () => {
+    // a lost stream is reopened by the browser. A closed one was refused, e.g. too many browsers: poll instead
+    if (eventSource != null && eventSource.readyState === EventSource.CLOSED) {
+      console.info("Events not available, polling the device");
+      eventSource = null;
+      refreshAP();
+      startRefreshAPInterval();
+      if (!statusPaused) {
+        startCheckStatusInterval();
+      }
+    }
+  });
+  return true;
 }
 
 docReady(async function () {
@@ -181,10 +227,12 @@ docReady(async function () {
     wifi_div.style.display = "block";
   });
 
-  //first time the page loads: attempt get the connection status and start the wifi scan
-  await refreshAP();
-  startCheckStatusInterval();
-  startRefreshAPInterval();
+  //first time the page loads: the device pushes the connection status and the wifi list, or they are polled
+  if (!startEvents()) {
+    await refreshAP();
+    startCheckStatusInterval();
+    startRefreshAPInterval();
+  }
 });
 
 async function performConnect(conntype) {
@@ -244,22 +292,31 @@ function rssiToIcon(rssi) {
 
 async function refreshAP(url = "ap.json") {
   try {
+    // the browser revalidates the list with its ETag: an unchanged list costs headers only
     var res = await fetch(url);
-    var access_points = await res.json();
-    if (access_points.length > 0) {
-      //sort by signal strength
-      access_points.sort((a, b) => {
-        var x = a["rssi"];
-        var y = b["rssi"];
-        return x < y ? 1 : x > y ? -1 : 0;
-      });
-      refreshAPHTML(access_points);
+    var etag = res.headers.get("ETag");
+    if (etag && etag === apETag) {
+      return;
     }
+    apETag = etag;
+    applyAP(await res.json());
   } catch (e) {
     console.info("Access points returned empty from /ap.json!");
   }
 }
 
+function applyAP(access_points) {
+  if (access_points.length > 0) {
+    //sort by signal strength
+    access_points.sort((a, b) => {
+      var x = a["rssi"];
+      var y = b["rssi"];
+      return x < y ? 1 : x > y ? -1 : 0;
+    });
+    refreshAPHTML(access_points);
+  }
+}
+
 function refreshAPHTML(data) {
   var h = "";
   data.forEach(function (e, idx, array) {
@@ -275,78 +332,81 @@ function refreshAPHTML(data) {
 async function checkStatus(url = "status.json") {
   try {
     var response = await fetch(url);
-    var data = await response.json();
-    if (data && data.hasOwnProperty("ssid") && data["ssid"] != "") {
-      if (data["ssid"] === selectedSSID) {
-        // Attempting connection
-        switch (data["urc"]) {
-          case 0:
-            console.info("Got connection!");
-            document.querySelector(
-              "#connected-to div div div span"
-            ).textContent = data["ssid"];
-            document.querySelector("#connect-details h1").textContent =
-              data["ssid"];
-            gel("ip").textContent = data["ip"];
-            gel("netmask").textContent = data["netmask"];
-            gel("gw").textContent = data["gw"];
-            gel("wifi-status").style.display = "block";
-
-            //unlock the wait screen if needed
-            gel("ok-connect").disabled = false;
-
-            //update wait screen
-            gel("loading").style.display = "none";
-            gel("connect-success").style.display = "block";
-            gel("connect-fail").style.display = "none";
-            break;
-          case 1:
-            console.info("Connection attempt failed!");
-            document.querySelector(
-              "#connected-to div div div span"
-            ).textContent = data["ssid"];
-            document.querySelector("#connect-details h1").textContent =
-              data["ssid"];
-            gel("ip").textContent = "0.0.0.0";
-            gel("netmask").textContent = "0.0.0.0";
-            gel("gw").textContent = "0.0.0.0";
-
-            //don't show any connection
-            gel("wifi-status").display = "none";
-
-            //unlock the wait screen
-            gel("ok-connect").disabled = false;
-
-            //update wait screen
-            gel("loading").display = "none";
-            gel("connect-fail").style.display = "block";
-            gel("connect-success").style.display = "none";
-            break;
-        }
-      } else if (data.hasOwnProperty("urc") && data["urc"] === 0) {
-        console.info("Connection established");
-        //ESP32 is already connected to a wifi without having the user do anything
-        if (
-          gel("wifi-status").style.display == "" ||
-          gel("wifi-status").style.display == "none"
-        ) {
-          document.querySelector("#connected-to div div div span").textContent =
-            data["ssid"];
+    applyStatus(await response.json());
+  } catch (e) {
+    console.info("Was not able to fetch /status.json");
+  }
+}
+
+function applyStatus(data) {
+  if (data && data.hasOwnProperty("ssid") && data["ssid"] != "") {
+    if (data["ssid"] === selectedSSID) {
+      // Attempting connection
+      switch (data["urc"]) {
+        case 0:
+          console.info("Got connection!");
+          document.querySelector(
+            "#connected-to div div div span"
+          ).textContent = data["ssid"];
           document.querySelector("#connect-details h1").textContent =
             data["ssid"];
           gel("ip").textContent = data["ip"];
           gel("netmask").textContent = data["netmask"];
           gel("gw").textContent = data["gw"];
           gel("wifi-status").style.display = "block";
-        }
+
+          //unlock the wait screen if needed
+          gel("ok-connect").disabled = false;
+
+          //update wait screen
+          gel("loading").style.display = "none";
+          gel("connect-success").style.display = "block";
+          gel("connect-fail").style.display = "none";
+          break;
+        case 1:
+          console.info("Connection attempt failed!");
+          document.querySelector(
+            "#connected-to div div div span"
+          ).textContent = data["ssid"];
+          document.querySelector("#connect-details h1").textContent =
+            data["ssid"];
+          gel("ip").textContent = "0.0.0.0";
+          gel("netmask").textContent = "0.0.0.0";
+          gel("gw").textContent = "0.0.0.0";
+
+          //don't show any connection
+          gel("wifi-status").display = "none";
+
+          //unlock the wait screen
+          gel("ok-connect").disabled = false;
+
+          //update wait screen
+          gel("loading").display = "none";
+          gel("connect-fail").style.display = "block";
+          gel("connect-success").style.display = "none";
+          break;
       }
-    } else if (data.hasOwnProperty("urc") && data["urc"] === 2) {
-      console.log("Manual disconnect requested...");
-      if (gel("wifi-status").style.display == "block") {
-        gel("wifi-status").style.display = "none";
+    } else if (data.hasOwnProperty("urc") && data["urc"] === 0) {
+      console.info("Connection established");
+      //ESP32 is already connected to a wifi without having the user do anything
+      if (
+        gel("wifi-status").style.display == "" ||
+        gel("wifi-status").style.display == "none"
+      ) {
+        document.querySelector("#connected-to div div div span").textContent =
+          data["ssid"];
+        document.querySelector("#connect-details h1").textContent =
+          data["ssid"];
+        gel("ip").textContent = data["ip"];
+        gel("netmask").textContent = data["netmask"];
+        gel("gw").textContent = data["gw"];
+        gel("wifi-status").style.display = "block";
       }
     }
-  } catch (e) {
-    console.info("Was not able to fetch /status.json");
+  } else if (data.hasOwnProperty("urc") && data["urc"] === 2) {
+    console.log("Manual disconnect requested...");
+    if (gel("wifi-status").style.display == "block") {
+      gel("wifi-status").style.display = "none";
+    }
   }
 }
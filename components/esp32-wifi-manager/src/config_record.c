@@ -0,0 +1,303 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+@file config_record.c
+@brief Versioned, CRC protected record holding the wifi manager configuration in flash ram storage
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_wifi.h>
+#include <esp_crc.h>
+#include "nvs.h"
+
+#include "nvs_sync.h"
+#include "wifi_manager.h"
+#include "config_record.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "config_record";
+
+/* @brief NVS key of the record */
+static const char config_record_nvs_key[] = "config";
+
+/* @brief NVS keys of the blobs written by older firmwares */
+static const char config_record_legacy_ssid_key[] = "ssid";
+static const char config_record_legacy_password_key[] = "password";
+static const char config_record_legacy_settings_key[] = "settings";
+
+/* @brief copy of the record as it is in flash. Only valid when config_record_cached is set */
+static struct config_record_t config_record_cache;
+static bool config_record_cached = false;
+
+
+
+/* @brief size of the header of every version of the record, which the CRC does not cover */
+#define CONFIG_RECORD_HEADER_SIZE			offsetof(struct config_record_t, sta_ssid)
+
+/**
+ * @brief Version 2 moved the profile out of the header, where the CRC did not protect it.
+ */
+static void config_record_upgrade_to_v2(struct config_record_t *record){
+	record->profile = record->reserved < WIFI_PROFILE_COUNT ? record->reserved : WIFI_PROFILE_DEFAULT;
+	record->reserved = 0;
+}
+
+/**
+ * @brief Converters from the previous version of the record, indexed by the version they convert to. Fields
+ * appended by a version need none: they are zeroed before the converters run.
+ */
+static void (* const config_record_upgrades[CONFIG_RECORD_VERSION + 1])(struct config_record_t *record) = {
+	NULL,
+	NULL,							/* 1: first version */
+	config_record_upgrade_to_v2,	/* 2: profile covered by the CRC */
+};
+
+
+/**
+ * @brief CRC32 of the length - CONFIG_RECORD_HEADER_SIZE bytes that follow the header.
+ */
+static uint32_t config_record_crc(const struct config_record_t *record, size_t length){
+	return esp_crc32_le(0, (const uint8_t*)record + CONFIG_RECORD_HEADER_SIZE, length - CONFIG_RECORD_HEADER_SIZE);
+}
+
+static void config_record_pack(struct config_record_t *record, const wifi_config_t *sta_config, const struct wifi_settings_t *settings){
+
+	memset(record, 0x00, sizeof(struct config_record_t));
+	record->version = CONFIG_RECORD_VERSION;
+	record->profile = (uint8_t)settings->profile;
+	record->length = sizeof(struct config_record_t);
+
+	memcpy(record->sta_ssid, sta_config->sta.ssid, sizeof(record->sta_ssid));
+	memcpy(record->sta_password, sta_config->sta.password, sizeof(record->sta_password));
+	memcpy(record->ap_ssid, settings->ap_ssid, sizeof(record->ap_ssid));
+	memcpy(record->ap_pwd, settings->ap_pwd, sizeof(record->ap_pwd));
+	record->ap_channel = settings->ap_channel;
+	record->ap_ssid_hidden = settings->ap_ssid_hidden;
+	record->ap_bandwidth = (uint8_t)settings->ap_bandwidth;
+	record->sta_only = settings->sta_only;
+	record->sta_power_save = (uint8_t)settings->sta_power_save;
+	record->sta_static_ip = settings->sta_static_ip;
+	record->sta_ip = settings->sta_static_ip_config.ip.addr;
+	record->sta_netmask = settings->sta_static_ip_config.netmask.addr;
+	record->sta_gw = settings->sta_static_ip_config.gw.addr;
+
+	record->crc = config_record_crc(record, sizeof(struct config_record_t));
+}
+
+static void config_record_unpack(const struct config_record_t *record, wifi_config_t *sta_config, struct wifi_settings_t *settings){
+
+	memcpy(sta_config->sta.ssid, record->sta_ssid, sizeof(record->sta_ssid));
+	memcpy(sta_config->sta.password, record->sta_password, sizeof(record->sta_password));
+	memcpy(settings->ap_ssid, record->ap_ssid, sizeof(record->ap_ssid));
+	memcpy(settings->ap_pwd, record->ap_pwd, sizeof(record->ap_pwd));
+	settings->ap_channel = record->ap_channel;
+	settings->ap_ssid_hidden = record->ap_ssid_hidden;
+	settings->ap_bandwidth = (wifi_bandwidth_t)record->ap_bandwidth;
+	settings->sta_only = record->sta_only;
+	settings->sta_power_save = (wifi_ps_type_t)record->sta_power_save;
+	settings->sta_static_ip = record->sta_static_ip;
+	settings->sta_static_ip_config.ip.addr = record->sta_ip;
+	settings->sta_static_ip_config.netmask.addr = record->sta_netmask;
+	settings->sta_static_ip_config.gw.addr = record->sta_gw;
+	/* a profile this build does not know about falls back to the default one */
+	settings->profile = record->profile < WIFI_PROFILE_COUNT ? (wifi_profile_id_t)record->profile : WIFI_PROFILE_DEFAULT;
+}
+
+/**
+ * @brief reads the blobs written by older firmwares. They hold wifi_config_t fields and a raw struct wifi_settings_t.
+ * @return ESP_OK if all three were found.
+ */
+static esp_err_t config_record_read_legacy(wifi_config_t *sta_config, struct wifi_settings_t *settings){
+
+	esp_err_t esp_err;
+	size_t sz;
+
+	sz = sizeof(sta_config->sta.ssid);
+	esp_err = nvs_sync_get_blob(wifi_manager_nvs_namespace, config_record_legacy_ssid_key, sta_config->sta.ssid, &sz);
+	if(esp_err != ESP_OK) return esp_err;
+
+	sz = sizeof(sta_config->sta.password);
+	esp_err = nvs_sync_get_blob(wifi_manager_nvs_namespace, config_record_legacy_password_key, sta_config->sta.password, &sz);
+	if(esp_err != ESP_OK) return esp_err;
+
+	/* older firmwares had no profile: the blob stops before that field */
+	settings->profile = WIFI_PROFILE_DEFAULT;
+	sz = offsetof(struct wifi_settings_t, profile);
+	return nvs_sync_get_blob(wifi_manager_nvs_namespace, config_record_legacy_settings_key, settings, &sz);
+}
+
+/**
+ * @brief Checks a record read from flash and brings it up to the current version.
+ *
+ * The record is checked against the length and CRC it was written with. A record of an older version then has
+ * the fields it lacks zeroed, and goes through the converters of the versions that followed it.
+ * @param sz number of bytes read from flash.
+ * @return ESP_OK if record holds a valid record of the current version, ESP_ERR_INVALID_VERSION if it was written by
+ * a newer firmware, ESP_ERR_INVALID_CRC if it is corrupted.
+ */
+static esp_err_t config_record_upgrade(struct config_record_t *record, size_t sz){
+
+	if(sz >= CONFIG_RECORD_HEADER_SIZE && record->version > CONFIG_RECORD_VERSION){
+		ESP_LOGW(TAG, "ignoring a configuration record written by a newer firmware (version %d)", record->version);
+		return ESP_ERR_INVALID_VERSION;
+	}
+	if(sz < CONFIG_RECORD_HEADER_SIZE || record->version == 0 || record->length != sz ||
+			(record->version == CONFIG_RECORD_VERSION && sz != sizeof(struct config_record_t)) ||
+			record->crc != config_record_crc(record, sz)){
+		ESP_LOGE(TAG, "ignoring a corrupted configuration record");
+		return ESP_ERR_INVALID_CRC;
+	}
+
+	if(record->version == CONFIG_RECORD_VERSION){
+		return ESP_OK;
+	}
+
+	ESP_LOGI(TAG, "upgrading the configuration record from version %d to %d", record->version, CONFIG_RECORD_VERSION);
+	memset((uint8_t*)record + sz, 0x00, sizeof(struct config_record_t) - sz);
+	for(uint8_t version = record->version + 1; version <= CONFIG_RECORD_VERSION; version++){
+		if(config_record_upgrades[version]){
+			config_record_upgrades[version](record);
+		}
+	}
+	record->version = CONFIG_RECORD_VERSION;
+	record->length = sizeof(struct config_record_t);
+	record->crc = config_record_crc(record, sizeof(struct config_record_t));
+
+	return ESP_OK;
+}
+
+/**
+ * @brief writes a record to flash and caches it. The blobs of older firmwares are erased in the same commit if asked to.
+ */
+static esp_err_t config_record_write(const struct config_record_t *record, bool erase_legacy){
+
+	esp_err_t esp_err;
+
+	esp_err = nvs_sync_set_blob(wifi_manager_nvs_namespace, config_record_nvs_key, record, sizeof(struct config_record_t));
+	if(esp_err == ESP_OK && erase_legacy){
+		nvs_sync_erase_key(wifi_manager_nvs_namespace, config_record_legacy_ssid_key);
+		nvs_sync_erase_key(wifi_manager_nvs_namespace, config_record_legacy_password_key);
+		nvs_sync_erase_key(wifi_manager_nvs_namespace, config_record_legacy_settings_key);
+	}
+	if(esp_err == ESP_OK){
+		esp_err = nvs_sync_commit(wifi_manager_nvs_namespace);
+	}
+
+	if(esp_err == ESP_OK){
+		config_record_cache = *record;
+		config_record_cached = true;
+	}
+
+	return esp_err;
+}
+
+esp_err_t config_record_load(wifi_config_t *sta_config, struct wifi_settings_t *settings){
+
+	esp_err_t esp_err;
+	struct config_record_t record;
+	size_t sz = sizeof(record);
+
+	esp_err = nvs_sync_get_blob(wifi_manager_nvs_namespace, config_record_nvs_key, &record, &sz);
+
+	if(esp_err == ESP_ERR_NVS_NOT_FOUND){
+
+		/* first boot after an update from a firmware that saved three separate blobs */
+		wifi_config_t legacy_sta_config;
+		struct wifi_settings_t legacy_settings;
+		memset(&legacy_sta_config, 0x00, sizeof(legacy_sta_config));
+		memset(&legacy_settings, 0x00, sizeof(legacy_settings));
+		if(config_record_read_legacy(&legacy_sta_config, &legacy_settings) != ESP_OK){
+			return ESP_ERR_NVS_NOT_FOUND;
+		}
+
+		ESP_LOGI(TAG, "converting the configuration saved by an older firmware");
+		config_record_pack(&record, &legacy_sta_config, &legacy_settings);
+		esp_err = config_record_write(&record, true);
+		if(esp_err != ESP_OK){
+			ESP_LOGE(TAG, "could not save the converted configuration: %s", esp_err_to_name(esp_err));
+		}
+	}
+	else{
+		/* a record larger than this build expects was written by a newer firmware */
+		if(esp_err == ESP_ERR_NVS_INVALID_LENGTH){
+			ESP_LOGW(TAG, "ignoring a configuration record written by a newer firmware");
+			return ESP_ERR_INVALID_VERSION;
+		}
+		if(esp_err != ESP_OK){
+			return esp_err;
+		}
+
+		const uint8_t version = record.version;
+		esp_err = config_record_upgrade(&record, sz);
+		if(esp_err != ESP_OK){
+			return esp_err;
+		}
+
+		if(version != CONFIG_RECORD_VERSION){
+			/* saved in the current layout straight away: the next boot does not have to upgrade it again */
+			esp_err = config_record_write(&record, false);
+			if(esp_err != ESP_OK){
+				ESP_LOGE(TAG, "could not save the upgraded configuration: %s", esp_err_to_name(esp_err));
+			}
+		}
+		else{
+			config_record_cache = record;
+			config_record_cached = true;
+		}
+	}
+
+	config_record_unpack(&record, sta_config, settings);
+
+	return ESP_OK;
+}
+
+esp_err_t config_record_save(const wifi_config_t *sta_config, const struct wifi_settings_t *settings){
+
+	struct config_record_t record;
+	config_record_pack(&record, sta_config, settings);
+
+	if(config_record_cached && memcmp(&record, &config_record_cache, sizeof(record)) == 0){
+		ESP_LOGI(TAG, "Wifi config was not saved to flash because no change has been detected.");
+		return ESP_OK;
+	}
+
+	esp_err_t esp_err = config_record_write(&record, false);
+	if(esp_err == ESP_OK){
+		ESP_LOGI(TAG, "wifi_manager_wrote config: ssid:%s", (char*)record.sta_ssid);
+	}
+
+	return esp_err;
+}
+
+void config_record_invalidate_cache(){
+	config_record_cached = false;
+}
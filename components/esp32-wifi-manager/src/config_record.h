@@ -0,0 +1,111 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+@file config_record.h
+@brief Versioned, CRC protected record holding the wifi manager configuration in flash ram storage
+
+The STA credentials and the wifi settings are saved as a single fixed layout record instead of raw structures,
+so the record does not depend on the padding or enum sizes chosen by the compiler. A copy of the record last
+read or written is kept in RAM: flash is only written when the configuration actually changed.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_CONFIG_RECORD_H_INCLUDED
+#define WIFI_MANAGER_CONFIG_RECORD_H_INCLUDED
+
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_wifi.h>
+
+#include "wifi_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Version of the layout of struct config_record_t. Must be incremented whenever the layout changes.
+ *
+ * Records written by older firmwares are upgraded when loaded: new fields must be appended to the record, and
+ * are zero in an upgraded record. Any other change needs a converter in config_record.c.
+ */
+#define CONFIG_RECORD_VERSION				2
+
+/**
+ * @brief The configuration as saved in flash. Multi-byte fields are little endian, addresses are as in esp_ip4_addr_t.
+ */
+struct config_record_t{
+	uint8_t version;
+	uint8_t reserved;				/* written as 0. Held the profile in version 1, where the CRC did not cover it */
+	uint16_t length;				/* size of the record, header included */
+	uint32_t crc;					/* CRC32 of everything after this field */
+	uint8_t sta_ssid[MAX_SSID_SIZE];
+	uint8_t sta_password[MAX_PASSWORD_SIZE];
+	uint8_t ap_ssid[MAX_SSID_SIZE];
+	uint8_t ap_pwd[MAX_PASSWORD_SIZE];
+	uint8_t ap_channel;
+	uint8_t ap_ssid_hidden;
+	uint8_t ap_bandwidth;
+	uint8_t sta_only;
+	uint8_t sta_power_save;
+	uint8_t sta_static_ip;
+	uint8_t padding[2];
+	uint32_t sta_ip;				/* static IP configuration, used when sta_static_ip is set */
+	uint32_t sta_netmask;
+	uint32_t sta_gw;
+	uint8_t profile;				/* wifi_profile_id_t, since version 2 */
+} __attribute__((packed));
+
+/**
+ * @brief reads the configuration from flash ram storage with a single read.
+ *
+ * If no record exists but the three blobs written by older firmwares do, they are converted to a record
+ * and erased.
+ *
+ * @param sta_config receives the STA ssid and password. Other fields are left untouched.
+ * @param settings receives the wifi settings.
+ * A record written by an older firmware is upgraded to the current version and saved again.
+ *
+ * @return ESP_OK if a configuration was read, ESP_ERR_NVS_NOT_FOUND if none was saved, ESP_ERR_INVALID_CRC if the
+ * record is corrupted, ESP_ERR_INVALID_VERSION if it was written by a newer firmware. Nothing is written to the
+ * outputs unless ESP_OK is returned.
+ */
+esp_err_t config_record_load(wifi_config_t *sta_config, struct wifi_settings_t *settings);
+
+/**
+ * @brief saves the configuration to flash ram storage. Nothing is written if it did not change since it was last read or written.
+ */
+esp_err_t config_record_save(const wifi_config_t *sta_config, const struct wifi_settings_t *settings);
+
+/**
+ * @brief forgets what config_record_save believes is in flash, so that the next save writes the record whatever it holds.
+ * @note to be called when a batch the record was saved in failed to commit: see nvs_sync_end_batch.
+ */
+void config_record_invalidate_cache();
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_CONFIG_RECORD_H_INCLUDED */
@@ -0,0 +1,270 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file event_dispatcher.c
+@brief Runs the callbacks subscribed to wifi_manager messages on a dedicated task
+
+Each subscription has its own queue so that a subscriber falling behind only loses its own messages.
+The dispatcher task serves the queues in turn, one message each, and times every callback.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "wifi_manager.h"
+#include "payload_pool.h"
+#include "event_dispatcher.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "event_dispatcher";
+
+/**
+ * @brief A message as queued for a subscriber. Payloads are copied in the item itself.
+ */
+struct event_dispatcher_item_t{
+	message_code_t code;
+	void *param;
+	bool has_payload;
+	union payload_pool_block_t payload;
+};
+
+struct event_subscriber_t{
+	void (*func_ptr)(void*);
+	message_code_t code;
+	const char *name;
+	QueueHandle_t queue;	/* created on first use of the slot and kept afterwards */
+	uint32_t calls;
+	uint32_t dropped;
+	uint32_t max_time_us;
+	uint64_t total_time_us;
+};
+
+static struct event_subscriber_t event_subscribers[MAX_SUBSCRIBERS];
+
+/* @brief protects event_subscribers */
+static SemaphoreHandle_t event_dispatcher_mutex = NULL;
+
+static TaskHandle_t task_event_dispatcher = NULL;
+
+
+static bool event_dispatcher_has_payload(message_code_t code){
+	return code == WM_EVENT_SCAN_DONE || code == WM_EVENT_STA_DISCONNECTED || code == WM_EVENT_STA_GOT_IP;
+}
+
+static bool event_dispatcher_lock(){
+	return event_dispatcher_mutex && xSemaphoreTake(event_dispatcher_mutex, portMAX_DELAY) == pdTRUE;
+}
+
+static void event_dispatcher_unlock(){
+	xSemaphoreGive(event_dispatcher_mutex);
+}
+
+static void event_dispatcher_call(struct event_subscriber_t *subscriber, struct event_dispatcher_item_t *item){
+
+	/* the subscription may have been cancelled while the message was waiting */
+	void (*func_ptr)(void*) = subscriber->func_ptr;
+	if(func_ptr == NULL || subscriber->code != item->code) return;
+
+	int64_t start = esp_timer_get_time();
+	(*func_ptr)( item->has_payload ? (void*)&item->payload : item->param );
+	uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+	subscriber->calls++;
+	subscriber->total_time_us += elapsed;
+	if(elapsed > subscriber->max_time_us) subscriber->max_time_us = elapsed;
+
+	if(elapsed > SLOW_CALLBACK_THRESHOLD * 1000){
+		ESP_LOGW(TAG, "callback %s for message %d took %u ms", subscriber->name ? subscriber->name : "(unnamed)", item->code, elapsed / 1000);
+	}
+}
+
+static void event_dispatcher(void *pvParameters){
+
+	struct event_dispatcher_item_t item;
+
+	for(;;){
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		/* one message per subscriber and per round, until all queues are empty */
+		bool more;
+		do{
+			more = false;
+			for(int i=0; i<MAX_SUBSCRIBERS; i++){
+				QueueHandle_t queue = event_subscribers[i].queue;
+				if(queue && xQueueReceive(queue, &item, 0) == pdTRUE){
+					event_dispatcher_call(&event_subscribers[i], &item);
+					more = true;
+				}
+			}
+		}while(more);
+	}
+}
+
+esp_err_t event_dispatcher_start(){
+
+	if(task_event_dispatcher) return ESP_OK;
+
+	if(event_dispatcher_mutex == NULL){
+		event_dispatcher_mutex = xSemaphoreCreateMutex();
+		if(event_dispatcher_mutex == NULL) return ESP_ERR_NO_MEM;
+	}
+
+	if(xTaskCreate(&event_dispatcher, "event_dispatcher", 4096, NULL, WIFI_MANAGER_TASK_PRIORITY-1, &task_event_dispatcher) != pdPASS){
+		return ESP_ERR_NO_MEM;
+	}
+
+	return ESP_OK;
+}
+
+void event_dispatcher_stop(){
+	if(task_event_dispatcher){
+		vTaskDelete(task_event_dispatcher);
+		task_event_dispatcher = NULL;
+	}
+}
+
+esp_err_t event_dispatcher_subscribe(message_code_t code, void (*func_ptr)(void*), const char *name){
+
+	esp_err_t err = ESP_ERR_NO_MEM;
+
+	if(func_ptr == NULL || code >= WM_MESSAGE_CODE_COUNT) return ESP_ERR_INVALID_ARG;
+	if(!event_dispatcher_lock()) return ESP_ERR_INVALID_STATE;
+
+	for(int i=0; i<MAX_SUBSCRIBERS; i++){
+		struct event_subscriber_t *subscriber = &event_subscribers[i];
+		if(subscriber->func_ptr != NULL) continue;
+
+		if(subscriber->queue == NULL){
+			subscriber->queue = xQueueCreate(SUBSCRIBER_QUEUE_SIZE, sizeof(struct event_dispatcher_item_t));
+			if(subscriber->queue == NULL) break;
+		}
+		else{
+			/* leftovers of a previous subscription of this slot */
+			xQueueReset(subscriber->queue);
+		}
+
+		subscriber->code = code;
+		subscriber->name = name;
+		subscriber->calls = 0;
+		subscriber->dropped = 0;
+		subscriber->max_time_us = 0;
+		subscriber->total_time_us = 0;
+		subscriber->func_ptr = func_ptr;
+		err = ESP_OK;
+		break;
+	}
+
+	event_dispatcher_unlock();
+
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "could not subscribe to message %d: %s", code, esp_err_to_name(err));
+	}
+
+	return err;
+}
+
+esp_err_t event_dispatcher_unsubscribe(message_code_t code, void (*func_ptr)(void*)){
+
+	esp_err_t err = ESP_ERR_NOT_FOUND;
+
+	if(!event_dispatcher_lock()) return ESP_ERR_INVALID_STATE;
+
+	for(int i=0; i<MAX_SUBSCRIBERS; i++){
+		if(event_subscribers[i].func_ptr == func_ptr && event_subscribers[i].code == code){
+			event_subscribers[i].func_ptr = NULL;
+			err = ESP_OK;
+			break;
+		}
+	}
+
+	event_dispatcher_unlock();
+
+	return err;
+}
+
+void event_dispatcher_post(message_code_t code, void *param){
+
+	struct event_dispatcher_item_t item;
+	bool posted = false;
+
+	item.code = code;
+	item.has_payload = param != NULL && event_dispatcher_has_payload(code);
+	if(item.has_payload){
+		/* payloads of events always come from the payload pool: a full block can be copied */
+		memcpy(&item.payload, param, sizeof(item.payload));
+		item.param = NULL;
+	}
+	else{
+		item.param = param;
+	}
+
+	if(!event_dispatcher_lock()) return;
+
+	for(int i=0; i<MAX_SUBSCRIBERS; i++){
+		struct event_subscriber_t *subscriber = &event_subscribers[i];
+		if(subscriber->func_ptr == NULL || subscriber->code != code) continue;
+
+		if(xQueueSend(subscriber->queue, &item, 0) == pdTRUE){
+			posted = true;
+		}
+		else{
+			subscriber->dropped++;
+			ESP_LOGW(TAG, "callback %s is falling behind, message %d dropped", subscriber->name ? subscriber->name : "(unnamed)", code);
+		}
+	}
+
+	event_dispatcher_unlock();
+
+	if(posted && task_event_dispatcher){
+		xTaskNotifyGive(task_event_dispatcher);
+	}
+}
+
+bool event_dispatcher_get_stats(uint8_t index, struct wifi_manager_subscriber_stats_t *stats){
+
+	if(index >= MAX_SUBSCRIBERS || !event_dispatcher_lock()) return false;
+
+	struct event_subscriber_t *subscriber = &event_subscribers[index];
+	bool found = subscriber->func_ptr != NULL;
+	if(found){
+		stats->name = subscriber->name;
+		stats->code = subscriber->code;
+		stats->calls = subscriber->calls;
+		stats->dropped = subscriber->dropped;
+		stats->max_time_us = subscriber->max_time_us;
+		stats->total_time_us = subscriber->total_time_us;
+	}
+
+	event_dispatcher_unlock();
+
+	return found;
+}
@@ -0,0 +1,103 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file event_dispatcher.h
+@brief Runs the callbacks subscribed to wifi_manager messages on a dedicated task
+
+The wifi_manager task only posts a copy of each message to the queue of every subscriber of that message:
+a slow callback can no longer hold up the processing of wifi events.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_EVENT_DISPATCHER_H_INCLUDED
+#define WIFI_MANAGER_EVENT_DISPATCHER_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "wifi_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Maximum number of subscriptions, all messages included.
+ */
+#define MAX_SUBSCRIBERS						CONFIG_WIFI_MANAGER_MAX_SUBSCRIBERS
+
+/**
+ * @brief Number of messages that can wait in the queue of a single subscriber. Messages are dropped for a
+ * subscriber whose queue is full.
+ */
+#define SUBSCRIBER_QUEUE_SIZE				CONFIG_WIFI_MANAGER_SUBSCRIBER_QUEUE_SIZE
+
+/**
+ * @brief Callbacks running longer than this (in ms) are reported in the console.
+ */
+#define SLOW_CALLBACK_THRESHOLD				CONFIG_WIFI_MANAGER_SLOW_CALLBACK_THRESHOLD
+
+
+/**
+ * @brief Starts the dispatcher task. Must be called before any subscription is made.
+ */
+esp_err_t event_dispatcher_start();
+
+/**
+ * @brief Stops the dispatcher task. Subscriptions are kept.
+ */
+void event_dispatcher_stop();
+
+/**
+ * @brief Adds a callback to the subscribers of a message.
+ * @param name used in the console and in the statistics. Can be NULL.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE if the dispatcher was never started,
+ * or ESP_ERR_NO_MEM if there are already MAX_SUBSCRIBERS subscriptions.
+ */
+esp_err_t event_dispatcher_subscribe(message_code_t code, void (*func_ptr)(void*), const char *name);
+
+/**
+ * @brief Removes a callback from the subscribers of a message. Messages already queued for it are discarded.
+ */
+esp_err_t event_dispatcher_unsubscribe(message_code_t code, void (*func_ptr)(void*));
+
+/**
+ * @brief Queues a message for all its subscribers. Never blocks.
+ *
+ * The payload of events carrying data (scan done, disconnected, got IP) is copied, so param can be released
+ * as soon as this returns. Other params are passed as is.
+ */
+void event_dispatcher_post(message_code_t code, void *param);
+
+/**
+ * @brief Copies the statistics of the subscription stored at index.
+ * @return false if there is no subscription at index.
+ */
+bool event_dispatcher_get_stats(uint8_t index, struct wifi_manager_subscriber_stats_t *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_EVENT_DISPATCHER_H_INCLUDED */
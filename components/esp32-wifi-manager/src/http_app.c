@@ -45,6 +45,13 @@ function to process requests, decode URLs, serve files, etc. etc.
 
 #include "wifi_manager.h"
 #include "http_app.h"
+#include "throughput_test.h"
+#include "link_telemetry.h"
+#include "web_assets.h"
+#include "http_router.h"
+#include "http_events.h"
+#include "http_async.h"
+#include "captive_portal.h"
 
 
 /* @brief tag used for ESP serial console messages */
@@ -57,43 +64,47 @@ static httpd_handle_t httpd_handle = NULL;
 esp_err_t (*custom_get_httpd_uri_handler)(httpd_req_t *r) = NULL;
 esp_err_t (*custom_post_httpd_uri_handler)(httpd_req_t *r) = NULL;
 
-/* strings holding the URLs of the wifi manager */
-static char* http_root_url = NULL;
-static char* http_redirect_url = NULL;
-static char* http_js_url = NULL;
-static char* http_css_url = NULL;
-static char* http_connect_url = NULL;
-static char* http_ap_url = NULL;
-static char* http_status_url = NULL;
+/* the pages of the wifi manager are added to the router the first time the server starts */
+static bool http_app_routes_added = false;
 
 /**
- * @brief embedded binary data.
- * @see file "component.mk"
+ * @brief embedded binary data, minified and gzipped at build time by tools/build_assets.py.
+ * @see file "CMakeLists.txt"
  * @see https://docs.espressif.com/projects/esp-idf/en/latest/api-guides/build-system.html#embedding-binary-data
  */
-extern const uint8_t style_css_start[] asm("_binary_style_css_start");
-extern const uint8_t style_css_end[]   asm("_binary_style_css_end");
-extern const uint8_t code_js_start[] asm("_binary_code_js_start");
-extern const uint8_t code_js_end[] asm("_binary_code_js_end");
-extern const uint8_t index_html_start[] asm("_binary_index_html_start");
-extern const uint8_t index_html_end[] asm("_binary_index_html_end");
+extern const uint8_t style_css_start[] asm("_binary_style_css_gz_start");
+extern const uint8_t style_css_end[]   asm("_binary_style_css_gz_end");
+extern const uint8_t code_js_start[] asm("_binary_code_js_gz_start");
+extern const uint8_t code_js_end[] asm("_binary_code_js_gz_end");
+extern const uint8_t index_html_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_end[] asm("_binary_index_html_gz_end");
 
 
 /* const httpd related values stored in ROM */
 const static char http_200_hdr[] = "200 OK";
-const static char http_302_hdr[] = "302 Found";
+const static char http_304_hdr[] = "304 Not Modified";
 const static char http_400_hdr[] = "400 Bad Request";
 const static char http_404_hdr[] = "404 Not Found";
 const static char http_503_hdr[] = "503 Service Unavailable";
-const static char http_location_hdr[] = "Location";
 const static char http_content_type_html[] = "text/html";
 const static char http_content_type_js[] = "text/javascript";
 const static char http_content_type_css[] = "text/css";
 const static char http_content_type_json[] = "application/json";
 const static char http_cache_control_hdr[] = "Cache-Control";
 const static char http_cache_control_no_cache[] = "no-store, no-cache, must-revalidate, max-age=0";
-const static char http_cache_control_cache[] = "public, max-age=31536000";
+const static char http_cache_control_immutable[] = "public, max-age=31536000, immutable";
+const static char http_cache_control_revalidate[] = "no-cache";
+const static char* const http_cache_control_policies[] = {
+	[HTTP_CACHE_NO_STORE] = http_cache_control_no_cache,
+	[HTTP_CACHE_REVALIDATE] = http_cache_control_revalidate,
+	[HTTP_CACHE_IMMUTABLE] = http_cache_control_immutable
+};
+const static char http_etag_hdr[] = "ETag";
+const static char http_if_none_match_hdr[] = "If-None-Match";
+const static char http_content_encoding_hdr[] = "Content-Encoding";
+const static char http_content_encoding_gzip[] = "gzip";
 const static char http_pragma_hdr[] = "Pragma";
+const static char http_host_hdr[] = "Host";
 const static char http_pragma_no_cache[] = "no-cache";
 
 
@@ -115,243 +126,373 @@ esp_err_t http_app_set_handler_hook( httpd_method_t method,  esp_err_t (*handler
 }
 
 
-static esp_err_t http_server_delete_handler(httpd_req_t *req){
+esp_err_t http_app_register_route(const struct http_route_t *route){
+	if(route->async_handler){
+		esp_err_t err = http_async_init();
+		if(err != ESP_OK){
+			return err;
+		}
+	}
+	return http_router_add(route);
+}
 
-	ESP_LOGI(TAG, "DELETE %s", req->uri);
+esp_err_t http_app_unregister_route(httpd_method_t method, const char *uri){
+	return http_router_remove(method, uri);
+}
 
-	/* DELETE /connect.json */
-	if(strcmp(req->uri, http_connect_url) == 0){
-		wifi_manager_disconnect_async();
 
-		httpd_resp_set_status(req, http_200_hdr);
-		httpd_resp_set_type(req, http_content_type_json);
-		httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-		httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
+/**
+ * @brief Sends one of the embedded web assets, already gzipped, or only its headers if the browser has it.
+ * Content-Type and Cache-Control are set by the route.
+ */
+static esp_err_t http_app_send_asset(httpd_req_t *req, const char *etag, const uint8_t *start, const uint8_t *end){
+
+	/* large enough for a few ETags: browsers may send several, or a weak W/ one */
+	char if_none_match[64];
+
+	httpd_resp_set_hdr(req, http_etag_hdr, etag);
+	if(httpd_req_get_hdr_value_str(req, http_if_none_match_hdr, if_none_match, sizeof(if_none_match)) == ESP_OK &&
+			strstr(if_none_match, etag) != NULL){
+		httpd_resp_set_status(req, http_304_hdr);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	httpd_resp_set_status(req, http_200_hdr);
+	httpd_resp_set_hdr(req, http_content_encoding_hdr, http_content_encoding_gzip);
+	return httpd_resp_send(req, (const char*)start, end - start);
+}
+
+
+/* GET / */
+static esp_err_t http_app_get_index(httpd_req_t *req){
+	/* the page names the current code.js and style.css, so it must always be revalidated */
+	return http_app_send_asset(req, WEB_ASSET_INDEX_HTML_ETAG, index_html_start, index_html_end);
+}
+
+/* GET /code.<hash>.js */
+static esp_err_t http_app_get_js(httpd_req_t *req){
+	/* a new firmware with a different code.js gives it a different name: the browser can keep this one forever */
+	return http_app_send_asset(req, WEB_ASSET_CODE_JS_ETAG, code_js_start, code_js_end);
+}
+
+/* GET /style.<hash>.css */
+static esp_err_t http_app_get_css(httpd_req_t *req){
+	return http_app_send_asset(req, WEB_ASSET_STYLE_CSS_ETAG, style_css_start, style_css_end);
+}
+
+/* GET /ap.json */
+static esp_err_t http_app_get_ap_list(httpd_req_t *req){
+
+	/* the snapshot stays valid while it's being sent, even if a scan publishes a new list meanwhile */
+	const struct json_snapshot_t *ap_list = wifi_manager_acquire_ap_list_json();
+
+	/* the browser may keep the list but has to revalidate it: if it did not change since its
+	 * last poll, only headers are sent back */
+	char if_none_match[16];
+	httpd_resp_set_hdr(req, http_etag_hdr, ap_list->etag);
+	if(httpd_req_get_hdr_value_str(req, http_if_none_match_hdr, if_none_match, sizeof(if_none_match)) == ESP_OK &&
+			strcmp(if_none_match, ap_list->etag) == 0){
+		httpd_resp_set_status(req, http_304_hdr);
 		httpd_resp_send(req, NULL, 0);
 	}
 	else{
-		httpd_resp_set_status(req, http_404_hdr);
-		httpd_resp_send(req, NULL, 0);
+		httpd_resp_set_status(req, http_200_hdr);
+		httpd_resp_send(req, ap_list->data, ap_list->len);
 	}
+	wifi_manager_release_json(ap_list);
+
+	/* request a wifi scan */
+	wifi_manager_scan_async();
 
 	return ESP_OK;
 }
 
+/* GET /status.json */
+static esp_err_t http_app_get_status(httpd_req_t *req){
 
-static esp_err_t http_server_post_handler(httpd_req_t *req){
+	const struct json_snapshot_t *ip_info = wifi_manager_acquire_ip_info_json();
+	httpd_resp_set_status(req, http_200_hdr);
+	esp_err_t ret = httpd_resp_send(req, ip_info->data, ip_info->len);
+	wifi_manager_release_json(ip_info);
 
+	return ret;
+}
 
-	esp_err_t ret = ESP_OK;
+/* GET /telemetry.json */
+static esp_err_t http_app_get_telemetry(httpd_req_t *req){
+
+	/* the ring can be larger than the stack of the http server: it is sent in chunks */
+	char json[LINK_TELEMETRY_JSON_CHUNK];
+	struct link_telemetry_cursor_t cursor = { 0 };
+	size_t len;
+	httpd_resp_set_status(req, http_200_hdr);
+	while((len = link_telemetry_get_json(json, sizeof(json), &cursor)) > 0){
+		if(httpd_resp_send_chunk(req, json, len) != ESP_OK){
+			break;
+		}
+	}
+	return httpd_resp_send_chunk(req, NULL, 0);
+}
 
-	ESP_LOGI(TAG, "POST %s", req->uri);
+/* POST /connect.json */
+static esp_err_t http_app_post_connect(httpd_req_t *req){
 
-	/* POST /connect.json */
-	if(strcmp(req->uri, http_connect_url) == 0){
+	/* buffers for the headers */
+	size_t ssid_len = 0, password_len = 0;
+	char *ssid = NULL, *password = NULL;
 
+	/* len of values provided */
+	ssid_len = httpd_req_get_hdr_value_len(req, "X-Custom-ssid");
+	password_len = httpd_req_get_hdr_value_len(req, "X-Custom-pwd");
 
-		/* buffers for the headers */
-		size_t ssid_len = 0, password_len = 0;
-		char *ssid = NULL, *password = NULL;
 
-		/* len of values provided */
-		ssid_len = httpd_req_get_hdr_value_len(req, "X-Custom-ssid");
-		password_len = httpd_req_get_hdr_value_len(req, "X-Custom-pwd");
+	if(ssid_len && ssid_len <= MAX_SSID_SIZE && password_len && password_len <= MAX_PASSWORD_SIZE){
 
+		/* get the actual value of the headers */
+		ssid = malloc(sizeof(char) * (ssid_len + 1));
+		password = malloc(sizeof(char) * (password_len + 1));
+		httpd_req_get_hdr_value_str(req, "X-Custom-ssid", ssid, ssid_len+1);
+		httpd_req_get_hdr_value_str(req, "X-Custom-pwd", password, password_len+1);
 
-		if(ssid_len && ssid_len <= MAX_SSID_SIZE && password_len && password_len <= MAX_PASSWORD_SIZE){
+		wifi_config_t* config = wifi_manager_get_wifi_sta_config();
+		memset(config, 0x00, sizeof(wifi_config_t));
+		memcpy(config->sta.ssid, ssid, ssid_len);
+		memcpy(config->sta.password, password, password_len);
+		ESP_LOGI(TAG, "ssid: %s, password: %s", ssid, password);
+		ESP_LOGD(TAG, "http_app_post_connect: wifi_manager_connect_async() call");
+		wifi_manager_connect_async();
 
-			/* get the actual value of the headers */
-			ssid = malloc(sizeof(char) * (ssid_len + 1));
-			password = malloc(sizeof(char) * (password_len + 1));
-			httpd_req_get_hdr_value_str(req, "X-Custom-ssid", ssid, ssid_len+1);
-			httpd_req_get_hdr_value_str(req, "X-Custom-pwd", password, password_len+1);
+		/* free memory */
+		free(ssid);
+		free(password);
 
-			wifi_config_t* config = wifi_manager_get_wifi_sta_config();
-			memset(config, 0x00, sizeof(wifi_config_t));
-			memcpy(config->sta.ssid, ssid, ssid_len);
-			memcpy(config->sta.password, password, password_len);
-			ESP_LOGI(TAG, "ssid: %s, password: %s", ssid, password);
-			ESP_LOGD(TAG, "http_server_post_handler: wifi_manager_connect_async() call");
-			wifi_manager_connect_async();
+		httpd_resp_set_status(req, http_200_hdr);
+		httpd_resp_send(req, NULL, 0);
 
-			/* free memory */
-			free(ssid);
-			free(password);
+	}
+	else{
+		/* bad request the authentification header is not complete/not the correct format */
+		httpd_resp_set_status(req, http_400_hdr);
+		httpd_resp_send(req, NULL, 0);
+	}
 
-			httpd_resp_set_status(req, http_200_hdr);
-			httpd_resp_set_type(req, http_content_type_json);
-			httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-			httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
-			httpd_resp_send(req, NULL, 0);
+	return ESP_OK;
+}
 
-		}
-		else{
-			/* bad request the authentification header is not complete/not the correct format */
-			httpd_resp_set_status(req, http_400_hdr);
-			httpd_resp_send(req, NULL, 0);
-		}
+/* DELETE /connect.json */
+static esp_err_t http_app_delete_connect(httpd_req_t *req){
 
-	}
-	else{
+	wifi_manager_disconnect_async();
 
-		if(custom_post_httpd_uri_handler == NULL){
-			httpd_resp_set_status(req, http_404_hdr);
-			httpd_resp_send(req, NULL, 0);
-		}
-		else{
+	httpd_resp_set_status(req, http_200_hdr);
+	return httpd_resp_send(req, NULL, 0);
+}
 
-			/* if there's a hook, run it */
-			ret = (*custom_post_httpd_uri_handler)(req);
-		}
+#ifdef CONFIG_WIFI_MANAGER_THROUGHPUT_TEST
+/**
+ * @brief reads a short header value, e.g. X-Custom-proto. Returns an empty string if it is missing or too long.
+ */
+static void http_app_get_short_hdr(httpd_req_t *req, const char *field, char *value, size_t size){
+	if(httpd_req_get_hdr_value_str(req, field, value, size) != ESP_OK){
+		*value = '\0';
 	}
-
-	return ret;
 }
 
+/**
+ * @brief starts a throughput test with the parameters given in the X-Custom-proto ("tcp" or "udp"),
+ * X-Custom-direction ("download" or "upload"), X-Custom-duration (ms), X-Custom-bitrate (kbit/s) and
+ * X-Custom-scan ("none", "full" or "channel": scans ordered during the transfer) headers.
+ * Answers with the state of the test, which tells the host the port to connect to.
+ * POST /throughput.json
+ */
+static esp_err_t http_app_start_throughput_test(httpd_req_t *req){
+
+	char value[16];
+	char json[THROUGHPUT_TEST_JSON_SIZE];
+	struct throughput_test_config_t config = {
+		.proto = THROUGHPUT_TEST_TCP,
+		.direction = THROUGHPUT_TEST_DOWNLOAD,
+		.duration = 10000,
+		.bitrate = 1000
+	};
+
+	http_app_get_short_hdr(req, "X-Custom-proto", value, sizeof(value));
+	if(strcmp(value, "udp") == 0) config.proto = THROUGHPUT_TEST_UDP;
+	http_app_get_short_hdr(req, "X-Custom-direction", value, sizeof(value));
+	if(strcmp(value, "upload") == 0) config.direction = THROUGHPUT_TEST_UPLOAD;
+	http_app_get_short_hdr(req, "X-Custom-duration", value, sizeof(value));
+	if(*value) config.duration = (uint32_t)strtoul(value, NULL, 10);
+	http_app_get_short_hdr(req, "X-Custom-bitrate", value, sizeof(value));
+	if(*value) config.bitrate = (uint32_t)strtoul(value, NULL, 10);
+	http_app_get_short_hdr(req, "X-Custom-scan", value, sizeof(value));
+	if(strcmp(value, "full") == 0) config.scan = THROUGHPUT_TEST_SCAN_FULL;
+	else if(strcmp(value, "channel") == 0) config.scan = THROUGHPUT_TEST_SCAN_PER_CHANNEL;
+
+	esp_err_t err = throughput_test_start(&config);
+	if(err == ESP_ERR_INVALID_ARG){
+		httpd_resp_set_status(req, http_400_hdr);
+		return httpd_resp_send(req, NULL, 0);
+	}
+	if(err != ESP_OK){
+		/* a test already in progress, or no socket available */
+		httpd_resp_set_status(req, http_503_hdr);
+		return httpd_resp_send(req, NULL, 0);
+	}
 
-static esp_err_t http_server_get_handler(httpd_req_t *req){
+	size_t len = throughput_test_get_json(json, sizeof(json));
+	httpd_resp_set_status(req, http_200_hdr);
+	return httpd_resp_send(req, json, len);
+}
 
-    char* host = NULL;
-    size_t buf_len;
-    esp_err_t ret = ESP_OK;
+/* GET /throughput.json */
+static esp_err_t http_app_get_throughput_test(httpd_req_t *req){
+	char json[THROUGHPUT_TEST_JSON_SIZE];
+	size_t len = throughput_test_get_json(json, sizeof(json));
+	httpd_resp_set_status(req, http_200_hdr);
+	return httpd_resp_send(req, json, len);
+}
+#endif
 
-    ESP_LOGD(TAG, "GET %s", req->uri);
 
-    /* Get header value string length and allocate memory for length + 1,
-     * extra byte for null termination */
-    buf_len = httpd_req_get_hdr_value_len(req, "Host") + 1;
-    if (buf_len > 1) {
-    	host = malloc(buf_len);
-    	if(httpd_req_get_hdr_value_str(req, "Host", host, buf_len) != ESP_OK){
-    		/* if something is wrong we just 0 the whole memory */
-    		memset(host, 0x00, buf_len);
-    	}
-    }
+/**
+ * @brief the pages of the wifi manager, relative to WEBAPP_LOCATION.
+ */
+static const struct http_route_t http_app_routes[] = {
+	{ .method = HTTP_GET, .uri = "", .handler = http_app_get_index, .content_type = http_content_type_html, .cache_policy = HTTP_CACHE_REVALIDATE },
+	{ .method = HTTP_GET, .uri = WEB_ASSET_CODE_JS_NAME, .handler = http_app_get_js, .content_type = http_content_type_js, .cache_policy = HTTP_CACHE_IMMUTABLE },
+	{ .method = HTTP_GET, .uri = WEB_ASSET_STYLE_CSS_NAME, .handler = http_app_get_css, .content_type = http_content_type_css, .cache_policy = HTTP_CACHE_IMMUTABLE },
+	{ .method = HTTP_GET, .uri = "ap.json", .handler = http_app_get_ap_list, .content_type = http_content_type_json, .cache_policy = HTTP_CACHE_REVALIDATE },
+	{ .method = HTTP_GET, .uri = "status.json", .handler = http_app_get_status, .content_type = http_content_type_json, .cache_policy = HTTP_CACHE_NO_STORE },
+	{ .method = HTTP_GET, .uri = "telemetry.json", .handler = http_app_get_telemetry, .content_type = http_content_type_json, .cache_policy = HTTP_CACHE_NO_STORE },
+	{ .method = HTTP_GET, .uri = "events", .handler = http_events_handler },
+	{ .method = HTTP_POST, .uri = "connect.json", .handler = http_app_post_connect, .content_type = http_content_type_json, .cache_policy = HTTP_CACHE_NO_STORE },
+	{ .method = HTTP_DELETE, .uri = "connect.json", .handler = http_app_delete_connect, .content_type = http_content_type_json, .cache_policy = HTTP_CACHE_NO_STORE },
+#ifdef CONFIG_WIFI_MANAGER_THROUGHPUT_TEST
+	{ .method = HTTP_GET, .uri = "throughput.json", .handler = http_app_get_throughput_test, .content_type = http_content_type_json, .cache_policy = HTTP_CACHE_NO_STORE },
+	{ .method = HTTP_POST, .uri = "throughput.json", .handler = http_app_start_throughput_test, .content_type = http_content_type_json, .cache_policy = HTTP_CACHE_NO_STORE },
+#endif
+};
 
-	/* determine if Host is from the STA IP address */
-	wifi_manager_lock_sta_ip_string(portMAX_DELAY);
-	bool access_from_sta_ip = host != NULL?strstr(host, wifi_manager_get_sta_ip_string()):false;
-	wifi_manager_unlock_sta_ip_string();
 
+/**
+ * @brief Parses the Host header of a request addressed to an IPv4 address, e.g. "10.10.0.1" or "10.10.0.1:80".
+ * @return the address as in esp_ip4_addr_t, or 0 if host is not an IPv4 address.
+ */
+static uint32_t http_app_parse_host_ip(const char *host){
 
-	if (host != NULL && !strstr(host, DEFAULT_AP_IP) && !access_from_sta_ip) {
+	uint8_t octets[4];
+	const char *p = host;
 
-		/* Captive Portal functionality */
-		/* 302 Redirect to IP of the access point */
-		httpd_resp_set_status(req, http_302_hdr);
-		httpd_resp_set_hdr(req, http_location_hdr, http_redirect_url);
-		httpd_resp_send(req, NULL, 0);
+	for(int i=0; i<4; i++){
+		if(i > 0 && *p++ != '.') return 0;
 
+		uint32_t octet = 0;
+		int digits = 0;
+		for(; *p >= '0' && *p <= '9'; p++){
+			octet = octet * 10 + (uint32_t)(*p - '0');
+			if(++digits > 3) return 0;
+		}
+		if(digits == 0 || octet > 255) return 0;
+		octets[i] = (uint8_t)octet;
 	}
-	else{
 
-		/* GET /  */
-		if(strcmp(req->uri, http_root_url) == 0){
-			httpd_resp_set_status(req, http_200_hdr);
-			httpd_resp_set_type(req, http_content_type_html);
-			httpd_resp_send(req, (char*)index_html_start, index_html_end - index_html_start);
-		}
-		/* GET /code.js */
-		else if(strcmp(req->uri, http_js_url) == 0){
-			httpd_resp_set_status(req, http_200_hdr);
-			httpd_resp_set_type(req, http_content_type_js);
-			httpd_resp_send(req, (char*)code_js_start, code_js_end - code_js_start);
-		}
-		/* GET /style.css */
-		else if(strcmp(req->uri, http_css_url) == 0){
-			httpd_resp_set_status(req, http_200_hdr);
-			httpd_resp_set_type(req, http_content_type_css);
-			httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_cache);
-			httpd_resp_send(req, (char*)style_css_start, style_css_end - style_css_start);
-		}
-		/* GET /ap.json */
-		else if(strcmp(req->uri, http_ap_url) == 0){
+	/* only a port can follow the address */
+	if(*p != '\0' && *p != ':') return 0;
 
-			/* if we can get the mutex, write the last version of the AP list */
-			if(wifi_manager_lock_json_buffer(( TickType_t ) 10)){
+	return ESP_IP4TOADDR(octets[0], octets[1], octets[2], octets[3]);
+}
 
-				httpd_resp_set_status(req, http_200_hdr);
-				httpd_resp_set_type(req, http_content_type_json);
-				httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-				httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
-				char* ap_buf = wifi_manager_get_ap_list_json();
-				httpd_resp_send(req, ap_buf, strlen(ap_buf));
-				wifi_manager_unlock_json_buffer();
-			}
-			else{
-				httpd_resp_set_status(req, http_503_hdr);
-				httpd_resp_send(req, NULL, 0);
-				ESP_LOGE(TAG, "http_server_netconn_serve: GET /ap.json failed to obtain mutex");
-			}
+/**
+ * @brief Handles every request: requests for another host go to the captive portal, the others to their route.
+ */
+static esp_err_t http_app_dispatch(httpd_req_t *req){
 
-			/* request a wifi scan */
-			wifi_manager_scan_async();
-		}
-		/* GET /status.json */
-		else if(strcmp(req->uri, http_status_url) == 0){
-
-			if(wifi_manager_lock_json_buffer(( TickType_t ) 10)){
-				char *buff = wifi_manager_get_ip_info_json();
-				if(buff){
-					httpd_resp_set_status(req, http_200_hdr);
-					httpd_resp_set_type(req, http_content_type_json);
-					httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-					httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
-					httpd_resp_send(req, buff, strlen(buff));
-					wifi_manager_unlock_json_buffer();
-				}
-				else{
-					httpd_resp_set_status(req, http_503_hdr);
-					httpd_resp_send(req, NULL, 0);
-				}
-			}
-			else{
-				httpd_resp_set_status(req, http_503_hdr);
-				httpd_resp_send(req, NULL, 0);
-				ESP_LOGE(TAG, "http_server_netconn_serve: GET /status.json failed to obtain mutex");
-			}
+	struct http_route_t route;
+
+	ESP_LOGD(TAG, "%s %s", http_method_str(req->method), req->uri);
+
+	if(req->method == HTTP_GET){
+
+		char host[HTTP_HOST_MAX_LEN];
+
+		/* a Host that does not fit is a name rather than an address: it gets redirected like any other name */
+		esp_err_t host_err = httpd_req_get_hdr_value_str(req, http_host_hdr, host, sizeof(host));
+		bool has_host = host_err != ESP_ERR_NOT_FOUND;
+		uint32_t host_ip = host_err == ESP_OK ? http_app_parse_host_ip(host) : 0;
+
+		/* determine if Host is the AP or the STA IP address. Both are published atomically by the wifi manager */
+		bool access_from_own_ip = host_ip != 0 && (host_ip == wifi_manager_get_ap_ip() || host_ip == wifi_manager_get_sta_ip());
+
+		if(has_host && !access_from_own_ip){
+			/* Captive Portal functionality: redirect to the IP of the access point */
+			return captive_portal_redirect(req);
 		}
-		else{
+	}
 
-			if(custom_get_httpd_uri_handler == NULL){
-				httpd_resp_set_status(req, http_404_hdr);
-				httpd_resp_send(req, NULL, 0);
-			}
-			else{
+	if(http_router_find(req->method, req->uri, &route)){
+
+		if(route.async_handler){
+			/* slow: a worker answers it, and the server goes on with the next request */
+			return http_async_submit(req, &route, route.cache_policy != HTTP_CACHE_DEFAULT ? http_cache_control_policies[route.cache_policy] : NULL);
+		}
 
-				/* if there's a hook, run it */
-				ret = (*custom_get_httpd_uri_handler)(req);
+		if(route.content_type){
+			httpd_resp_set_type(req, route.content_type);
+		}
+		if(route.cache_policy != HTTP_CACHE_DEFAULT){
+			httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_policies[route.cache_policy]);
+			if(route.cache_policy == HTTP_CACHE_NO_STORE){
+				httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
 			}
 		}
+		req->user_ctx = route.user_ctx;
 
+		return route.handler(req);
 	}
 
-    /* memory clean up */
-    if(host != NULL){
-    	free(host);
-    }
+	/* no route: if there's a hook, run it */
+	if(req->method == HTTP_GET && custom_get_httpd_uri_handler != NULL){
+		return (*custom_get_httpd_uri_handler)(req);
+	}
+	if(req->method == HTTP_POST && custom_post_httpd_uri_handler != NULL){
+		return (*custom_post_httpd_uri_handler)(req);
+	}
 
-    return ret;
+	httpd_resp_set_status(req, http_404_hdr);
+	return httpd_resp_send(req, NULL, 0);
+}
 
+/**
+ * @brief Close callback of the server: the requests pending on the socket and the event streams forget it.
+ */
+static void http_app_close_fn(httpd_handle_t server, int sockfd){
+	http_async_sock_closed(sockfd);
+	http_events_close_fn(server, sockfd);
 }
 
-/* URI wild card for any GET request */
+/* URI wild cards: every request goes through the router */
 static const httpd_uri_t http_server_get_request = {
-    .uri       = "*",
-    .method    = HTTP_GET,
-    .handler   = http_server_get_handler
+	.uri	= "*",
+	.method = HTTP_GET,
+	.handler = http_app_dispatch
 };
 
 static const httpd_uri_t http_server_post_request = {
 	.uri	= "*",
 	.method = HTTP_POST,
-	.handler = http_server_post_handler
+	.handler = http_app_dispatch
+};
+
+static const httpd_uri_t http_server_put_request = {
+	.uri	= "*",
+	.method = HTTP_PUT,
+	.handler = http_app_dispatch
 };
 
 static const httpd_uri_t http_server_delete_request = {
 	.uri	= "*",
 	.method = HTTP_DELETE,
-	.handler = http_server_delete_handler
+	.handler = http_app_dispatch
 };
 
 
@@ -359,40 +500,20 @@ void http_app_stop(){
 
 	if(httpd_handle != NULL){
 
+		/* the routes of the wifi manager stay in the router: they are the same when the server is restarted */
 
-		/* dealloc URLs */
-		if(http_root_url) {
-			free(http_root_url);
-			http_root_url = NULL;
-		}
-		if(http_redirect_url){
-			free(http_redirect_url);
-			http_redirect_url = NULL;
-		}
-		if(http_js_url){
-			free(http_js_url);
-			http_js_url = NULL;
-		}
-		if(http_css_url){
-			free(http_css_url);
-			http_css_url = NULL;
-		}
-		if(http_connect_url){
-			free(http_connect_url);
-			http_connect_url = NULL;
-		}
-		if(http_ap_url){
-			free(http_ap_url);
-			http_ap_url = NULL;
-		}
-		if(http_status_url){
-			free(http_status_url);
-			http_status_url = NULL;
-		}
+		/* the event streams are closed with the server */
+		http_events_stop();
+
+		/* the workers stop sending responses through the server */
+		http_async_stop();
 
 		/* stop server */
 		httpd_stop(httpd_handle);
 		httpd_handle = NULL;
+
+		/* the requests still being handled are dropped */
+		http_async_cleanup();
 	}
 }
 
@@ -428,41 +549,20 @@ void http_app_start(bool lru_purge_enable){
 		config.uri_match_fn = httpd_uri_match_wildcard;
 		config.lru_purge_enable = lru_purge_enable;
 
-		/* generate the URLs */
-		if(http_root_url == NULL){
-			int root_len = strlen(WEBAPP_LOCATION);
-
-			/* all the pages */
-			const char page_js[] = "code.js";
-			const char page_css[] = "style.css";
-			const char page_connect[] = "connect.json";
-			const char page_ap[] = "ap.json";
-			const char page_status[] = "status.json";
-
-			/* root url, eg "/"   */
-			const size_t http_root_url_sz = sizeof(char) * (root_len+1);
-			http_root_url = malloc(http_root_url_sz);
-			memset(http_root_url, 0x00, http_root_url_sz);
-			strcpy(http_root_url, WEBAPP_LOCATION);
-
-			/* redirect url */
-			size_t redirect_sz = 22 + root_len + 1; /* strlen(http://255.255.255.255) + strlen("/") + 1 for \0 */
-			http_redirect_url = malloc(sizeof(char) * redirect_sz);
-			*http_redirect_url = '\0';
-
-			if(root_len == 1){
-				snprintf(http_redirect_url, redirect_sz, "http://%s", DEFAULT_AP_IP);
-			}
-			else{
-				snprintf(http_redirect_url, redirect_sz, "http://%s%s", DEFAULT_AP_IP, WEBAPP_LOCATION);
-			}
+		/* the sockets of the event streams and of the pending async requests must be forgotten when they are closed */
+		config.close_fn = http_app_close_fn;
+
+		if(!http_app_routes_added){
 
-			/* generate the other pages URLs*/
-			http_js_url = http_app_generate_url(page_js);
-			http_css_url = http_app_generate_url(page_css);
-			http_connect_url = http_app_generate_url(page_connect);
-			http_ap_url = http_app_generate_url(page_ap);
-			http_status_url = http_app_generate_url(page_status);
+			/* route the pages of the wifi manager. The router copies the URLs */
+			for(size_t i=0; i<sizeof(http_app_routes)/sizeof(http_app_routes[0]); i++){
+				struct http_route_t route = http_app_routes[i];
+				char *url = http_app_generate_url(route.uri);
+				route.uri = url;
+				http_router_add(&route);
+				free(url);
+			}
+			http_app_routes_added = true;
 
 		}
 
@@ -472,7 +572,10 @@ void http_app_start(bool lru_purge_enable){
 	        ESP_LOGI(TAG, "Registering URI handlers");
 	        httpd_register_uri_handler(httpd_handle, &http_server_get_request);
 	        httpd_register_uri_handler(httpd_handle, &http_server_post_request);
+	        httpd_register_uri_handler(httpd_handle, &http_server_put_request);
 	        httpd_register_uri_handler(httpd_handle, &http_server_delete_request);
+	        http_events_start(httpd_handle);
+	        http_async_start(httpd_handle);
 	    }
 	}
 
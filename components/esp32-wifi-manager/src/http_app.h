@@ -37,6 +37,8 @@ function to process requests, decode URLs, serve files, etc. etc.
 #include <stdbool.h>
 #include <esp_http_server.h>
 
+#include "http_router.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -48,6 +50,11 @@ extern "C" {
  */
 #define WEBAPP_LOCATION 					CONFIG_WEBAPP_LOCATION
 
+/** @brief Size of the buffer holding the Host header of a request, on the stack of the http server.
+ *  Enough for any IPv4 address with a port: longer hosts are names and are redirected to the captive portal.
+ */
+#define HTTP_HOST_MAX_LEN					32
+
 
 /** 
  * @brief spawns the http server 
@@ -61,10 +68,26 @@ void http_app_stop();
 
 /** 
  * @brief sets a hook into the wifi manager URI handlers. Setting the handler to NULL disables the hook.
+ * The hook is only called for the GET or POST requests that match no route.
  * @return ESP_OK in case of success, ESP_ERR_INVALID_ARG if the method is unsupported.
  */
 esp_err_t http_app_set_handler_hook( httpd_method_t method,  esp_err_t (*handler)(httpd_req_t *r)  );
 
+/**
+ * @brief serves a page of your own at route->uri, e.g. "/helloworld". Can be called before or after the server
+ * is started. The Content-Type and Cache-Control of the route are set before its handler is called.
+ * @return ESP_OK, or ESP_ERR_NO_MEM if there are already CONFIG_WIFI_MANAGER_HTTP_MAX_ROUTES routes, or if the
+ * workers of a route with an async_handler could not be created.
+ * @see http_router.h
+ */
+esp_err_t http_app_register_route(const struct http_route_t *route);
+
+/**
+ * @brief removes a route added with http_app_register_route.
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND.
+ */
+esp_err_t http_app_unregister_route(httpd_method_t method, const char *uri);
+
 
 #ifdef __cplusplus
 }
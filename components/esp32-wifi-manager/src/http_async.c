@@ -0,0 +1,429 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file http_async.c
+@brief Runs the handlers of slow routes on a pool of workers, off the task of the http server
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+#include <esp_log.h>
+
+#include "wifi_manager.h"
+#include "http_async.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "http_async";
+
+/* @brief requests being handled or waiting for a worker */
+#define HTTP_ASYNC_MAX_JOBS					(HTTP_ASYNC_WORKERS + HTTP_ASYNC_QUEUE_SIZE)
+
+static const char http_async_503[] =
+		"HTTP/1.1 503 Service Unavailable\r\n"
+		"Retry-After: 1\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n";
+static const char http_async_503_hdr[] = "503 Service Unavailable";
+static const char http_async_500_hdr[] = "500 Internal Server Error";
+static const char http_async_413_hdr[] = "413 Payload Too Large";
+static const char http_async_408_hdr[] = "408 Request Timeout";
+static const char http_async_200_hdr[] = "200 OK";
+
+typedef enum http_async_state_t{
+	HTTP_ASYNC_QUEUED = 0,				/* waiting for a worker, or being handled */
+	HTTP_ASYNC_HANDLED = 1,				/* the response is ready: the server task sends it */
+	HTTP_ASYNC_ORPHANED = 2,			/* the server was stopped: the worker frees the job */
+}http_async_state_t;
+
+struct http_async_job_t{
+	struct http_async_req_t req;		/* first: handlers get a pointer to it */
+	uint32_t id;
+	int sockfd;
+	esp_err_t (*handler)(struct http_async_req_t *req);
+	const char *content_type;
+	const char *cache_control;
+	bool no_cache;
+	TimerHandle_t timer;
+
+	/* set on the server task when the client got a 503 or went away: the response of the handler is dropped */
+	atomic_bool abandoned;
+	atomic_int state;
+
+	/* response, only written by the worker and read once the job is HANDLED */
+	const char *status;
+	char *body;
+	size_t body_len;
+	size_t body_size;
+	bool failed;
+
+	char data[];						/* uri and body */
+};
+
+/* @brief the server the requests come from, NULL while it is stopped. Guarded by http_async_mutex */
+static httpd_handle_t http_async_server = NULL;
+static SemaphoreHandle_t http_async_mutex = NULL;
+
+/* @brief the workers are only created once an async route is registered. Claimed under http_async_init_mux */
+static QueueHandle_t http_async_queue = NULL;
+static bool http_async_initialized = false;
+static portMUX_TYPE http_async_init_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* @brief the jobs not answered yet. Only used on the task of the http server, or once it is stopped */
+static struct http_async_job_t *http_async_jobs[HTTP_ASYNC_MAX_JOBS];
+static int http_async_job_count = 0;
+
+/* @brief jobs are found back by id: a work item can run after its job was freed */
+static uint32_t http_async_next_id = 1;
+
+
+static void http_async_free(struct http_async_job_t *job){
+	if(job->timer){
+		xTimerDelete(job->timer, (TickType_t)0);
+	}
+	free(job->body);
+	free(job);
+}
+
+static struct http_async_job_t* http_async_find(uint32_t id){
+	for(int i=0; i<http_async_job_count; i++){
+		if(http_async_jobs[i]->id == id){
+			return http_async_jobs[i];
+		}
+	}
+	return NULL;
+}
+
+static void http_async_remove(struct http_async_job_t *job){
+	for(int i=0; i<http_async_job_count; i++){
+		if(http_async_jobs[i] == job){
+			http_async_jobs[i] = http_async_jobs[--http_async_job_count];
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Queues work on the server, unless it is being stopped.
+ */
+static void http_async_queue_work(httpd_work_fn_t work, uint32_t id){
+
+	xSemaphoreTake(http_async_mutex, portMAX_DELAY);
+	if(http_async_server == NULL || httpd_queue_work(http_async_server, work, (void*)(uintptr_t)id) != ESP_OK){
+		/* the timer, or http_async_cleanup, takes care of the job */
+		ESP_LOGW(TAG, "request %u: no way back to the server", id);
+	}
+	xSemaphoreGive(http_async_mutex);
+}
+
+/**
+ * @brief Sends a frame to a client. A client that cannot take it has its socket closed.
+ */
+static bool http_async_send(int sockfd, const char *buf, size_t len){
+
+	int sent = httpd_socket_send(http_async_server, sockfd, buf, len, 0);
+	if(sent < 0 || (size_t)sent != len){
+		httpd_sess_trigger_close(http_async_server, sockfd);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Runs on the task of the http server: sends the response of a handled job, then frees the job.
+ */
+static void http_async_finish(struct http_async_job_t *job){
+
+	/* the server may be stopping: the work queued before is still run */
+	if(!atomic_load(&job->abandoned) && http_async_server != NULL){
+
+		char hdr[256];
+		const char *status = job->failed ? http_async_500_hdr : (job->status ? job->status : http_async_200_hdr);
+		size_t body_len = job->failed ? 0 : job->body_len;
+		int len = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n%s%s%s%s\r\n",
+				status,
+				job->content_type ? job->content_type : HTTPD_TYPE_TEXT,
+				(unsigned)body_len,
+				job->cache_control ? "Cache-Control: " : "",
+				job->cache_control ? job->cache_control : "",
+				job->cache_control ? "\r\n" : "",
+				job->no_cache ? "Pragma: no-cache\r\n" : "");
+
+		if(len >= (int)sizeof(hdr)){
+			ESP_LOGE(TAG, "request %u: headers too long", job->id);
+			httpd_sess_trigger_close(http_async_server, job->sockfd);
+		}
+		else if(http_async_send(job->sockfd, hdr, len) && body_len > 0){
+			http_async_send(job->sockfd, job->body, body_len);
+		}
+	}
+
+	http_async_remove(job);
+	http_async_free(job);
+}
+
+/**
+ * @brief Runs on the task of the http server once a worker handled a job.
+ */
+static void http_async_complete(void *arg){
+
+	struct http_async_job_t *job = http_async_find((uint32_t)(uintptr_t)arg);
+	if(job){
+		http_async_finish(job);
+	}
+}
+
+/**
+ * @brief Runs on the task of the http server when a job is not answered in time.
+ */
+static void http_async_timeout(void *arg){
+
+	struct http_async_job_t *job = http_async_find((uint32_t)(uintptr_t)arg);
+	if(job == NULL || http_async_server == NULL){
+		return;
+	}
+
+	if(atomic_load(&job->state) == HTTP_ASYNC_HANDLED){
+		/* the response was ready, but its way back to the server was lost */
+		http_async_finish(job);
+	}
+	else if(!atomic_exchange(&job->abandoned, true)){
+		ESP_LOGW(TAG, "%s timed out", job->req.uri);
+		http_async_send(job->sockfd, http_async_503, sizeof(http_async_503) - 1);
+		/* the job stays until its worker is done with it */
+	}
+}
+
+static void http_async_timer_cb(TimerHandle_t xTimer){
+	http_async_queue_work(http_async_timeout, (uint32_t)(uintptr_t)pvTimerGetTimerID(xTimer));
+}
+
+static void http_async_worker(void *pvParameters){
+
+	QueueHandle_t queue = (QueueHandle_t)pvParameters;
+	struct http_async_job_t *job;
+
+	for(;;){
+		if(xQueueReceive(queue, &job, portMAX_DELAY) != pdTRUE){
+			continue;
+		}
+
+		if(!atomic_load(&job->abandoned)){
+			if(job->handler(&job->req) != ESP_OK){
+				job->failed = true;
+			}
+		}
+
+		/* once HANDLED, the job can be freed on the server task at any time */
+		uint32_t id = job->id;
+		if(atomic_exchange(&job->state, HTTP_ASYNC_HANDLED) == HTTP_ASYNC_ORPHANED){
+			/* the server was stopped while the job was handled: nobody else knows about it anymore */
+			http_async_free(job);
+			continue;
+		}
+
+		http_async_queue_work(http_async_complete, id);
+	}
+}
+
+void http_async_resp_set_status(struct http_async_req_t *req, const char *status){
+	((struct http_async_job_t*)req)->status = status;
+}
+
+esp_err_t http_async_resp_append(struct http_async_req_t *req, const char *buf, size_t len){
+
+	struct http_async_job_t *job = (struct http_async_job_t*)req;
+
+	if(job->failed){
+		return ESP_ERR_NO_MEM;
+	}
+
+	if(job->body_len + len > job->body_size){
+		size_t size = job->body_size ? job->body_size : 256;
+		while(size < job->body_len + len) size *= 2;
+		char *body = realloc(job->body, size);
+		if(body == NULL){
+			ESP_LOGE(TAG, "%s: out of memory", req->uri);
+			job->failed = true;
+			return ESP_ERR_NO_MEM;
+		}
+		job->body = body;
+		job->body_size = size;
+	}
+
+	memcpy(job->body + job->body_len, buf, len);
+	job->body_len += len;
+	return ESP_OK;
+}
+
+bool http_async_is_abandoned(struct http_async_req_t *req){
+	return atomic_load(&((struct http_async_job_t*)req)->abandoned);
+}
+
+esp_err_t http_async_submit(httpd_req_t *req, const struct http_route_t *route, const char *cache_control){
+
+	if(http_async_server == NULL || http_async_queue == NULL || http_async_job_count >= HTTP_ASYNC_MAX_JOBS){
+		/* every worker is busy and the queue is full */
+		ESP_LOGW(TAG, "%s refused: busy", req->uri);
+		httpd_resp_set_status(req, http_async_503_hdr);
+		httpd_resp_set_hdr(req, "Retry-After", "1");
+		return httpd_resp_send(req, NULL, 0);
+	}
+	if(req->content_len > HTTP_ASYNC_MAX_BODY){
+		httpd_resp_set_status(req, http_async_413_hdr);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	size_t uri_len = strlen(req->uri);
+	struct http_async_job_t *job = calloc(1, sizeof(struct http_async_job_t) + uri_len + 1 + req->content_len + 1);
+	if(job == NULL){
+		httpd_resp_set_status(req, http_async_503_hdr);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	/* the body is read here: the socket is only read on the server task */
+	char *body = job->data + uri_len + 1;
+	size_t received = 0;
+	while(received < req->content_len){
+		int ret = httpd_req_recv(req, body + received, req->content_len - received);
+		if(ret <= 0){
+			free(job);
+			if(ret == HTTPD_SOCK_ERR_TIMEOUT){
+				httpd_resp_set_status(req, http_async_408_hdr);
+				return httpd_resp_send(req, NULL, 0);
+			}
+			return ESP_FAIL;
+		}
+		received += ret;
+	}
+
+	memcpy(job->data, req->uri, uri_len + 1);
+	job->req.method = req->method;
+	job->req.uri = job->data;
+	job->req.body = req->content_len > 0 ? body : NULL;
+	job->req.body_len = req->content_len;
+	job->req.user_ctx = route->user_ctx;
+	job->id = http_async_next_id++;
+	job->sockfd = httpd_req_to_sockfd(req);
+	job->handler = route->async_handler;
+	job->content_type = route->content_type;
+	job->cache_control = cache_control;
+	job->no_cache = route->cache_policy == HTTP_CACHE_NO_STORE;
+	atomic_init(&job->abandoned, false);
+	atomic_init(&job->state, HTTP_ASYNC_QUEUED);
+
+	uint32_t timeout = route->timeout ? route->timeout : HTTP_ASYNC_TIMEOUT;
+	job->timer = xTimerCreate(NULL, pdMS_TO_TICKS(timeout), pdFALSE, (void*)(uintptr_t)job->id, http_async_timer_cb);
+	if(job->timer == NULL){
+		free(job);
+		httpd_resp_set_status(req, http_async_503_hdr);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	/* the queue holds as many jobs as the table: there is room */
+	http_async_jobs[http_async_job_count++] = job;
+	xQueueSend(http_async_queue, &job, (TickType_t)0);
+	xTimerStart(job->timer, (TickType_t)0);
+
+	/* the response is sent later, straight to the socket */
+	return ESP_OK;
+}
+
+esp_err_t http_async_init(){
+
+	/* routes can be registered from any task: only the first caller creates the workers */
+	portENTER_CRITICAL(&http_async_init_mux);
+	bool first = !http_async_initialized;
+	http_async_initialized = true;
+	portEXIT_CRITICAL(&http_async_init_mux);
+	if(!first){
+		return ESP_OK;
+	}
+
+	QueueHandle_t queue = xQueueCreate(HTTP_ASYNC_MAX_JOBS, sizeof(struct http_async_job_t*));
+	if(queue == NULL){
+		portENTER_CRITICAL(&http_async_init_mux);
+		http_async_initialized = false;
+		portEXIT_CRITICAL(&http_async_init_mux);
+		return ESP_ERR_NO_MEM;
+	}
+	for(int i=0; i<HTTP_ASYNC_WORKERS; i++){
+		if(xTaskCreate(&http_async_worker, "http_async", HTTP_ASYNC_STACK_SIZE, (void*)queue, WIFI_MANAGER_TASK_PRIORITY-1, NULL) != pdPASS){
+			ESP_LOGE(TAG, "could not create worker %d", i);
+		}
+	}
+	/* published last: a request is only handed off once the queue exists */
+	http_async_queue = queue;
+	return ESP_OK;
+}
+
+void http_async_start(httpd_handle_t server){
+
+	if(http_async_mutex == NULL){
+		http_async_mutex = xSemaphoreCreateMutex();
+	}
+
+	xSemaphoreTake(http_async_mutex, portMAX_DELAY);
+	http_async_server = server;
+	xSemaphoreGive(http_async_mutex);
+}
+
+void http_async_stop(){
+
+	if(http_async_mutex){
+		/* once released, no worker or timer can queue work on the server anymore */
+		xSemaphoreTake(http_async_mutex, portMAX_DELAY);
+		http_async_server = NULL;
+		xSemaphoreGive(http_async_mutex);
+	}
+}
+
+void http_async_cleanup(){
+
+	for(int i=0; i<http_async_job_count; i++){
+		struct http_async_job_t *job = http_async_jobs[i];
+		atomic_store(&job->abandoned, true);
+		if(atomic_exchange(&job->state, HTTP_ASYNC_ORPHANED) == HTTP_ASYNC_HANDLED){
+			/* handled, but never sent: the worker is done with it */
+			http_async_free(job);
+		}
+	}
+	http_async_job_count = 0;
+}
+
+void http_async_sock_closed(int sockfd){
+	for(int i=0; i<http_async_job_count; i++){
+		if(http_async_jobs[i]->sockfd == sockfd){
+			atomic_store(&http_async_jobs[i]->abandoned, true);
+		}
+	}
+}
@@ -0,0 +1,154 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file http_async.h
+@brief Runs the handlers of slow routes on a pool of workers, off the task of the http server
+
+The http server handles one request at a time: a handler that takes a second keeps every other client waiting,
+including the captive portal probes of the phones joining the access point. A route with an async_handler is
+handed off instead. The server task reads the request body, queues the request and moves on to the next one. A
+worker runs the handler, which builds its response with http_async_resp_set_status and http_async_resp_append,
+and the response is sent back on the server task once the handler returns.
+
+Each request has a timeout, CONFIG_WIFI_MANAGER_HTTP_ASYNC_TIMEOUT or the timeout of its route. A request
+that is not answered by then gets a 503 with Retry-After, and whatever its handler produces later is dropped.
+When every worker is busy and the queue is full, new requests get the same 503 right away.
+
+The sockets stay owned by the http server: all the writes happen on its task, queued with httpd_queue_work.
+
+The body is read whole on the server task before the hand-off, and held in RAM: async routes are for requests
+that are slow to answer, not for large uploads. IDF 4.3 drops what is left of a body once the handler of the
+server returns, so a body cannot be streamed to a worker. A route receiving a large body, like a firmware,
+keeps the server busy for the whole transfer whatever it does: run it on a server of its own.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_HTTP_ASYNC_H_INCLUDED
+#define WIFI_MANAGER_HTTP_ASYNC_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_http_server.h>
+
+#include "http_router.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of worker tasks running the async handlers.
+ */
+#define HTTP_ASYNC_WORKERS					CONFIG_WIFI_MANAGER_HTTP_ASYNC_WORKERS
+
+/**
+ * @brief Number of requests that can wait for a worker. Beyond that, requests get a 503.
+ */
+#define HTTP_ASYNC_QUEUE_SIZE				CONFIG_WIFI_MANAGER_HTTP_ASYNC_QUEUE_SIZE
+
+/**
+ * @brief Default time (in ms) an async request has to be answered.
+ */
+#define HTTP_ASYNC_TIMEOUT					CONFIG_WIFI_MANAGER_HTTP_ASYNC_TIMEOUT
+
+/**
+ * @brief Largest request body handed to an async handler. Larger bodies get a 413. Bodies are not streamed.
+ */
+#define HTTP_ASYNC_MAX_BODY					CONFIG_WIFI_MANAGER_HTTP_ASYNC_MAX_BODY
+
+/**
+ * @brief Stack size of a worker task.
+ */
+#define HTTP_ASYNC_STACK_SIZE				4096
+
+
+/**
+ * @brief A request handed to an async handler. Everything it points to stays valid until the handler returns.
+ */
+struct http_async_req_t{
+	httpd_method_t method;
+	const char *uri;					/* with its query string, if any */
+	const char *body;					/* NUL terminated, NULL if the request has none */
+	size_t body_len;
+	void *user_ctx;						/* user_ctx of the route */
+};
+
+
+/**
+ * @brief Sets the status of the response, e.g. "404 Not Found". "200 OK" if never called.
+ * @param status must stay valid until the response is sent: a string literal.
+ */
+void http_async_resp_set_status(struct http_async_req_t *req, const char *status);
+
+/**
+ * @brief Appends to the body of the response. The response is sent once the handler returns ESP_OK.
+ * @return ESP_OK, or ESP_ERR_NO_MEM: the client then gets a 500.
+ */
+esp_err_t http_async_resp_append(struct http_async_req_t *req, const char *buf, size_t len);
+
+/**
+ * @brief Tells a handler its response will be dropped: the request timed out or the client went away.
+ * A long handler can check it to stop early.
+ */
+bool http_async_is_abandoned(struct http_async_req_t *req);
+
+/**
+ * @brief Hands a request off to the workers. Called on the server task by the dispatcher of http_app.
+ * @param cache_control value of the Cache-Control header of the response, or NULL.
+ * @return the result of sending the error response if the request was refused, ESP_OK otherwise.
+ */
+esp_err_t http_async_submit(httpd_req_t *req, const struct http_route_t *route, const char *cache_control);
+
+/**
+ * @brief Creates the queue and the workers, the first time a route with an async_handler is registered: a
+ * firmware without async routes does not pay for their stacks. Safe to call from any task, and more than once.
+ * @return ESP_OK, or ESP_ERR_NO_MEM if the queue could not be created.
+ */
+esp_err_t http_async_init();
+
+/**
+ * @brief Lets requests be handed off to the workers of this server.
+ */
+void http_async_start(httpd_handle_t server);
+
+/**
+ * @brief Stops queuing work on the server. Called before the server is stopped.
+ */
+void http_async_stop();
+
+/**
+ * @brief Frees the requests the stopped server was still answering. Called once the server is stopped.
+ */
+void http_async_cleanup();
+
+/**
+ * @brief Tells that a socket was closed: the requests still pending on it will not be answered.
+ * @note to be called on the server task, from its close callback.
+ */
+void http_async_sock_closed(int sockfd);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_HTTP_ASYNC_H_INCLUDED */
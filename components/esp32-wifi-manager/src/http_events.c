@@ -0,0 +1,261 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file http_events.c
+@brief Pushes the connection status and the access point list to the browsers as server-sent events
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <esp_log.h>
+#include <lwip/sockets.h>
+
+#include "wifi_manager.h"
+#include "json_snapshot.h"
+#include "http_events.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "http_events";
+
+static const char http_events_stream_hdr[] =
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: text/event-stream\r\n"
+		"Cache-Control: no-cache\r\n"
+		"\r\n";
+static const char http_events_keepalive[] = ":\n\n";
+static const char http_events_503_hdr[] = "503 Service Unavailable";
+
+/* @brief the server the clients are connected to, NULL while it is stopped */
+static httpd_handle_t http_events_server = NULL;
+
+/* @brief sockets of the clients. Only used on the task of the http server */
+static int http_events_clients[HTTP_EVENTS_MAX_CLIENTS];
+static int http_events_client_count = 0;
+
+/* @brief entity tags of the versions last pushed, to push only what changed */
+static char http_events_status_etag[sizeof(((struct json_snapshot_t*)0)->etag)];
+static char http_events_ap_etag[sizeof(((struct json_snapshot_t*)0)->etag)];
+
+/* @brief set while a push is queued on the http server */
+static atomic_bool http_events_pending = ATOMIC_VAR_INIT(false);
+
+/* @brief scans the access points while clients are connected */
+static TimerHandle_t http_events_scan_timer = NULL;
+
+
+static void http_events_scan_timer_cb(TimerHandle_t xTimer){
+	wifi_manager_scan_async();
+}
+
+static void http_events_remove_client(int sockfd){
+
+	for(int i=0; i<http_events_client_count; i++){
+		if(http_events_clients[i] == sockfd){
+			http_events_clients[i] = http_events_clients[--http_events_client_count];
+			if(http_events_client_count == 0 && http_events_scan_timer){
+				xTimerStop(http_events_scan_timer, (TickType_t)0);
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Sends a frame to a client. A client that cannot take it is dropped and its socket closed.
+ */
+static void http_events_send(int sockfd, const char *frame, size_t len){
+
+	int sent = httpd_socket_send(http_events_server, sockfd, frame, len, 0);
+	if(sent < 0 || (size_t)sent != len){
+		ESP_LOGI(TAG, "client %d went away", sockfd);
+		http_events_remove_client(sockfd);
+		httpd_sess_trigger_close(http_events_server, sockfd);
+	}
+}
+
+/**
+ * @brief Formats a document as an event. Each of its lines becomes a data line, which the browser joins back.
+ * @return the frame, to be freed, or NULL if out of memory.
+ */
+static char* http_events_format(const char *event, const struct json_snapshot_t *doc, size_t *len){
+
+	const char *line = doc->data;
+	const char *end = doc->data + doc->len;
+	size_t lines = 1;
+
+	/* the documents end with a new line, which is not a line of data */
+	if(end > line && end[-1] == '\n') end--;
+	for(const char *c = line; c < end; c++){
+		if(*c == '\n') lines++;
+	}
+
+	char *frame = malloc(sizeof("event: \n") + strlen(event) + doc->len + lines * (sizeof("data: \n") - 1) + 1);
+	if(frame == NULL){
+		return NULL;
+	}
+
+	char *p = frame + sprintf(frame, "event: %s\n", event);
+	while(line <= end){
+		const char *nl = memchr(line, '\n', end - line);
+		if(nl == NULL) nl = end;
+		memcpy(p, "data: ", 6);
+		p += 6;
+		memcpy(p, line, nl - line);
+		p += nl - line;
+		*p++ = '\n';
+		line = nl + 1;
+	}
+	*p++ = '\n';
+
+	*len = p - frame;
+	return frame;
+}
+
+/**
+ * @brief Pushes a document to a client, or to all of them if it changed since it was last pushed.
+ * @param sockfd the client, or -1 for all of them.
+ * @return true if something was sent.
+ */
+static bool http_events_push_doc(const char *event, const struct json_snapshot_t *doc, char *last_etag, int sockfd){
+
+	bool sent = false;
+
+	if(sockfd >= 0 || strcmp(doc->etag, last_etag) != 0){
+
+		size_t len;
+		char *frame = http_events_format(event, doc, &len);
+		if(frame){
+			if(sockfd >= 0){
+				/* the others may not have this version yet: the next push is still due to them */
+				http_events_send(sockfd, frame, len);
+			}
+			else{
+				/* backwards: a client that went away is replaced by the last one */
+				for(int i=http_events_client_count-1; i>=0; i--){
+					http_events_send(http_events_clients[i], frame, len);
+				}
+				strcpy(last_etag, doc->etag);
+			}
+			free(frame);
+			sent = true;
+		}
+		else{
+			ESP_LOGE(TAG, "out of memory: %s event not sent", event);
+		}
+	}
+
+	wifi_manager_release_json(doc);
+	return sent;
+}
+
+/**
+ * @brief Runs on the task of the http server: pushes whatever changed to all the clients.
+ */
+static void http_events_push(void *arg){
+
+	/* cleared first: a change published from now on queues another push */
+	atomic_store(&http_events_pending, false);
+
+	if(http_events_server == NULL || http_events_client_count == 0){
+		return;
+	}
+
+	bool sent = http_events_push_doc("status", wifi_manager_acquire_ip_info_json(), http_events_status_etag, -1);
+	sent |= http_events_push_doc("ap", wifi_manager_acquire_ap_list_json(), http_events_ap_etag, -1);
+
+	if(!sent){
+		/* nothing new after a scan: a comment makes sure the clients are still there */
+		for(int i=http_events_client_count-1; i>=0; i--){
+			http_events_send(http_events_clients[i], http_events_keepalive, sizeof(http_events_keepalive) - 1);
+		}
+	}
+}
+
+esp_err_t http_events_handler(httpd_req_t *req){
+
+	char retry[24];
+	int sockfd = httpd_req_to_sockfd(req);
+
+	if(http_events_client_count >= HTTP_EVENTS_MAX_CLIENTS){
+		/* the browser falls back to polling */
+		httpd_resp_set_status(req, http_events_503_hdr);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	/* the response never ends: its headers are sent raw and the socket is then written from work items */
+	int len = snprintf(retry, sizeof(retry), "retry: %d\n\n", HTTP_EVENTS_RETRY);
+	if(httpd_send(req, http_events_stream_hdr, sizeof(http_events_stream_hdr) - 1) < 0 || httpd_send(req, retry, len) < 0){
+		return ESP_FAIL;
+	}
+
+	http_events_clients[http_events_client_count++] = sockfd;
+	ESP_LOGI(TAG, "client %d connected", sockfd);
+
+	/* the current state first, then only the changes */
+	http_events_push_doc("status", wifi_manager_acquire_ip_info_json(), http_events_status_etag, sockfd);
+	http_events_push_doc("ap", wifi_manager_acquire_ap_list_json(), http_events_ap_etag, sockfd);
+
+	/* the first client starts the scans, unless it already went away */
+	if(http_events_client_count == 1 && http_events_clients[0] == sockfd){
+		if(http_events_scan_timer == NULL){
+			http_events_scan_timer = xTimerCreate(NULL, pdMS_TO_TICKS(HTTP_EVENTS_SCAN_INTERVAL), pdTRUE, (void*)0, http_events_scan_timer_cb);
+		}
+		xTimerStart(http_events_scan_timer, (TickType_t)0);
+		wifi_manager_scan_async();
+	}
+
+	return ESP_OK;
+}
+
+void http_events_close_fn(httpd_handle_t server, int sockfd){
+	http_events_remove_client(sockfd);
+	close(sockfd);
+}
+
+void http_events_start(httpd_handle_t server){
+	http_events_client_count = 0;
+	http_events_server = server;
+}
+
+void http_events_stop(){
+	http_events_server = NULL;
+	http_events_client_count = 0;
+	if(http_events_scan_timer){
+		xTimerStop(http_events_scan_timer, (TickType_t)0);
+	}
+}
+
+void http_events_notify(){
+
+	if(http_events_server != NULL && !atomic_exchange(&http_events_pending, true)){
+		if(httpd_queue_work(http_events_server, http_events_push, NULL) != ESP_OK){
+			atomic_store(&http_events_pending, false);
+		}
+	}
+}
@@ -0,0 +1,95 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file http_events.h
+@brief Pushes the connection status and the access point list to the browsers as server-sent events
+
+A browser opens GET /events once and keeps it open. It immediately receives the current status and list, then
+a "status" event each time the status changes and an "ap" event each time a scan changes the list, with the
+same JSON as /status.json and /ap.json. Nothing is sent while nothing changes, but for a comment after each
+scan that detects the clients that went away.
+
+The sockets of the clients are owned by the http server: all the writes happen on its task, queued with
+httpd_queue_work. While at least one client is connected, the access points are scanned every
+HTTP_EVENTS_SCAN_INTERVAL, which replaces the scans the browsers requested by polling /ap.json.
+
+@see https://html.spec.whatwg.org/multipage/server-sent-events.html
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_HTTP_EVENTS_H_INCLUDED
+#define WIFI_MANAGER_HTTP_EVENTS_H_INCLUDED
+
+#include <esp_http_server.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of browsers that can receive events at the same time. Each one holds a socket of the http server.
+ */
+#define HTTP_EVENTS_MAX_CLIENTS				CONFIG_WIFI_MANAGER_EVENTS_MAX_CLIENTS
+
+/**
+ * @brief Time (in ms) between two scans of the access points while a browser receives events.
+ */
+#define HTTP_EVENTS_SCAN_INTERVAL			CONFIG_WIFI_MANAGER_EVENTS_SCAN_INTERVAL
+
+/**
+ * @brief Time (in ms) a browser waits before reconnecting when the stream is lost.
+ */
+#define HTTP_EVENTS_RETRY					3000
+
+
+/**
+ * @brief Lets the events be pushed through this server. Called once the server is started.
+ */
+void http_events_start(httpd_handle_t server);
+
+/**
+ * @brief Forgets the clients: called before the server is stopped, which closes their sockets.
+ */
+void http_events_stop();
+
+/**
+ * @brief Handler of GET /events: turns the connection into an event stream.
+ */
+esp_err_t http_events_handler(httpd_req_t *req);
+
+/**
+ * @brief Close callback of the http server: forgets the client if the socket was one, then closes it.
+ */
+void http_events_close_fn(httpd_handle_t server, int sockfd);
+
+/**
+ * @brief Tells that the status or the access point list was published: the clients get whichever changed.
+ * Cheap and non-blocking; several calls before the push happens result in a single push.
+ * @note to be called from the wifi_manager task, like http_app_start and http_app_stop.
+ */
+void http_events_notify();
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_HTTP_EVENTS_H_INCLUDED */
@@ -0,0 +1,211 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file http_router.c
+@brief Table of the routes of the http server, looked up by method and path
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+
+#include "http_router.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "http_router";
+
+typedef enum http_router_slot_state_t{
+	HTTP_ROUTER_SLOT_EMPTY = 0,			/* ends a probe sequence */
+	HTTP_ROUTER_SLOT_USED = 1,
+	HTTP_ROUTER_SLOT_DELETED = 2,		/* free, but a probe sequence goes on past it */
+}http_router_slot_state_t;
+
+struct http_router_slot_t{
+	uint32_t hash;
+	http_router_slot_state_t state;
+	struct http_route_t route;
+};
+
+static struct http_router_slot_t http_router_slots[HTTP_ROUTER_SLOTS];
+static uint32_t http_router_count = 0;
+
+/* @brief the table is read by the http server task and written by whoever registers routes */
+static portMUX_TYPE http_router_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+/**
+ * @brief FNV-1a hash of the method and of the path, which ends at the query string if there is one.
+ * @param len receives the length of the path.
+ */
+static uint32_t http_router_hash(httpd_method_t method, const char *uri, size_t *len){
+
+	uint32_t hash = 2166136261u;
+	const char *p = uri;
+
+	hash = (hash ^ (uint8_t)method) * 16777619u;
+	for(; *p != '\0' && *p != '?'; p++){
+		hash = (hash ^ (uint8_t)*p) * 16777619u;
+	}
+
+	*len = (size_t)(p - uri);
+	return hash;
+}
+
+/**
+ * @brief Finds the slot of a route. Must be called within the critical section.
+ * @param free_slot if not NULL, receives the first slot where the route could be inserted, or -1.
+ * @return the index of the slot holding the route, or -1.
+ */
+static int http_router_lookup(uint32_t hash, httpd_method_t method, const char *uri, size_t len, int *free_slot){
+
+	uint32_t i = hash % HTTP_ROUTER_SLOTS;
+
+	if(free_slot) *free_slot = -1;
+
+	/* bounded: deleted slots could otherwise make the probe loop forever in a table with no empty slot left */
+	for(uint32_t n=0; n<HTTP_ROUTER_SLOTS; n++, i = (i + 1) % HTTP_ROUTER_SLOTS){
+
+		struct http_router_slot_t *slot = &http_router_slots[i];
+
+		if(slot->state == HTTP_ROUTER_SLOT_EMPTY){
+			if(free_slot && *free_slot < 0) *free_slot = (int)i;
+			return -1;
+		}
+		if(slot->state == HTTP_ROUTER_SLOT_DELETED){
+			if(free_slot && *free_slot < 0) *free_slot = (int)i;
+			continue;
+		}
+		if(slot->hash == hash && slot->route.method == method &&
+				strncmp(slot->route.uri, uri, len) == 0 && slot->route.uri[len] == '\0'){
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
+esp_err_t http_router_add(const struct http_route_t *route){
+
+	if(route->uri == NULL || (route->handler == NULL && route->async_handler == NULL)){
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	/* the copy is made outside of the critical section, where allocating is not allowed */
+	char *uri = strdup(route->uri);
+	if(uri == NULL){
+		return ESP_ERR_NO_MEM;
+	}
+
+	size_t len;
+	uint32_t hash = http_router_hash(route->method, uri, &len);
+	esp_err_t ret = ESP_OK;
+	int free_slot;
+
+	portENTER_CRITICAL(&http_router_mux);
+	int i = http_router_lookup(hash, route->method, uri, len, &free_slot);
+	if(i >= 0){
+		/* replaced: the route keeps the copy of the uri it already has */
+		const char *existing = http_router_slots[i].route.uri;
+		http_router_slots[i].route = *route;
+		http_router_slots[i].route.uri = existing;
+	}
+	else if(http_router_count >= HTTP_ROUTER_MAX_ROUTES || free_slot < 0){
+		ret = ESP_ERR_NO_MEM;
+	}
+	else{
+		struct http_router_slot_t *slot = &http_router_slots[free_slot];
+		slot->hash = hash;
+		slot->route = *route;
+		slot->route.uri = uri;
+		slot->state = HTTP_ROUTER_SLOT_USED;
+		http_router_count++;
+		uri = NULL;
+	}
+	portEXIT_CRITICAL(&http_router_mux);
+
+	/* NULL if the table took it */
+	free(uri);
+
+	if(ret == ESP_ERR_NO_MEM){
+		ESP_LOGE(TAG, "no room for %s: increase CONFIG_WIFI_MANAGER_HTTP_MAX_ROUTES", route->uri);
+	}
+
+	return ret;
+}
+
+esp_err_t http_router_remove(httpd_method_t method, const char *uri){
+
+	size_t len;
+	uint32_t hash = http_router_hash(method, uri, &len);
+	char *removed = NULL;
+
+	portENTER_CRITICAL(&http_router_mux);
+	int i = http_router_lookup(hash, method, uri, len, NULL);
+	if(i >= 0){
+		removed = (char*)http_router_slots[i].route.uri;
+		memset(&http_router_slots[i].route, 0x00, sizeof(struct http_route_t));
+		http_router_slots[i].state = HTTP_ROUTER_SLOT_DELETED;
+		http_router_count--;
+
+		/* deleted slots that end a probe sequence are not needed to go on with it: emptying them keeps
+		 * the sequences short when routes are added and removed over and over */
+		while(http_router_slots[i].state == HTTP_ROUTER_SLOT_DELETED &&
+				http_router_slots[(i + 1) % HTTP_ROUTER_SLOTS].state == HTTP_ROUTER_SLOT_EMPTY){
+			http_router_slots[i].state = HTTP_ROUTER_SLOT_EMPTY;
+			i = (i + HTTP_ROUTER_SLOTS - 1) % HTTP_ROUTER_SLOTS;
+		}
+	}
+	portEXIT_CRITICAL(&http_router_mux);
+
+	if(removed == NULL){
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	/* nothing can be comparing against it anymore: lookups only happen within the critical section */
+	free(removed);
+	return ESP_OK;
+}
+
+bool http_router_find(httpd_method_t method, const char *uri, struct http_route_t *route){
+
+	size_t len;
+	uint32_t hash = http_router_hash(method, uri, &len);
+
+	portENTER_CRITICAL(&http_router_mux);
+	int i = http_router_lookup(hash, method, uri, len, NULL);
+	if(i >= 0){
+		*route = http_router_slots[i].route;
+	}
+	portEXIT_CRITICAL(&http_router_mux);
+
+	if(i < 0){
+		return false;
+	}
+
+	route->uri = uri;
+	return true;
+}
@@ -0,0 +1,105 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file http_router.h
+@brief Table of the routes of the http server, looked up by method and path
+
+The http server registers a single wildcard handler per method: the captive portal must answer any URI while
+the fake DNS is active. The handler finds the route of a request in a statically allocated hash table, keyed
+on the method and the path without its query string. The table is kept at most half full, so a lookup is a
+hash of the path and, almost always, a single string comparison however many routes there are.
+
+Routes can be added and removed at any time, including while the server is running.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_HTTP_ROUTER_H_INCLUDED
+#define WIFI_MANAGER_HTTP_ROUTER_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_http_server.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of routes the table can hold, including the pages of the wifi manager itself.
+ */
+#define HTTP_ROUTER_MAX_ROUTES				CONFIG_WIFI_MANAGER_HTTP_MAX_ROUTES
+
+/**
+ * @brief Number of slots of the hash table: twice the number of routes keeps the probe sequences short.
+ */
+#define HTTP_ROUTER_SLOTS					(2 * HTTP_ROUTER_MAX_ROUTES)
+
+
+/**
+ * @brief Cache-Control header sent before the handler of a route is called.
+ */
+typedef enum http_cache_policy_t{
+	HTTP_CACHE_DEFAULT = 0,				/* no header: the handler sets it if it needs one */
+	HTTP_CACHE_NO_STORE = 1,			/* live data, never cached. Pragma: no-cache is sent as well */
+	HTTP_CACHE_REVALIDATE = 2,			/* cached, but revalidated before each use: pair it with an ETag */
+	HTTP_CACHE_IMMUTABLE = 3,			/* cached for a year: for content whose URI changes with it */
+}http_cache_policy_t;
+
+struct http_async_req_t;
+
+struct http_route_t{
+	httpd_method_t method;
+	const char *uri;					/* full path, e.g. "/helloworld". The router keeps its own copy */
+	esp_err_t (*handler)(httpd_req_t *req);
+	void *user_ctx;						/* given to the handler in req->user_ctx */
+	const char *content_type;			/* Content-Type sent before the handler is called, NULL to let it decide */
+	http_cache_policy_t cache_policy;
+	esp_err_t (*async_handler)(struct http_async_req_t *req);	/* run on a worker instead of handler, see http_async.h */
+	uint32_t timeout;					/* time (in ms) an async route has to answer, 0 for HTTP_ASYNC_TIMEOUT */
+};
+
+
+/**
+ * @brief Adds a route, or replaces the route with the same method and uri.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if uri or both handlers are missing, ESP_ERR_NO_MEM if the table is full.
+ */
+esp_err_t http_router_add(const struct http_route_t *route);
+
+/**
+ * @brief Removes a route.
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if there is no route with this method and uri.
+ */
+esp_err_t http_router_remove(httpd_method_t method, const char *uri);
+
+/**
+ * @brief Finds the route of a request. The query string of uri, if any, is ignored.
+ * @param route receives a copy of the route, with uri pointing to the uri given.
+ * @return true if a route was found.
+ */
+bool http_router_find(httpd_method_t method, const char *uri, struct http_route_t *route);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_HTTP_ROUTER_H_INCLUDED */
@@ -32,6 +32,32 @@ OTHER DEALINGS IN THE SOFTWARE.
 #include "json.h"
 
 
+size_t json_escaped_length(const unsigned char *input)
+{
+	const unsigned char *input_pointer = NULL;
+	size_t escape_characters = 0;
+
+	if (input == NULL)
+	{
+		return sizeof("\"\"") - 1;
+	}
+
+	for (input_pointer = input; *input_pointer; input_pointer++)
+	{
+		if (strchr("\"\\\b\f\n\r\t", *input_pointer))
+		{
+			escape_characters++;
+		}
+		else if (*input_pointer < 32)
+		{
+			escape_characters += 5;
+		}
+	}
+
+	/* two quotes around the escaped string */
+	return (size_t)(input_pointer - input) + escape_characters + 2;
+}
+
 bool json_print_string(const unsigned char *input, unsigned char *output_buffer)
 {
 	const unsigned char *input_pointer = NULL;
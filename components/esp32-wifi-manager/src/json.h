@@ -28,6 +28,9 @@ OTHER DEALINGS IN THE SOFTWARE.
 #ifndef JSON_H_INCLUDED
 #define JSON_H_INCLUDED
 
+#include <stddef.h>
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,6 +43,13 @@ extern "C" {
  */
 bool json_print_string(const unsigned char *input, unsigned char *output_buffer);
 
+/**
+ * @brief Computes the length of the JSON escaped version of a cstring, as printed by json_print_string.
+ * @param input the input buffer to be escaped.
+ * @return the number of characters json_print_string writes, quotes included and terminating null character excluded.
+ */
+size_t json_escaped_length(const unsigned char *input);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,155 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+@file json_snapshot.c
+@brief Immutable JSON documents published by the wifi_manager and read by the http server without locking
+
+Readers load the index of the published buffer, take a reference on it, then check it is still the published
+one. A writer only ever fills a buffer that is neither published nor referenced, so once a reader validated its
+reference the buffer cannot change under it. A reader racing with a writer at worst retries with the newer index.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include "json_snapshot.h"
+
+
+struct json_snapshots_t{
+	struct json_snapshot_t *buffers[JSON_SNAPSHOT_BUFFERS];
+	atomic_uint current;				/* index of the published buffer */
+	uint32_t writing;					/* index of the buffer being written, between begin and publish */
+	size_t size;
+	SemaphoreHandle_t writer_mutex;
+};
+
+
+json_snapshots_t* json_snapshots_create(size_t size, const char *initial){
+
+	json_snapshots_t *snapshots = (json_snapshots_t*)malloc(sizeof(json_snapshots_t));
+	if(snapshots == NULL) return NULL;
+	memset(snapshots, 0x00, sizeof(json_snapshots_t));
+	snapshots->size = size;
+
+	snapshots->writer_mutex = xSemaphoreCreateMutex();
+	if(snapshots->writer_mutex == NULL){
+		json_snapshots_delete(snapshots);
+		return NULL;
+	}
+
+	for(int i=0; i<JSON_SNAPSHOT_BUFFERS; i++){
+		snapshots->buffers[i] = (struct json_snapshot_t*)malloc(sizeof(struct json_snapshot_t) + size);
+		if(snapshots->buffers[i] == NULL){
+			json_snapshots_delete(snapshots);
+			return NULL;
+		}
+		atomic_init(&snapshots->buffers[i]->refs, 0);
+	}
+
+	char *data = json_snapshots_begin(snapshots);
+	strncpy(data, initial, size - 1);
+	data[size - 1] = '\0';
+	json_snapshots_publish(snapshots);
+
+	return snapshots;
+}
+
+void json_snapshots_delete(json_snapshots_t *snapshots){
+	if(snapshots){
+		for(int i=0; i<JSON_SNAPSHOT_BUFFERS; i++){
+			free(snapshots->buffers[i]);
+		}
+		if(snapshots->writer_mutex){
+			vSemaphoreDelete(snapshots->writer_mutex);
+		}
+		free(snapshots);
+	}
+}
+
+char* json_snapshots_begin(json_snapshots_t *snapshots){
+
+	xSemaphoreTake(snapshots->writer_mutex, portMAX_DELAY);
+
+	uint32_t current = atomic_load(&snapshots->current);
+	for(;;){
+		for(uint32_t i=0; i<JSON_SNAPSHOT_BUFFERS; i++){
+			if(i != current && atomic_load(&snapshots->buffers[i]->refs) == 0){
+				snapshots->writing = i;
+				return snapshots->buffers[i]->data;
+			}
+		}
+		/* every other buffer is still being sent by a reader. Only happens with several slow clients */
+		vTaskDelay(1);
+	}
+}
+
+void json_snapshots_publish(json_snapshots_t *snapshots){
+
+	struct json_snapshot_t *snapshot = snapshots->buffers[snapshots->writing];
+
+	uint32_t hash = 2166136261u;
+	size_t len = 0;
+	for(; len < snapshots->size - 1 && snapshot->data[len] != '\0'; len++){
+		hash = (hash ^ (uint8_t)snapshot->data[len]) * 16777619u;
+	}
+	snapshot->data[len] = '\0';
+	snapshot->len = len;
+	snprintf(snapshot->etag, sizeof(snapshot->etag), "\"%08x\"", hash);
+
+	/* release: the content is visible to any reader that sees the new index */
+	atomic_store(&snapshots->current, snapshots->writing);
+
+	xSemaphoreGive(snapshots->writer_mutex);
+}
+
+size_t json_snapshots_size(json_snapshots_t *snapshots){
+	return snapshots->size;
+}
+
+const struct json_snapshot_t* json_snapshots_acquire(json_snapshots_t *snapshots){
+
+	for(;;){
+		uint32_t current = atomic_load(&snapshots->current);
+		struct json_snapshot_t *snapshot = snapshots->buffers[current];
+		atomic_fetch_add(&snapshot->refs, 1);
+
+		/* the writer may have picked this buffer before the reference was taken: only keep it if still published */
+		if(atomic_load(&snapshots->current) == current){
+			return snapshot;
+		}
+		atomic_fetch_sub(&snapshot->refs, 1);
+	}
+}
+
+void json_snapshots_release(const struct json_snapshot_t *snapshot){
+	if(snapshot){
+		atomic_fetch_sub(&((struct json_snapshot_t*)snapshot)->refs, 1);
+	}
+}
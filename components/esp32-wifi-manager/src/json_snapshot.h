@@ -0,0 +1,112 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+@file json_snapshot.h
+@brief Immutable JSON documents published by the wifi_manager and read by the http server without locking
+
+A document is kept in a few refcounted buffers. The writer fills a buffer that no reader holds, then publishes
+it with a single atomic store. Readers take a reference on the published buffer and can send it for as long as
+they need: it is never modified while referenced. Readers never wait, and writers never wait on readers.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_JSON_SNAPSHOT_H_INCLUDED
+#define WIFI_MANAGER_JSON_SNAPSHOT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of buffers per document: the published one, one being written, and one for a slow reader
+ * still sending the previous version.
+ */
+#define JSON_SNAPSHOT_BUFFERS				3
+
+/**
+ * @brief One version of a document. Immutable while a reader holds a reference on it.
+ */
+struct json_snapshot_t{
+	atomic_uint refs;
+	size_t len;						/* length of data, excluding the terminating null character */
+	char etag[11];					/* entity tag of data: a quoted FNV-1a hash of its content */
+	char data[];
+};
+
+typedef struct json_snapshots_t json_snapshots_t;
+
+/**
+ * @brief Allocates the buffers of a document and publishes its first version.
+ * @param size maximum length of the document, including the terminating null character.
+ * @param initial first version of the document.
+ * @return the document, or NULL if out of memory.
+ */
+json_snapshots_t* json_snapshots_create(size_t size, const char *initial);
+
+/**
+ * @brief Frees a document.
+ * @warning no reader may hold a snapshot of the document anymore.
+ */
+void json_snapshots_delete(json_snapshots_t *snapshots);
+
+/**
+ * @brief Starts writing a new version of the document.
+ *
+ * Writers are serialized: the caller must then call json_snapshots_publish. The buffer returned is not visible
+ * to readers until then, and is json_snapshots_size bytes long.
+ *
+ * @return the buffer to write the new version to.
+ */
+char* json_snapshots_begin(json_snapshots_t *snapshots);
+
+/**
+ * @brief Publishes the version written since json_snapshots_begin. Readers acquiring the document from now on get it.
+ */
+void json_snapshots_publish(json_snapshots_t *snapshots);
+
+/**
+ * @brief Size of the buffers of the document, including the terminating null character.
+ */
+size_t json_snapshots_size(json_snapshots_t *snapshots);
+
+/**
+ * @brief Takes a reference on the latest published version of the document. Never blocks.
+ * @return the snapshot, which must be released with json_snapshots_release.
+ */
+const struct json_snapshot_t* json_snapshots_acquire(json_snapshots_t *snapshots);
+
+/**
+ * @brief Gives back a snapshot obtained with json_snapshots_acquire. NULL is ignored.
+ */
+void json_snapshots_release(const struct json_snapshot_t *snapshot);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_JSON_SNAPSHOT_H_INCLUDED */
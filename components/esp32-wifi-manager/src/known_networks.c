@@ -0,0 +1,439 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file known_networks.c
+@brief Bounded store of the wifi networks the STA successfully connected to, ranked by connection history
+
+Each entry keeps the credentials of a network along with the radio parameters of the AP it was
+last seen on and a few statistics used to decide which network to try first.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/param.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_wifi.h>
+#include <esp_crc.h>
+#include "nvs.h"
+
+#include "nvs_sync.h"
+#include "wifi_manager.h"
+#include "known_networks.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "known_networks";
+
+/* @brief NVS key of the blob holding the known networks */
+static const char known_networks_nvs_key[] = "knownnets";
+
+/* @brief NVS key of the raw array of struct known_network_t written by older firmwares */
+static const char known_networks_legacy_nvs_key[] = "networks";
+
+/**
+ * @brief Version of the layout of struct known_networks_entry_t. Must be incremented whenever the layout changes.
+ *
+ * New fields must be appended to the entry: entries written by an older firmware are shorter and read with the
+ * new fields zeroed, entries written by a newer one are read up to the fields this build knows about.
+ */
+#define KNOWN_NETWORKS_VERSION				1
+
+/**
+ * @brief Header of the blob, followed by count entries of entry_size bytes.
+ */
+struct known_networks_header_t{
+	uint8_t version;
+	uint8_t count;
+	uint16_t entry_size;
+	uint32_t crc;					/* CRC32 of the entries */
+} __attribute__((packed));
+
+/**
+ * @brief A known network as saved in flash. Multi-byte fields are little endian.
+ */
+struct known_networks_entry_t{
+	uint8_t ssid[MAX_SSID_SIZE];
+	uint8_t password[MAX_PASSWORD_SIZE];
+	uint8_t bssid[6];
+	uint8_t channel;
+	uint8_t authmode;
+	int8_t rssi;
+	uint8_t failures;
+	uint32_t last_success;
+	uint32_t avg_assoc_time;
+} __attribute__((packed));
+
+/* @brief RSSI difference (in dB) with the saved value above which the entry is rewritten to flash */
+#define KNOWN_NETWORKS_RSSI_DRIFT			10
+
+/* @brief the store, most recently used network not necessarily first */
+static struct known_network_t known_networks[MAX_KNOWN_NETWORKS];
+static uint8_t known_networks_num = 0;
+
+
+
+static bool known_networks_ssid_equals(const uint8_t *a, const uint8_t *b){
+	return strncmp((const char*)a, (const char*)b, MAX_SSID_SIZE) == 0;
+}
+
+/**
+ * @brief highest connection sequence number in the store.
+ */
+static uint32_t known_networks_newest(){
+	uint32_t newest = 0;
+	for(uint8_t i=0; i<known_networks_num; i++){
+		if(known_networks[i].last_success > newest) newest = known_networks[i].last_success;
+	}
+	return newest;
+}
+
+/**
+ * @brief returns a free entry, evicting the least recently used network if the store is full.
+ */
+static struct known_network_t* known_networks_alloc(){
+
+	if(known_networks_num < MAX_KNOWN_NETWORKS){
+		return &known_networks[known_networks_num++];
+	}
+
+	struct known_network_t *oldest = &known_networks[0];
+	for(uint8_t i=1; i<known_networks_num; i++){
+		if(known_networks[i].last_success < oldest->last_success) oldest = &known_networks[i];
+	}
+	ESP_LOGI(TAG, "store is full, forgetting %s", (char*)oldest->ssid);
+
+	return oldest;
+}
+
+static void known_networks_pack(struct known_networks_entry_t *entry, const struct known_network_t *n){
+	memcpy(entry->ssid, n->ssid, sizeof(entry->ssid));
+	memcpy(entry->password, n->password, sizeof(entry->password));
+	memcpy(entry->bssid, n->bssid, sizeof(entry->bssid));
+	entry->channel = n->channel;
+	entry->authmode = n->authmode;
+	entry->rssi = n->rssi;
+	entry->failures = n->failures;
+	entry->last_success = n->last_success;
+	entry->avg_assoc_time = n->avg_assoc_time;
+}
+
+static void known_networks_unpack(const struct known_networks_entry_t *entry, struct known_network_t *n){
+	memset(n, 0x00, sizeof(struct known_network_t));
+	memcpy(n->ssid, entry->ssid, sizeof(n->ssid));
+	memcpy(n->password, entry->password, sizeof(n->password));
+	memcpy(n->bssid, entry->bssid, sizeof(n->bssid));
+	n->channel = entry->channel;
+	n->authmode = entry->authmode;
+	n->rssi = entry->rssi;
+	n->failures = entry->failures;
+	n->last_success = entry->last_success;
+	n->avg_assoc_time = entry->avg_assoc_time;
+}
+
+static esp_err_t known_networks_save(){
+
+	esp_err_t esp_err;
+
+	if(known_networks_num > 0){
+		size_t sz = sizeof(struct known_networks_header_t) + sizeof(struct known_networks_entry_t) * known_networks_num;
+		uint8_t *blob = calloc(1, sz);
+		if(blob == NULL) return ESP_ERR_NO_MEM;
+
+		struct known_networks_header_t *header = (struct known_networks_header_t*)blob;
+		struct known_networks_entry_t *entries = (struct known_networks_entry_t*)(blob + sizeof(struct known_networks_header_t));
+		for(uint8_t i=0; i<known_networks_num; i++){
+			known_networks_pack(&entries[i], &known_networks[i]);
+		}
+		header->version = KNOWN_NETWORKS_VERSION;
+		header->count = known_networks_num;
+		header->entry_size = sizeof(struct known_networks_entry_t);
+		header->crc = esp_crc32_le(0, (const uint8_t*)entries, sz - sizeof(struct known_networks_header_t));
+
+		esp_err = nvs_sync_set_blob(wifi_manager_nvs_namespace, known_networks_nvs_key, blob, sz);
+		free(blob);
+	}
+	else{
+		esp_err = nvs_sync_erase_key(wifi_manager_nvs_namespace, known_networks_nvs_key);
+	}
+	if(esp_err == ESP_OK){
+		esp_err = nvs_sync_commit(wifi_manager_nvs_namespace);
+	}
+
+	ESP_LOGI(TAG, "known_networks_save: %d network(s)", known_networks_num);
+
+	return esp_err;
+}
+
+/**
+ * @brief adds a network read from flash. When there are more than MAX_KNOWN_NETWORKS, the ones that have not
+ * been used for the longest time are left out.
+ */
+static void known_networks_load_entry(const struct known_network_t *n){
+
+	if(known_networks_num < MAX_KNOWN_NETWORKS){
+		known_networks[known_networks_num++] = *n;
+		return;
+	}
+
+	struct known_network_t *oldest = &known_networks[0];
+	for(uint8_t i=1; i<known_networks_num; i++){
+		if(known_networks[i].last_success < oldest->last_success) oldest = &known_networks[i];
+	}
+	if(n->last_success > oldest->last_success){
+		*oldest = *n;
+	}
+}
+
+/**
+ * @brief reads the raw array saved by older firmwares, and saves it again in the current format.
+ */
+static esp_err_t known_networks_load_legacy(){
+
+	size_t sz = 0;
+	esp_err_t esp_err = nvs_sync_get_blob(wifi_manager_nvs_namespace, known_networks_legacy_nvs_key, NULL, &sz);
+	if(esp_err != ESP_OK) return esp_err;
+
+	struct known_network_t *legacy = malloc(sz ? sz : 1);
+	if(legacy == NULL) return ESP_ERR_NO_MEM;
+	esp_err = nvs_sync_get_blob(wifi_manager_nvs_namespace, known_networks_legacy_nvs_key, legacy, &sz);
+	if(esp_err == ESP_OK){
+		ESP_LOGI(TAG, "converting the networks saved by an older firmware");
+		for(size_t i=0; i<sz / sizeof(struct known_network_t); i++){
+			known_networks_load_entry(&legacy[i]);
+		}
+		nvs_sync_erase_key(wifi_manager_nvs_namespace, known_networks_legacy_nvs_key);
+		esp_err = known_networks_save();
+	}
+	free(legacy);
+
+	return esp_err;
+}
+
+esp_err_t known_networks_load(){
+
+	esp_err_t esp_err;
+	size_t sz = 0;
+
+	known_networks_num = 0;
+
+	esp_err = nvs_sync_get_blob(wifi_manager_nvs_namespace, known_networks_nvs_key, NULL, &sz);
+	if(esp_err == ESP_ERR_NVS_NOT_FOUND){
+		esp_err = known_networks_load_legacy();
+		/* nothing was ever saved, or the namespace does not exist yet */
+		return esp_err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : esp_err;
+	}
+	else if(esp_err != ESP_OK){
+		return esp_err;
+	}
+
+	uint8_t *blob = malloc(sz > 0 ? sz : 1);
+	if(blob == NULL) return ESP_ERR_NO_MEM;
+	esp_err = nvs_sync_get_blob(wifi_manager_nvs_namespace, known_networks_nvs_key, blob, &sz);
+	if(esp_err != ESP_OK){
+		free(blob);
+		return esp_err;
+	}
+
+	const struct known_networks_header_t *header = (const struct known_networks_header_t*)blob;
+	const uint8_t *entries = blob + sizeof(struct known_networks_header_t);
+	if(sz < sizeof(struct known_networks_header_t) || header->version == 0 || header->entry_size == 0 ||
+			sz != sizeof(struct known_networks_header_t) + (size_t)header->entry_size * header->count ||
+			header->crc != esp_crc32_le(0, entries, sz - sizeof(struct known_networks_header_t))){
+		ESP_LOGE(TAG, "ignoring corrupted known networks");
+		free(blob);
+		return ESP_OK;
+	}
+	if(header->version > KNOWN_NETWORKS_VERSION){
+		ESP_LOGW(TAG, "known networks saved by a newer firmware (version %d): reading the fields this one knows", header->version);
+	}
+
+	const uint8_t count = header->count;
+	for(uint8_t i=0; i<count; i++){
+		struct known_networks_entry_t entry;
+		struct known_network_t n;
+		memset(&entry, 0x00, sizeof(entry));
+		memcpy(&entry, entries + (size_t)header->entry_size * i, MIN((size_t)header->entry_size, sizeof(entry)));
+		known_networks_unpack(&entry, &n);
+		known_networks_load_entry(&n);
+	}
+	free(blob);
+
+	if(count > known_networks_num){
+		ESP_LOGW(TAG, "%d networks were saved, keeping the %d most recently used", count, known_networks_num);
+	}
+	ESP_LOGI(TAG, "known_networks_load: %d network(s)", known_networks_num);
+
+	return ESP_OK;
+}
+
+uint8_t known_networks_count(){
+	return known_networks_num;
+}
+
+struct known_network_t* known_networks_find(const uint8_t *ssid){
+	for(uint8_t i=0; i<known_networks_num; i++){
+		if(known_networks_ssid_equals(known_networks[i].ssid, ssid)) return &known_networks[i];
+	}
+	return NULL;
+}
+
+struct known_network_t* known_networks_get(uint8_t index){
+	return index < known_networks_num ? &known_networks[index] : NULL;
+}
+
+esp_err_t known_networks_add(const uint8_t *ssid, const uint8_t *password){
+
+	if(ssid[0] == '\0') return ESP_ERR_INVALID_ARG;
+	if(known_networks_find(ssid)) return ESP_OK;
+
+	struct known_network_t *n = known_networks_alloc();
+	memset(n, 0x00, sizeof(struct known_network_t));
+	memcpy(n->ssid, ssid, MAX_SSID_SIZE);
+	memcpy(n->password, password, MAX_PASSWORD_SIZE);
+
+	return known_networks_save();
+}
+
+esp_err_t known_networks_record_success(const wifi_config_t *config, const wifi_ap_record_t *ap, uint32_t assoc_time){
+
+	const uint32_t newest = known_networks_newest();
+	bool change = false;
+
+	struct known_network_t *n = known_networks_find(config->sta.ssid);
+	if(n == NULL){
+		n = known_networks_alloc();
+		memset(n, 0x00, sizeof(struct known_network_t));
+		memcpy(n->ssid, config->sta.ssid, MAX_SSID_SIZE);
+		change = true;
+	}
+
+	if(memcmp(n->password, config->sta.password, MAX_PASSWORD_SIZE) != 0){
+		memcpy(n->password, config->sta.password, MAX_PASSWORD_SIZE);
+		change = true;
+	}
+
+	if(ap){
+		if(memcmp(n->bssid, ap->bssid, sizeof(n->bssid)) != 0 || n->channel != ap->primary || n->authmode != (uint8_t)ap->authmode){
+			memcpy(n->bssid, ap->bssid, sizeof(n->bssid));
+			n->channel = ap->primary;
+			n->authmode = (uint8_t)ap->authmode;
+			change = true;
+		}
+		if(abs(n->rssi - ap->rssi) >= KNOWN_NETWORKS_RSSI_DRIFT){
+			change = true;
+		}
+		n->rssi = ap->rssi;
+	}
+
+	if(assoc_time != 0){
+		/* moving average over the last few connections */
+		uint32_t avg = n->avg_assoc_time == 0 ? assoc_time : (n->avg_assoc_time * 3 + assoc_time) / 4;
+		if(avg > n->avg_assoc_time + n->avg_assoc_time / 4 || avg < n->avg_assoc_time - n->avg_assoc_time / 4){
+			change = true;
+		}
+		n->avg_assoc_time = avg;
+	}
+
+	n->failures = 0;
+
+	/* only bump the sequence number if this network was not already the most recently used one */
+	if(n->last_success == 0 || n->last_success != newest){
+		n->last_success = newest + 1;
+		change = true;
+	}
+
+	return change ? known_networks_save() : ESP_OK;
+}
+
+void known_networks_record_failure(const uint8_t *ssid){
+	struct known_network_t *n = known_networks_find(ssid);
+	if(n && n->failures < UINT8_MAX){
+		n->failures++;
+	}
+}
+
+esp_err_t known_networks_remove(const uint8_t *ssid){
+
+	struct known_network_t *n = known_networks_find(ssid);
+	if(n == NULL) return ESP_OK;
+
+	uint8_t index = (uint8_t)(n - known_networks);
+	memmove(&known_networks[index], &known_networks[index+1], sizeof(struct known_network_t) * (known_networks_num - index - 1));
+	known_networks_num--;
+
+	return known_networks_save();
+}
+
+/**
+ * @brief score of a network based on its history alone. Higher is better.
+ *
+ * The most recently used network scores 0, every step back in recency costs 20 points,
+ * every 100ms of average association time costs 1 point and each consecutive failure costs 30 points.
+ */
+static int32_t known_networks_history_score(const struct known_network_t *n, uint32_t newest){
+	int32_t score = 0;
+	uint32_t age = n->last_success == 0 ? 10 : newest - n->last_success;
+
+	score -= 20 * (int32_t)MIN(age, 10);
+	score -= (int32_t)MIN(n->avg_assoc_time / 100, 50);
+	score -= 30 * (int32_t)MIN(n->failures, 10);
+
+	return score;
+}
+
+uint8_t known_networks_rank(const wifi_ap_record_t *aplist, uint16_t ap_num, uint8_t *order){
+
+	int32_t score[MAX_KNOWN_NETWORKS];
+	const uint32_t newest = known_networks_newest();
+
+	for(uint8_t i=0; i<known_networks_num; i++){
+		score[i] = known_networks_history_score(&known_networks[i], newest);
+
+		/* networks in range go first, 4 points per dB: a 10dB stronger network outweighs two steps of recency.
+		 * A network made of several access points is scored on its strongest one. */
+		int16_t best_rssi = INT16_MIN;
+		for(uint16_t j=0; aplist && j<ap_num; j++){
+			if(known_networks_ssid_equals(known_networks[i].ssid, aplist[j].ssid) && aplist[j].rssi > best_rssi){
+				best_rssi = aplist[j].rssi;
+			}
+		}
+		if(best_rssi != INT16_MIN){
+			score[i] += 1000 + 4 * (best_rssi + 100);
+		}
+
+		/* insertion sort on the score, stable for equal scores */
+		uint8_t k = i;
+		while(k > 0 && score[order[k-1]] < score[i]){
+			order[k] = order[k-1];
+			k--;
+		}
+		order[k] = i;
+	}
+
+	return known_networks_num;
+}
@@ -0,0 +1,137 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file known_networks.h
+@brief Bounded store of the wifi networks the STA successfully connected to, ranked by connection history
+
+Each entry keeps the credentials of a network along with the radio parameters of the AP it was
+last seen on and a few statistics used to decide which network to try first.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_KNOWN_NETWORKS_H_INCLUDED
+#define WIFI_MANAGER_KNOWN_NETWORKS_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+#include <esp_netif.h>
+#include <esp_wifi.h>
+
+#include "wifi_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Defines the maximum number of networks remembered by the wifi manager.
+ * When the store is full, the network that has not been used for the longest time is forgotten.
+ */
+#define MAX_KNOWN_NETWORKS					CONFIG_WIFI_MANAGER_MAX_KNOWN_NETWORKS
+
+
+/**
+ * @brief One remembered network.
+ */
+struct known_network_t{
+	uint8_t ssid[MAX_SSID_SIZE];
+	uint8_t password[MAX_PASSWORD_SIZE];
+	uint8_t bssid[6];			/* BSSID of the AP of the last successful connection */
+	uint8_t channel;			/* primary channel of that AP, 0 when unknown */
+	uint8_t authmode;			/* auth mode of that AP */
+	int8_t rssi;				/* RSSI at the last successful connection */
+	uint8_t failures;			/* consecutive failed attempts since the last success */
+	uint32_t last_success;		/* connection sequence number of the last success. Higher is more recent, 0 means never */
+	uint32_t avg_assoc_time;	/* moving average of the time (in ms) between connection order and GOT_IP */
+};
+
+
+/**
+ * @brief loads the known networks from flash ram storage.
+ * @return ESP_OK if the store was read or does not exist yet, an NVS error otherwise.
+ */
+esp_err_t known_networks_load();
+
+/**
+ * @brief number of networks currently remembered.
+ */
+uint8_t known_networks_count();
+
+/**
+ * @brief returns the known network matching ssid, or NULL if it's not remembered.
+ */
+struct known_network_t* known_networks_find(const uint8_t *ssid);
+
+/**
+ * @brief returns the known network stored at index, or NULL if index is out of bounds.
+ */
+struct known_network_t* known_networks_get(uint8_t index);
+
+/**
+ * @brief remembers a network without any connection history, e.g. credentials saved by an older firmware.
+ * @note does nothing if the network is already known.
+ */
+esp_err_t known_networks_add(const uint8_t *ssid, const uint8_t *password);
+
+/**
+ * @brief records a successful connection.
+ *
+ * The network is added to the store if unknown. Flash is only written when the credentials or AP changed,
+ * when the network was not already the most recently used one, or when its statistics drifted significantly.
+ *
+ * @param config the STA configuration that was used to connect.
+ * @param ap the AP the STA is connected to, as returned by esp_wifi_sta_get_ap_info.
+ * @param assoc_time time in ms between the connection order and GOT_IP.
+ */
+esp_err_t known_networks_record_success(const wifi_config_t *config, const wifi_ap_record_t *ap, uint32_t assoc_time);
+
+/**
+ * @brief records a failed connection attempt. This is kept in RAM only.
+ */
+void known_networks_record_failure(const uint8_t *ssid);
+
+/**
+ * @brief forgets a network.
+ */
+esp_err_t known_networks_remove(const uint8_t *ssid);
+
+/**
+ * @brief computes the order in which known networks should be tried.
+ *
+ * Networks present in the scan results are tried first, strongest and most reliable first. Networks absent
+ * from the scan (or all of them if no scan results are given) are ranked on their history alone.
+ *
+ * @param aplist latest scan results, one record per access point: a network seen through several of them is ranked on the strongest. Can be NULL.
+ * @param ap_num number of records in aplist.
+ * @param order output array of at least MAX_KNOWN_NETWORKS indexes usable with known_networks_get.
+ * @return the number of indexes written in order.
+ */
+uint8_t known_networks_rank(const wifi_ap_record_t *aplist, uint16_t ap_num, uint8_t *order);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_KNOWN_NETWORKS_H_INCLUDED */
@@ -0,0 +1,362 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file link_telemetry.c
+@brief History of the quality of the STA link
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_wifi.h>
+#include <esp_timer.h>
+
+#include "link_telemetry.h"
+
+
+/* @brief parts of the JSON written one after the other by link_telemetry_get_json */
+enum{
+	LINK_TELEMETRY_JSON_COUNTERS = 0,
+	LINK_TELEMETRY_JSON_HISTOGRAMS,
+	LINK_TELEMETRY_JSON_REASONS,
+	LINK_TELEMETRY_JSON_SAMPLES,
+	LINK_TELEMETRY_JSON_DONE
+};
+
+static const int8_t link_telemetry_rssi_edges[LINK_TELEMETRY_RSSI_BINS - 1] = { -90, -80, -70, -60, -50 };
+static const uint16_t link_telemetry_reconnect_edges[LINK_TELEMETRY_RECONNECT_BINS - 1] = { 250, 500, 1000, 2000, 5000, 10000 };
+
+/* @brief samples, indexed by their sequence number modulo LINK_TELEMETRY_SIZE */
+static struct link_telemetry_sample_t link_telemetry_ring[LINK_TELEMETRY_SIZE];
+
+/* @brief sequence number of the next sample. The ring holds the samples from written - LINK_TELEMETRY_SIZE on */
+static uint32_t link_telemetry_written = 0;
+
+static uint32_t link_telemetry_rssi_hist[LINK_TELEMETRY_RSSI_BINS];
+static uint32_t link_telemetry_reconnect_hist[LINK_TELEMETRY_RECONNECT_BINS];
+static uint32_t link_telemetry_channel_hist[LINK_TELEMETRY_CHANNEL_BINS];
+static uint32_t link_telemetry_reason_hist[LINK_TELEMETRY_REASON_BINS];
+static struct link_telemetry_stats_t link_telemetry_stats;
+
+/* @brief ring, histograms and counters are written by the wifi_manager task and read by the http server */
+static portMUX_TYPE link_telemetry_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* @brief last signal seen while connected, recorded with the disconnection since the AP is gone by then */
+static int8_t link_telemetry_last_rssi = 0;
+static uint8_t link_telemetry_last_channel = 0;
+static uint8_t link_telemetry_last_phy = 0;
+
+/* @brief time the established connection was lost, 0 while connected or before the first connection */
+static int64_t link_telemetry_lost_time = 0;
+static bool link_telemetry_connected = false;
+
+
+static uint8_t link_telemetry_reason_bin(uint8_t reason){
+	if(reason > 0 && reason < 64){
+		return reason;
+	}
+	if(reason >= 200 && reason < 216){
+		return 64 + reason - 200;
+	}
+	return 0;
+}
+
+static uint16_t link_telemetry_bin_reason(uint8_t bin){
+	return bin < 64 ? bin : 200 + bin - 64;
+}
+
+static uint8_t link_telemetry_phy(const wifi_ap_record_t *ap_info){
+	return (ap_info->phy_11b ? LINK_TELEMETRY_PHY_11B : 0) |
+			(ap_info->phy_11g ? LINK_TELEMETRY_PHY_11G : 0) |
+			(ap_info->phy_11n ? LINK_TELEMETRY_PHY_11N : 0) |
+			(ap_info->phy_lr ? LINK_TELEMETRY_PHY_LR : 0) |
+			(ap_info->second != WIFI_SECOND_CHAN_NONE ? LINK_TELEMETRY_PHY_HT40 : 0);
+}
+
+/**
+ * @brief Adds a sample to the ring and to the histograms, and charges the time since start to the sampling overhead.
+ */
+static void link_telemetry_push(struct link_telemetry_sample_t *sample, int64_t start){
+
+	sample->time = (uint32_t)(start / 1000000);
+
+	taskENTER_CRITICAL(&link_telemetry_mux);
+	link_telemetry_ring[link_telemetry_written % LINK_TELEMETRY_SIZE] = *sample;
+	link_telemetry_written++;
+	link_telemetry_stats.samples++;
+
+	if(sample->event == LINK_TELEMETRY_DISCONNECTED){
+		link_telemetry_reason_hist[link_telemetry_reason_bin(sample->reason)]++;
+	}
+	else if(sample->channel != 0){
+		uint8_t bin = 0;
+		while(bin < LINK_TELEMETRY_RSSI_BINS - 1 && sample->rssi >= link_telemetry_rssi_edges[bin]) bin++;
+		link_telemetry_rssi_hist[bin]++;
+		if(sample->channel >= 1 && sample->channel <= LINK_TELEMETRY_CHANNEL_BINS){
+			link_telemetry_channel_hist[sample->channel - 1]++;
+		}
+	}
+	if(sample->event == LINK_TELEMETRY_CONNECTED && sample->reconnect_time != 0){
+		uint8_t bin = 0;
+		while(bin < LINK_TELEMETRY_RECONNECT_BINS - 1 && sample->reconnect_time >= link_telemetry_reconnect_edges[bin]) bin++;
+		link_telemetry_reconnect_hist[bin]++;
+	}
+
+	uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+	link_telemetry_stats.total_time_us += elapsed;
+	if(elapsed > link_telemetry_stats.max_time_us){
+		link_telemetry_stats.max_time_us = elapsed;
+	}
+	taskEXIT_CRITICAL(&link_telemetry_mux);
+}
+
+/**
+ * @brief Reads the connected AP into a sample and remembers its signal for the next disconnection.
+ */
+static bool link_telemetry_read_ap(struct link_telemetry_sample_t *sample){
+	wifi_ap_record_t ap_info;
+	if(esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK){
+		return false;
+	}
+	sample->rssi = link_telemetry_last_rssi = ap_info.rssi;
+	sample->channel = link_telemetry_last_channel = ap_info.primary;
+	sample->phy = link_telemetry_last_phy = link_telemetry_phy(&ap_info);
+	return true;
+}
+
+void link_telemetry_sample(){
+
+	int64_t start = esp_timer_get_time();
+
+	/* the budget is the share of the time since boot, so a costly sample is paid back by skipping the next ones */
+	if(link_telemetry_stats.total_time_us * 1000000ULL > (uint64_t)start * LINK_TELEMETRY_MAX_OVERHEAD){
+		taskENTER_CRITICAL(&link_telemetry_mux);
+		link_telemetry_stats.skipped++;
+		taskEXIT_CRITICAL(&link_telemetry_mux);
+		return;
+	}
+
+	struct link_telemetry_sample_t sample = { .event = LINK_TELEMETRY_PERIODIC };
+	if(link_telemetry_read_ap(&sample)){
+		link_telemetry_push(&sample, start);
+	}
+}
+
+void link_telemetry_record_disconnection(uint8_t reason){
+
+	int64_t start = esp_timer_get_time();
+	struct link_telemetry_sample_t sample = {
+		.rssi = link_telemetry_last_rssi,
+		.channel = link_telemetry_last_channel,
+		.phy = link_telemetry_last_phy,
+		.event = LINK_TELEMETRY_DISCONNECTED,
+		.reason = reason
+	};
+
+	/* failed attempts that follow a loss are part of the same outage */
+	if(link_telemetry_connected){
+		link_telemetry_connected = false;
+		link_telemetry_lost_time = start;
+	}
+
+	taskENTER_CRITICAL(&link_telemetry_mux);
+	link_telemetry_stats.disconnections++;
+	taskEXIT_CRITICAL(&link_telemetry_mux);
+	link_telemetry_push(&sample, start);
+}
+
+void link_telemetry_record_connection(){
+
+	int64_t start = esp_timer_get_time();
+	struct link_telemetry_sample_t sample = { .event = LINK_TELEMETRY_CONNECTED };
+	link_telemetry_read_ap(&sample);
+
+	if(link_telemetry_lost_time != 0){
+		int64_t ms = (start - link_telemetry_lost_time) / 1000;
+		sample.reconnect_time = ms <= 0 ? 1 : (ms > UINT16_MAX ? UINT16_MAX : (uint16_t)ms);
+		link_telemetry_lost_time = 0;
+		taskENTER_CRITICAL(&link_telemetry_mux);
+		link_telemetry_stats.reconnections++;
+		taskEXIT_CRITICAL(&link_telemetry_mux);
+	}
+	link_telemetry_connected = true;
+
+	link_telemetry_push(&sample, start);
+}
+
+bool link_telemetry_get_sample(uint32_t age, struct link_telemetry_sample_t *sample){
+	bool ret = false;
+	taskENTER_CRITICAL(&link_telemetry_mux);
+	if(age < link_telemetry_written && age < LINK_TELEMETRY_SIZE){
+		*sample = link_telemetry_ring[(link_telemetry_written - 1 - age) % LINK_TELEMETRY_SIZE];
+		ret = true;
+	}
+	taskEXIT_CRITICAL(&link_telemetry_mux);
+	return ret;
+}
+
+void link_telemetry_get_stats(struct link_telemetry_stats_t *stats){
+	taskENTER_CRITICAL(&link_telemetry_mux);
+	*stats = link_telemetry_stats;
+	taskEXIT_CRITICAL(&link_telemetry_mux);
+}
+
+/**
+ * @brief Appends to buf if the whole text fits, so that an element is never split between two chunks.
+ */
+static bool link_telemetry_append(char *buf, size_t size, size_t *len, const char *format, ...){
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(buf + *len, size - *len, format, args);
+	va_end(args);
+	if(n < 0 || (size_t)n >= size - *len){
+		buf[*len] = '\0';
+		return false;
+	}
+	*len += (size_t)n;
+	return true;
+}
+
+static bool link_telemetry_append_hist(char *buf, size_t size, size_t *len, const char *name, const uint32_t *hist, size_t bins){
+	if(!link_telemetry_append(buf, size, len, ",\"%s\":[", name)) return false;
+	for(size_t i = 0; i < bins; i++){
+		if(!link_telemetry_append(buf, size, len, i ? ",%u" : "%u", hist[i])) return false;
+	}
+	return link_telemetry_append(buf, size, len, "]");
+}
+
+size_t link_telemetry_get_json(char *buf, size_t size, struct link_telemetry_cursor_t *cursor){
+
+	size_t len = 0;
+
+	while(cursor->part != LINK_TELEMETRY_JSON_DONE){
+
+		switch(cursor->part){
+
+		case LINK_TELEMETRY_JSON_COUNTERS:{
+			struct link_telemetry_stats_t stats;
+			link_telemetry_get_stats(&stats);
+			uint32_t avg = stats.samples ? (uint32_t)(stats.total_time_us / stats.samples) : 0;
+			uint32_t ppm = (uint32_t)(stats.total_time_us * 1000000ULL / (uint64_t)(esp_timer_get_time() | 1));
+			if(!link_telemetry_append(buf, size, &len,
+					"{\"samples\":%u,\"skipped\":%u,\"disconnections\":%u,\"reconnections\":%u,"
+					"\"overhead\":{\"avg_us\":%u,\"max_us\":%u,\"ppm\":%u,\"max_ppm\":%u}",
+					stats.samples, stats.skipped, stats.disconnections, stats.reconnections,
+					avg, stats.max_time_us, ppm, LINK_TELEMETRY_MAX_OVERHEAD)){
+				return len;
+			}
+			cursor->part = LINK_TELEMETRY_JSON_HISTOGRAMS;
+			break;
+		}
+
+		case LINK_TELEMETRY_JSON_HISTOGRAMS:{
+			uint32_t rssi[LINK_TELEMETRY_RSSI_BINS], reconnect[LINK_TELEMETRY_RECONNECT_BINS], channel[LINK_TELEMETRY_CHANNEL_BINS];
+			taskENTER_CRITICAL(&link_telemetry_mux);
+			memcpy(rssi, link_telemetry_rssi_hist, sizeof(rssi));
+			memcpy(reconnect, link_telemetry_reconnect_hist, sizeof(reconnect));
+			memcpy(channel, link_telemetry_channel_hist, sizeof(channel));
+			taskEXIT_CRITICAL(&link_telemetry_mux);
+
+			size_t mark = len;
+			if(!link_telemetry_append_hist(buf, size, &len, "rssi", rssi, LINK_TELEMETRY_RSSI_BINS) ||
+					!link_telemetry_append_hist(buf, size, &len, "reconnect_ms", reconnect, LINK_TELEMETRY_RECONNECT_BINS) ||
+					!link_telemetry_append_hist(buf, size, &len, "channel", channel, LINK_TELEMETRY_CHANNEL_BINS) ||
+					!link_telemetry_append(buf, size, &len, ",\"reasons\":{")){
+				/* the histograms go together: start over in the next chunk */
+				buf[mark] = '\0';
+				return mark;
+			}
+			cursor->part = LINK_TELEMETRY_JSON_REASONS;
+			cursor->bin = 0;
+			cursor->items = 0;
+			break;
+		}
+
+		case LINK_TELEMETRY_JSON_REASONS:
+			/* only the reasons seen are listed, as "reason code":count */
+			for(; cursor->bin < LINK_TELEMETRY_REASON_BINS; cursor->bin++){
+				taskENTER_CRITICAL(&link_telemetry_mux);
+				uint32_t count = link_telemetry_reason_hist[cursor->bin];
+				taskEXIT_CRITICAL(&link_telemetry_mux);
+				if(count == 0){
+					continue;
+				}
+				bool ok = cursor->bin == 0 ?
+						link_telemetry_append(buf, size, &len, "%s\"other\":%u", cursor->items ? "," : "", count) :
+						link_telemetry_append(buf, size, &len, "%s\"%u\":%u", cursor->items ? "," : "", link_telemetry_bin_reason(cursor->bin), count);
+				if(!ok){
+					return len;
+				}
+				cursor->items++;
+			}
+			if(!link_telemetry_append(buf, size, &len, "},\"recent\":[")){
+				return len;
+			}
+			taskENTER_CRITICAL(&link_telemetry_mux);
+			cursor->next = link_telemetry_written > LINK_TELEMETRY_SIZE ? link_telemetry_written - LINK_TELEMETRY_SIZE : 0;
+			taskEXIT_CRITICAL(&link_telemetry_mux);
+			cursor->part = LINK_TELEMETRY_JSON_SAMPLES;
+			cursor->items = 0;
+			break;
+
+		case LINK_TELEMETRY_JSON_SAMPLES:
+			/* oldest first, as [time,rssi,channel,phy,event,reason,reconnect_ms] */
+			for(;;){
+				struct link_telemetry_sample_t s;
+				taskENTER_CRITICAL(&link_telemetry_mux);
+				uint32_t written = link_telemetry_written;
+				if(written > LINK_TELEMETRY_SIZE && cursor->next < written - LINK_TELEMETRY_SIZE){
+					/* overwritten while the previous chunks were sent */
+					cursor->next = written - LINK_TELEMETRY_SIZE;
+				}
+				if(cursor->next < written){
+					s = link_telemetry_ring[cursor->next % LINK_TELEMETRY_SIZE];
+				}
+				taskEXIT_CRITICAL(&link_telemetry_mux);
+				if(cursor->next >= written){
+					break;
+				}
+				if(!link_telemetry_append(buf, size, &len, "%s[%u,%d,%u,%u,%u,%u,%u]", cursor->items ? "," : "",
+						s.time, s.rssi, s.channel, s.phy, s.event, s.reason, s.reconnect_time)){
+					return len;
+				}
+				cursor->next++;
+				cursor->items++;
+			}
+			if(!link_telemetry_append(buf, size, &len, "]}\n")){
+				return len;
+			}
+			cursor->part = LINK_TELEMETRY_JSON_DONE;
+			break;
+
+		default:
+			cursor->part = LINK_TELEMETRY_JSON_DONE;
+			break;
+		}
+	}
+
+	return len;
+}
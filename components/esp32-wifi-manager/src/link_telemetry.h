@@ -0,0 +1,167 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file link_telemetry.h
+@brief History of the quality of the STA link
+
+The signal of the connected AP is sampled periodically, and every disconnection and reconnection is recorded with
+its reason code or duration. The latest samples are kept in a ring of fixed size; histograms of the RSSI, channel,
+reconnection time and disconnection reason cover the time since boot and are updated as samples come, so that
+reading them costs no more than copying them. Nothing is allocated.
+
+Samples are recorded by the wifi_manager task. Periodic samples are skipped whenever the time spent sampling
+exceeds LINK_TELEMETRY_MAX_OVERHEAD.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_LINK_TELEMETRY_H_INCLUDED
+#define WIFI_MANAGER_LINK_TELEMETRY_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * @brief Number of samples kept in the ring. Each sample is 12 bytes.
+ */
+#define LINK_TELEMETRY_SIZE					CONFIG_WIFI_MANAGER_TELEMETRY_SIZE
+
+/**
+ * @brief Time (in ms) between two periodic samples while the STA is connected.
+ */
+#define LINK_TELEMETRY_INTERVAL				CONFIG_WIFI_MANAGER_TELEMETRY_INTERVAL
+
+/**
+ * @brief Share of the CPU time (in parts per million) the periodic samples may take.
+ */
+#define LINK_TELEMETRY_MAX_OVERHEAD			CONFIG_WIFI_MANAGER_TELEMETRY_MAX_OVERHEAD
+
+/**
+ * @brief Bins of the histograms.
+ * RSSI: under -90 dBm, then by steps of 10 dB up to -50 dBm and above.
+ * Reconnection time: under 250 ms, 500 ms, 1 s, 2 s, 5 s, 10 s and longer.
+ * Channel: 1 to 14.
+ * Reason: reason codes 1 to 63 and 200 to 215 each have their own bin. Bin 0 counts any other code.
+ */
+#define LINK_TELEMETRY_RSSI_BINS			6
+#define LINK_TELEMETRY_RECONNECT_BINS		7
+#define LINK_TELEMETRY_CHANNEL_BINS			14
+#define LINK_TELEMETRY_REASON_BINS			80
+
+/**
+ * @brief Smallest buffer link_telemetry_get_json can fill: every part of the JSON fits in it.
+ */
+#define LINK_TELEMETRY_JSON_CHUNK			384
+
+/**
+ * @brief Bits of the phy field of a sample.
+ */
+#define LINK_TELEMETRY_PHY_11B				0x01
+#define LINK_TELEMETRY_PHY_11G				0x02
+#define LINK_TELEMETRY_PHY_11N				0x04
+#define LINK_TELEMETRY_PHY_LR				0x08
+#define LINK_TELEMETRY_PHY_HT40				0x10
+
+
+typedef enum link_telemetry_event_t{
+	LINK_TELEMETRY_PERIODIC = 0,
+	LINK_TELEMETRY_DISCONNECTED = 1,	/* signal and channel are the last ones known before the disconnection */
+	LINK_TELEMETRY_CONNECTED = 2
+}link_telemetry_event_t;
+
+struct link_telemetry_sample_t{
+	uint32_t time;					/* seconds since boot */
+	int8_t rssi;
+	uint8_t channel;
+	uint8_t phy;					/* LINK_TELEMETRY_PHY_* of the AP */
+	uint8_t event;					/* link_telemetry_event_t */
+	uint8_t reason;					/* reason code of a disconnection, 0 otherwise */
+	uint8_t reserved;
+	uint16_t reconnect_time;		/* time (in ms, saturated) between the loss of the connection and the next IP address */
+};
+
+struct link_telemetry_stats_t{
+	uint32_t samples;				/* samples recorded since boot */
+	uint32_t skipped;				/* periodic samples skipped to stay within LINK_TELEMETRY_MAX_OVERHEAD */
+	uint32_t disconnections;
+	uint32_t reconnections;			/* connections established again after a loss */
+	uint32_t max_time_us;			/* longest time spent recording a sample */
+	uint64_t total_time_us;			/* cumulated time spent recording samples */
+};
+
+/**
+ * @brief Position of link_telemetry_get_json in the JSON. Zero it to start from the beginning.
+ */
+struct link_telemetry_cursor_t{
+	uint8_t part;
+	uint8_t bin;
+	uint16_t items;
+	uint32_t next;					/* sequence number of the next sample */
+};
+
+
+/**
+ * @brief Records the signal of the connected AP, unless sampling is over its time budget.
+ */
+void link_telemetry_sample();
+
+/**
+ * @brief Records the loss of the connection or the failure of a connection attempt.
+ */
+void link_telemetry_record_disconnection(uint8_t reason);
+
+/**
+ * @brief Records a connection. When it follows the loss of a connection, the reconnection time is added to its histogram.
+ */
+void link_telemetry_record_connection();
+
+/**
+ * @brief Copies the sample recorded age samples ago, 0 being the latest one.
+ * @return false if the ring does not hold that many samples.
+ */
+bool link_telemetry_get_sample(uint32_t age, struct link_telemetry_sample_t *sample);
+
+/**
+ * @brief Copies the counters and the sampling overhead.
+ */
+void link_telemetry_get_stats(struct link_telemetry_stats_t *stats);
+
+/**
+ * @brief Writes the next part of the JSON representation of the histograms and of the samples in the ring.
+ *
+ * Each call writes as many whole elements as fit in buf, which must be at least LINK_TELEMETRY_JSON_CHUNK long,
+ * and moves the cursor past them, so that the JSON can be sent in chunks from a small buffer.
+ * @return the length written, 0 once the whole JSON was written.
+ */
+size_t link_telemetry_get_json(char *buf, size_t size, struct link_telemetry_cursor_t *cursor);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_LINK_TELEMETRY_H_INCLUDED */
@@ -0,0 +1,187 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file message_ring.c
+@brief Bounded lock-free multi-producer single-consumer queue of wifi_manager messages
+
+This is a bounded queue in the manner of Dmitry Vyukov's MPMC queue: each cell carries a sequence number
+telling producers and the consumer whether it is free or holds a message for the current lap, so producers
+only contend on a single compare and swap of the enqueue position. The consumer sleeps on its task
+notification when the ring is empty.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "wifi_manager.h"
+#include "message_ring.h"
+
+
+struct message_ring_cell_t{
+	atomic_uint sequence;
+	queue_message msg;
+	bool coalesce;
+};
+
+struct message_ring_t{
+	struct message_ring_cell_t *cells;
+	uint32_t mask;
+	atomic_uint enqueue_pos;
+	atomic_uint dequeue_pos;
+	atomic_uint pending;			/* one bit per message code with a coalesced message waiting in the ring */
+	atomic_uintptr_t consumer;		/* task to notify when a message is pushed, known once it first waits */
+	atomic_uint pushed;
+	atomic_uint coalesced;
+	atomic_uint dropped;
+	atomic_uint high_water_mark;
+};
+
+
+message_ring_t* message_ring_create(uint32_t capacity){
+
+	uint32_t size = 1;
+	while(size < capacity) size <<= 1;
+
+	message_ring_t *ring = (message_ring_t*)malloc(sizeof(message_ring_t));
+	if(ring == NULL) return NULL;
+	memset(ring, 0x00, sizeof(message_ring_t));
+
+	ring->cells = (struct message_ring_cell_t*)malloc(sizeof(struct message_ring_cell_t) * size);
+	if(ring->cells == NULL){
+		free(ring);
+		return NULL;
+	}
+	memset(ring->cells, 0x00, sizeof(struct message_ring_cell_t) * size);
+
+	/* cell i is free for the producer holding position i */
+	for(uint32_t i=0; i<size; i++){
+		atomic_init(&ring->cells[i].sequence, i);
+	}
+	ring->mask = size - 1;
+
+	return ring;
+}
+
+void message_ring_delete(message_ring_t *ring){
+	if(ring){
+		free(ring->cells);
+		free(ring);
+	}
+}
+
+bool message_ring_push(message_ring_t *ring, const queue_message *msg, bool coalesce){
+
+	struct message_ring_cell_t *cell;
+	const uint32_t bit = 1u << msg->code;
+
+	/* the bit is only set by a producer holding a cell, and cleared once that cell is popped: the message seen
+	 * here is bound to be popped after this call. Two producers may both miss it and push the same order twice */
+	if(coalesce && (atomic_load(&ring->pending) & bit)){
+		atomic_fetch_add_explicit(&ring->coalesced, 1, memory_order_relaxed);
+		return true;
+	}
+
+	uint32_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+	for(;;){
+		cell = &ring->cells[pos & ring->mask];
+		uint32_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		int32_t dif = (int32_t)(seq - pos);
+		if(dif == 0){
+			/* the cell is free: claim the position */
+			if(atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+		}
+		else if(dif < 0){
+			/* the cell still holds the message of the previous lap: the ring is full */
+			atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+			return false;
+		}
+		else{
+			/* another producer claimed this position first */
+			pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	/* before the cell is published, so before the consumer can clear the bit again */
+	if(coalesce){
+		atomic_fetch_or(&ring->pending, bit);
+	}
+	cell->msg = *msg;
+	cell->coalesce = coalesce;
+	atomic_store(&cell->sequence, pos + 1);
+
+	atomic_fetch_add_explicit(&ring->pushed, 1, memory_order_relaxed);
+	uint32_t depth = pos + 1 - atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+	uint32_t hwm = atomic_load_explicit(&ring->high_water_mark, memory_order_relaxed);
+	while(depth > hwm && !atomic_compare_exchange_weak_explicit(&ring->high_water_mark, &hwm, depth, memory_order_relaxed, memory_order_relaxed));
+
+	/* wake up the consumer. Task notifications never block the caller */
+	TaskHandle_t consumer = (TaskHandle_t)atomic_load(&ring->consumer);
+	if(consumer){
+		xTaskNotifyGive(consumer);
+	}
+
+	return true;
+}
+
+bool message_ring_pop(message_ring_t *ring, queue_message *msg, TickType_t xTicksToWait){
+
+	/* published before looking at the ring: a producer that pushes after the check below is bound to notify */
+	atomic_store(&ring->consumer, (uintptr_t)xTaskGetCurrentTaskHandle());
+
+	for(;;){
+		uint32_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+		struct message_ring_cell_t *cell = &ring->cells[pos & ring->mask];
+		uint32_t seq = atomic_load(&cell->sequence);
+
+		if(seq == pos + 1){
+			*msg = cell->msg;
+			if(cell->coalesce){
+				atomic_fetch_and(&ring->pending, ~(1u << msg->code));
+			}
+			/* hand the cell over to the producer of the next lap */
+			atomic_store_explicit(&cell->sequence, pos + ring->mask + 1, memory_order_release);
+			atomic_store_explicit(&ring->dequeue_pos, pos + 1, memory_order_relaxed);
+			return true;
+		}
+
+		/* empty: sleep until a producer pushes something. Stale notifications only cause an extra loop */
+		if(ulTaskNotifyTake(pdTRUE, xTicksToWait) == 0){
+			return false;
+		}
+	}
+}
+
+void message_ring_get_stats(message_ring_t *ring, struct wifi_manager_queue_stats_t *stats){
+	stats->pushed = atomic_load_explicit(&ring->pushed, memory_order_relaxed);
+	stats->coalesced = atomic_load_explicit(&ring->coalesced, memory_order_relaxed);
+	stats->dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+	stats->high_water_mark = atomic_load_explicit(&ring->high_water_mark, memory_order_relaxed);
+	stats->capacity = ring->mask + 1;
+}
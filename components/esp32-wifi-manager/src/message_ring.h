@@ -0,0 +1,83 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file message_ring.h
+@brief Bounded lock-free multi-producer single-consumer queue of wifi_manager messages
+
+Producers never block: a message that does not fit is dropped and counted. Stateless orders can be
+coalesced: while one is waiting in the ring, identical orders are counted and discarded. Producers racing
+each other may still queue the same order twice, but an order reported as coalesced is never lost.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_MESSAGE_RING_H_INCLUDED
+#define WIFI_MANAGER_MESSAGE_RING_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+
+#include "wifi_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct message_ring_t message_ring_t;
+
+/**
+ * @brief Allocates a ring.
+ * @param capacity number of messages the ring can hold, rounded up to the next power of two.
+ * @return the ring, or NULL if out of memory.
+ */
+message_ring_t* message_ring_create(uint32_t capacity);
+
+/**
+ * @brief Frees a ring. Messages still in the ring are lost.
+ */
+void message_ring_delete(message_ring_t *ring);
+
+/**
+ * @brief Adds a message to the ring. Never blocks and can be called from any task.
+ * @param coalesce if true and a coalesced message with the same code is already waiting in the ring, msg is discarded.
+ * @return true if msg was queued or coalesced, false if the ring is full.
+ */
+bool message_ring_push(message_ring_t *ring, const queue_message *msg, bool coalesce);
+
+/**
+ * @brief Takes the oldest message from the ring, waiting for one if the ring is empty.
+ * @warning only one task may ever call this function on a given ring: it's the task notified by producers.
+ * @return true if a message was written to msg, false on timeout.
+ */
+bool message_ring_pop(message_ring_t *ring, queue_message *msg, TickType_t xTicksToWait);
+
+/**
+ * @brief Copies the counters of the ring.
+ */
+void message_ring_get_stats(message_ring_t *ring, struct wifi_manager_queue_stats_t *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_MESSAGE_RING_H_INCLUDED */
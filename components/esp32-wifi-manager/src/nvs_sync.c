@@ -23,57 +23,485 @@ SOFTWARE.
 @author Tony Pottier
 @brief Exposes a simple API to synchronize NVS memory read and writes
 
+Each namespace has a reader/writer lock made of a binary semaphore, held either by one writer or by the readers as
+a group, and of a mutex protecting the count of readers. Staged writes are kept in RAM per namespace and only read
+or modified under the lock of their namespace.
+
 @see https://idyl.io
 @see https://github.com/tonyp7/esp32-wifi-manager
 */
 
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "nvs.h"
 #include "nvs_sync.h"
+#include "wifi_manager.h"
 
 
-static SemaphoreHandle_t nvs_sync_mutex = NULL;
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "nvs_sync";
 
-esp_err_t nvs_sync_create(){
-    if(nvs_sync_mutex == NULL){
+/**
+ * @brief A blob write waiting for the next commit of its namespace. value is NULL for the erasure of the key.
+ */
+struct nvs_sync_pending_t{
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	void *value;
+	size_t length;
+};
+
+struct nvs_sync_namespace_t{
+	char name[NVS_KEY_NAME_MAX_SIZE];		/* empty when the slot is free */
+	SemaphoreHandle_t write_sem;			/* held by the writer, or by the readers as a group */
+	SemaphoreHandle_t readers_mutex;		/* protects readers */
+	uint16_t readers;
+	uint16_t batch_depth;
+	int64_t held_since;
+	struct nvs_sync_pending_t pending[NVS_SYNC_MAX_PENDING];
+	uint8_t pending_num;
+	struct nvs_sync_stats_t stats;
+};
+
+static struct nvs_sync_namespace_t nvs_sync_namespaces[NVS_SYNC_MAX_NAMESPACES];
+
+/* @brief protects the allocation of namespace slots */
+static SemaphoreHandle_t nvs_sync_registry_mutex = NULL;
+
+/* @brief protects the statistics, which are updated by readers and writers alike */
+static portMUX_TYPE nvs_sync_stats_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+/**
+ * @brief finds the slot of a namespace, allocating it on first use.
+ * @return the slot, or NULL if all slots are used by other namespaces.
+ */
+static struct nvs_sync_namespace_t* nvs_sync_get_namespace(const char *name_space, bool create){
+
+	struct nvs_sync_namespace_t *ns = NULL;
 
-        nvs_sync_mutex = xSemaphoreCreateMutex();
+	if(nvs_sync_registry_mutex == NULL || xSemaphoreTake(nvs_sync_registry_mutex, portMAX_DELAY) != pdTRUE){
+		return NULL;
+	}
 
-		if(nvs_sync_mutex){
-			return ESP_OK;
+	for(int i=0; i<NVS_SYNC_MAX_NAMESPACES && ns == NULL; i++){
+		if(strncmp(nvs_sync_namespaces[i].name, name_space, NVS_KEY_NAME_MAX_SIZE) == 0){
+			ns = &nvs_sync_namespaces[i];
 		}
-		else{
-			return ESP_FAIL;
+	}
+
+	for(int i=0; i<NVS_SYNC_MAX_NAMESPACES && ns == NULL && create; i++){
+		struct nvs_sync_namespace_t *slot = &nvs_sync_namespaces[i];
+		if(slot->name[0] == '\0'){
+			slot->write_sem = xSemaphoreCreateBinary();
+			slot->readers_mutex = xSemaphoreCreateMutex();
+			if(slot->write_sem == NULL || slot->readers_mutex == NULL){
+				if(slot->write_sem) vSemaphoreDelete(slot->write_sem);
+				if(slot->readers_mutex) vSemaphoreDelete(slot->readers_mutex);
+				memset(slot, 0x00, sizeof(struct nvs_sync_namespace_t));
+				break;
+			}
+			/* binary semaphores are created empty */
+			xSemaphoreGive(slot->write_sem);
+			strncpy(slot->name, name_space, NVS_KEY_NAME_MAX_SIZE - 1);
+			ns = slot;
+		}
+	}
+
+	xSemaphoreGive(nvs_sync_registry_mutex);
+
+	if(ns == NULL && create){
+		ESP_LOGE(TAG, "no slot left for namespace %s", name_space);
+	}
+
+	return ns;
+}
+
+/**
+ * @brief takes a semaphore, recording whether the caller had to wait for it.
+ */
+static bool nvs_sync_take(SemaphoreHandle_t sem, TickType_t xTicksToWait, bool *contended){
+	if(xSemaphoreTake(sem, 0) == pdTRUE){
+		return true;
+	}
+	*contended = true;
+	return xTicksToWait != 0 && xSemaphoreTake(sem, xTicksToWait) == pdTRUE;
+}
+
+static void nvs_sync_record_lock(struct nvs_sync_namespace_t *ns, nvs_sync_mode_t mode, int64_t start, bool contended, bool success){
+
+	uint32_t wait = (uint32_t)(esp_timer_get_time() - start);
+
+	taskENTER_CRITICAL(&nvs_sync_stats_spinlock);
+	if(success){
+		if(mode == NVS_SYNC_READ) ns->stats.read_locks++;
+		else ns->stats.write_locks++;
+	}
+	else{
+		ns->stats.timeouts++;
+	}
+	if(contended){
+		ns->stats.contended++;
+		ns->stats.wait_time += wait;
+		if(wait > ns->stats.max_wait_time) ns->stats.max_wait_time = wait;
+	}
+	taskEXIT_CRITICAL(&nvs_sync_stats_spinlock);
+}
+
+static void nvs_sync_record_hold(struct nvs_sync_namespace_t *ns, nvs_sync_mode_t mode){
+
+	uint32_t hold = (uint32_t)(esp_timer_get_time() - ns->held_since);
+
+	taskENTER_CRITICAL(&nvs_sync_stats_spinlock);
+	if(mode == NVS_SYNC_READ) ns->stats.read_hold_time += hold;
+	else ns->stats.write_hold_time += hold;
+	if(hold > ns->stats.max_hold_time) ns->stats.max_hold_time = hold;
+	taskEXIT_CRITICAL(&nvs_sync_stats_spinlock);
+}
+
+static bool nvs_sync_lock_namespace(struct nvs_sync_namespace_t *ns, nvs_sync_mode_t mode, TickType_t xTicksToWait){
+
+	int64_t start = esp_timer_get_time();
+	bool contended = false;
+	bool success;
+
+	if(mode == NVS_SYNC_READ){
+		success = nvs_sync_take(ns->readers_mutex, xTicksToWait, &contended);
+		if(success){
+			/* the first reader takes the namespace for all readers */
+			if(ns->readers == 0){
+				success = nvs_sync_take(ns->write_sem, xTicksToWait, &contended);
+				if(success) ns->held_since = esp_timer_get_time();
+			}
+			if(success) ns->readers++;
+			xSemaphoreGive(ns->readers_mutex);
+		}
+	}
+	else{
+		success = nvs_sync_take(ns->write_sem, xTicksToWait, &contended);
+		if(success) ns->held_since = esp_timer_get_time();
+	}
+
+	nvs_sync_record_lock(ns, mode, start, contended, success);
+
+	return success;
+}
+
+static void nvs_sync_unlock_namespace(struct nvs_sync_namespace_t *ns, nvs_sync_mode_t mode){
+
+	if(mode == NVS_SYNC_READ){
+		xSemaphoreTake(ns->readers_mutex, portMAX_DELAY);
+		/* the last reader gives the namespace back */
+		if(--ns->readers == 0){
+			nvs_sync_record_hold(ns, mode);
+			xSemaphoreGive(ns->write_sem);
 		}
-    }
+		xSemaphoreGive(ns->readers_mutex);
+	}
 	else{
+		nvs_sync_record_hold(ns, mode);
+		xSemaphoreGive(ns->write_sem);
+	}
+}
+
+static struct nvs_sync_pending_t* nvs_sync_find_pending(struct nvs_sync_namespace_t *ns, const char *key){
+	for(uint8_t i=0; i<ns->pending_num; i++){
+		if(strncmp(ns->pending[i].key, key, NVS_KEY_NAME_MAX_SIZE) == 0){
+			return &ns->pending[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief writes the staged writes of a namespace to flash with a single commit.
+ * @note must be called with the namespace locked for writing. On failure the staged writes are kept, so that the
+ * next commit of the namespace tries them again.
+ */
+static esp_err_t nvs_sync_flush(struct nvs_sync_namespace_t *ns){
+
+	nvs_handle handle;
+	esp_err_t esp_err;
+
+	if(ns->pending_num == 0){
 		return ESP_OK;
 	}
+
+	esp_err = nvs_open(ns->name, NVS_READWRITE, &handle);
+	if(esp_err == ESP_OK){
+		for(uint8_t i=0; i<ns->pending_num && esp_err == ESP_OK; i++){
+			struct nvs_sync_pending_t *pending = &ns->pending[i];
+			if(pending->value){
+				esp_err = nvs_set_blob(handle, pending->key, pending->value, pending->length);
+			}
+			else{
+				esp_err = nvs_erase_key(handle, pending->key);
+				if(esp_err == ESP_ERR_NVS_NOT_FOUND) esp_err = ESP_OK;
+			}
+		}
+		if(esp_err == ESP_OK){
+			esp_err = nvs_commit(handle);
+		}
+		nvs_close(handle);
+	}
+
+	taskENTER_CRITICAL(&nvs_sync_stats_spinlock);
+	ns->stats.commits++;
+	taskEXIT_CRITICAL(&nvs_sync_stats_spinlock);
+
+	if(esp_err != ESP_OK){
+		ESP_LOGE(TAG, "commit of %d write(s) to %s failed: %s", ns->pending_num, ns->name, esp_err_to_name(esp_err));
+		return esp_err;
+	}
+
+	for(uint8_t i=0; i<ns->pending_num; i++){
+		free(ns->pending[i].value);
+	}
+	memset(ns->pending, 0x00, sizeof(ns->pending));
+	ns->pending_num = 0;
+
+	return ESP_OK;
 }
 
-void nvs_sync_free(){
-    if(nvs_sync_mutex != NULL){
-        vSemaphoreDelete( nvs_sync_mutex );
-        nvs_sync_mutex = NULL;
-    }
+/**
+ * @brief stages a write or an erasure (value NULL) of key.
+ */
+static esp_err_t nvs_sync_stage(const char *name_space, const char *key, const void *value, size_t length){
+
+	struct nvs_sync_namespace_t *ns = nvs_sync_get_namespace(name_space, true);
+	if(ns == NULL) return ESP_ERR_NO_MEM;
+
+	void *copy = NULL;
+	if(value){
+		copy = malloc(length);
+		if(copy == NULL) return ESP_ERR_NO_MEM;
+		memcpy(copy, value, length);
+	}
+
+	if(!nvs_sync_lock_namespace(ns, NVS_SYNC_WRITE, portMAX_DELAY)){
+		free(copy);
+		return ESP_ERR_TIMEOUT;
+	}
+
+	esp_err_t esp_err = ESP_OK;
+	bool merged = false;
+	struct nvs_sync_pending_t *pending = nvs_sync_find_pending(ns, key);
+	if(pending){
+		/* only the last write of a key matters */
+		free(pending->value);
+		merged = true;
+	}
+	else{
+		if(ns->pending_num == NVS_SYNC_MAX_PENDING){
+			esp_err = nvs_sync_flush(ns);
+		}
+		if(esp_err != ESP_OK){
+			/* the staged writes are still there: this one has nowhere to go */
+			nvs_sync_unlock_namespace(ns, NVS_SYNC_WRITE);
+			free(copy);
+			return esp_err;
+		}
+		pending = &ns->pending[ns->pending_num++];
+		strncpy(pending->key, key, NVS_KEY_NAME_MAX_SIZE - 1);
+	}
+	pending->value = copy;
+	pending->length = length;
+
+	taskENTER_CRITICAL(&nvs_sync_stats_spinlock);
+	ns->stats.staged_writes++;
+	if(merged) ns->stats.merged_writes++;
+	taskEXIT_CRITICAL(&nvs_sync_stats_spinlock);
+
+	nvs_sync_unlock_namespace(ns, NVS_SYNC_WRITE);
+
+	return esp_err;
 }
 
-bool nvs_sync_lock(TickType_t xTicksToWait){
-	if(nvs_sync_mutex){
-		if( xSemaphoreTake( nvs_sync_mutex, xTicksToWait ) == pdTRUE ) {
-			return true;
+
+bool nvs_sync_acquire(const char *name_space, nvs_sync_mode_t mode, TickType_t xTicksToWait){
+	struct nvs_sync_namespace_t *ns = nvs_sync_get_namespace(name_space, true);
+	return ns != NULL && nvs_sync_lock_namespace(ns, mode, xTicksToWait);
+}
+
+void nvs_sync_release(const char *name_space, nvs_sync_mode_t mode){
+	struct nvs_sync_namespace_t *ns = nvs_sync_get_namespace(name_space, false);
+	if(ns){
+		nvs_sync_unlock_namespace(ns, mode);
+	}
+}
+
+esp_err_t nvs_sync_get_blob(const char *name_space, const char *key, void *out_value, size_t *length){
+
+	nvs_handle handle;
+	esp_err_t esp_err;
+
+	struct nvs_sync_namespace_t *ns = nvs_sync_get_namespace(name_space, true);
+	if(ns == NULL) return ESP_ERR_NO_MEM;
+
+	if(!nvs_sync_lock_namespace(ns, NVS_SYNC_READ, portMAX_DELAY)){
+		return ESP_ERR_TIMEOUT;
+	}
+
+	struct nvs_sync_pending_t *pending = nvs_sync_find_pending(ns, key);
+	if(pending){
+		/* same contract as nvs_get_blob */
+		if(pending->value == NULL){
+			esp_err = ESP_ERR_NVS_NOT_FOUND;
+		}
+		else if(out_value == NULL){
+			*length = pending->length;
+			esp_err = ESP_OK;
+		}
+		else if(*length < pending->length){
+			*length = pending->length;
+			esp_err = ESP_ERR_NVS_INVALID_LENGTH;
 		}
 		else{
-			return false;
+			memcpy(out_value, pending->value, pending->length);
+			*length = pending->length;
+			esp_err = ESP_OK;
 		}
 	}
 	else{
+		esp_err = nvs_open(name_space, NVS_READONLY, &handle);
+		if(esp_err == ESP_OK){
+			esp_err = nvs_get_blob(handle, key, out_value, length);
+			nvs_close(handle);
+		}
+	}
+
+	nvs_sync_unlock_namespace(ns, NVS_SYNC_READ);
+
+	return esp_err;
+}
+
+esp_err_t nvs_sync_set_blob(const char *name_space, const char *key, const void *value, size_t length){
+	if(value == NULL) return ESP_ERR_INVALID_ARG;
+	return nvs_sync_stage(name_space, key, value, length);
+}
+
+esp_err_t nvs_sync_erase_key(const char *name_space, const char *key){
+	return nvs_sync_stage(name_space, key, NULL, 0);
+}
+
+esp_err_t nvs_sync_commit(const char *name_space){
+
+	struct nvs_sync_namespace_t *ns = nvs_sync_get_namespace(name_space, false);
+	if(ns == NULL) return ESP_OK; /* nothing was ever staged */
+
+	if(!nvs_sync_lock_namespace(ns, NVS_SYNC_WRITE, portMAX_DELAY)){
+		return ESP_ERR_TIMEOUT;
+	}
+	esp_err_t esp_err = ns->batch_depth == 0 ? nvs_sync_flush(ns) : ESP_OK;
+	nvs_sync_unlock_namespace(ns, NVS_SYNC_WRITE);
+
+	return esp_err;
+}
+
+void nvs_sync_begin_batch(const char *name_space){
+	struct nvs_sync_namespace_t *ns = nvs_sync_get_namespace(name_space, true);
+	if(ns && nvs_sync_lock_namespace(ns, NVS_SYNC_WRITE, portMAX_DELAY)){
+		ns->batch_depth++;
+		nvs_sync_unlock_namespace(ns, NVS_SYNC_WRITE);
+	}
+}
+
+esp_err_t nvs_sync_end_batch(const char *name_space){
+
+	esp_err_t esp_err = ESP_OK;
+	struct nvs_sync_namespace_t *ns = nvs_sync_get_namespace(name_space, false);
+	if(ns && nvs_sync_lock_namespace(ns, NVS_SYNC_WRITE, portMAX_DELAY)){
+		if(ns->batch_depth > 0 && --ns->batch_depth == 0){
+			esp_err = nvs_sync_flush(ns);
+		}
+		nvs_sync_unlock_namespace(ns, NVS_SYNC_WRITE);
+	}
+
+	return esp_err;
+}
+
+esp_err_t nvs_sync_get_stats(const char *name_space, struct nvs_sync_stats_t *stats){
+
+	struct nvs_sync_namespace_t *ns = nvs_sync_get_namespace(name_space, false);
+	if(ns == NULL) return ESP_ERR_NOT_FOUND;
+
+	taskENTER_CRITICAL(&nvs_sync_stats_spinlock);
+	*stats = ns->stats;
+	taskEXIT_CRITICAL(&nvs_sync_stats_spinlock);
+
+	return ESP_OK;
+}
+
+
+bool nvs_sync_lock(TickType_t xTicksToWait){
+
+	struct nvs_sync_namespace_t *ns = nvs_sync_get_namespace(wifi_manager_nvs_namespace, true);
+	if(ns == NULL || !nvs_sync_lock_namespace(ns, NVS_SYNC_WRITE, xTicksToWait)){
 		return false;
 	}
+
+	/* the caller is about to use the nvs API directly: it has to see what was staged */
+	nvs_sync_flush(ns);
+
+	return true;
 }
 
 void nvs_sync_unlock(){
-	xSemaphoreGive( nvs_sync_mutex );
-}
\ No newline at end of file
+	nvs_sync_release(wifi_manager_nvs_namespace, NVS_SYNC_WRITE);
+}
+
+esp_err_t nvs_sync_create(){
+
+	if(nvs_sync_registry_mutex != NULL){
+		return ESP_OK;
+	}
+
+	SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+	if(mutex == NULL){
+		return ESP_FAIL;
+	}
+
+	/* several tasks may initialize the layer at the same time */
+	bool installed = false;
+	taskENTER_CRITICAL(&nvs_sync_stats_spinlock);
+	if(nvs_sync_registry_mutex == NULL){
+		nvs_sync_registry_mutex = mutex;
+		installed = true;
+	}
+	taskEXIT_CRITICAL(&nvs_sync_stats_spinlock);
+
+	if(!installed){
+		vSemaphoreDelete(mutex);
+	}
+
+	return ESP_OK;
+}
+
+void nvs_sync_free(){
+
+	if(nvs_sync_registry_mutex == NULL){
+		return;
+	}
+
+	for(int i=0; i<NVS_SYNC_MAX_NAMESPACES; i++){
+		struct nvs_sync_namespace_t *ns = &nvs_sync_namespaces[i];
+		if(ns->name[0] != '\0'){
+			for(uint8_t j=0; j<ns->pending_num; j++){
+				free(ns->pending[j].value);
+			}
+			vSemaphoreDelete(ns->write_sem);
+			vSemaphoreDelete(ns->readers_mutex);
+			memset(ns, 0x00, sizeof(struct nvs_sync_namespace_t));
+		}
+	}
+
+	vSemaphoreDelete(nvs_sync_registry_mutex);
+	nvs_sync_registry_mutex = NULL;
+}
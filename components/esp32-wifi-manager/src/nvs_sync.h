@@ -23,6 +23,10 @@ SOFTWARE.
 @author Tony Pottier
 @brief Exposes a simple API to synchronize NVS memory read and writes
 
+Each NVS namespace has its own reader/writer lock so that readers of a namespace never wait on each other nor on
+writers of another namespace. Blob writes made through this API are staged in RAM and written to flash by
+nvs_sync_commit, so that several writes can share a single commit. Wait and hold times of the locks are recorded.
+
 @see https://idyl.io
 @see https://github.com/tonyp7/esp32-wifi-manager
 */
@@ -33,6 +37,8 @@ SOFTWARE.
 #define WIFI_MANAGER_NVS_SYNC_H_INCLUDED
 
 #include <stdbool.h> /* for type bool */
+#include <stddef.h> /* for size_t */
+#include <stdint.h>
 #include <freertos/FreeRTOS.h> /* for TickType_t */
 #include <esp_err.h> /* for esp_err_t */
 
@@ -42,7 +48,102 @@ extern "C" {
 
 
 /**
- * @brief Attempts to get hold of the NVS semaphore for a set amount of ticks.
+ * @brief Maximum number of namespaces that can be synchronized.
+ */
+#define NVS_SYNC_MAX_NAMESPACES				CONFIG_WIFI_MANAGER_NVS_SYNC_MAX_NAMESPACES
+
+/**
+ * @brief Maximum number of blob writes staged per namespace. A write that does not fit commits the namespace first,
+ * and fails with the error of that commit if it fails.
+ */
+#define NVS_SYNC_MAX_PENDING				CONFIG_WIFI_MANAGER_NVS_SYNC_MAX_PENDING
+
+
+typedef enum nvs_sync_mode_t{
+	NVS_SYNC_READ = 0,		/* shared: any number of readers at the same time */
+	NVS_SYNC_WRITE = 1		/* exclusive */
+}nvs_sync_mode_t;
+
+/**
+ * @brief Contention statistics of a namespace. Times are in microseconds.
+ */
+struct nvs_sync_stats_t{
+	uint32_t read_locks;
+	uint32_t write_locks;
+	uint32_t contended;			/* number of locks that had to wait */
+	uint32_t timeouts;
+	uint64_t wait_time;			/* total time spent waiting for the lock, readers and writers */
+	uint32_t max_wait_time;
+	uint64_t read_hold_time;	/* total time the namespace was held by at least one reader */
+	uint64_t write_hold_time;
+	uint32_t max_hold_time;
+	uint32_t staged_writes;
+	uint32_t merged_writes;		/* staged writes that replaced a write of the same key before it was committed */
+	uint32_t commits;
+};
+
+
+/**
+ * @brief Locks a namespace.
+ * @note If you are uncertain about the number of ticks to wait use portMAX_DELAY.
+ * @return true on a succesful lock, false otherwise
+ */
+bool nvs_sync_acquire(const char *name_space, nvs_sync_mode_t mode, TickType_t xTicksToWait);
+
+/**
+ * @brief Unlocks a namespace locked with nvs_sync_acquire.
+ */
+void nvs_sync_release(const char *name_space, nvs_sync_mode_t mode);
+
+/**
+ * @brief Reads a blob under a read lock. A write staged and not committed yet is returned instead of the flash content.
+ * @param out_value can be NULL to get the length of the blob in length.
+ * @param length size of out_value in input, length of the blob in output.
+ * @return same as nvs_get_blob.
+ */
+esp_err_t nvs_sync_get_blob(const char *name_space, const char *key, void *out_value, size_t *length);
+
+/**
+ * @brief Stages a blob write under a write lock. The blob is written to flash by the next nvs_sync_commit of the namespace.
+ */
+esp_err_t nvs_sync_set_blob(const char *name_space, const char *key, const void *value, size_t length);
+
+/**
+ * @brief Stages the erasure of a key under a write lock. The key is erased by the next nvs_sync_commit of the namespace.
+ */
+esp_err_t nvs_sync_erase_key(const char *name_space, const char *key);
+
+/**
+ * @brief Writes all staged writes of a namespace to flash with a single commit. If it fails the writes stay staged
+ * and the next commit tries them again.
+ * @note Does nothing and returns ESP_OK while a batch is open on the namespace: the writes are committed when the
+ * batch ends, and only nvs_sync_end_batch tells whether they reached flash.
+ */
+esp_err_t nvs_sync_commit(const char *name_space);
+
+/**
+ * @brief Opens a batch: commits of the namespace are deferred until nvs_sync_end_batch. Batches can be nested.
+ */
+void nvs_sync_begin_batch(const char *name_space);
+
+/**
+ * @brief Closes a batch and commits the writes staged in the meantime once the outermost batch is closed.
+ * @return the result of that commit. Callers that keep in RAM what they wrote during the batch must drop it on failure.
+ */
+esp_err_t nvs_sync_end_batch(const char *name_space);
+
+/**
+ * @brief Copies the contention statistics of a namespace.
+ * @return ESP_ERR_NOT_FOUND if the namespace was never used through this API.
+ */
+esp_err_t nvs_sync_get_stats(const char *name_space, struct nvs_sync_stats_t *stats);
+
+
+/**
+ * @brief Attempts to get hold of the wifi manager namespace for writing for a set amount of ticks.
+ *
+ * Staged writes of the namespace are committed first, so that the namespace can be used directly with the nvs API.
+ *
  * @note If you are uncertain about the number of ticks to wait use portMAX_DELAY.
  * @return true on a succesful lock, false otherwise
  */
@@ -50,21 +151,21 @@ bool nvs_sync_lock(TickType_t xTicksToWait);
 
 
 /**
- * @brief Releases the NVS semaphore
+ * @brief Releases the lock taken with nvs_sync_lock
  */
 void nvs_sync_unlock();
 
 
 /** 
- * @brief Create the NVS semaphore
- * @return      ESP_OK: success or if the semaphore already exists
+ * @brief Initializes the synchronization layer. Can be called several times, e.g. by each user of NVS.
+ * @return      ESP_OK: success or if it was already initialized
  *              ESP_FAIL: failure
  */ 
 esp_err_t nvs_sync_create();
 
 /**
- * @brief Frees memory associated with the NVS semaphore 
- * @warning Do not delete a semaphore that has tasks blocked on it (tasks that are in the Blocked state waiting for the semaphore to become available).
+ * @brief Frees memory associated with the synchronization layer. Staged writes that were not committed are lost.
+ * @warning Do not free while tasks are blocked on a lock.
  */
 void nvs_sync_free();
 
@@ -0,0 +1,102 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file payload_pool.c
+@brief Fixed-size pool of the event payloads posted to the wifi_manager task
+
+Free blocks are tracked in a bitmap: a block is taken by atomically setting its bit, which needs no lock
+and is not subject to the ABA problem of a lock-free free list.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <esp_log.h>
+
+#include "wifi_manager.h"
+#include "payload_pool.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "payload_pool";
+
+#define PAYLOAD_POOL_WORDS					((PAYLOAD_POOL_SIZE + 31) / 32)
+
+static union payload_pool_block_t payload_pool_blocks[PAYLOAD_POOL_SIZE];
+
+/* @brief one bit per block, set when the block is in use */
+static atomic_uint payload_pool_used[PAYLOAD_POOL_WORDS];
+
+static atomic_uint payload_pool_in_use;
+static atomic_uint payload_pool_high_water_mark;
+static atomic_uint payload_pool_exhausted;
+
+
+void* payload_pool_alloc(){
+
+	for(uint32_t w=0; w<PAYLOAD_POOL_WORDS; w++){
+
+		/* blocks past PAYLOAD_POOL_SIZE in the last word are never handed out */
+		const uint32_t valid = (w == PAYLOAD_POOL_WORDS - 1 && PAYLOAD_POOL_SIZE % 32) ? (1u << (PAYLOAD_POOL_SIZE % 32)) - 1 : 0xffffffffu;
+		uint32_t used = atomic_load_explicit(&payload_pool_used[w], memory_order_relaxed);
+
+		while((used & valid) != valid){
+			uint32_t bit = __builtin_ctz(~used & valid);
+			if(atomic_compare_exchange_weak_explicit(&payload_pool_used[w], &used, used | (1u << bit), memory_order_acquire, memory_order_relaxed)){
+
+				uint32_t in_use = atomic_fetch_add_explicit(&payload_pool_in_use, 1, memory_order_relaxed) + 1;
+				uint32_t hwm = atomic_load_explicit(&payload_pool_high_water_mark, memory_order_relaxed);
+				while(in_use > hwm && !atomic_compare_exchange_weak_explicit(&payload_pool_high_water_mark, &hwm, in_use, memory_order_relaxed, memory_order_relaxed));
+
+				return &payload_pool_blocks[w * 32 + bit];
+			}
+			/* used was refreshed by the failed compare and swap: try again */
+		}
+	}
+
+	atomic_fetch_add_explicit(&payload_pool_exhausted, 1, memory_order_relaxed);
+	ESP_LOGW(TAG, "pool exhausted");
+	return NULL;
+}
+
+void payload_pool_free(void *block){
+
+	if(block == NULL) return;
+
+	uint32_t index = (uint32_t)((union payload_pool_block_t*)block - payload_pool_blocks);
+	if(index >= PAYLOAD_POOL_SIZE){
+		ESP_LOGE(TAG, "payload_pool_free: %p is not a block of the pool", block);
+		return;
+	}
+
+	atomic_fetch_and_explicit(&payload_pool_used[index / 32], ~(1u << (index % 32)), memory_order_release);
+	atomic_fetch_sub_explicit(&payload_pool_in_use, 1, memory_order_relaxed);
+}
+
+void payload_pool_get_stats(struct wifi_manager_payload_pool_stats_t *stats){
+	stats->capacity = PAYLOAD_POOL_SIZE;
+	stats->block_size = sizeof(union payload_pool_block_t);
+	stats->in_use = atomic_load_explicit(&payload_pool_in_use, memory_order_relaxed);
+	stats->high_water_mark = atomic_load_explicit(&payload_pool_high_water_mark, memory_order_relaxed);
+	stats->exhausted = atomic_load_explicit(&payload_pool_exhausted, memory_order_relaxed);
+}
@@ -0,0 +1,82 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file payload_pool.h
+@brief Fixed-size pool of the event payloads posted to the wifi_manager task
+
+Wifi and IP events are copied into blocks of a statically allocated pool instead of the heap, so that
+reconnection storms do not fragment the heap. Allocation and release are lock-free and never block.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_PAYLOAD_POOL_H_INCLUDED
+#define WIFI_MANAGER_PAYLOAD_POOL_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_wifi.h>
+#include <esp_netif.h>
+
+#include "wifi_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of blocks in the pool.
+ * Each payload waits in the message queue until processed: when more events are waiting, the latest one of each
+ * kind is kept aside by the wifi manager and handled late.
+ */
+#define PAYLOAD_POOL_SIZE					CONFIG_WIFI_MANAGER_PAYLOAD_POOL_SIZE
+
+/**
+ * @brief A block of the pool is large enough for any of the event payloads posted to the wifi_manager task.
+ */
+union payload_pool_block_t{
+	wifi_event_sta_scan_done_t scan_done;
+	wifi_event_sta_disconnected_t disconnected;
+	ip_event_got_ip_t got_ip;
+};
+
+/**
+ * @brief takes a block from the pool.
+ * @return the block, or NULL if all blocks are in use.
+ */
+void* payload_pool_alloc();
+
+/**
+ * @brief gives a block back to the pool. NULL is ignored.
+ */
+void payload_pool_free(void *block);
+
+/**
+ * @brief copies the counters of the pool.
+ */
+void payload_pool_get_stats(struct wifi_manager_payload_pool_stats_t *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_PAYLOAD_POOL_H_INCLUDED */
@@ -0,0 +1,108 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file reconnect_policy.c
+@brief Decides when to try reconnecting after a failure, and when to give up and start the access point
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <stdint.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+
+#include "reconnect_policy.h"
+
+
+/* @brief failed rounds since the outage started */
+static uint32_t reconnect_policy_attempts = 0;
+
+/* @brief consecutive failures that retrying cannot fix */
+static uint32_t reconnect_policy_credential_failures = 0;
+
+/* @brief time of the first failure of the outage, 0 when connected */
+static int64_t reconnect_policy_outage_start = 0;
+
+
+reconnect_reason_class_t reconnect_policy_classify(uint8_t reason){
+
+	switch(reason){
+		case WIFI_REASON_IE_INVALID:
+		case WIFI_REASON_MIC_FAILURE:
+		case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:		/* wrong password */
+		case WIFI_REASON_IE_IN_4WAY_DIFFERS:
+		case WIFI_REASON_GROUP_CIPHER_INVALID:
+		case WIFI_REASON_PAIRWISE_CIPHER_INVALID:
+		case WIFI_REASON_AKMP_INVALID:
+		case WIFI_REASON_UNSUPP_RSN_IE_VERSION:
+		case WIFI_REASON_INVALID_RSN_IE_CAP:
+		case WIFI_REASON_802_1X_AUTH_FAILED:
+		case WIFI_REASON_CIPHER_SUITE_REJECTED:
+		case WIFI_REASON_AUTH_FAIL:
+		case WIFI_REASON_HANDSHAKE_TIMEOUT:
+			return RECONNECT_REASON_CREDENTIALS;
+		default:
+			/* beacon timeout, AP not found, association refused or expired... */
+			return RECONNECT_REASON_TRANSIENT;
+	}
+}
+
+void reconnect_policy_next(uint8_t reason, struct reconnect_decision_t *decision){
+
+	int64_t now = esp_timer_get_time();
+	if(reconnect_policy_outage_start == 0){
+		reconnect_policy_outage_start = now;
+	}
+
+	decision->reason_class = reconnect_policy_classify(reason);
+
+	if(decision->reason_class == RECONNECT_REASON_CREDENTIALS){
+		/* the same credentials will not work any sooner: retry slowly, and ask the user once it is clear */
+		reconnect_policy_credential_failures++;
+		decision->delay = WIFI_MANAGER_RETRY_TIMER;
+		decision->start_ap = reconnect_policy_credential_failures > WIFI_MANAGER_MAX_RETRY_START_AP;
+	}
+	else{
+		reconnect_policy_credential_failures = 0;
+		if(reconnect_policy_attempts == 0){
+			decision->delay = 0;
+		}
+		else{
+			/* exponential backoff with equal jitter: half of the delay is fixed, the other half random */
+			uint32_t shift = reconnect_policy_attempts - 1 < 16 ? reconnect_policy_attempts - 1 : 16;
+			uint64_t backoff = (uint64_t)WIFI_MANAGER_RETRY_BACKOFF_MIN << shift;
+			if(backoff > WIFI_MANAGER_RETRY_TIMER){
+				backoff = WIFI_MANAGER_RETRY_TIMER;
+			}
+			decision->delay = (uint32_t)(backoff / 2 + esp_random() % (backoff / 2 + 1));
+		}
+		decision->start_ap = now - reconnect_policy_outage_start >= (int64_t)WIFI_MANAGER_AP_FALLBACK_TIMEOUT * 1000;
+	}
+
+	reconnect_policy_attempts++;
+}
+
+void reconnect_policy_reset(){
+	reconnect_policy_attempts = 0;
+	reconnect_policy_credential_failures = 0;
+	reconnect_policy_outage_start = 0;
+}
@@ -0,0 +1,83 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file reconnect_policy.h
+@brief Decides when to try reconnecting after a failure, and when to give up and start the access point
+
+The first retry after an outage is immediate: most connection losses are an AP rebooting or a beacon missed,
+and the network is often back by the time the attempt is made. Further retries back off exponentially from
+WIFI_MANAGER_RETRY_BACKOFF_MIN to WIFI_MANAGER_RETRY_TIMER, with a random jitter so that devices losing the
+same AP do not all come back at the same time.
+
+Whether the access point is started depends on why the attempts fail. Failures that retrying cannot fix, such as
+a wrong password, start it after WIFI_MANAGER_MAX_RETRY_START_AP consecutive attempts. Anything else, such as
+an AP not found or a beacon timeout, only starts it once the outage lasts WIFI_MANAGER_AP_FALLBACK_TIMEOUT.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_RECONNECT_POLICY_H_INCLUDED
+#define WIFI_MANAGER_RECONNECT_POLICY_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "wifi_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef enum reconnect_reason_class_t{
+	RECONNECT_REASON_TRANSIENT = 0,		/* the AP went away or did not answer: it may come back any moment */
+	RECONNECT_REASON_CREDENTIALS = 1,	/* the AP refused the credentials or the security settings */
+}reconnect_reason_class_t;
+
+struct reconnect_decision_t{
+	uint32_t delay;						/* time (in ms) to wait before the next attempt, 0 to retry right away */
+	bool start_ap;						/* the access point should be started if it is not already */
+	reconnect_reason_class_t reason_class;
+};
+
+
+/**
+ * @brief Tells whether retrying can fix a failure with this disconnection reason code.
+ */
+reconnect_reason_class_t reconnect_policy_classify(uint8_t reason);
+
+/**
+ * @brief Decides what to do after a failed round of connection attempts, or after the connection was lost.
+ * @param reason the reason code of the last disconnection.
+ */
+void reconnect_policy_next(uint8_t reason, struct reconnect_decision_t *decision);
+
+/**
+ * @brief Ends the outage: the next failure is retried right away.
+ */
+void reconnect_policy_reset();
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_RECONNECT_POLICY_H_INCLUDED */
@@ -0,0 +1,453 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+@file throughput_test.c
+@brief TCP and UDP throughput test against a host running tools/throughput_test.py
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/timers.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_wifi.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+
+#include "wifi_manager.h"
+#include "throughput_test.h"
+
+
+#ifdef CONFIG_WIFI_MANAGER_THROUGHPUT_TEST
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "throughput_test";
+
+/* @brief size of the buffer used to receive and send. An UDP payload fits a single unfragmented frame */
+#define THROUGHPUT_TEST_BUFFER_SIZE			2920
+#define THROUGHPUT_TEST_UDP_PAYLOAD			1470
+
+/* @brief time (in ms) the host has to connect, or to send its first UDP datagram, once the test is started */
+#define THROUGHPUT_TEST_CONNECT_TIMEOUT		10000
+
+/* @brief an UDP download ends when nothing was received for this long (in ms) */
+#define THROUGHPUT_TEST_IDLE_TIMEOUT		1000
+
+/* @brief sequence number of the datagrams marking the end of an UDP test */
+#define THROUGHPUT_TEST_UDP_FIN				0xffffffffu
+
+/**
+ * @brief header of every UDP datagram, in network byte order. The time is the sender's clock: only differences
+ * between two datagrams are used, so the clocks of the host and of the device do not need to agree.
+ */
+struct throughput_test_udp_hdr_t{
+	uint32_t seq;
+	uint32_t sec;
+	uint32_t usec;
+} __attribute__((packed));
+
+/* @brief result of the last test, shared with the http server */
+static struct throughput_test_result_t throughput_test_result;
+static portMUX_TYPE throughput_test_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* @brief parameters and listening socket of the test in progress, owned by the test task once it is started */
+static struct throughput_test_config_t throughput_test_config;
+static int throughput_test_socket = -1;
+
+/* @brief orders the scans of a test that asks for them, and the number it ordered */
+static TimerHandle_t throughput_test_scan_timer = NULL;
+static uint32_t throughput_test_scans = 0;
+
+
+static int8_t throughput_test_rssi(){
+	wifi_ap_record_t ap_info;
+	return esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK ? ap_info.rssi : 0;
+}
+
+static void throughput_test_scan_cb(TimerHandle_t xTimer){
+	scan_request_made_by_code_t request = throughput_test_config.scan == THROUGHPUT_TEST_SCAN_FULL ? SCAN_REQUEST_FULL : SCAN_REQUEST_PER_CHANNEL;
+	if(wifi_manager_send_message(WM_ORDER_START_WIFI_SCAN, (void*)request) == pdTRUE){
+		throughput_test_scans++;
+	}
+}
+
+static void throughput_test_set_state(throughput_test_state_t state){
+	taskENTER_CRITICAL(&throughput_test_mux);
+	throughput_test_result.state = state;
+	taskEXIT_CRITICAL(&throughput_test_mux);
+
+	/* the scans start with the transfer, the first one right away */
+	if(state == THROUGHPUT_TEST_RUNNING && throughput_test_scan_timer){
+		throughput_test_scan_cb(throughput_test_scan_timer);
+		xTimerStart(throughput_test_scan_timer, portMAX_DELAY);
+	}
+}
+
+static void throughput_test_set_timeout(int fd, uint32_t ms){
+	struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * @brief accepts the host on the listening socket, giving up after THROUGHPUT_TEST_CONNECT_TIMEOUT.
+ */
+static int throughput_test_accept(){
+	int64_t deadline = esp_timer_get_time() + (int64_t)THROUGHPUT_TEST_CONNECT_TIMEOUT * 1000;
+	while(esp_timer_get_time() < deadline){
+		int fd = accept(throughput_test_socket, NULL, NULL);
+		if(fd >= 0){
+			return fd;
+		}
+	}
+	return -1;
+}
+
+static void throughput_test_tcp(struct throughput_test_result_t *r, char *buf, int64_t *first, int64_t *last){
+
+	int fd = throughput_test_accept();
+	if(fd < 0){
+		ESP_LOGW(TAG, "No host connected");
+		return;
+	}
+	throughput_test_set_timeout(fd, THROUGHPUT_TEST_IDLE_TIMEOUT);
+
+	throughput_test_set_state(THROUGHPUT_TEST_RUNNING);
+	r->rssi_start = throughput_test_rssi();
+	*first = esp_timer_get_time();
+	int64_t end = *first + (int64_t)throughput_test_config.duration * 1000;
+
+	if(throughput_test_config.direction == THROUGHPUT_TEST_DOWNLOAD){
+		/* the clock starts with the first byte so that the connection setup is not counted */
+		bool started = false;
+		for(;;){
+			int len = recv(fd, buf, THROUGHPUT_TEST_BUFFER_SIZE, 0);
+			int64_t now = esp_timer_get_time();
+			if(len <= 0) break;
+			if(!started){
+				*first = now;
+				end = now + (int64_t)throughput_test_config.duration * 1000;
+				started = true;
+			}
+			r->bytes += len;
+			*last = now;
+			if(now >= end) break;
+		}
+	}
+	else{
+		memset(buf, 0x55, THROUGHPUT_TEST_BUFFER_SIZE);
+		while(esp_timer_get_time() < end){
+			int len = send(fd, buf, THROUGHPUT_TEST_BUFFER_SIZE, 0);
+			if(len < 0) break;
+			r->bytes += len;
+		}
+		*last = esp_timer_get_time();
+	}
+
+	r->rssi_end = throughput_test_rssi();
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+}
+
+static void throughput_test_udp_download(struct throughput_test_result_t *r, char *buf, int64_t *first, int64_t *last){
+
+	uint32_t next_seq = 0;
+	int64_t prev_transit = 0;
+	int64_t jitter16 = 0; /* jitter scaled by 16, as in RFC 3550 appendix A.8 */
+	int64_t deadline = esp_timer_get_time() + (int64_t)THROUGHPUT_TEST_CONNECT_TIMEOUT * 1000;
+
+	for(;;){
+		int len = recv(throughput_test_socket, buf, THROUGHPUT_TEST_BUFFER_SIZE, 0);
+		int64_t now = esp_timer_get_time();
+
+		if(len < 0){
+			/* receive timeout: before the first datagram the host may still be starting, after it the test is over */
+			if(r->packets == 0 && now < deadline) continue;
+			break;
+		}
+		if(len < (int)sizeof(struct throughput_test_udp_hdr_t)) continue;
+
+		struct throughput_test_udp_hdr_t hdr;
+		memcpy(&hdr, buf, sizeof(hdr));
+		uint32_t seq = ntohl(hdr.seq);
+		if(seq == THROUGHPUT_TEST_UDP_FIN) break;
+
+		if(r->packets == 0){
+			throughput_test_set_state(THROUGHPUT_TEST_RUNNING);
+			r->rssi_start = throughput_test_rssi();
+			*first = now;
+		}
+		r->packets++;
+		r->bytes += len;
+		*last = now;
+
+		if(seq >= next_seq){
+			r->lost += seq - next_seq;
+			next_seq = seq + 1;
+		}
+		else{
+			/* this one was counted as lost when a later one arrived */
+			r->out_of_order++;
+			if(r->lost > 0) r->lost--;
+		}
+
+		int64_t transit = now - ((int64_t)ntohl(hdr.sec) * 1000000LL + ntohl(hdr.usec));
+		if(r->packets > 1){
+			int64_t d = transit - prev_transit;
+			if(d < 0) d = -d;
+			jitter16 += d - ((jitter16 + 8) >> 4);
+		}
+		prev_transit = transit;
+	}
+
+	r->jitter = (uint32_t)(jitter16 >> 4);
+	r->rssi_end = throughput_test_rssi();
+}
+
+static void throughput_test_udp_upload(struct throughput_test_result_t *r, char *buf, int64_t *first, int64_t *last){
+
+	/* the host first sends a datagram so that the device knows where to send to */
+	struct sockaddr_in host;
+	socklen_t host_len = sizeof(host);
+	int64_t deadline = esp_timer_get_time() + (int64_t)THROUGHPUT_TEST_CONNECT_TIMEOUT * 1000;
+	int len = -1;
+	while(len < 0 && esp_timer_get_time() < deadline){
+		len = recvfrom(throughput_test_socket, buf, THROUGHPUT_TEST_BUFFER_SIZE, 0, (struct sockaddr*)&host, &host_len);
+	}
+	if(len < 0){
+		ESP_LOGW(TAG, "No host connected");
+		return;
+	}
+
+	throughput_test_set_state(THROUGHPUT_TEST_RUNNING);
+	r->rssi_start = throughput_test_rssi();
+	memset(buf, 0x55, THROUGHPUT_TEST_UDP_PAYLOAD);
+
+	/* datagrams are paced to the requested bitrate on an absolute schedule: the task sleeps until the next one is
+	 * due, rounded up to the tick, and sends whatever is due when it wakes up. Above one datagram per tick they
+	 * leave in small bursts, but the rate is the requested one and not bound to the tick rate. When the link cannot
+	 * keep up, sendto blocks or fails and the schedule falls behind: the task still sleeps once per tick so that
+	 * lower priority tasks, IDLE included, are not starved */
+	uint32_t bitrate = throughput_test_config.bitrate ? throughput_test_config.bitrate : 1000;
+	int64_t interval = (int64_t)THROUGHPUT_TEST_UDP_PAYLOAD * 8 * 1000 / bitrate;
+	*first = esp_timer_get_time();
+	int64_t end = *first + (int64_t)throughput_test_config.duration * 1000;
+	int64_t next = *first;
+	const int64_t tick = (int64_t)portTICK_PERIOD_MS * 1000;
+	int64_t slept = *first;
+
+	for(uint32_t seq = 0;; seq++){
+		int64_t now = esp_timer_get_time();
+		if(now - slept >= tick){
+			vTaskDelay(1);
+			now = slept = esp_timer_get_time();
+		}
+		while(now < next && now < end){
+			vTaskDelay((TickType_t)((next - now + tick - 1) / tick));
+			now = slept = esp_timer_get_time();
+		}
+		if(now >= end) break;
+
+		struct throughput_test_udp_hdr_t hdr = {
+			.seq = htonl(seq),
+			.sec = htonl((uint32_t)(now / 1000000)),
+			.usec = htonl((uint32_t)(now % 1000000))
+		};
+		memcpy(buf, &hdr, sizeof(hdr));
+		if(sendto(throughput_test_socket, buf, THROUGHPUT_TEST_UDP_PAYLOAD, 0, (struct sockaddr*)&host, host_len) < 0){
+			/* out of buffers: let the driver drain them. The host sees the gap as loss */
+			vTaskDelay(1);
+			slept = esp_timer_get_time();
+			continue;
+		}
+		r->packets++;
+		r->bytes += THROUGHPUT_TEST_UDP_PAYLOAD;
+		next += interval;
+	}
+	*last = esp_timer_get_time();
+
+	/* a few end markers in case some get lost */
+	struct throughput_test_udp_hdr_t fin = { .seq = htonl(THROUGHPUT_TEST_UDP_FIN) };
+	for(int i=0; i<3; i++){
+		sendto(throughput_test_socket, &fin, sizeof(fin), 0, (struct sockaddr*)&host, host_len);
+	}
+
+	r->rssi_end = throughput_test_rssi();
+}
+
+static void throughput_test_task(void *pvParameters){
+
+	struct throughput_test_result_t r;
+	int64_t first = 0, last = 0;
+	char *buf = malloc(THROUGHPUT_TEST_BUFFER_SIZE);
+
+	memset(&r, 0x00, sizeof(r));
+	r.proto = throughput_test_config.proto;
+	r.direction = throughput_test_config.direction;
+	r.scan = throughput_test_config.scan;
+
+	throughput_test_scans = 0;
+	if(throughput_test_config.scan != THROUGHPUT_TEST_SCAN_NONE){
+		throughput_test_scan_timer = xTimerCreate(NULL, pdMS_TO_TICKS(THROUGHPUT_TEST_SCAN_INTERVAL), pdTRUE, NULL, throughput_test_scan_cb);
+	}
+
+	if(buf){
+		if(throughput_test_config.proto == THROUGHPUT_TEST_TCP){
+			throughput_test_tcp(&r, buf, &first, &last);
+		}
+		else if(throughput_test_config.direction == THROUGHPUT_TEST_DOWNLOAD){
+			throughput_test_udp_download(&r, buf, &first, &last);
+		}
+		else{
+			throughput_test_udp_upload(&r, buf, &first, &last);
+		}
+		free(buf);
+	}
+
+	close(throughput_test_socket);
+	throughput_test_socket = -1;
+
+	if(throughput_test_scan_timer){
+		xTimerDelete(throughput_test_scan_timer, portMAX_DELAY);
+		throughput_test_scan_timer = NULL;
+	}
+	r.scans = throughput_test_scans;
+
+	r.duration = last > first ? (uint32_t)((last - first) / 1000) : 0;
+	if(r.duration > 0){
+		r.goodput = (uint32_t)((uint64_t)r.bytes * 8 / r.duration);
+	}
+	r.state = r.bytes > 0 ? THROUGHPUT_TEST_DONE : THROUGHPUT_TEST_FAILED;
+
+	ESP_LOGI(TAG, "%s %s: %u bytes in %u ms, %u kbit/s, %u lost, jitter %u us, rssi %d/%d dBm, %u scan(s)",
+			r.proto == THROUGHPUT_TEST_TCP ? "tcp" : "udp", r.direction == THROUGHPUT_TEST_DOWNLOAD ? "download" : "upload",
+			r.bytes, r.duration, r.goodput, r.lost, r.jitter, r.rssi_start, r.rssi_end, r.scans);
+
+	taskENTER_CRITICAL(&throughput_test_mux);
+	memcpy(&throughput_test_result, &r, sizeof(r));
+	taskEXIT_CRITICAL(&throughput_test_mux);
+
+	vTaskDelete(NULL);
+}
+
+esp_err_t throughput_test_start(const struct throughput_test_config_t *config){
+
+	if(config == NULL || config->duration == 0 || config->duration > THROUGHPUT_TEST_MAX_DURATION ||
+			config->proto > THROUGHPUT_TEST_UDP || config->direction > THROUGHPUT_TEST_UPLOAD ||
+			config->scan > THROUGHPUT_TEST_SCAN_PER_CHANNEL || config->bitrate > THROUGHPUT_TEST_MAX_BITRATE){
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	/* one test at a time: the state is claimed before anything else */
+	taskENTER_CRITICAL(&throughput_test_mux);
+	bool busy = throughput_test_result.state == THROUGHPUT_TEST_WAITING || throughput_test_result.state == THROUGHPUT_TEST_RUNNING;
+	if(!busy){
+		memset(&throughput_test_result, 0x00, sizeof(throughput_test_result));
+		throughput_test_result.state = THROUGHPUT_TEST_WAITING;
+		throughput_test_result.proto = config->proto;
+		throughput_test_result.direction = config->direction;
+		throughput_test_result.scan = config->scan;
+	}
+	taskEXIT_CRITICAL(&throughput_test_mux);
+	if(busy){
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	throughput_test_config = *config;
+
+	/* the socket is listening before this returns: the host can connect as soon as its request is answered */
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(THROUGHPUT_TEST_PORT),
+		.sin_addr.s_addr = htonl(INADDR_ANY)
+	};
+	int reuse = 1;
+	bool tcp = config->proto == THROUGHPUT_TEST_TCP;
+	throughput_test_socket = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, tcp ? IPPROTO_TCP : IPPROTO_UDP);
+	if(throughput_test_socket < 0 ||
+			setsockopt(throughput_test_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+			bind(throughput_test_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+			(tcp && listen(throughput_test_socket, 1) < 0)){
+		ESP_LOGE(TAG, "Cannot listen on port %d", THROUGHPUT_TEST_PORT);
+		if(throughput_test_socket >= 0){
+			close(throughput_test_socket);
+			throughput_test_socket = -1;
+		}
+		throughput_test_set_state(THROUGHPUT_TEST_FAILED);
+		return ESP_FAIL;
+	}
+	throughput_test_set_timeout(throughput_test_socket, THROUGHPUT_TEST_IDLE_TIMEOUT);
+
+	if(xTaskCreate(&throughput_test_task, "throughput_test", 3072, NULL, WIFI_MANAGER_TASK_PRIORITY-1, NULL) != pdPASS){
+		close(throughput_test_socket);
+		throughput_test_socket = -1;
+		throughput_test_set_state(THROUGHPUT_TEST_FAILED);
+		return ESP_ERR_NO_MEM;
+	}
+
+	ESP_LOGI(TAG, "Waiting for the host on port %d", THROUGHPUT_TEST_PORT);
+	return ESP_OK;
+}
+
+void throughput_test_get_result(struct throughput_test_result_t *result){
+	taskENTER_CRITICAL(&throughput_test_mux);
+	memcpy(result, &throughput_test_result, sizeof(throughput_test_result));
+	taskEXIT_CRITICAL(&throughput_test_mux);
+}
+
+size_t throughput_test_get_json(char *buf, size_t size){
+
+	static const char * const states[] = { "idle", "waiting", "running", "done", "failed" };
+	static const char * const scans[] = { "none", "full", "channel" };
+	struct throughput_test_result_t r;
+	throughput_test_get_result(&r);
+
+	int len = snprintf(buf, size,
+			"{\"state\":\"%s\",\"proto\":\"%s\",\"direction\":\"%s\",\"port\":%d,\"bytes\":%u,\"duration\":%u,\"goodput\":%u,"
+			"\"packets\":%u,\"lost\":%u,\"out_of_order\":%u,\"jitter\":%u,\"rssi_start\":%d,\"rssi_end\":%d,\"scan\":\"%s\",\"scans\":%u}\n",
+			states[r.state], r.proto == THROUGHPUT_TEST_TCP ? "tcp" : "udp", r.direction == THROUGHPUT_TEST_DOWNLOAD ? "download" : "upload",
+			THROUGHPUT_TEST_PORT, r.bytes, r.duration, r.goodput, r.packets, r.lost, r.out_of_order, r.jitter, r.rssi_start, r.rssi_end,
+			scans[r.scan], r.scans);
+
+	return len < 0 ? 0 : ((size_t)len < size ? (size_t)len : size - 1);
+}
+
+#else
+
+esp_err_t throughput_test_start(const struct throughput_test_config_t *config){
+	return ESP_ERR_NOT_SUPPORTED;
+}
+
+void throughput_test_get_result(struct throughput_test_result_t *result){
+	memset(result, 0x00, sizeof(struct throughput_test_result_t));
+}
+
+size_t throughput_test_get_json(char *buf, size_t size){
+	return (size_t)snprintf(buf, size, "{}\n");
+}
+
+#endif
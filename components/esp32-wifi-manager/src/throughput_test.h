@@ -0,0 +1,152 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file throughput_test.h
+@brief TCP and UDP throughput test against a host running tools/throughput_test.py
+
+The device listens on THROUGHPUT_TEST_PORT and the host connects to it. In a download test the
+host sends and the device receives, like during an OTA update; in an upload test the device sends.
+UDP datagrams carry a sequence number and the send time so that the receiver can count lost packets and
+compute the interarrival jitter as defined in RFC 3550.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_THROUGHPUT_TEST_H_INCLUDED
+#define WIFI_MANAGER_THROUGHPUT_TEST_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * @brief TCP or UDP port the device listens on during a test.
+ */
+#define THROUGHPUT_TEST_PORT				CONFIG_WIFI_MANAGER_THROUGHPUT_TEST_PORT
+
+/**
+ * @brief Longest test that can be requested, in ms.
+ */
+#define THROUGHPUT_TEST_MAX_DURATION		60000
+
+/**
+ * @brief Highest bitrate (in kbit/s) an UDP upload can ask for. It is above what the esp32 radio can send, and a
+ * link too slow for the requested rate costs lost datagrams, not CPU: the sending task still yields every tick.
+ */
+#define THROUGHPUT_TEST_MAX_BITRATE		100000
+
+/**
+ * @brief Time (in ms) between two scans ordered during a test that asks for them. A sweep of the 13 channels one
+ * at a time takes about as long with the default dwell and gap, so that both kinds of scan keep the radio busy.
+ */
+#define THROUGHPUT_TEST_SCAN_INTERVAL		5000
+
+/**
+ * @brief Size of the JSON representation of a result, including the terminating null character.
+ */
+#define THROUGHPUT_TEST_JSON_SIZE			320
+
+
+typedef enum throughput_test_proto_t{
+	THROUGHPUT_TEST_TCP = 0,
+	THROUGHPUT_TEST_UDP = 1
+}throughput_test_proto_t;
+
+typedef enum throughput_test_direction_t{
+	THROUGHPUT_TEST_DOWNLOAD = 0,	/* host to device, the direction of an OTA update */
+	THROUGHPUT_TEST_UPLOAD = 1		/* device to host */
+}throughput_test_direction_t;
+
+/**
+ * @brief Scans ordered every THROUGHPUT_TEST_SCAN_INTERVAL while the transfer runs, to measure what they cost.
+ */
+typedef enum throughput_test_scan_t{
+	THROUGHPUT_TEST_SCAN_NONE = 0,
+	THROUGHPUT_TEST_SCAN_FULL = 1,			/* all channels at once */
+	THROUGHPUT_TEST_SCAN_PER_CHANNEL = 2	/* one channel at a time, back to the AP between two channels */
+}throughput_test_scan_t;
+
+typedef enum throughput_test_state_t{
+	THROUGHPUT_TEST_IDLE = 0,
+	THROUGHPUT_TEST_WAITING = 1,	/* listening, the host did not connect yet */
+	THROUGHPUT_TEST_RUNNING = 2,
+	THROUGHPUT_TEST_DONE = 3,
+	THROUGHPUT_TEST_FAILED = 4
+}throughput_test_state_t;
+
+struct throughput_test_config_t{
+	throughput_test_proto_t proto;
+	throughput_test_direction_t direction;
+	uint32_t duration;				/* in ms, at most THROUGHPUT_TEST_MAX_DURATION */
+	uint32_t bitrate;				/* in kbit/s, rate of an UDP upload, up to THROUGHPUT_TEST_MAX_BITRATE. Other tests go as fast as they can */
+	throughput_test_scan_t scan;
+};
+
+/**
+ * @brief Measures of a test as seen by the device. Loss and jitter are only measured by the receiver of an UDP test.
+ */
+struct throughput_test_result_t{
+	throughput_test_state_t state;
+	throughput_test_proto_t proto;
+	throughput_test_direction_t direction;
+	throughput_test_scan_t scan;
+	uint32_t scans;					/* scans ordered during the transfer */
+	uint32_t bytes;					/* payload bytes received or sent */
+	uint32_t duration;				/* time (in ms) between the first and the last byte */
+	uint32_t goodput;				/* payload rate in kbit/s, the same unit as the OTA phase timings */
+	uint32_t packets;				/* UDP datagrams received or sent */
+	uint32_t lost;					/* UDP datagrams missing from the sequence */
+	uint32_t out_of_order;			/* UDP datagrams received after a later one */
+	uint32_t jitter;				/* UDP interarrival jitter in us */
+	int8_t rssi_start;				/* RSSI of the AP when the transfer started, 0 if not connected */
+	int8_t rssi_end;				/* RSSI of the AP when the transfer ended */
+};
+
+
+/**
+ * @brief Opens the test socket and starts the test task. Returns once the host can connect.
+ * @return ESP_ERR_INVALID_STATE if a test is already in progress, ESP_ERR_INVALID_ARG for a bad configuration.
+ */
+esp_err_t throughput_test_start(const struct throughput_test_config_t *config);
+
+/**
+ * @brief Copies the state and the measures of the last test.
+ */
+void throughput_test_get_result(struct throughput_test_result_t *result);
+
+/**
+ * @brief Writes the last result as JSON in buf, which should be THROUGHPUT_TEST_JSON_SIZE long.
+ * @return the length of the JSON.
+ */
+size_t throughput_test_get_json(char *buf, size_t size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_THROUGHPUT_TEST_H_INCLUDED */
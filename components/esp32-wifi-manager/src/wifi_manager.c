@@ -34,7 +34,10 @@ Contains the freeRTOS task and all necessary support
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
 #include "esp_system.h"
+#include "esp_timer.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/task.h>
@@ -53,17 +56,59 @@ Contains the freeRTOS task and all necessary support
 #include "lwip/err.h"
 #include "lwip/netdb.h"
 #include "lwip/ip4_addr.h"
+#include "lwip/netif.h"
+#include "lwip/dhcp.h"
+#include "lwip/tcpip.h"
 
 
 #include "json.h"
 #include "dns_server.h"
 #include "nvs_sync.h"
 #include "wifi_manager.h"
+#include "known_networks.h"
+#include "ap_list.h"
+#include "config_record.h"
+#include "message_ring.h"
+#include "payload_pool.h"
+#include "event_dispatcher.h"
+#include "wifi_profile.h"
+#include "link_telemetry.h"
+#include "reconnect_policy.h"
+#include "http_events.h"
 
 
 
 /* objects used to manipulate the main queue of events */
-QueueHandle_t wifi_manager_queue;
+message_ring_t *wifi_manager_queue = NULL;
+
+/* @brief number of state events: WM_EVENT_SCAN_DONE, WM_EVENT_STA_DISCONNECTED and WM_EVENT_STA_GOT_IP */
+#define WIFI_MANAGER_STATE_EVENTS			3
+
+/**
+ * @brief State events that did not fit in the queue or the payload pool. Each kind keeps its latest value, and
+ * the kinds are replayed in the order of their latest occurrence once the messages queued before them are handled.
+ * Written by the event loop, read by the wifi_manager task, under wifi_manager_deferred_mux.
+ */
+static struct{
+	union payload_pool_block_t payload[WIFI_MANAGER_STATE_EVENTS];
+	message_code_t order[WIFI_MANAGER_STATE_EVENTS];
+	uint8_t count;
+	uint32_t mark;					/* messages pushed to the queue before the first deferred event */
+} wifi_manager_deferred;
+static portMUX_TYPE wifi_manager_deferred_mux = portMUX_INITIALIZER_UNLOCKED;
+static atomic_uint wifi_manager_deferred_total = 0;
+
+/* @brief messages taken from the queue by the wifi_manager task, compared to wifi_manager_deferred.mark */
+static uint32_t wifi_manager_popped = 0;
+
+/* @brief payload of the deferred event being handled by the wifi_manager task. Not a block of the pool */
+static union payload_pool_block_t wifi_manager_deferred_payload;
+
+/* @brief orders that carry no state: one waiting in the queue serves any identical order posted meanwhile.
+ * The ring coalesces on the code alone, so only orders with a NULL param are coalesced: a scan requested by a
+ * user must not be absorbed by a pending background sweep, which is why the two have their own codes */
+static const uint32_t WIFI_MANAGER_COALESCED_MESSAGES =
+		(1u << WM_ORDER_START_WIFI_SCAN) | (1u << WM_ORDER_START_BACKGROUND_SCAN) | (1u << WM_ORDER_SCAN_NEXT_CHANNEL) | (1u << WM_ORDER_RENEW_DHCP_LEASE) | (1u << WM_ORDER_STOP_AP) | (1u << WM_ORDER_CHECK_ROAMING) | (1u << WM_ORDER_SAMPLE_TELEMETRY);
 
 /* @brief software timer to wait between each connection retry.
  * There is no point hogging a hardware timer for a functionality like this which only needs to be 'accurate enough' */
@@ -73,17 +118,117 @@ TimerHandle_t wifi_manager_retry_timer = NULL;
  * There is no point hogging a hardware timer for a functionality like this which only needs to be 'accurate enough' */
 TimerHandle_t wifi_manager_shutdown_ap_timer = NULL;
 
-SemaphoreHandle_t wifi_manager_json_mutex = NULL;
-SemaphoreHandle_t wifi_manager_sta_ip_mutex = NULL;
-char *wifi_manager_sta_ip = NULL;
+#ifdef CONFIG_WIFI_MANAGER_DHCP_LEASE_REUSE
+/* @brief software timer that will trigger the revalidation of a reused DHCP lease */
+TimerHandle_t wifi_manager_dhcp_renew_timer = NULL;
+#endif
+
+#if WIFI_MANAGER_SCAN_CHANNEL_GAP > 0
+/* @brief software timer that will trigger the scan of the next channel of a per-channel sweep */
+TimerHandle_t wifi_manager_scan_gap_timer = NULL;
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_BACKGROUND_SCAN
+/* @brief software timer that will trigger the periodic background scans while connected */
+TimerHandle_t wifi_manager_background_scan_timer = NULL;
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+/* @brief software timer that will trigger the periodic checks of the signal of the connected AP */
+TimerHandle_t wifi_manager_roam_timer = NULL;
+#endif
+
+/* @brief software timer that will trigger the periodic telemetry samples while connected */
+TimerHandle_t wifi_manager_telemetry_timer = NULL;
+
+
+/* @brief addresses of the STA and of the AP as in esp_ip4_addr_t, read by the http server on every request */
+static atomic_uint wifi_manager_sta_ip = 0;
+static atomic_uint wifi_manager_ap_ip = 0;
+
+/* @brief results of the latest scans, one record per BSSID, strongest first */
 uint16_t ap_num = MAX_AP_NUM;
 wifi_ap_record_t *accessp_records;
-char *accessp_json = NULL;
-char *ip_info_json = NULL;
+
+/* @brief copy of accessp_records with one record per network, as shown on the page */
+static wifi_ap_record_t *accessp_unique_records = NULL;
+
+/* @brief published versions of the list of access points and of the connection status, read by the http server */
+static json_snapshots_t *wifi_manager_ap_list_json = NULL;
+static json_snapshots_t *wifi_manager_ip_info_json = NULL;
+
 wifi_config_t* wifi_manager_config_sta = NULL;
 
-/* @brief Array of callback function pointers */
-void (**cb_ptr_arr)(void*) = NULL;
+/* @brief order in which the known networks are tried, as indexes usable with known_networks_get */
+static uint8_t wifi_manager_candidates[MAX_KNOWN_NETWORKS];
+
+/* @brief number of entries in wifi_manager_candidates. 0 when no round of automatic connection attempts is in progress */
+static uint8_t wifi_manager_candidate_count = 0;
+
+/* @brief index in wifi_manager_candidates of the known network currently being tried */
+static uint8_t wifi_manager_candidate_index = 0;
+
+/* @brief esp_timer time (in us) of the last successful scan. 0 if there was none */
+static int64_t wifi_manager_scan_time = 0;
+
+/* @brief channel being scanned by a per-channel sweep. 0 when no such sweep is in progress */
+static uint8_t wifi_manager_scan_channel = 0;
+
+/* @brief set when the scan whose SCAN_DONE is awaited covers a single channel. Its results belong to a sweep: they are
+ * dropped if the sweep was abandoned before they arrived */
+static bool wifi_manager_scan_single_channel = false;
+
+/* @brief scan results older than this (in us) are not used to rank the known networks */
+static const int64_t WIFI_MANAGER_SCAN_MAX_AGE = 60LL * 1000000LL;
+
+/* @brief time (in ms) an active scan of all channels takes, roughly */
+static const uint32_t WIFI_MANAGER_FULL_SCAN_TIME = 2000;
+
+/* @brief last DHCP lease obtained on the saved network */
+static struct wifi_dhcp_lease_t wifi_manager_dhcp_lease;
+
+/* @brief true when wifi_manager_dhcp_lease matches the saved STA ssid and is not known to be expired */
+static bool wifi_manager_dhcp_lease_valid = false;
+
+/* @brief true while the lwIP DHCP client confirms a reused lease, behind the back of esp_netif which still
+ * sees the address as static. Only used on the wifi_manager task */
+static bool wifi_manager_dhcp_revalidating = false;
+
+/* @brief esp_timer time (in us) at which the current connection attempt was ordered. 0 when no attempt is in progress */
+static int64_t wifi_manager_connect_start_time = 0;
+
+/* @brief time (in ms) between the connection order and IP_EVENT_STA_GOT_IP for the current connection */
+static uint32_t wifi_manager_got_ip_latency = 0;
+
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+/* @brief maximum number of access points of the current network considered when looking for a stronger one */
+#define WIFI_MANAGER_ROAM_MAX_CANDIDATES	8
+
+/* @brief roaming statistics, returned by wifi_manager_get_roam_stats */
+static struct wifi_manager_roam_stats_t wifi_manager_roam_stats;
+
+/* @brief true when the scan in progress looks for another AP of the current network */
+static bool wifi_manager_roam_scan = false;
+
+/* @brief esp_timer time (in us) at which the STA left its AP to roam. 0 when no roam is in progress */
+static int64_t wifi_manager_roam_start_time = 0;
+
+/* @brief esp_timer time (in us) of the last scan for a stronger AP. 0 if there was none */
+static int64_t wifi_manager_roam_scan_time = 0;
+
+/* @brief AP the STA reassociates to once it left the current one */
+static uint8_t wifi_manager_roam_bssid[6];
+static uint8_t wifi_manager_roam_channel = 0;
+#endif
+
+/* @brief wifi profile in use, read by wifi_manager_get_profile from any task */
+static atomic_uint wifi_manager_profile = WIFI_PROFILE_DEFAULT;
+
+/* @brief profile used instead of the saved one, e.g. during a firmware download. WIFI_PROFILE_COUNT when there is none */
+static wifi_profile_id_t wifi_manager_profile_override = WIFI_PROFILE_COUNT;
+
+/* @brief wall clock values below this (2020-01-01) mean the time was never set, e.g. no SNTP sync since boot */
+static const time_t WIFI_MANAGER_TIME_SET_THRESHOLD = 1577836800;
 
 /* @brief tag used for ESP serial console messages */
 static const char TAG[] = "wifi_manager";
@@ -109,6 +254,7 @@ struct wifi_settings_t wifi_settings = {
 	.sta_only = DEFAULT_STA_ONLY,
 	.sta_power_save = DEFAULT_STA_POWER_SAVE,
 	.sta_static_ip = 0,
+	.profile = WIFI_PROFILE_DEFAULT,
 };
 
 const char wifi_manager_nvs_namespace[] = "espwifimgr";
@@ -141,6 +287,15 @@ const int WIFI_MANAGER_SCAN_BIT = BIT7;
 /* @brief When set, means user requested for a disconnect */
 const int WIFI_MANAGER_REQUEST_DISCONNECT_BIT = BIT8;
 
+/* @brief When set, means the current connection attempt is a directed connect using the BSSID/channel of the known network */
+const int WIFI_MANAGER_FAST_CONNECT_BIT = BIT9;
+
+/* @brief When set, means the STA was given the cached DHCP lease and the DHCP client still has to revalidate it */
+const int WIFI_MANAGER_DHCP_LEASE_REUSED_BIT = BIT10;
+
+/* @brief When set, means the STA is leaving its AP to reassociate to a stronger AP of the same network */
+const int WIFI_MANAGER_ROAMING_BIT = BIT11;
+
 
 
 void wifi_manager_timer_retry_cb( TimerHandle_t xTimer ){
@@ -164,10 +319,184 @@ void wifi_manager_timer_shutdown_ap_cb( TimerHandle_t xTimer){
 	wifi_manager_send_message(WM_ORDER_STOP_AP, NULL);
 }
 
+#ifdef CONFIG_WIFI_MANAGER_DHCP_LEASE_REUSE
+/**
+ * @brief Runs on the tcpip thread: starts the lwIP DHCP client on the STA netif as it is.
+ *
+ * esp_netif_dhcpc_start would clear the reused address first, and lwIP would abort every TCP connection bound
+ * to it. lwIP's own client leaves the address alone while it talks to the server: if it gets the same address
+ * back, binding it changes nothing, and only a different address replaces it.
+ */
+static void wifi_manager_dhcp_revalidate(void *ctx){
+	if(dhcp_start((struct netif*)ctx) != ERR_OK){
+		ESP_LOGW(TAG, "could not start the DHCP client to revalidate the lease");
+	}
+}
+
+/**
+ * @brief Runs on the tcpip thread: tells the wifi manager which address the DHCP server confirmed, if any yet.
+ */
+static void wifi_manager_dhcp_check(void *ctx){
+	struct netif *netif = (struct netif*)ctx;
+	uint32_t ip = dhcp_supplied_address(netif) ? ip4_addr_get_u32(netif_ip4_addr(netif)) : 0;
+	wifi_manager_send_message(WM_EVENT_DHCP_LEASE_CHECKED, (void*)(uintptr_t)ip);
+}
+
+/**
+ * @brief Runs on the tcpip thread: stops the lwIP DHCP client started by wifi_manager_dhcp_revalidate.
+ */
+static void wifi_manager_dhcp_stop(void *ctx){
+	dhcp_stop((struct netif*)ctx);
+}
+
+void wifi_manager_timer_dhcp_renew_cb( TimerHandle_t xTimer ){
+
+	/* stop the timer */
+	xTimerStop( xTimer, (TickType_t) 0 );
+
+	/* Revalidate the reused lease */
+	wifi_manager_send_message(WM_ORDER_RENEW_DHCP_LEASE, NULL);
+}
+#endif
+
+#if WIFI_MANAGER_SCAN_CHANNEL_GAP > 0
+void wifi_manager_timer_scan_gap_cb( TimerHandle_t xTimer ){
+
+	/* stop the timer */
+	xTimerStop( xTimer, (TickType_t) 0 );
+
+	/* Move on to the next channel. If the queue is full the order would be lost and the sweep would never end:
+	 * try again after another gap */
+	if(wifi_manager_send_message(WM_ORDER_SCAN_NEXT_CHANNEL, NULL) != pdTRUE){
+		xTimerStart( xTimer, (TickType_t) 0 );
+	}
+}
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_BACKGROUND_SCAN
+void wifi_manager_timer_background_scan_cb( TimerHandle_t xTimer ){
+
+	/* periodic timer: keeps running until the connection is lost */
+	wifi_manager_send_message(WM_ORDER_START_BACKGROUND_SCAN, NULL);
+}
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+void wifi_manager_timer_roam_cb( TimerHandle_t xTimer ){
+
+	/* periodic timer: keeps running until the connection is lost */
+	wifi_manager_send_message(WM_ORDER_CHECK_ROAMING, NULL);
+}
+#endif
+
+void wifi_manager_timer_telemetry_cb( TimerHandle_t xTimer ){
+
+	/* periodic timer: keeps running until the connection is lost */
+	wifi_manager_send_message(WM_ORDER_SAMPLE_TELEMETRY, NULL);
+}
+
 void wifi_manager_scan_async(){
+	/* scan orders are coalesced in the queue: the scan rate does not depend on the number of clients polling the access point list */
 	wifi_manager_send_message(WM_ORDER_START_WIFI_SCAN, NULL);
 }
 
+/**
+ * @brief Starts a scan of a single channel, or of all channels if channel is 0.
+ * When ssid is not NULL, only the access points of that network are reported.
+ * Scans can be refused by the driver, e.g. while the STA is connecting: this is not treated as a fatal error.
+ */
+static esp_err_t wifi_manager_start_scan(uint8_t channel, uint8_t *ssid){
+
+	wifi_scan_config_t scan_config = {
+		.ssid = ssid,
+		.bssid = 0,
+		.channel = channel,
+		.show_hidden = (ssid == NULL)
+	};
+
+	/* a single channel or single network scan leaves the home channel for at most the dwell time on each channel */
+	if(channel != 0 || ssid != NULL){
+		scan_config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+		scan_config.scan_time.active.min = 0;
+		scan_config.scan_time.active.max = WIFI_MANAGER_SCAN_CHANNEL_DWELL;
+	}
+
+	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_SCAN_BIT);
+	wifi_manager_scan_single_channel = channel != 0;
+	esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+	if(err != ESP_OK){
+		ESP_LOGW(TAG, "esp_wifi_scan_start failed: %s", esp_err_to_name(err));
+		xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_SCAN_BIT);
+		wifi_manager_scan_channel = 0;
+		wifi_manager_scan_single_channel = false;
+	}
+
+	return err;
+}
+
+/**
+ * @brief Replaces the access points previously seen on channel by the results of the scan of that channel.
+ *
+ * The list holds every BSSID: the access points of a network spread over several channels all keep their own
+ * record, whichever channel is scanned last.
+ */
+static void wifi_manager_merge_channel_records(uint8_t channel){
+
+	uint16_t kept = 0;
+	for(uint16_t i=0; i<ap_num; i++){
+		if(accessp_records[i].primary != channel){
+			if(kept != i){
+				memcpy(&accessp_records[kept], &accessp_records[i], sizeof(wifi_ap_record_t));
+			}
+			kept++;
+		}
+	}
+
+	/* the list is sorted by RSSI: if it is full, the weakest access point makes room */
+	if(kept == MAX_AP_NUM){
+		kept--;
+	}
+
+	uint16_t num = MAX_AP_NUM - kept;
+	ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&num, accessp_records + kept));
+	ap_num = kept + num;
+
+	ap_list_sort(accessp_records, ap_num);
+}
+
+/**
+ * @brief Moves a per-channel sweep on to the next channel, or ends it.
+ *
+ * The sweep is abandoned if a scan failed or if a connection attempt is in progress: scanning would
+ * take the radio away from the channel of the AP the STA is trying to join.
+ * Channels are spaced by WIFI_MANAGER_SCAN_CHANNEL_GAP so that traffic flows between them.
+ */
+static void wifi_manager_scan_next_channel(bool success){
+
+	wifi_country_t country;
+	uint8_t last_channel = 0;
+	if(esp_wifi_get_country(&country) == ESP_OK){
+		last_channel = country.schan + country.nchan - 1;
+	}
+
+	if(success && wifi_manager_scan_channel >= last_channel){
+		/* sweep complete */
+		wifi_manager_scan_channel = 0;
+		wifi_manager_scan_time = esp_timer_get_time();
+	}
+	else if(!success || wifi_manager_connect_start_time != 0){
+		wifi_manager_scan_channel = 0;
+	}
+	else{
+#if WIFI_MANAGER_SCAN_CHANNEL_GAP > 0
+		xTimerStart( wifi_manager_scan_gap_timer, (TickType_t)0 );
+#else
+		wifi_manager_scan_channel++;
+		wifi_manager_start_scan(wifi_manager_scan_channel, NULL);
+#endif
+	}
+}
+
 void wifi_manager_disconnect_async(){
 	wifi_manager_send_message(WM_ORDER_DISCONNECT_STA, NULL);
 }
@@ -183,23 +512,16 @@ void wifi_manager_start(){
 	ESP_ERROR_CHECK(nvs_sync_create()); /* semaphore for thread synchronization on NVS memory */
 
 	/* memory allocation */
-	wifi_manager_queue = xQueueCreate( 3, sizeof( queue_message) );
-	wifi_manager_json_mutex = xSemaphoreCreateMutex();
+	wifi_manager_queue = message_ring_create( WIFI_MANAGER_QUEUE_SIZE );
 	accessp_records = (wifi_ap_record_t*)malloc(sizeof(wifi_ap_record_t) * MAX_AP_NUM);
-	accessp_json = (char*)malloc(MAX_AP_NUM * JSON_ONE_APP_SIZE + 4); /* 4 bytes for json encapsulation of "[\n" and "]\0" */
-	wifi_manager_clear_access_points_json();
-	ip_info_json = (char*)malloc(sizeof(char) * JSON_IP_INFO_SIZE);
-	wifi_manager_clear_ip_info_json();
+	accessp_unique_records = (wifi_ap_record_t*)malloc(sizeof(wifi_ap_record_t) * MAX_AP_NUM);
+	wifi_manager_ap_list_json = json_snapshots_create(JSON_ACCESS_POINTS_SIZE, "[]\n");
+	wifi_manager_ip_info_json = json_snapshots_create(JSON_IP_INFO_SIZE, "{}\n");
 	wifi_manager_config_sta = (wifi_config_t*)malloc(sizeof(wifi_config_t));
 	memset(wifi_manager_config_sta, 0x00, sizeof(wifi_config_t));
 	memset(&wifi_settings.sta_static_ip_config, 0x00, sizeof(esp_netif_ip_info_t));
-	cb_ptr_arr = malloc(sizeof(void (*)(void*)) * WM_MESSAGE_CODE_COUNT);
-	for(int i=0; i<WM_MESSAGE_CODE_COUNT; i++){
-		cb_ptr_arr[i] = NULL;
-	}
-	wifi_manager_sta_ip_mutex = xSemaphoreCreateMutex();
-	wifi_manager_sta_ip = (char*)malloc(sizeof(char) * IP4ADDR_STRLEN_MAX);
-	wifi_manager_safe_update_sta_ip_string((uint32_t)0);
+	ESP_ERROR_CHECK(event_dispatcher_start()); /* task running the callbacks */
+	wifi_manager_set_sta_ip((uint32_t)0);
 	wifi_manager_event_group = xEventGroupCreate();
 
 	/* create timer for to keep track of retries */
@@ -208,190 +530,225 @@ void wifi_manager_start(){
 	/* create timer for to keep track of AP shutdown */
 	wifi_manager_shutdown_ap_timer = xTimerCreate( NULL, pdMS_TO_TICKS(WIFI_MANAGER_SHUTDOWN_AP_TIMER), pdFALSE, ( void * ) 0, wifi_manager_timer_shutdown_ap_cb);
 
+#ifdef CONFIG_WIFI_MANAGER_DHCP_LEASE_REUSE
+	/* create timer for to keep track of the revalidation of a reused DHCP lease */
+	wifi_manager_dhcp_renew_timer = xTimerCreate( NULL, pdMS_TO_TICKS(WIFI_MANAGER_DHCP_LEASE_RENEW_DELAY), pdFALSE, ( void * ) 0, wifi_manager_timer_dhcp_renew_cb);
+#endif
+
+#if WIFI_MANAGER_SCAN_CHANNEL_GAP > 0
+	/* create timer for to keep track of the gap between two channels of a per-channel scan */
+	wifi_manager_scan_gap_timer = xTimerCreate( NULL, pdMS_TO_TICKS(WIFI_MANAGER_SCAN_CHANNEL_GAP), pdFALSE, ( void * ) 0, wifi_manager_timer_scan_gap_cb);
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_BACKGROUND_SCAN
+	/* create timer for to keep track of background scans */
+	wifi_manager_background_scan_timer = xTimerCreate( NULL, pdMS_TO_TICKS(WIFI_MANAGER_BACKGROUND_SCAN_INTERVAL), pdTRUE, ( void * ) 0, wifi_manager_timer_background_scan_cb);
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+	/* create timer for to keep track of the signal checks */
+	wifi_manager_roam_timer = xTimerCreate( NULL, pdMS_TO_TICKS(WIFI_MANAGER_ROAM_CHECK_INTERVAL), pdTRUE, ( void * ) 0, wifi_manager_timer_roam_cb);
+#endif
+
+	/* create timer for to keep track of the telemetry samples */
+	wifi_manager_telemetry_timer = xTimerCreate( NULL, pdMS_TO_TICKS(LINK_TELEMETRY_INTERVAL), pdTRUE, ( void * ) 0, wifi_manager_timer_telemetry_cb);
+
 	/* start wifi manager task */
 	xTaskCreate(&wifi_manager, "wifi_manager", 4096, NULL, WIFI_MANAGER_TASK_PRIORITY, &task_wifi_manager);
 }
 
 esp_err_t wifi_manager_save_sta_config(){
 
-	nvs_handle handle;
-	esp_err_t esp_err;
-	size_t sz;
-
-	/* variables used to check if write is really needed */
-	wifi_config_t tmp_conf;
-	struct wifi_settings_t tmp_settings;
-	memset(&tmp_conf, 0x00, sizeof(tmp_conf));
-	memset(&tmp_settings, 0x00, sizeof(tmp_settings));
-	bool change = false;
+	if(wifi_manager_config_sta == NULL){
+		return ESP_ERR_INVALID_STATE;
+	}
 
 	ESP_LOGI(TAG, "About to save config to flash!!");
 
-	if(wifi_manager_config_sta && nvs_sync_lock( portMAX_DELAY )){
+	/* the STA config and the settings are saved as a single record, only if they changed */
+	return config_record_save(wifi_manager_config_sta, &wifi_settings);
+}
 
-		esp_err = nvs_open(wifi_manager_nvs_namespace, NVS_READWRITE, &handle);
-		if (esp_err != ESP_OK){
-			nvs_sync_unlock();
-			return esp_err;
-		}
+bool wifi_manager_fetch_wifi_sta_config(){
 
-		sz = sizeof(tmp_conf.sta.ssid);
-		esp_err = nvs_get_blob(handle, "ssid", tmp_conf.sta.ssid, &sz);
-		if( (esp_err == ESP_OK  || esp_err == ESP_ERR_NVS_NOT_FOUND) && strcmp( (char*)tmp_conf.sta.ssid, (char*)wifi_manager_config_sta->sta.ssid) != 0){
-			/* different ssid or ssid does not exist in flash: save new ssid */
-			esp_err = nvs_set_blob(handle, "ssid", wifi_manager_config_sta->sta.ssid, 32);
-			if (esp_err != ESP_OK){
-				nvs_sync_unlock();
-				return esp_err;
-			}
-			change = true;
-			ESP_LOGI(TAG, "wifi_manager_wrote wifi_sta_config: ssid:%s",wifi_manager_config_sta->sta.ssid);
+	if(wifi_manager_config_sta == NULL){
+		wifi_manager_config_sta = (wifi_config_t*)malloc(sizeof(wifi_config_t));
+	}
+	memset(wifi_manager_config_sta, 0x00, sizeof(wifi_config_t));
 
-		}
+	if(config_record_load(wifi_manager_config_sta, &wifi_settings) != ESP_OK){
+		return false;
+	}
 
-		sz = sizeof(tmp_conf.sta.password);
-		esp_err = nvs_get_blob(handle, "password", tmp_conf.sta.password, &sz);
-		if( (esp_err == ESP_OK  || esp_err == ESP_ERR_NVS_NOT_FOUND) && strcmp( (char*)tmp_conf.sta.password, (char*)wifi_manager_config_sta->sta.password) != 0){
-			/* different password or password does not exist in flash: save new password */
-			esp_err = nvs_set_blob(handle, "password", wifi_manager_config_sta->sta.password, 64);
-			if (esp_err != ESP_OK){
-				nvs_sync_unlock();
-				return esp_err;
-			}
-			change = true;
-			ESP_LOGI(TAG, "wifi_manager_wrote wifi_sta_config: password:%s",wifi_manager_config_sta->sta.password);
-		}
+	ESP_LOGI(TAG, "wifi_manager_fetch_wifi_sta_config: ssid:%s password:%s",wifi_manager_config_sta->sta.ssid,wifi_manager_config_sta->sta.password);
+	ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_ssid:%s",wifi_settings.ap_ssid);
+	ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_pwd:%s",wifi_settings.ap_pwd);
+	ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_channel:%i",wifi_settings.ap_channel);
+	ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_hidden (1 = yes):%i",wifi_settings.ap_ssid_hidden);
+	ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_bandwidth (1 = 20MHz, 2 = 40MHz)%i",wifi_settings.ap_bandwidth);
+	ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: sta_only (0 = APSTA, 1 = STA when connected):%i",wifi_settings.sta_only);
+	ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: sta_power_save (1 = yes):%i",wifi_settings.sta_power_save);
+	ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: sta_static_ip (0 = dhcp client, 1 = static ip):%i",wifi_settings.sta_static_ip);
+
+	return wifi_manager_config_sta->sta.ssid[0] != '\0';
+}
 
-		sz = sizeof(tmp_settings);
-		esp_err = nvs_get_blob(handle, "settings", &tmp_settings, &sz);
-		if( (esp_err == ESP_OK  || esp_err == ESP_ERR_NVS_NOT_FOUND) &&
-				(
-				strcmp( (char*)tmp_settings.ap_ssid, (char*)wifi_settings.ap_ssid) != 0 ||
-				strcmp( (char*)tmp_settings.ap_pwd, (char*)wifi_settings.ap_pwd) != 0 ||
-				tmp_settings.ap_ssid_hidden != wifi_settings.ap_ssid_hidden ||
-				tmp_settings.ap_bandwidth != wifi_settings.ap_bandwidth ||
-				tmp_settings.sta_only != wifi_settings.sta_only ||
-				tmp_settings.sta_power_save != wifi_settings.sta_power_save ||
-				tmp_settings.ap_channel != wifi_settings.ap_channel
-				)
-		){
-			esp_err = nvs_set_blob(handle, "settings", &wifi_settings, sizeof(wifi_settings));
-			if (esp_err != ESP_OK){
-				nvs_sync_unlock();
-				return esp_err;
-			}
-			change = true;
-
-			ESP_LOGD(TAG, "wifi_manager_wrote wifi_settings: SoftAP_ssid: %s",wifi_settings.ap_ssid);
-			ESP_LOGD(TAG, "wifi_manager_wrote wifi_settings: SoftAP_pwd: %s",wifi_settings.ap_pwd);
-			ESP_LOGD(TAG, "wifi_manager_wrote wifi_settings: SoftAP_channel: %i",wifi_settings.ap_channel);
-			ESP_LOGD(TAG, "wifi_manager_wrote wifi_settings: SoftAP_hidden (1 = yes): %i",wifi_settings.ap_ssid_hidden);
-			ESP_LOGD(TAG, "wifi_manager_wrote wifi_settings: SoftAP_bandwidth (1 = 20MHz, 2 = 40MHz): %i",wifi_settings.ap_bandwidth);
-			ESP_LOGD(TAG, "wifi_manager_wrote wifi_settings: sta_only (0 = APSTA, 1 = STA when connected): %i",wifi_settings.sta_only);
-			ESP_LOGD(TAG, "wifi_manager_wrote wifi_settings: sta_power_save (1 = yes): %i",wifi_settings.sta_power_save);
-		}
+esp_err_t wifi_manager_save_dhcp_lease(const esp_netif_ip_info_t *ip_info){
 
-		if(change){
-			esp_err = nvs_commit(handle);
-		}
-		else{
-			ESP_LOGI(TAG, "Wifi config was not saved to flash because no change has been detected.");
+	esp_err_t esp_err;
+	size_t sz;
+	struct wifi_dhcp_lease_t tmp_lease, nvs_lease;
+	esp_netif_dns_info_t dns;
+	time_t now = time(NULL);
+
+	memset(&tmp_lease, 0x00, sizeof(tmp_lease));
+	memcpy(tmp_lease.ssid, wifi_manager_config_sta->sta.ssid, sizeof(tmp_lease.ssid));
+	tmp_lease.ip_info = *ip_info;
+	if(esp_netif_get_dns_info(esp_netif_sta, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK){
+		tmp_lease.dns = dns.ip.u_addr.ip4.addr;
+	}
+	struct netif *lwip_netif = (struct netif*)esp_netif_get_netif_impl(esp_netif_sta);
+	struct dhcp *dhcp = lwip_netif ? netif_dhcp_data(lwip_netif) : NULL;
+	tmp_lease.lease_time = dhcp ? dhcp->offered_t0_lease : 0;
+	tmp_lease.obtained = now > WIFI_MANAGER_TIME_SET_THRESHOLD ? (int64_t)now : 0;
+
+	/* the lease is rewritten when the address changed, or when the saved one is halfway through
+	 * its duration so that its expiry check stays meaningful without writing at every connection */
+	sz = sizeof(nvs_lease);
+	esp_err = nvs_sync_get_blob(wifi_manager_nvs_namespace, "dhcplease", &nvs_lease, &sz);
+	bool change = esp_err != ESP_OK || sz != sizeof(nvs_lease) ||
+			memcmp(tmp_lease.ssid, nvs_lease.ssid, sizeof(tmp_lease.ssid)) != 0 ||
+			memcmp(&tmp_lease.ip_info, &nvs_lease.ip_info, sizeof(tmp_lease.ip_info)) != 0 ||
+			tmp_lease.dns != nvs_lease.dns ||
+			tmp_lease.lease_time != nvs_lease.lease_time ||
+			(tmp_lease.obtained != 0 && tmp_lease.obtained - nvs_lease.obtained > tmp_lease.lease_time / 2);
+
+	esp_err = ESP_OK;
+	if(change){
+		esp_err = nvs_sync_set_blob(wifi_manager_nvs_namespace, "dhcplease", &tmp_lease, sizeof(tmp_lease));
+		if(esp_err == ESP_OK){
+			esp_err = nvs_sync_commit(wifi_manager_nvs_namespace);
 		}
+		ESP_LOGI(TAG, "wifi_manager_wrote dhcp_lease: lease_time:%u", tmp_lease.lease_time);
+	}
 
-		if (esp_err != ESP_OK) return esp_err;
-
-		nvs_close(handle);
-		nvs_sync_unlock();
+	if(esp_err != ESP_OK) return esp_err;
 
-	}
-	else{
-		ESP_LOGE(TAG, "wifi_manager_save_sta_config failed to acquire nvs_sync mutex");
-	}
+	wifi_manager_dhcp_lease = tmp_lease;
+	wifi_manager_dhcp_lease_valid = true;
 
 	return ESP_OK;
 }
 
-bool wifi_manager_fetch_wifi_sta_config(){
+bool wifi_manager_fetch_dhcp_lease(){
 
-	nvs_handle handle;
 	esp_err_t esp_err;
-	if(nvs_sync_lock( portMAX_DELAY )){
+	size_t sz;
 
-		esp_err = nvs_open(wifi_manager_nvs_namespace, NVS_READONLY, &handle);
+	wifi_manager_dhcp_lease_valid = false;
 
-		if(esp_err != ESP_OK){
-			nvs_sync_unlock();
-			return false;
-		}
+	sz = sizeof(wifi_manager_dhcp_lease);
+	esp_err = nvs_sync_get_blob(wifi_manager_nvs_namespace, "dhcplease", &wifi_manager_dhcp_lease, &sz);
 
-		if(wifi_manager_config_sta == NULL){
-			wifi_manager_config_sta = (wifi_config_t*)malloc(sizeof(wifi_config_t));
-		}
-		memset(wifi_manager_config_sta, 0x00, sizeof(wifi_config_t));
-
-		/* allocate buffer */
-		size_t sz = sizeof(wifi_settings);
-		uint8_t *buff = (uint8_t*)malloc(sizeof(uint8_t) * sz);
-		memset(buff, 0x00, sizeof(sz));
-
-		/* ssid */
-		sz = sizeof(wifi_manager_config_sta->sta.ssid);
-		esp_err = nvs_get_blob(handle, "ssid", buff, &sz);
-		if(esp_err != ESP_OK){
-			free(buff);
-			nvs_sync_unlock();
-			return false;
-		}
-		memcpy(wifi_manager_config_sta->sta.ssid, buff, sz);
-
-		/* password */
-		sz = sizeof(wifi_manager_config_sta->sta.password);
-		esp_err = nvs_get_blob(handle, "password", buff, &sz);
-		if(esp_err != ESP_OK){
-			free(buff);
-			nvs_sync_unlock();
-			return false;
-		}
-		memcpy(wifi_manager_config_sta->sta.password, buff, sz);
-
-		/* settings */
-		sz = sizeof(wifi_settings);
-		esp_err = nvs_get_blob(handle, "settings", buff, &sz);
-		if(esp_err != ESP_OK){
-			free(buff);
-			nvs_sync_unlock();
-			return false;
-		}
-		memcpy(&wifi_settings, buff, sz);
+	/* the ssid is checked against the network actually being joined in wifi_manager_apply_sta_ip_config */
+	if(esp_err != ESP_OK || sz != sizeof(wifi_manager_dhcp_lease) || wifi_manager_dhcp_lease.ip_info.ip.addr == 0 ||
+			wifi_manager_dhcp_lease.ssid[0] == '\0'){
+		return false;
+	}
 
-		free(buff);
-		nvs_close(handle);
-		nvs_sync_unlock();
+	/* expiry can only be checked if both the lease and the current time come from a set clock.
+	 * Otherwise the lease is used and the background revalidation catches a stale address. */
+	time_t now = time(NULL);
+	if(wifi_manager_dhcp_lease.obtained != 0 && now > WIFI_MANAGER_TIME_SET_THRESHOLD && wifi_manager_dhcp_lease.lease_time != 0 &&
+			(int64_t)now - wifi_manager_dhcp_lease.obtained >= (int64_t)wifi_manager_dhcp_lease.lease_time){
+		ESP_LOGI(TAG, "wifi_manager_fetch_dhcp_lease: saved lease has expired");
+		return false;
+	}
 
+	wifi_manager_dhcp_lease_valid = true;
 
-		ESP_LOGI(TAG, "wifi_manager_fetch_wifi_sta_config: ssid:%s password:%s",wifi_manager_config_sta->sta.ssid,wifi_manager_config_sta->sta.password);
-		ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_ssid:%s",wifi_settings.ap_ssid);
-		ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_pwd:%s",wifi_settings.ap_pwd);
-		ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_channel:%i",wifi_settings.ap_channel);
-		ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_hidden (1 = yes):%i",wifi_settings.ap_ssid_hidden);
-		ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: SoftAP_bandwidth (1 = 20MHz, 2 = 40MHz)%i",wifi_settings.ap_bandwidth);
-		ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: sta_only (0 = APSTA, 1 = STA when connected):%i",wifi_settings.sta_only);
-		ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: sta_power_save (1 = yes):%i",wifi_settings.sta_power_save);
-		ESP_LOGD(TAG, "wifi_manager_fetch_wifi_settings: sta_static_ip (0 = dhcp client, 1 = static ip):%i",wifi_settings.sta_static_ip);
+	return wifi_manager_dhcp_lease_valid;
+}
 
-		return wifi_manager_config_sta->sta.ssid[0] != '\0';
+uint32_t wifi_manager_get_got_ip_latency(){
+	return wifi_manager_got_ip_latency;
+}
 
+/**
+ * @brief Starts a new round of automatic connection attempts by ranking the known networks.
+ *
+ * The latest scan results are only taken into account if they are recent enough: an old scan would
+ * favor networks the device may have moved away from.
+ */
+static void wifi_manager_rank_candidates(){
+
+	wifi_manager_candidate_index = 0;
 
+	if(wifi_manager_scan_time != 0 && esp_timer_get_time() - wifi_manager_scan_time < WIFI_MANAGER_SCAN_MAX_AGE){
+		wifi_manager_candidate_count = known_networks_rank(accessp_records, ap_num, wifi_manager_candidates);
 	}
 	else{
-		return false;
+		wifi_manager_candidate_count = known_networks_rank(NULL, 0, wifi_manager_candidates);
+	}
+
+	ESP_LOGI(TAG, "%d known network(s) to try", wifi_manager_candidate_count);
+}
+
+/**
+ * @brief Configures how the STA gets its address for the upcoming connection attempt.
+ *
+ * A configured static IP always wins. Otherwise automatic reconnections to the saved network reuse the
+ * cached DHCP lease, and everything else goes through a regular DHCP exchange.
+ */
+static void wifi_manager_apply_sta_ip_config(connection_request_made_by_code_t request){
+
+	esp_netif_dhcp_status_t dhcp_status = ESP_NETIF_DHCP_INIT;
+	esp_netif_dns_info_t dns;
+	memset(&dns, 0x00, sizeof(dns));
+	dns.ip.type = ESP_IPADDR_TYPE_V4;
+
+	esp_netif_dhcpc_get_status(esp_netif_sta, &dhcp_status);
+	xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_DHCP_LEASE_REUSED_BIT);
+
+	if(wifi_settings.sta_static_ip && wifi_settings.sta_static_ip_config.ip.addr != 0){
+		if(dhcp_status != ESP_NETIF_DHCP_STOPPED){
+			esp_netif_dhcpc_stop(esp_netif_sta);
+		}
+		esp_netif_set_ip_info(esp_netif_sta, &wifi_settings.sta_static_ip_config);
+
+		/* the static configuration carries no DNS server: most gateways relay DNS */
+		dns.ip.u_addr.ip4.addr = wifi_settings.sta_static_ip_config.gw.addr;
+		esp_netif_set_dns_info(esp_netif_sta, ESP_NETIF_DNS_MAIN, &dns);
+		return;
 	}
 
+#ifdef CONFIG_WIFI_MANAGER_DHCP_LEASE_REUSE
+	if(request != CONNECTION_REQUEST_USER && wifi_manager_dhcp_lease_valid &&
+			memcmp(wifi_manager_dhcp_lease.ssid, wifi_manager_config_sta->sta.ssid, sizeof(wifi_manager_dhcp_lease.ssid)) == 0){
+		if(dhcp_status != ESP_NETIF_DHCP_STOPPED){
+			esp_netif_dhcpc_stop(esp_netif_sta);
+		}
+		esp_netif_set_ip_info(esp_netif_sta, &wifi_manager_dhcp_lease.ip_info);
+		if(wifi_manager_dhcp_lease.dns != 0){
+			dns.ip.u_addr.ip4.addr = wifi_manager_dhcp_lease.dns;
+			esp_netif_set_dns_info(esp_netif_sta, ESP_NETIF_DNS_MAIN, &dns);
+		}
+		xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_DHCP_LEASE_REUSED_BIT);
+		ESP_LOGI(TAG, "Reusing saved DHCP lease");
+		return;
+	}
+#endif
+
+	if(dhcp_status == ESP_NETIF_DHCP_STOPPED){
+		esp_netif_dhcpc_start(esp_netif_sta);
+	}
 }
 
 
 void wifi_manager_clear_ip_info_json(){
-	strcpy(ip_info_json, "{}\n");
+	strcpy(json_snapshots_begin(wifi_manager_ip_info_json), "{}\n");
+	json_snapshots_publish(wifi_manager_ip_info_json);
+	http_events_notify();
 }
 
 
@@ -400,7 +757,9 @@ void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code)
 	wifi_config_t *config = wifi_manager_get_wifi_sta_config();
 	if(config){
 
-		const char *ip_info_json_format = ",\"ip\":\"%s\",\"netmask\":\"%s\",\"gw\":\"%s\",\"urc\":%d}\n";
+		/* the new version is written aside: readers keep getting the previous one until it's published */
+		char *ip_info_json = json_snapshots_begin(wifi_manager_ip_info_json);
+		const char *ip_info_json_format = ",\"ip\":\"%s\",\"netmask\":\"%s\",\"gw\":\"%s\",\"urc\":%d,\"gotip_ms\":%u}\n";
 
 		memset(ip_info_json, 0x00, JSON_IP_INFO_SIZE);
 
@@ -428,7 +787,8 @@ void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code)
 					ip,
 					netmask,
 					gw,
-					(int)update_reason_code);
+					(int)update_reason_code,
+					wifi_manager_got_ip_latency);
 		}
 		else{
 			/* notify in the json output the reason code why this was updated without a connection */
@@ -436,8 +796,12 @@ void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code)
 								"0",
 								"0",
 								"0",
-								(int)update_reason_code);
+								(int)update_reason_code,
+								0);
 		}
+
+		json_snapshots_publish(wifi_manager_ip_info_json);
+		http_events_notify();
 	}
 	else{
 		wifi_manager_clear_ip_info_json();
@@ -448,107 +812,187 @@ void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code)
 
 
 void wifi_manager_clear_access_points_json(){
-	strcpy(accessp_json, "[]\n");
+	strcpy(json_snapshots_begin(wifi_manager_ap_list_json), "[]\n");
+	json_snapshots_publish(wifi_manager_ap_list_json);
+	http_events_notify();
 }
 void wifi_manager_generate_acess_points_json(){
 
-	strcpy(accessp_json, "[");
+	const char oneap_str[] = ",\"chan\":%d,\"rssi\":%d,\"auth\":%d},\n";
+	const char ssid_str[] = "{\"ssid\":";
+
+	/* the list is written in a single pass: len is the current end of the list in accessp_json */
+	size_t len = 0;
+	uint16_t written = 0;
+	char *accessp_json = json_snapshots_begin(wifi_manager_ap_list_json);
+	accessp_json[len++] = '[';
 
+	/* the page shows networks, not access points: duplicate SSIDs are removed from a copy of the list */
+	uint16_t unique_num = ap_num;
+	memcpy(accessp_unique_records, accessp_records, sizeof(wifi_ap_record_t) * ap_num);
+	ap_list_filter_unique(accessp_unique_records, &unique_num);
 
-	const char oneap_str[] = ",\"chan\":%d,\"rssi\":%d,\"auth\":%d}%c\n";
+	for(int i=0; i<unique_num;i++){
 
-	/* stack buffer to hold on to one AP until it's copied over to accessp_json */
-	char one_ap[JSON_ONE_APP_SIZE];
-	for(int i=0; i<ap_num;i++){
+		wifi_ap_record_t *ap = &accessp_unique_records[i];
 
-		wifi_ap_record_t ap = accessp_records[i];
+		/* worst case for the rest of the record once the ssid is printed. 2 bytes are kept for closing the list */
+		size_t ssid_len = json_escaped_length( (unsigned char*)ap->ssid );
+		if(len + sizeof(ssid_str) - 1 + ssid_len + sizeof(",\"chan\":255,\"rssi\":-128,\"auth\":255},\n") + 2 > JSON_ACCESS_POINTS_SIZE){
+			ESP_LOGW(TAG, "access point list truncated to %d entries", written);
+			break;
+		}
+
+		memcpy(accessp_json + len, ssid_str, sizeof(ssid_str) - 1);
+		len += sizeof(ssid_str) - 1;
 
 		/* ssid needs to be json escaped. To save on heap memory it's directly printed at the correct address */
-		strcat(accessp_json, "{\"ssid\":");
-		json_print_string( (unsigned char*)ap.ssid,  (unsigned char*)(accessp_json+strlen(accessp_json)) );
+		json_print_string( (unsigned char*)ap->ssid,  (unsigned char*)(accessp_json + len) );
+		len += ssid_len;
 
 		/* print the rest of the json for this access point: no more string to escape */
-		snprintf(one_ap, (size_t)JSON_ONE_APP_SIZE, oneap_str,
-				ap.primary,
-				ap.rssi,
-				ap.authmode,
-				i==ap_num-1?']':',');
-
-		/* add it to the list */
-		strcat(accessp_json, one_ap);
+		len += snprintf(accessp_json + len, JSON_ACCESS_POINTS_SIZE - len, oneap_str,
+				ap->primary,
+				ap->rssi,
+				ap->authmode);
+		written++;
+	}
+
+	if(written > 0){
+		/* replace the trailing ",\n" of the last record */
+		len -= 2;
 	}
+	accessp_json[len++] = ']';
+	accessp_json[len++] = '\n';
+	accessp_json[len] = '\0';
 
+	/* the entity tag of the new version is computed on publication */
+	json_snapshots_publish(wifi_manager_ap_list_json);
+	http_events_notify();
 }
 
 
 
-bool wifi_manager_lock_sta_ip_string(TickType_t xTicksToWait){
-	if(wifi_manager_sta_ip_mutex){
-		if( xSemaphoreTake( wifi_manager_sta_ip_mutex, xTicksToWait ) == pdTRUE ) {
-			return true;
-		}
-		else{
-			return false;
-		}
-	}
-	else{
-		return false;
-	}
+void wifi_manager_set_sta_ip(uint32_t ip){
+
+	atomic_store(&wifi_manager_sta_ip, ip);
 
+	esp_ip4_addr_t ip4;
+	ip4.addr = ip;
+	ESP_LOGI(TAG, "Set STA IP to: " IPSTR, IP2STR(&ip4));
 }
-void wifi_manager_unlock_sta_ip_string(){
-	xSemaphoreGive( wifi_manager_sta_ip_mutex );
+
+uint32_t wifi_manager_get_sta_ip(){
+	return atomic_load_explicit(&wifi_manager_sta_ip, memory_order_relaxed);
 }
 
-void wifi_manager_safe_update_sta_ip_string(uint32_t ip){
+uint32_t wifi_manager_get_ap_ip(){
+	return atomic_load_explicit(&wifi_manager_ap_ip, memory_order_relaxed);
+}
 
-	if(wifi_manager_lock_sta_ip_string(portMAX_DELAY)){
 
-		esp_ip4_addr_t ip4;
-		ip4.addr = ip;
+const struct json_snapshot_t* wifi_manager_acquire_ap_list_json(){
+	return json_snapshots_acquire(wifi_manager_ap_list_json);
+}
 
-		char str_ip[IP4ADDR_STRLEN_MAX];
-		esp_ip4addr_ntoa(&ip4, str_ip, IP4ADDR_STRLEN_MAX);
+const struct json_snapshot_t* wifi_manager_acquire_ip_info_json(){
+	return json_snapshots_acquire(wifi_manager_ip_info_json);
+}
 
-		strcpy(wifi_manager_sta_ip, str_ip);
+void wifi_manager_release_json(const struct json_snapshot_t *snapshot){
+	json_snapshots_release(snapshot);
+}
 
-		ESP_LOGI(TAG, "Set STA IP String to: %s", wifi_manager_sta_ip);
 
-		wifi_manager_unlock_sta_ip_string();
-	}
+/**
+ * @brief Standard wifi event handler
+ */
+static uint8_t wifi_manager_state_event_index(message_code_t code){
+	return code == WM_EVENT_SCAN_DONE ? 0 : code == WM_EVENT_STA_DISCONNECTED ? 1 : 2;
 }
 
-char* wifi_manager_get_sta_ip_string(){
-	return wifi_manager_sta_ip;
-}
+/**
+ * @brief Posts a state event to the wifi_manager task, which must never lose one: it would wait forever for a
+ * scan to end or keep believing it is connected.
+ *
+ * The event normally goes through the queue with its payload in a block of the pool. When either is full the
+ * event is deferred instead, counted and logged. Later state events are deferred as well until the wifi_manager
+ * task replays the deferred ones, so that none of them overtakes another.
+ * The wifi_manager task cannot be asleep on an empty queue while an event is deferred: deferring means that
+ * the queue is full, or that every block of the pool is waiting in the queue.
+ */
+static void wifi_manager_post_state_event(message_code_t code, const void *event_data, size_t size){
+
+	taskENTER_CRITICAL(&wifi_manager_deferred_mux);
+	bool deferring = wifi_manager_deferred.count > 0;
+	taskEXIT_CRITICAL(&wifi_manager_deferred_mux);
+
+	if(!deferring){
+		void *payload = payload_pool_alloc();
+		if(payload){
+			memcpy(payload, event_data, size);
+			if(wifi_manager_send_message(code, payload) == pdTRUE){
+				return;
+			}
+			payload_pool_free(payload);
+		}
+	}
 
+	struct wifi_manager_queue_stats_t stats;
+	message_ring_get_stats(wifi_manager_queue, &stats);
+	uint8_t index = wifi_manager_state_event_index(code);
 
-bool wifi_manager_lock_json_buffer(TickType_t xTicksToWait){
-	if(wifi_manager_json_mutex){
-		if( xSemaphoreTake( wifi_manager_json_mutex, xTicksToWait ) == pdTRUE ) {
-			return true;
-		}
-		else{
-			return false;
-		}
+	taskENTER_CRITICAL(&wifi_manager_deferred_mux);
+	if(wifi_manager_deferred.count == 0){
+		wifi_manager_deferred.mark = stats.pushed;
 	}
-	else{
-		return false;
+	/* an older event of the same kind is replaced, and moves to the end of the replay order */
+	uint8_t kept = 0;
+	for(uint8_t i=0; i<wifi_manager_deferred.count; i++){
+		if(wifi_manager_deferred.order[i] != code){
+			wifi_manager_deferred.order[kept++] = wifi_manager_deferred.order[i];
+		}
 	}
+	wifi_manager_deferred.order[kept] = code;
+	wifi_manager_deferred.count = kept + 1;
+	memcpy(&wifi_manager_deferred.payload[index], event_data, size);
+	taskEXIT_CRITICAL(&wifi_manager_deferred_mux);
 
-}
-void wifi_manager_unlock_json_buffer(){
-	xSemaphoreGive( wifi_manager_json_mutex );
+	uint32_t total = atomic_fetch_add(&wifi_manager_deferred_total, 1) + 1;
+	ESP_LOGW(TAG, "message queue or payload pool full: event %d deferred (%u so far)", code, total);
 }
 
-char* wifi_manager_get_ap_list_json(){
-	return accessp_json;
-}
+/**
+ * @brief Takes the oldest deferred state event, once the messages queued before it have all been handled.
+ * @return true if msg holds a deferred event. Its param points to wifi_manager_deferred_payload.
+ */
+static bool wifi_manager_take_deferred_event(queue_message *msg){
+
+	bool taken = false;
+
+	taskENTER_CRITICAL(&wifi_manager_deferred_mux);
+	if(wifi_manager_deferred.count > 0 && (int32_t)(wifi_manager_popped - wifi_manager_deferred.mark) >= 0){
+		msg->code = wifi_manager_deferred.order[0];
+		msg->param = &wifi_manager_deferred_payload;
+		memcpy(&wifi_manager_deferred_payload, &wifi_manager_deferred.payload[wifi_manager_state_event_index(msg->code)], sizeof(wifi_manager_deferred_payload));
+		wifi_manager_deferred.count--;
+		memmove(&wifi_manager_deferred.order[0], &wifi_manager_deferred.order[1], sizeof(message_code_t) * wifi_manager_deferred.count);
+		taken = true;
+	}
+	taskEXIT_CRITICAL(&wifi_manager_deferred_mux);
 
+	return taken;
+}
 
 /**
- * @brief Standard wifi event handler
+ * @brief Gives the payload of a state event back, to the pool unless it was deferred.
  */
+static void wifi_manager_free_payload(void *payload){
+	if(payload != &wifi_manager_deferred_payload){
+		payload_pool_free(payload);
+	}
+}
+
 static void wifi_manager_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data){
 
 
@@ -577,9 +1021,7 @@ static void wifi_manager_event_handler(void* arg, esp_event_base_t event_base, i
 		case WIFI_EVENT_SCAN_DONE:
 			ESP_LOGD(TAG, "WIFI_EVENT_SCAN_DONE");
 	    	xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_SCAN_BIT);
-			wifi_event_sta_scan_done_t* event_sta_scan_done = (wifi_event_sta_scan_done_t*)malloc(sizeof(wifi_event_sta_scan_done_t));
-			*event_sta_scan_done = *((wifi_event_sta_scan_done_t*)event_data);
-	    	wifi_manager_send_message(WM_EVENT_SCAN_DONE, event_sta_scan_done);
+			wifi_manager_post_state_event(WM_EVENT_SCAN_DONE, event_data, sizeof(wifi_event_sta_scan_done_t));
 			break;
 
 		/* If esp_wifi_start() returns ESP_OK and the current Wi-Fi mode is Station or AP+Station, then this event will
@@ -653,14 +1095,11 @@ static void wifi_manager_event_handler(void* arg, esp_event_base_t event_base, i
 		case WIFI_EVENT_STA_DISCONNECTED:
 			ESP_LOGI(TAG, "WIFI_EVENT_STA_DISCONNECTED");
 
-			wifi_event_sta_disconnected_t* wifi_event_sta_disconnected = (wifi_event_sta_disconnected_t*)malloc(sizeof(wifi_event_sta_disconnected_t));
-			*wifi_event_sta_disconnected =  *( (wifi_event_sta_disconnected_t*)event_data );
-
 			/* if a DISCONNECT message is posted while a scan is in progress this scan will NEVER end, causing scan to never work again. For this reason SCAN_BIT is cleared too */
 			xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_WIFI_CONNECTED_BIT | WIFI_MANAGER_SCAN_BIT);
 
 			/* post disconnect event with reason code */
-			wifi_manager_send_message(WM_EVENT_STA_DISCONNECTED, (void*)wifi_event_sta_disconnected );
+			wifi_manager_post_state_event(WM_EVENT_STA_DISCONNECTED, event_data, sizeof(wifi_event_sta_disconnected_t));
 			break;
 
 		/* This event arises when the AP to which the station is connected changes its authentication mode, e.g., from no auth
@@ -723,9 +1162,7 @@ static void wifi_manager_event_handler(void* arg, esp_event_base_t event_base, i
 		case IP_EVENT_STA_GOT_IP:
 			ESP_LOGI(TAG, "IP_EVENT_STA_GOT_IP");
 	        xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_WIFI_CONNECTED_BIT);
-	        ip_event_got_ip_t* ip_event_got_ip = (ip_event_got_ip_t*)malloc(sizeof(ip_event_got_ip_t));
-			*ip_event_got_ip =  *( (ip_event_got_ip_t*)event_data );
-	        wifi_manager_send_message(WM_EVENT_STA_GOT_IP, (void*)(ip_event_got_ip) );
+			wifi_manager_post_state_event(WM_EVENT_STA_GOT_IP, event_data, sizeof(ip_event_got_ip_t));
 			break;
 
 		/* This event arises when the IPV6 SLAAC support auto-configures an address for the ESP32, or when this address changes.
@@ -760,46 +1197,35 @@ void wifi_manager_connect_async(){
 	 * There'se a risk the front end sees an IP or a password error when in fact
 	 * it's a remnant from a previous connection
 	 */
-	if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
-		wifi_manager_clear_ip_info_json();
-		wifi_manager_unlock_json_buffer();
-	}
+	wifi_manager_clear_ip_info_json();
 	wifi_manager_send_message(WM_ORDER_CONNECT_STA, (void*)CONNECTION_REQUEST_USER);
 }
 
 
-char* wifi_manager_get_ip_info_json(){
-	return ip_info_json;
-}
-
-
 void wifi_manager_destroy(){
 
 	vTaskDelete(task_wifi_manager);
 	task_wifi_manager = NULL;
+	event_dispatcher_stop();
 
 	/* heap buffers */
 	free(accessp_records);
 	accessp_records = NULL;
-	free(accessp_json);
-	accessp_json = NULL;
-	free(ip_info_json);
-	ip_info_json = NULL;
-	free(wifi_manager_sta_ip);
-	wifi_manager_sta_ip = NULL;
+	free(accessp_unique_records);
+	accessp_unique_records = NULL;
+	json_snapshots_delete(wifi_manager_ap_list_json);
+	wifi_manager_ap_list_json = NULL;
+	json_snapshots_delete(wifi_manager_ip_info_json);
+	wifi_manager_ip_info_json = NULL;
 	if(wifi_manager_config_sta){
 		free(wifi_manager_config_sta);
 		wifi_manager_config_sta = NULL;
 	}
 
 	/* RTOS objects */
-	vSemaphoreDelete(wifi_manager_json_mutex);
-	wifi_manager_json_mutex = NULL;
-	vSemaphoreDelete(wifi_manager_sta_ip_mutex);
-	wifi_manager_sta_ip_mutex = NULL;
 	vEventGroupDelete(wifi_manager_event_group);
 	wifi_manager_event_group = NULL;
-	vQueueDelete(wifi_manager_queue);
+	message_ring_delete(wifi_manager_queue);
 	wifi_manager_queue = NULL;
 
 
@@ -807,79 +1233,183 @@ void wifi_manager_destroy(){
 
 
 void wifi_manager_filter_unique( wifi_ap_record_t * aplist, uint16_t * aps) {
-	int total_unique;
-	wifi_ap_record_t * first_free;
-	total_unique=*aps;
-
-	first_free=NULL;
-
-	for(int i=0; i<*aps-1;i++) {
-		wifi_ap_record_t * ap = &aplist[i];
-
-		/* skip the previously removed APs */
-		if (ap->ssid[0] == 0) continue;
-
-		/* remove the identical SSID+authmodes */
-		for(int j=i+1; j<*aps;j++) {
-			wifi_ap_record_t * ap1 = &aplist[j];
-			if ( (strcmp((const char *)ap->ssid, (const char *)ap1->ssid)==0) && 
-			     (ap->authmode == ap1->authmode) ) { /* same SSID, different auth mode is skipped */
-				/* save the rssi for the display */
-				if ((ap1->rssi) > (ap->rssi)) ap->rssi=ap1->rssi;
-				/* clearing the record */
-				memset(ap1,0, sizeof(wifi_ap_record_t));
-			}
-		}
-	}
-	/* reorder the list so APs follow each other in the list */
-	for(int i=0; i<*aps;i++) {
-		wifi_ap_record_t * ap = &aplist[i];
-		/* skipping all that has no name */
-		if (ap->ssid[0] == 0) {
-			/* mark the first free slot */
-			if (first_free==NULL) first_free=ap;
-			total_unique--;
-			continue;
-		}
-		if (first_free!=NULL) {
-			memcpy(first_free, ap, sizeof(wifi_ap_record_t));
-			memset(ap,0, sizeof(wifi_ap_record_t));
-			/* find the next free slot */
-			for(int j=0; j<*aps;j++) {
-				if (aplist[j].ssid[0]==0) {
-					first_free=&aplist[j];
-					break;
-				}
-			}
-		}
-	}
-	/* update the length of the list */
-	*aps = total_unique;
+	ap_list_filter_unique(aplist, aps);
 }
 
 
 BaseType_t wifi_manager_send_message_to_front(message_code_t code, void *param){
-	queue_message msg;
-	msg.code = code;
-	msg.param = param;
-	return xQueueSendToFront( wifi_manager_queue, &msg, portMAX_DELAY);
+	return wifi_manager_send_message(code, param);
 }
 
 BaseType_t wifi_manager_send_message(message_code_t code, void *param){
 	queue_message msg;
 	msg.code = code;
 	msg.param = param;
-	return xQueueSend( wifi_manager_queue, &msg, portMAX_DELAY);
+	bool coalesce = param == NULL && (WIFI_MANAGER_COALESCED_MESSAGES & (1u << code)) != 0;
+	if(message_ring_push( wifi_manager_queue, &msg, coalesce )){
+		return pdTRUE;
+	}
+	else{
+		ESP_LOGW(TAG, "message queue full, message %d dropped", code);
+		return pdFALSE;
+	}
 }
 
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+/**
+ * @brief Smooths the signal of the connected AP and, when it stays weak, scans for another AP of the same network.
+ *
+ * Channels are only scanned for the current SSID, with the per-channel dwell time, and no more often than
+ * WIFI_MANAGER_ROAM_SCAN_INTERVAL. Nothing is done while another scan or a connection attempt is in progress.
+ */
+static void wifi_manager_check_roaming(){
 
-void wifi_manager_set_callback(message_code_t message_code, void (*func_ptr)(void*) ){
+	EventBits_t uxBits = xEventGroupGetBits(wifi_manager_event_group);
+	if( !(uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT) || (uxBits & (WIFI_MANAGER_SCAN_BIT | WIFI_MANAGER_ROAMING_BIT)) ||
+			wifi_manager_scan_channel != 0 || wifi_manager_connect_start_time != 0){
+		return;
+	}
+
+	wifi_ap_record_t ap_info;
+	if(esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK){
+		return;
+	}
+
+	/* exponential moving average: a single weak sample does not trigger a scan */
+	wifi_manager_roam_stats.rssi = (int8_t)((3 * (int)wifi_manager_roam_stats.rssi + (int)ap_info.rssi) / 4);
 
-	if(cb_ptr_arr && message_code < WM_MESSAGE_CODE_COUNT){
-		cb_ptr_arr[message_code] = func_ptr;
+	int64_t now = esp_timer_get_time();
+	if(wifi_manager_roam_stats.rssi >= WIFI_MANAGER_ROAM_RSSI_THRESHOLD ||
+			(wifi_manager_roam_scan_time != 0 && now - wifi_manager_roam_scan_time < (int64_t)WIFI_MANAGER_ROAM_SCAN_INTERVAL * 1000)){
+		return;
+	}
+
+	ESP_LOGI(TAG, "Weak signal (%d dBm): looking for a stronger access point", wifi_manager_roam_stats.rssi);
+	wifi_manager_roam_scan_time = now;
+	if(wifi_manager_start_scan(0, wifi_manager_config_sta->sta.ssid) == ESP_OK){
+		wifi_manager_roam_scan = true;
+		wifi_manager_roam_stats.scans++;
 	}
 }
 
+/**
+ * @brief Picks the strongest other AP of the current network from the results of a roaming scan and leaves the
+ * current AP if it is stronger by at least WIFI_MANAGER_ROAM_HYSTERESIS.
+ */
+static void wifi_manager_evaluate_roam(){
+
+	wifi_ap_record_t ap_info;
+	wifi_ap_record_t records[WIFI_MANAGER_ROAM_MAX_CANDIDATES];
+	uint16_t num = WIFI_MANAGER_ROAM_MAX_CANDIDATES;
+
+	/* reading the results also frees them in the driver */
+	if(esp_wifi_scan_get_ap_records(&num, records) != ESP_OK || esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK){
+		return;
+	}
+
+	wifi_ap_record_t *best = NULL;
+	for(uint16_t i=0; i<num; i++){
+		if(memcmp(records[i].bssid, ap_info.bssid, sizeof(ap_info.bssid)) != 0 &&
+				strcmp((char*)records[i].ssid, (char*)ap_info.ssid) == 0 &&
+				records[i].rssi >= ap_info.rssi + WIFI_MANAGER_ROAM_HYSTERESIS &&
+				(best == NULL || records[i].rssi > best->rssi)){
+			best = &records[i];
+		}
+	}
+
+	if(best == NULL){
+		ESP_LOGD(TAG, "No access point stronger than %d dBm", ap_info.rssi);
+		return;
+	}
+
+	ESP_LOGI(TAG, "Roaming from "MACSTR" (%d dBm) to "MACSTR" (%d dBm) on channel %d",
+			MAC2STR(ap_info.bssid), ap_info.rssi, MAC2STR(best->bssid), best->rssi, best->primary);
+	memcpy(wifi_manager_roam_bssid, best->bssid, sizeof(wifi_manager_roam_bssid));
+	wifi_manager_roam_channel = best->primary;
+	wifi_manager_roam_stats.last_rssi_before = ap_info.rssi;
+	wifi_manager_roam_start_time = esp_timer_get_time();
+
+	/* the reassociation itself happens once the disconnection from the current AP is processed */
+	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_ROAMING_BIT);
+	esp_wifi_disconnect();
+}
+
+/**
+ * @brief Connects to the AP chosen by wifi_manager_evaluate_roam with a directed connect, reusing the current DHCP lease.
+ */
+static void wifi_manager_roam_reassociate(){
+
+	wifi_config_t sta_config = *wifi_manager_get_wifi_sta_config();
+	sta_config.sta.bssid_set = true;
+	memcpy(sta_config.sta.bssid, wifi_manager_roam_bssid, sizeof(sta_config.sta.bssid));
+	sta_config.sta.channel = wifi_manager_roam_channel;
+	ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &sta_config));
+
+	/* same network, same lease: the address is usable as soon as the STA is associated */
+	wifi_manager_apply_sta_ip_config(CONNECTION_REQUEST_AUTO_RECONNECT);
+
+	/* the reassociation time is measured from the moment the old AP was left */
+	wifi_manager_connect_start_time = wifi_manager_roam_start_time;
+	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_FAST_CONNECT_BIT);
+	ESP_ERROR_CHECK(esp_wifi_connect());
+}
+#endif
+
+void wifi_manager_get_queue_stats(struct wifi_manager_queue_stats_t *stats){
+	message_ring_get_stats(wifi_manager_queue, stats);
+	stats->deferred = atomic_load(&wifi_manager_deferred_total);
+}
+
+void wifi_manager_get_payload_pool_stats(struct wifi_manager_payload_pool_stats_t *stats){
+	payload_pool_get_stats(stats);
+}
+
+void wifi_manager_set_profile_async(wifi_profile_id_t profile){
+	if((unsigned)profile < WIFI_PROFILE_COUNT){
+		wifi_manager_send_message(WM_ORDER_SET_WIFI_PROFILE, (void*)(WIFI_PROFILE_REQUEST_SAVE | profile));
+	}
+}
+
+void wifi_manager_override_profile_async(wifi_profile_id_t profile){
+	if((unsigned)profile < WIFI_PROFILE_COUNT){
+		wifi_manager_send_message(WM_ORDER_SET_WIFI_PROFILE, (void*)(WIFI_PROFILE_REQUEST_OVERRIDE | profile));
+	}
+}
+
+void wifi_manager_restore_profile_async(){
+	wifi_manager_send_message(WM_ORDER_SET_WIFI_PROFILE, (void*)WIFI_PROFILE_REQUEST_RESTORE);
+}
+
+wifi_profile_id_t wifi_manager_get_profile(){
+	return (wifi_profile_id_t)atomic_load(&wifi_manager_profile);
+}
+
+void wifi_manager_get_roam_stats(struct wifi_manager_roam_stats_t *stats){
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+	/* fields are only written by the wifi manager task: a torn read at worst mixes two consecutive roams */
+	memcpy(stats, &wifi_manager_roam_stats, sizeof(struct wifi_manager_roam_stats_t));
+#else
+	memset(stats, 0x00, sizeof(struct wifi_manager_roam_stats_t));
+#endif
+}
+
+
+void wifi_manager_set_callback(message_code_t message_code, void (*func_ptr)(void*) ){
+	wifi_manager_subscribe(message_code, func_ptr, NULL);
+}
+
+esp_err_t wifi_manager_subscribe(message_code_t message_code, void (*func_ptr)(void*), const char *name){
+	return event_dispatcher_subscribe(message_code, func_ptr, name);
+}
+
+esp_err_t wifi_manager_unsubscribe(message_code_t message_code, void (*func_ptr)(void*)){
+	return event_dispatcher_unsubscribe(message_code, func_ptr);
+}
+
+bool wifi_manager_get_subscriber_stats(uint8_t index, struct wifi_manager_subscriber_stats_t *stats){
+	return event_dispatcher_get_stats(index, stats);
+}
+
 esp_netif_t* wifi_manager_get_esp_netif_ap(){
 	return esp_netif_ap;
 }
@@ -894,7 +1424,6 @@ void wifi_manager( void * pvParameters ){
 	queue_message msg;
 	BaseType_t xStatus;
 	EventBits_t uxBits;
-	uint8_t	retries = 0;
 
 
 	/* initialize the tcp stack */
@@ -907,8 +1436,14 @@ void wifi_manager( void * pvParameters ){
 	esp_netif_ap = esp_netif_create_default_wifi_ap();
 
 
-	/* default wifi config */
+	/* the configuration is read once, here: the driver buffers can only be sized now and they follow the saved
+	 * profile. ORDER_LOAD_AND_RESTORE_STA then works from what was read */
+	const bool sta_config_found = wifi_manager_fetch_wifi_sta_config();
+	atomic_store(&wifi_manager_profile, wifi_settings.profile);
+
+	/* default wifi config, adjusted by the profile */
 	wifi_init_config_t wifi_init_config = WIFI_INIT_CONFIG_DEFAULT();
+	wifi_profile_init_config(wifi_settings.profile, &wifi_init_config);
 	ESP_ERROR_CHECK(esp_wifi_init(&wifi_init_config));
 	ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
 
@@ -950,12 +1485,12 @@ void wifi_manager( void * pvParameters ){
 	inet_pton(AF_INET, DEFAULT_AP_GATEWAY, &ap_ip_info.gw);
 	inet_pton(AF_INET, DEFAULT_AP_NETMASK, &ap_ip_info.netmask);
 	ESP_ERROR_CHECK(esp_netif_set_ip_info(esp_netif_ap, &ap_ip_info));
+	atomic_store(&wifi_manager_ap_ip, ap_ip_info.ip.addr);
 	ESP_ERROR_CHECK(esp_netif_dhcps_start(esp_netif_ap));
 
 	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
 	ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &ap_config));
-	ESP_ERROR_CHECK(esp_wifi_set_bandwidth(WIFI_IF_AP, wifi_settings.ap_bandwidth));
-	ESP_ERROR_CHECK(esp_wifi_set_ps(wifi_settings.sta_power_save));
+	ESP_ERROR_CHECK(wifi_profile_apply(wifi_settings.profile, &wifi_settings));
 
 
 	/* by default the mode is STA because wifi_manager will not start the access point unless it has to! */
@@ -965,70 +1500,170 @@ void wifi_manager( void * pvParameters ){
 	/* start http server */
 	http_app_start(false);
 
-	/* wifi scanner config */
-	wifi_scan_config_t scan_config = {
-		.ssid = 0,
-		.bssid = 0,
-		.channel = 0,
-		.show_hidden = true
-	};
-
 	/* enqueue first event: load previous config */
 	wifi_manager_send_message(WM_ORDER_LOAD_AND_RESTORE_STA, NULL);
 
 
 	/* main processing loop */
 	for(;;){
-		xStatus = xQueueReceive( wifi_manager_queue, &msg, portMAX_DELAY );
+		/* deferred state events go first, as soon as the messages queued before them are handled */
+		if(wifi_manager_take_deferred_event(&msg)){
+			xStatus = pdPASS;
+		}
+		else if(message_ring_pop( wifi_manager_queue, &msg, portMAX_DELAY )){
+			wifi_manager_popped++;
+			xStatus = pdPASS;
+		}
+		else{
+			xStatus = pdFAIL;
+		}
 
 		if( xStatus == pdPASS ){
 			switch(msg.code){
 
 			case WM_EVENT_SCAN_DONE:{
 				wifi_event_sta_scan_done_t *evt_scan_done = (wifi_event_sta_scan_done_t*)msg.param;
+
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+				/* a scan restricted to the current network only decides whether to roam: the list of access points is left untouched */
+				if(wifi_manager_roam_scan){
+					wifi_manager_roam_scan = false;
+					if(evt_scan_done->status == 0){
+						wifi_manager_evaluate_roam();
+					}
+					event_dispatcher_post(msg.code, msg.param);
+					wifi_manager_free_payload(evt_scan_done);
+					break;
+				}
+#endif
+
+				/* the scan of one channel of a sweep abandoned in the meantime, e.g. by a connection attempt: its results
+				 * would replace the whole list, and the list is not a complete scan either */
+				if(wifi_manager_scan_single_channel && wifi_manager_scan_channel == 0){
+					wifi_manager_scan_single_channel = false;
+					if(evt_scan_done->status == 0){
+						/* the driver keeps the results until they are read */
+						wifi_ap_record_t dropped;
+						uint16_t dropped_num = 1;
+						esp_wifi_scan_get_ap_records(&dropped_num, &dropped);
+					}
+					ESP_LOGD(TAG, "results of an abandoned sweep dropped");
+					event_dispatcher_post(msg.code, msg.param);
+					wifi_manager_free_payload(evt_scan_done);
+					break;
+				}
+				wifi_manager_scan_single_channel = false;
+
 				/* only check for AP if the scan is succesful */
 				if(evt_scan_done->status == 0){
-					/* As input param, it stores max AP number ap_records can hold. As output param, it receives the actual AP number this API returns.
-					* As a consequence, ap_num MUST be reset to MAX_AP_NUM at every scan */
-					ap_num = MAX_AP_NUM;
-					ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_num, accessp_records));
-					/* make sure the http server isn't trying to access the list while it gets refreshed */
-					if(wifi_manager_lock_json_buffer( pdMS_TO_TICKS(1000) )){
-						/* Will remove the duplicate SSIDs from the list and update ap_num */
-						wifi_manager_filter_unique(accessp_records, &ap_num);
-						wifi_manager_generate_acess_points_json();
-						wifi_manager_unlock_json_buffer();
+					if(wifi_manager_scan_channel == 0){
+						/* As input param, it stores max AP number ap_records can hold. As output param, it receives the actual AP number this API returns.
+						* As a consequence, ap_num MUST be reset to MAX_AP_NUM at every scan */
+						ap_num = MAX_AP_NUM;
+						ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_num, accessp_records));
 					}
 					else{
-						ESP_LOGE(TAG, "could not get access to json mutex in wifi_scan");
+						/* one channel of a per-channel sweep: the list is updated incrementally */
+						wifi_manager_merge_channel_records(wifi_manager_scan_channel);
 					}
+					wifi_manager_generate_acess_points_json();
+				}
+
+				if(wifi_manager_scan_channel != 0){
+					wifi_manager_scan_next_channel(evt_scan_done->status == 0);
+				}
+				else if(evt_scan_done->status == 0){
+					wifi_manager_scan_time = esp_timer_get_time();
 				}
 
 				/* callback */
-				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])( msg.param );
-				free(evt_scan_done);
+				event_dispatcher_post(msg.code, msg.param);
+				wifi_manager_free_payload(evt_scan_done);
 				}
 				break;
 
 			case WM_ORDER_START_WIFI_SCAN:
-				ESP_LOGD(TAG, "MESSAGE: ORDER_START_WIFI_SCAN");
+			case WM_ORDER_START_BACKGROUND_SCAN:
+				ESP_LOGD(TAG, "MESSAGE: ORDER_START_%sSCAN", msg.code == WM_ORDER_START_BACKGROUND_SCAN ? "BACKGROUND_" : "WIFI_");
 
-				/* if a scan is already in progress this message is simply ignored thanks to the WIFI_MANAGER_SCAN_BIT uxBit */
+				/* if a scan is already in progress this message is simply ignored thanks to the WIFI_MANAGER_SCAN_BIT uxBit.
+				 * Same thing if the current results are recent enough: they are served from cache. */
 				uxBits = xEventGroupGetBits(wifi_manager_event_group);
-				if(! (uxBits & WIFI_MANAGER_SCAN_BIT) ){
-					xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_SCAN_BIT);
-					ESP_ERROR_CHECK(esp_wifi_scan_start(&scan_config, false));
+				const scan_request_made_by_code_t request = msg.code == WM_ORDER_START_BACKGROUND_SCAN ?
+						SCAN_REQUEST_BACKGROUND : (scan_request_made_by_code_t)msg.param;
+				if( (uxBits & WIFI_MANAGER_SCAN_BIT) || wifi_manager_scan_channel != 0 ){
+					ESP_LOGD(TAG, "Scan already in progress");
+				}
+				else if( request != SCAN_REQUEST_FULL && request != SCAN_REQUEST_PER_CHANNEL &&
+						wifi_manager_scan_time != 0 && esp_timer_get_time() - wifi_manager_scan_time < (int64_t)WIFI_MANAGER_SCAN_CACHE_TTL * 1000 ){
+					ESP_LOGD(TAG, "Scan results are still fresh");
+				}
+				else{
+					/* background scans never sweep all channels in one go: the STA would be off channel for too long */
+#ifdef CONFIG_WIFI_MANAGER_SCAN_PER_CHANNEL
+					bool per_channel = request != SCAN_REQUEST_FULL;
+#else
+					bool per_channel = request == SCAN_REQUEST_BACKGROUND || request == SCAN_REQUEST_PER_CHANNEL;
+#endif
+					wifi_country_t country;
+					if(per_channel && esp_wifi_get_country(&country) == ESP_OK && country.nchan > 0){
+						wifi_manager_scan_channel = country.schan;
+					}
+					wifi_manager_start_scan(wifi_manager_scan_channel, NULL);
 				}
 
 				/* callback */
-				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])(NULL);
+				event_dispatcher_post(msg.code, NULL);
+
+				break;
+
+			case WM_ORDER_SCAN_NEXT_CHANNEL:
+				ESP_LOGD(TAG, "MESSAGE: ORDER_SCAN_NEXT_CHANNEL");
+
+				/* the sweep may have been abandoned during the gap, e.g. by a connection attempt */
+				uxBits = xEventGroupGetBits(wifi_manager_event_group);
+				if(wifi_manager_scan_channel != 0 && !(uxBits & WIFI_MANAGER_SCAN_BIT)){
+					wifi_manager_scan_channel++;
+					wifi_manager_start_scan(wifi_manager_scan_channel, NULL);
+				}
+
+				/* callback */
+				event_dispatcher_post(msg.code, NULL);
+
+				break;
+
+			case WM_ORDER_CHECK_ROAMING:
+				ESP_LOGD(TAG, "MESSAGE: ORDER_CHECK_ROAMING");
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+				wifi_manager_check_roaming();
+#endif
+				/* callback */
+				event_dispatcher_post(msg.code, NULL);
+
+				break;
+
+			case WM_ORDER_SAMPLE_TELEMETRY:
+				ESP_LOGD(TAG, "MESSAGE: ORDER_SAMPLE_TELEMETRY");
+				uxBits = xEventGroupGetBits(wifi_manager_event_group);
+				if(uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT){
+					link_telemetry_sample();
+				}
+
+				/* callback */
+				event_dispatcher_post(msg.code, NULL);
 
 				break;
 
 			case WM_ORDER_LOAD_AND_RESTORE_STA:
 				ESP_LOGI(TAG, "MESSAGE: ORDER_LOAD_AND_RESTORE_STA");
-				if(wifi_manager_fetch_wifi_sta_config()){
+				known_networks_load();
+				if(sta_config_found){
+					/* credentials saved by a firmware that did not know about the known networks store */
+					known_networks_add(wifi_manager_config_sta->sta.ssid, wifi_manager_config_sta->sta.password);
+				}
+				if(known_networks_count() > 0){
 					ESP_LOGI(TAG, "Saved wifi found on startup. Will attempt to connect.");
+					wifi_manager_fetch_dhcp_lease();
 					wifi_manager_send_message(WM_ORDER_CONNECT_STA, (void*)CONNECTION_REQUEST_RESTORE_CONNECTION);
 				}
 				else{
@@ -1038,7 +1673,7 @@ void wifi_manager( void * pvParameters ){
 				}
 
 				/* callback */
-				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])(NULL);
+				event_dispatcher_post(msg.code, NULL);
 
 				break;
 
@@ -1058,19 +1693,65 @@ void wifi_manager( void * pvParameters ){
 
 				uxBits = xEventGroupGetBits(wifi_manager_event_group);
 				if( ! (uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT) ){
+					struct known_network_t *known_network = NULL;
+
+					/* automatic connections go through the known networks in ranked order. A user request
+					 * aborts any such round: the user may have picked a network we never connected to. */
+					if((BaseType_t)msg.param == CONNECTION_REQUEST_USER){
+						wifi_manager_candidate_count = 0;
+					}
+					else if(known_networks_count() > 0){
+						if(wifi_manager_candidate_count == 0){
+							wifi_manager_rank_candidates();
+						}
+						known_network = known_networks_get(wifi_manager_candidates[wifi_manager_candidate_index]);
+						if(known_network){
+							memcpy(wifi_manager_config_sta->sta.ssid, known_network->ssid, sizeof(wifi_manager_config_sta->sta.ssid));
+							memcpy(wifi_manager_config_sta->sta.password, known_network->password, sizeof(wifi_manager_config_sta->sta.password));
+							ESP_LOGI(TAG, "Trying known network %s", (char*)known_network->ssid);
+						}
+					}
+
 					/* update config to latest and attempt connection */
-					ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, wifi_manager_get_wifi_sta_config()));
+					wifi_config_t sta_config = *wifi_manager_get_wifi_sta_config();
+
+					/* known networks go straight to the BSSID of their last successful connection, on its channel */
+					if(known_network && known_network->channel != 0){
+						sta_config.sta.bssid_set = true;
+						memcpy(sta_config.sta.bssid, known_network->bssid, sizeof(sta_config.sta.bssid));
+						sta_config.sta.channel = known_network->channel;
+						sta_config.sta.threshold.authmode = (wifi_auth_mode_t)known_network->authmode;
+						xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_FAST_CONNECT_BIT);
+						ESP_LOGI(TAG, "Directed connect on channel %d", sta_config.sta.channel);
+					}
+					else{
+						sta_config.sta.bssid_set = false;
+						sta_config.sta.channel = 0;
+						xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_FAST_CONNECT_BIT);
+					}
+					ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &sta_config));
+
+					/* static IP, reused lease or DHCP */
+					wifi_manager_apply_sta_ip_config((connection_request_made_by_code_t)msg.param);
+
+					/* a directed connect falling back to a full scan is still the same attempt */
+					if(wifi_manager_connect_start_time == 0){
+						wifi_manager_connect_start_time = esp_timer_get_time();
+					}
 
 					/* if there is a wifi scan in progress abort it first
 					   Calling esp_wifi_scan_stop will trigger a SCAN_DONE event which will reset this bit */
 					if(uxBits & WIFI_MANAGER_SCAN_BIT){
 						esp_wifi_scan_stop();
 					}
+					/* a per-channel sweep is not resumed after the connection attempt. The SCAN_DONE of the channel
+					 * being scanned, if any, is still to come: its results are dropped */
+					wifi_manager_scan_channel = 0;
 					ESP_ERROR_CHECK(esp_wifi_connect());
 				}
 
 				/* callback */
-				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])(NULL);
+				event_dispatcher_post(msg.code, NULL);
 
 				break;
 
@@ -1131,7 +1812,31 @@ void wifi_manager( void * pvParameters ){
 				 * */
 
 				/* reset saved sta IP */
-				wifi_manager_safe_update_sta_ip_string((uint32_t)0);
+				wifi_manager_set_sta_ip((uint32_t)0);
+				wifi_manager_got_ip_latency = 0;
+
+#ifdef CONFIG_WIFI_MANAGER_DHCP_LEASE_REUSE
+				/* no point revalidating a lease on a lost connection */
+				xTimerStop( wifi_manager_dhcp_renew_timer, (TickType_t)0 );
+				if(wifi_manager_dhcp_revalidating){
+					/* esp_netif does not know about this client: left running it would fight over the next address */
+					tcpip_callback(wifi_manager_dhcp_stop, esp_netif_get_netif_impl(esp_netif_sta));
+					wifi_manager_dhcp_revalidating = false;
+				}
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_BACKGROUND_SCAN
+				xTimerStop( wifi_manager_background_scan_timer, (TickType_t)0 );
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+				xTimerStop( wifi_manager_roam_timer, (TickType_t)0 );
+				wifi_manager_roam_scan = false;
+#endif
+
+				/* reason codes of lost connections and of failed attempts alike go to the telemetry */
+				xTimerStop( wifi_manager_telemetry_timer, (TickType_t)0 );
+				link_telemetry_record_disconnection(wifi_event_sta_disconnected->reason);
 
 				/* if there was a timer on to stop the AP, well now it's time to cancel that since connection was lost! */
 				if(xTimerIsTimerActive(wifi_manager_shutdown_ap_timer) == pdTRUE ){
@@ -1139,31 +1844,58 @@ void wifi_manager( void * pvParameters ){
 				}
 
 				uxBits = xEventGroupGetBits(wifi_manager_event_group);
-				if( uxBits & WIFI_MANAGER_REQUEST_STA_CONNECT_BIT ){
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+				if( uxBits & WIFI_MANAGER_ROAMING_BIT ){
+					/* the STA left its AP on purpose: join the stronger AP straight away. Should that fail, the
+					 * fast connect fallback below reconnects to the network with a full scan. */
+					xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_ROAMING_BIT);
+					wifi_manager_roam_reassociate();
+				}
+				else
+#endif
+				if( uxBits & WIFI_MANAGER_FAST_CONNECT_BIT ){
+					/* the directed connect failed: the AP may have moved to another channel or been replaced.
+					 * Forget its channel until the next success and retry the same network straight away with
+					 * a full scan, without counting this as a failed attempt. */
+					ESP_LOGI(TAG, "Directed connect failed. Falling back to a full scan.");
+					xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_FAST_CONNECT_BIT);
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+					if(wifi_manager_roam_start_time != 0){
+						wifi_manager_roam_stats.failed_roams++;
+						wifi_manager_roam_start_time = 0;
+					}
+#endif
+					struct known_network_t *known_network = known_networks_find(wifi_manager_config_sta->sta.ssid);
+					if(known_network){
+						known_network->channel = 0;
+					}
+					wifi_manager_send_message(WM_ORDER_CONNECT_STA, (uxBits & WIFI_MANAGER_REQUEST_RESTORE_STA_BIT)?(void*)CONNECTION_REQUEST_RESTORE_CONNECTION:(void*)CONNECTION_REQUEST_AUTO_RECONNECT);
+				}
+				else if( uxBits & WIFI_MANAGER_REQUEST_STA_CONNECT_BIT ){
+					wifi_manager_connect_start_time = 0;
+
 					/* there are no retries when it's a user requested connection by design. This avoids a user hanging too much
 					 * in case they typed a wrong password for instance. Here we simply clear the request bit and move on */
 					xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_STA_CONNECT_BIT);
 
-					if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
-						wifi_manager_generate_ip_info_json( UPDATE_FAILED_ATTEMPT );
-						wifi_manager_unlock_json_buffer();
-					}
+					wifi_manager_generate_ip_info_json( UPDATE_FAILED_ATTEMPT );
 
 				}
 				else if (uxBits & WIFI_MANAGER_REQUEST_DISCONNECT_BIT){
 					/* user manually requested a disconnect so the lost connection is a normal event. Clear the flag and restart the AP */
 					xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_DISCONNECT_BIT);
+					wifi_manager_connect_start_time = 0;
 
 					/* erase configuration */
 					if(wifi_manager_config_sta){
+						known_networks_remove(wifi_manager_config_sta->sta.ssid);
 						memset(wifi_manager_config_sta, 0x00, sizeof(wifi_config_t));
 					}
+					wifi_manager_candidate_count = 0;
+					wifi_manager_dhcp_lease_valid = false;
 
 					/* regenerate json status */
-					if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
-						wifi_manager_generate_ip_info_json( UPDATE_USER_DISCONNECT );
-						wifi_manager_unlock_json_buffer();
-					}
+					wifi_manager_generate_ip_info_json( UPDATE_USER_DISCONNECT );
 
 					/* save NVS memory */
 					wifi_manager_save_sta_config();
@@ -1171,40 +1903,61 @@ void wifi_manager( void * pvParameters ){
 					/* start SoftAP */
 					wifi_manager_send_message(WM_ORDER_START_AP, NULL);
 				}
+				else if(wifi_manager_candidate_count > 0 && wifi_manager_candidate_index + 1 < wifi_manager_candidate_count){
+					/* a known network failed but there are more to try in this round: move on to the next one straight away */
+					wifi_manager_connect_start_time = 0;
+					known_networks_record_failure(wifi_manager_config_sta->sta.ssid);
+					wifi_manager_candidate_index++;
+					wifi_manager_send_message(WM_ORDER_CONNECT_STA, (uxBits & WIFI_MANAGER_REQUEST_RESTORE_STA_BIT)?(void*)CONNECTION_REQUEST_RESTORE_CONNECTION:(void*)CONNECTION_REQUEST_AUTO_RECONNECT);
+				}
 				else{
-					/* lost connection ? */
-					if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
-						wifi_manager_generate_ip_info_json( UPDATE_LOST_CONNECTION );
-						wifi_manager_unlock_json_buffer();
+					wifi_manager_connect_start_time = 0;
+
+					/* the whole round failed, or an established connection was lost: the next round is ranked again */
+					if(wifi_manager_candidate_count > 0){
+						known_networks_record_failure(wifi_manager_config_sta->sta.ssid);
+					}
+					wifi_manager_candidate_count = 0;
+
+					/* immediate retry first, then exponential backoff. The reason code tells whether it is worth
+					 * waiting for the network to come back or whether the user has to fix the configuration */
+					struct reconnect_decision_t decision;
+					reconnect_policy_next(wifi_event_sta_disconnected->reason, &decision);
+					ESP_LOGI(TAG, "Next connection attempt in %u ms", decision.delay);
+
+					/* the device may have moved: refresh the scan results before the retry timer ticks so the next round
+					 * tries the networks actually in range first. Not worth it if the connection attempt would abort the scan */
+					if(known_networks_count() > 1 && decision.delay >= WIFI_MANAGER_FULL_SCAN_TIME){
+						wifi_manager_send_message(WM_ORDER_START_WIFI_SCAN, NULL);
 					}
 
-					/* Start the timer that will try to restore the saved config */
-					xTimerStart( wifi_manager_retry_timer, (TickType_t)0 );
+					/* lost connection ? */
+					wifi_manager_generate_ip_info_json( UPDATE_LOST_CONNECTION );
 
 					/* if it was a restore attempt connection, we clear the bit */
 					xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_RESTORE_STA_BIT);
 
-					/* if the AP is not started, we check if we have reached the threshold of failed attempt to start it */
-					if(! (uxBits & WIFI_MANAGER_AP_STARTED_BIT) ){
+					/* retry right away, or start the timer that will try to restore the saved config */
+					if(decision.delay == 0){
+						wifi_manager_send_message(WM_ORDER_CONNECT_STA, (void*)CONNECTION_REQUEST_AUTO_RECONNECT);
+					}
+					else{
+						xTimerChangePeriod( wifi_manager_retry_timer, pdMS_TO_TICKS(decision.delay) ? pdMS_TO_TICKS(decision.delay) : 1, (TickType_t)0 );
+					}
 
-						/* if the nunber of retries is below the threshold to start the AP, a reconnection attempt is made
-						 * This way we avoid restarting the AP directly in case the connection is mementarily lost */
-						if(retries < WIFI_MANAGER_MAX_RETRY_START_AP){
-							retries++;
-						}
-						else{
-							/* In this scenario the connection was lost beyond repair: kick start the AP! */
-							retries = 0;
+					/* if the AP is not started, we check if the outage calls for it */
+					if( !(uxBits & WIFI_MANAGER_AP_STARTED_BIT) && decision.start_ap ){
+						ESP_LOGI(TAG, "Connection lost beyond repair (%s): starting the access point",
+								decision.reason_class == RECONNECT_REASON_CREDENTIALS ? "credentials refused" : "network unreachable");
 
-							/* start SoftAP */
-							wifi_manager_send_message(WM_ORDER_START_AP, NULL);
-						}
+						/* start SoftAP */
+						wifi_manager_send_message(WM_ORDER_START_AP, NULL);
 					}
 				}
 
 				/* callback */
-				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])( msg.param );
-				free(wifi_event_sta_disconnected);
+				event_dispatcher_post(msg.code, msg.param);
+				wifi_manager_free_payload(wifi_event_sta_disconnected);
 
 				break;
 
@@ -1213,6 +1966,9 @@ void wifi_manager( void * pvParameters ){
 
 				ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
 
+				/* the AP interface comes back with the driver default bandwidth */
+				wifi_profile_apply((wifi_profile_id_t)atomic_load(&wifi_manager_profile), &wifi_settings);
+
 				/* restart HTTP daemon */
 				http_app_stop();
 				http_app_start(true);
@@ -1221,7 +1977,7 @@ void wifi_manager( void * pvParameters ){
 				dns_server_start();
 
 				/* callback */
-				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])(NULL);
+				event_dispatcher_post(msg.code, NULL);
 
 				break;
 
@@ -1247,7 +2003,7 @@ void wifi_manager( void * pvParameters ){
 					http_app_start(false);
 
 					/* callback */
-					if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])(NULL);
+					event_dispatcher_post(msg.code, NULL);
 				}
 
 				break;
@@ -1257,11 +2013,38 @@ void wifi_manager( void * pvParameters ){
 				ip_event_got_ip_t* ip_event_got_ip = (ip_event_got_ip_t*)msg.param; 
 				uxBits = xEventGroupGetBits(wifi_manager_event_group);
 
+				if(wifi_manager_get_sta_ip() != 0){
+					/* the connection already had its address: the DHCP client renewed its lease. Nothing about the
+					 * connection changed, only the address itself may have */
+					if(ip_event_got_ip->ip_info.ip.addr != wifi_manager_get_sta_ip()){
+						wifi_manager_set_sta_ip(ip_event_got_ip->ip_info.ip.addr);
+						wifi_manager_generate_ip_info_json( UPDATE_CONNECTION_OK );
+						event_dispatcher_post(msg.code, msg.param);
+					}
+					if(!wifi_settings.sta_static_ip){
+						wifi_manager_save_dhcp_lease(&ip_event_got_ip->ip_info);
+					}
+					wifi_manager_free_payload(ip_event_got_ip);
+					break;
+				}
+
 				/* reset connection requests bits -- doesn't matter if it was set or not */
-				xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_STA_CONNECT_BIT);
+				xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_STA_CONNECT_BIT | WIFI_MANAGER_FAST_CONNECT_BIT);
 
 				/* save IP as a string for the HTTP server host */
-				wifi_manager_safe_update_sta_ip_string(ip_event_got_ip->ip_info.ip.addr);
+				wifi_manager_set_sta_ip(ip_event_got_ip->ip_info.ip.addr);
+
+				/* measure how long it took from the connection order to a usable address */
+				uint32_t assoc_time = 0;
+				if(wifi_manager_connect_start_time != 0){
+					wifi_manager_got_ip_latency = (uint32_t)((esp_timer_get_time() - wifi_manager_connect_start_time) / 1000);
+					assoc_time = wifi_manager_got_ip_latency;
+					wifi_manager_connect_start_time = 0;
+					ESP_LOGI(TAG, "Got IP %u ms after the connection order", wifi_manager_got_ip_latency);
+				}
+
+				/* config, connection history and lease are written to flash with a single commit */
+				nvs_sync_begin_batch(wifi_manager_nvs_namespace);
 
 				/* save wifi config in NVS if it wasn't a restored of a connection */
 				if(uxBits & WIFI_MANAGER_REQUEST_RESTORE_STA_BIT){
@@ -1271,16 +2054,57 @@ void wifi_manager( void * pvParameters ){
 					wifi_manager_save_sta_config();
 				}
 
-				/* reset number of retries */
-				retries = 0;
+				/* update the connection history of this network, including where its AP was found so that the next
+				 * attempt can skip the scan */
+				wifi_manager_candidate_count = 0;
+				wifi_ap_record_t ap_info;
+				bool have_ap_info = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+				known_networks_record_success(wifi_manager_config_sta, have_ap_info ? &ap_info : NULL, assoc_time);
+
+				if(uxBits & WIFI_MANAGER_DHCP_LEASE_REUSED_BIT){
+#ifdef CONFIG_WIFI_MANAGER_DHCP_LEASE_REUSE
+					/* the network is usable right now: confirm the lease with the server in the background */
+					xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_DHCP_LEASE_REUSED_BIT);
+					xTimerStart( wifi_manager_dhcp_renew_timer, (TickType_t)0 );
+#endif
+				}
+				else if(!wifi_settings.sta_static_ip){
+					/* lease obtained through a real DHCP exchange: keep it for the next reconnection */
+					wifi_manager_save_dhcp_lease(&ip_event_got_ip->ip_info);
+				}
 
-				/* refresh JSON with the new IP */
-				if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
-					/* generate the connection info with success */
-					wifi_manager_generate_ip_info_json( UPDATE_CONNECTION_OK );
-					wifi_manager_unlock_json_buffer();
+				if(nvs_sync_end_batch(wifi_manager_nvs_namespace) != ESP_OK){
+					/* the writes stay staged for the next commit, but the config must not be taken for saved */
+					ESP_LOGE(TAG, "the configuration of this connection could not be saved to flash");
+					config_record_invalidate_cache();
 				}
-				else { abort(); }
+
+				/* the outage is over: the next one starts with an immediate retry */
+				reconnect_policy_reset();
+
+#ifdef CONFIG_WIFI_MANAGER_BACKGROUND_SCAN
+				/* keep the list of access points fresh while connected */
+				xTimerStart( wifi_manager_background_scan_timer, (TickType_t)0 );
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+				if(wifi_manager_roam_start_time != 0){
+					wifi_manager_roam_stats.roams++;
+					wifi_manager_roam_stats.last_roam_time = assoc_time;
+					wifi_manager_roam_stats.last_rssi_after = have_ap_info ? ap_info.rssi : 0;
+					wifi_manager_roam_start_time = 0;
+					ESP_LOGI(TAG, "Roamed from %d dBm to %d dBm in %u ms", wifi_manager_roam_stats.last_rssi_before, wifi_manager_roam_stats.last_rssi_after, assoc_time);
+				}
+				/* the smoothed signal starts over from the AP just joined */
+				wifi_manager_roam_stats.rssi = have_ap_info ? ap_info.rssi : 0;
+				xTimerStart( wifi_manager_roam_timer, (TickType_t)0 );
+#endif
+
+				link_telemetry_record_connection();
+				xTimerStart( wifi_manager_telemetry_timer, (TickType_t)0 );
+
+				/* refresh JSON with the new IP */
+				wifi_manager_generate_ip_info_json( UPDATE_CONNECTION_OK );
 
 				/* bring down DNS hijack */
 				dns_server_stop();
@@ -1303,9 +2127,105 @@ void wifi_manager( void * pvParameters ){
 				}
 
 				/* callback and free memory allocated for the void* param */
-				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])( msg.param );
-				free(ip_event_got_ip);
+				event_dispatcher_post(msg.code, msg.param);
+				wifi_manager_free_payload(ip_event_got_ip);
+
+				break;
+
+			case WM_ORDER_RENEW_DHCP_LEASE:
+				ESP_LOGI(TAG, "MESSAGE: ORDER_RENEW_DHCP_LEASE");
+
+#ifdef CONFIG_WIFI_MANAGER_DHCP_LEASE_REUSE
+				/* the reused address is confirmed with the server without ever being taken off the interface: the
+				 * connections opened since the reconnection survive. The first time the client is started, then
+				 * each time the timer fires its progress is checked */
+				uxBits = xEventGroupGetBits(wifi_manager_event_group);
+				if((uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT) && !wifi_settings.sta_static_ip){
+					struct netif *lwip_netif = (struct netif*)esp_netif_get_netif_impl(esp_netif_sta);
+					if(!wifi_manager_dhcp_revalidating){
+						if(tcpip_callback(wifi_manager_dhcp_revalidate, lwip_netif) == ERR_OK){
+							wifi_manager_dhcp_revalidating = true;
+						}
+						xTimerStart( wifi_manager_dhcp_renew_timer, (TickType_t)0 );
+					}
+					else if(tcpip_callback(wifi_manager_dhcp_check, lwip_netif) != ERR_OK){
+						xTimerStart( wifi_manager_dhcp_renew_timer, (TickType_t)0 );
+					}
+				}
+#endif
+
+				/* callback */
+				event_dispatcher_post(msg.code, NULL);
+
+				break;
+
+			case WM_EVENT_DHCP_LEASE_CHECKED:{
+				uint32_t ip = (uint32_t)(uintptr_t)msg.param;
+				ESP_LOGI(TAG, "MESSAGE: EVENT_DHCP_LEASE_CHECKED");
+
+#ifdef CONFIG_WIFI_MANAGER_DHCP_LEASE_REUSE
+				uxBits = xEventGroupGetBits(wifi_manager_event_group);
+				if(!(uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT) || !wifi_manager_dhcp_revalidating){
+					/* the connection this was about is gone */
+				}
+				else if(ip == 0){
+					/* no answer from the server yet: the address stays in use and is checked again later */
+					xTimerStart( wifi_manager_dhcp_renew_timer, (TickType_t)0 );
+				}
+				else{
+					esp_netif_ip_info_t ip_info;
+					esp_netif_get_ip_info(esp_netif_sta, &ip_info);
+					ip_info.ip.addr = ip;
+
+					if(ip != wifi_manager_get_sta_ip()){
+						/* the lease was not renewed: lwIP already moved the interface to the new address */
+						ip_event_got_ip_t got_ip = { .esp_netif = esp_netif_sta, .ip_info = ip_info, .ip_changed = true };
+						ESP_LOGW(TAG, "DHCP server handed out another address than the reused one");
+						wifi_manager_set_sta_ip(ip);
+						wifi_manager_generate_ip_info_json( UPDATE_CONNECTION_OK );
+						event_dispatcher_post(WM_EVENT_STA_GOT_IP, &got_ip);
+					}
+					else{
+						ESP_LOGI(TAG, "Reused DHCP lease confirmed");
+					}
+					wifi_manager_save_dhcp_lease(&ip_info);
+				}
+#endif
 
+				/* callback */
+				event_dispatcher_post(msg.code, msg.param);
+
+				break;
+			}
+
+			case WM_ORDER_SET_WIFI_PROFILE:{
+				ESP_LOGI(TAG, "MESSAGE: ORDER_SET_WIFI_PROFILE");
+
+				BaseType_t request = (BaseType_t)msg.param & WIFI_PROFILE_REQUEST_MASK;
+				wifi_profile_id_t profile = (wifi_profile_id_t)((BaseType_t)msg.param & ~WIFI_PROFILE_REQUEST_MASK);
+
+				if(request == WIFI_PROFILE_REQUEST_OVERRIDE){
+					wifi_manager_profile_override = profile;
+				}
+				else if(request == WIFI_PROFILE_REQUEST_RESTORE){
+					wifi_manager_profile_override = WIFI_PROFILE_COUNT;
+				}
+				else if(wifi_settings.profile != profile){
+					wifi_settings.profile = profile;
+					wifi_manager_save_sta_config();
+					ESP_LOGI(TAG, "Profile %s saved. Driver buffers will follow it on the next start.", wifi_profile_get(profile)->name);
+				}
+
+				/* an override stays in force until it is restored, whatever the saved profile */
+				wifi_profile_id_t active = wifi_manager_profile_override != WIFI_PROFILE_COUNT ? wifi_manager_profile_override : wifi_settings.profile;
+				if(active != (wifi_profile_id_t)atomic_load(&wifi_manager_profile)){
+					wifi_profile_apply(active, &wifi_settings);
+					atomic_store(&wifi_manager_profile, active);
+				}
+
+				/* callback */
+				event_dispatcher_post(msg.code, msg.param);
+				}
 				break;
 
 			case WM_ORDER_DISCONNECT_STA:
@@ -1318,7 +2238,7 @@ void wifi_manager( void * pvParameters ){
 				ESP_ERROR_CHECK(esp_wifi_disconnect());
 
 				/* callback */
-				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])(NULL);
+				event_dispatcher_post(msg.code, NULL);
 
 				break;
 
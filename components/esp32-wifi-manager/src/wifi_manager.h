@@ -33,6 +33,7 @@ Contains the freeRTOS task and all necessary support
 #define WIFI_MANAGER_H_INCLUDED
 
 #include <stdbool.h>
+#include "json_snapshot.h"
 
 
 #ifdef __cplusplus
@@ -59,21 +60,94 @@ extern "C" {
  * To save memory and avoid nasty out of memory errors,
  * we can limit the number of APs detected in a wifi scan.
  */
-#define MAX_AP_NUM 							15
+#define MAX_AP_NUM 							CONFIG_WIFI_MANAGER_MAX_AP_NUM
 
 
 /**
- * @brief Defines the maximum number of failed retries allowed before the WiFi manager starts its own access point.
+ * @brief Defines the maximum number of retries refused by the AP for their credentials before the WiFi manager starts its own access point.
  * Setting it to 2 for instance means there will be 3 attempts in total (original request + 2 retries)
+ * @see reconnect_policy.h
  */
 #define WIFI_MANAGER_MAX_RETRY_START_AP		CONFIG_WIFI_MANAGER_MAX_RETRY_START_AP
 
 /**
- * @brief Time (in ms) between each retry attempt
- * Defines the time to wait before an attempt to re-connect to a saved wifi is made after connection is lost or another unsuccesful attempt is made.
+ * @brief Time (in ms) a connection can stay lost for other reasons, such as the AP not being found, before the WiFi manager starts its own access point.
+ */
+#define WIFI_MANAGER_AP_FALLBACK_TIMEOUT	CONFIG_WIFI_MANAGER_AP_FALLBACK_TIMEOUT
+
+/**
+ * @brief Number of messages the queue of the wifi_manager task can hold, rounded up to a power of two.
+ * Messages posted while the queue is full are dropped rather than blocking the sender.
+ */
+#define WIFI_MANAGER_QUEUE_SIZE				CONFIG_WIFI_MANAGER_QUEUE_SIZE
+
+/**
+ * @brief Longest time (in ms) between two retry attempts
+ * The first attempt to re-connect to a saved wifi after the connection is lost is made straight away. The time to wait
+ * before the next ones doubles from WIFI_MANAGER_RETRY_BACKOFF_MIN after each unsuccesful attempt, up to this value.
  */
 #define WIFI_MANAGER_RETRY_TIMER			CONFIG_WIFI_MANAGER_RETRY_TIMER
 
+/**
+ * @brief Time (in ms) to wait before the second retry attempt of an outage.
+ */
+#define WIFI_MANAGER_RETRY_BACKOFF_MIN		CONFIG_WIFI_MANAGER_RETRY_BACKOFF_MIN
+
+
+/**
+ * @brief Time (in ms) to wait before revalidating a reused DHCP lease
+ * After a connection is established with the cached lease, the DHCP client is restarted after this delay to confirm the lease with the server.
+ */
+#ifdef CONFIG_WIFI_MANAGER_DHCP_LEASE_REUSE
+#define WIFI_MANAGER_DHCP_LEASE_RENEW_DELAY	CONFIG_WIFI_MANAGER_DHCP_LEASE_RENEW_DELAY
+#endif
+
+
+/**
+ * @brief Time (in ms) during which scan results are served from cache.
+ * Scan requests received while the results are younger than this do not trigger a new scan.
+ */
+#define WIFI_MANAGER_SCAN_CACHE_TTL			CONFIG_WIFI_MANAGER_SCAN_CACHE_TTL
+
+/**
+ * @brief Time (in ms) spent listening on each channel during a per-channel scan.
+ */
+#define WIFI_MANAGER_SCAN_CHANNEL_DWELL		CONFIG_WIFI_MANAGER_SCAN_CHANNEL_DWELL
+
+/**
+ * @brief Time (in ms) spent back on the home channel between two channels of a per-channel scan.
+ * This is when normal STA and AP traffic flows.
+ */
+#define WIFI_MANAGER_SCAN_CHANNEL_GAP		CONFIG_WIFI_MANAGER_SCAN_CHANNEL_GAP
+
+#ifdef CONFIG_WIFI_MANAGER_BACKGROUND_SCAN
+/**
+ * @brief Time (in ms) between two background scans while the STA is connected.
+ */
+#define WIFI_MANAGER_BACKGROUND_SCAN_INTERVAL	CONFIG_WIFI_MANAGER_BACKGROUND_SCAN_INTERVAL
+#endif
+
+#ifdef CONFIG_WIFI_MANAGER_ROAMING
+/**
+ * @brief Smoothed RSSI (in dBm) under which the STA scans for a stronger access point of the same network.
+ */
+#define WIFI_MANAGER_ROAM_RSSI_THRESHOLD	CONFIG_WIFI_MANAGER_ROAM_RSSI_THRESHOLD
+
+/**
+ * @brief Margin (in dB) by which another access point must be stronger than the current one to roam to it.
+ */
+#define WIFI_MANAGER_ROAM_HYSTERESIS		CONFIG_WIFI_MANAGER_ROAM_HYSTERESIS
+
+/**
+ * @brief Time (in ms) between two checks of the signal of the connected access point.
+ */
+#define WIFI_MANAGER_ROAM_CHECK_INTERVAL	CONFIG_WIFI_MANAGER_ROAM_CHECK_INTERVAL
+
+/**
+ * @brief Minimum time (in ms) between two scans for a stronger access point.
+ */
+#define WIFI_MANAGER_ROAM_SCAN_INTERVAL		CONFIG_WIFI_MANAGER_ROAM_SCAN_INTERVAL
+#endif
 
 /**
  * @brief Time (in ms) to wait before shutting down the AP
@@ -170,20 +244,27 @@ extern "C" {
  */
 #define JSON_ONE_APP_SIZE					99
 
+/**
+ * @brief Defines the size in bytes of the buffer holding the JSON list of access points.
+ * 4 bytes for json encapsulation of "[\n" and "]\0". Should a scan hold so many heavily escaped
+ * SSIDs that the list does not fit, the weakest access points are left out.
+ */
+#define JSON_ACCESS_POINTS_SIZE				(MAX_AP_NUM * JSON_ONE_APP_SIZE + 4)
+
 /**
  * @brief Defines the maximum length in bytes of a JSON representation of the IP information
  * assuming all ips are 4*3 digits, and all characters in the ssid require to be escaped.
- * example: {"ssid":"abcdefghijklmnopqrstuvwxyz012345","ip":"192.168.1.119","netmask":"255.255.255.0","gw":"192.168.1.1","urc":99}
- * Run this JS (browser console is easiest) to come to the conclusion that 159 is the worst case.
+ * example: {"ssid":"abcdefghijklmnopqrstuvwxyz012345","ip":"192.168.1.119","netmask":"255.255.255.0","gw":"192.168.1.1","urc":99,"gotip_ms":4294967295}
+ * Run this JS (browser console is easiest) to come to the conclusion that 182 is the worst case.
  * ```
- * var a = {"ssid":"abcdefghijklmnopqrstuvwxyz012345","ip":"255.255.255.255","netmask":"255.255.255.255","gw":"255.255.255.255","urc":99};
+ * var a = {"ssid":"abcdefghijklmnopqrstuvwxyz012345","ip":"255.255.255.255","netmask":"255.255.255.255","gw":"255.255.255.255","urc":99,"gotip_ms":4294967295};
  * // Replace all ssid characters with a double quote which will have to be escaped
  * a.ssid = a.ssid.split('').map(() => '"').join('');
- * console.log(JSON.stringify(a).length); // => 158 +1 for null
+ * console.log(JSON.stringify(a).length); // => 180 +1 for \n +1 for null
  * console.log(JSON.stringify(a)); // print it
  * ```
  */
-#define JSON_IP_INFO_SIZE 					159
+#define JSON_IP_INFO_SIZE 					182
 
 
 /**
@@ -196,9 +277,9 @@ extern "C" {
  * @brief Defines the complete list of all messages that the wifi_manager can process.
  *
  * Some of these message are events ("EVENT"), and some of them are action ("ORDER")
- * Each of these messages can trigger a callback function and each callback function is stored
- * in a function pointer array for convenience. Because of this behavior, it is extremely important
- * to maintain a strict sequence and the top level special element 'MESSAGE_CODE_COUNT'
+ * Each of these messages can trigger callback functions. Because message codes are also used as bit
+ * positions to coalesce orders, it is extremely important to maintain a strict sequence, the top level
+ * special element 'MESSAGE_CODE_COUNT', and no more than 32 messages.
  *
  * @see wifi_manager_set_callback
  */
@@ -217,7 +298,14 @@ typedef enum message_code_t {
 	WM_EVENT_SCAN_DONE = 11,
 	WM_EVENT_STA_GOT_IP = 12,
 	WM_ORDER_STOP_AP = 13,
-	WM_MESSAGE_CODE_COUNT = 14 /* important for the callback array */
+	WM_ORDER_RENEW_DHCP_LEASE = 14,
+	WM_ORDER_SCAN_NEXT_CHANNEL = 15,
+	WM_ORDER_CHECK_ROAMING = 16,
+	WM_ORDER_SET_WIFI_PROFILE = 17,
+	WM_ORDER_SAMPLE_TELEMETRY = 18,
+	WM_EVENT_DHCP_LEASE_CHECKED = 19,
+	WM_ORDER_START_BACKGROUND_SCAN = 20,	/* periodic scan while connected, one channel at a time */
+	WM_MESSAGE_CODE_COUNT = 21 /* important for the callback array */
 
 }message_code_t;
 
@@ -241,6 +329,36 @@ typedef enum connection_request_made_by_code_t{
 	CONNECTION_REQUEST_MAX = 0x7fffffff /*force the creation of this enum as a 32 bit int */
 }connection_request_made_by_code_t;
 
+typedef enum scan_request_made_by_code_t{
+	SCAN_REQUEST_DEFAULT = 0,
+	SCAN_REQUEST_BACKGROUND = 1, /* same as WM_ORDER_START_BACKGROUND_SCAN, which is what the wifi manager posts */
+	SCAN_REQUEST_FULL = 2, /* all channels at once, even if the results are fresh: used to measure the cost of a scan */
+	SCAN_REQUEST_PER_CHANNEL = 3, /* one channel at a time, even if the results are fresh */
+	SCAN_REQUEST_MAX = 0x7fffffff /*force the creation of this enum as a 32 bit int */
+}scan_request_made_by_code_t;
+
+/**
+ * @brief Wifi performance profiles.
+ * @see wifi_profile.h for the driver parameters of each profile.
+ */
+typedef enum wifi_profile_id_t{
+	WIFI_PROFILE_DEFAULT = 0,			/* driver defaults, AP bandwidth and power save from the settings */
+	WIFI_PROFILE_BULK_TRANSFER = 1,		/* highest throughput, e.g. firmware downloads */
+	WIFI_PROFILE_LOW_LATENCY = 2,		/* shortest response time for small exchanges */
+	WIFI_PROFILE_LOW_POWER = 3,			/* modem sleep and small buffers for idle telemetry */
+	WIFI_PROFILE_COUNT = 4
+}wifi_profile_id_t;
+
+/**
+ * @brief Kind of profile change carried by WM_ORDER_SET_WIFI_PROFILE, or'ed with the wifi_profile_id_t.
+ */
+typedef enum wifi_profile_request_t{
+	WIFI_PROFILE_REQUEST_SAVE = 0x000,		/* make the profile the saved one */
+	WIFI_PROFILE_REQUEST_OVERRIDE = 0x100,	/* use the profile until WIFI_PROFILE_REQUEST_RESTORE, without saving it */
+	WIFI_PROFILE_REQUEST_RESTORE = 0x200,	/* go back to the saved profile */
+	WIFI_PROFILE_REQUEST_MASK = 0xf00
+}wifi_profile_request_t;
+
 /**
  * The actual WiFi settings in use
  */
@@ -254,9 +372,29 @@ struct wifi_settings_t{
 	wifi_ps_type_t sta_power_save;
 	bool sta_static_ip;
 	esp_netif_ip_info_t sta_static_ip_config;
+	wifi_profile_id_t profile;
 };
 extern struct wifi_settings_t wifi_settings;
 
+/**
+ * @brief NVS namespace shared by everything the wifi manager saves to flash ram storage.
+ */
+extern const char wifi_manager_nvs_namespace[];
+
+/**
+ * @brief Last DHCP lease obtained by the STA on the network identified by ssid.
+ *
+ * Saved in NVS so that a reconnection to the same network can reuse the address straight away
+ * instead of waiting for a full DHCP exchange.
+ */
+struct wifi_dhcp_lease_t{
+	uint8_t ssid[MAX_SSID_SIZE];
+	esp_netif_ip_info_t ip_info;
+	uint32_t dns;
+	uint32_t lease_time;	/* lease duration in seconds as granted by the DHCP server */
+	int64_t obtained;		/* wall clock time at which the lease was granted, 0 if time was not set */
+};
+
 
 /**
  * @brief Structure used to store one message in the queue.
@@ -266,6 +404,54 @@ typedef struct{
 	void *param;
 } queue_message;
 
+/**
+ * @brief Counters of the queue of messages processed by the wifi_manager task.
+ */
+struct wifi_manager_queue_stats_t{
+	uint32_t capacity;			/* number of messages the queue can hold */
+	uint32_t pushed;			/* messages queued since boot */
+	uint32_t coalesced;			/* orders discarded because an identical one was already waiting */
+	uint32_t dropped;			/* messages lost because the queue was full */
+	uint32_t high_water_mark;	/* highest number of messages waiting at the same time */
+	uint32_t deferred;			/* state events that found the queue or the payload pool full: delayed, never lost */
+};
+
+/**
+ * @brief Counters of the roaming engine.
+ */
+struct wifi_manager_roam_stats_t{
+	uint32_t scans;				/* scans for a stronger access point, triggered by a weak signal */
+	uint32_t roams;				/* reassociations to another access point that got an IP address */
+	uint32_t failed_roams;		/* reassociations that failed and fell back to a normal reconnection */
+	int8_t rssi;				/* smoothed RSSI of the current connection */
+	int8_t last_rssi_before;	/* RSSI of the access point left by the last roam */
+	int8_t last_rssi_after;		/* RSSI of the access point joined by the last roam */
+	uint32_t last_roam_time;	/* time (in ms) between leaving the old access point and getting an IP through the new one */
+};
+
+/**
+ * @brief Statistics of a subscription to a message.
+ */
+struct wifi_manager_subscriber_stats_t{
+	const char *name;
+	message_code_t code;
+	uint32_t calls;				/* number of times the callback was run */
+	uint32_t dropped;			/* messages lost because the callback was falling behind */
+	uint32_t max_time_us;		/* longest execution of the callback */
+	uint64_t total_time_us;		/* cumulated execution time of the callback */
+};
+
+/**
+ * @brief Counters of the pool holding the event payloads posted to the wifi_manager task.
+ */
+struct wifi_manager_payload_pool_stats_t{
+	uint32_t capacity;			/* number of blocks in the pool */
+	uint32_t block_size;		/* size in bytes of a block */
+	uint32_t in_use;			/* blocks currently allocated */
+	uint32_t high_water_mark;	/* highest number of blocks allocated at the same time */
+	uint32_t exhausted;			/* events that found all blocks in use, and were deferred */
+};
+
 
 /**
  * @brief returns the current esp_netif object for the STAtion
@@ -289,9 +475,10 @@ void wifi_manager_start();
 void wifi_manager_destroy();
 
 /**
- * Filters the AP scan list to unique SSIDs
+ * Filters the AP scan list to unique SSIDs, strongest signal first.
+ * Hidden networks are removed. ap_num is updated to the number of records left.
  */
-void filter_unique( wifi_ap_record_t * aplist, uint16_t * ap_num);
+void wifi_manager_filter_unique( wifi_ap_record_t * aplist, uint16_t * ap_num);
 
 /**
  * Main task for the wifi_manager
@@ -299,8 +486,27 @@ void filter_unique( wifi_ap_record_t * aplist, uint16_t * ap_num);
 void wifi_manager( void * pvParameters );
 
 
-char* wifi_manager_get_ap_list_json();
-char* wifi_manager_get_ip_info_json();
+/**
+ * @brief Takes a reference on the latest list of access points. Never blocks.
+ *
+ * The snapshot is immutable and stays valid until released, no matter how many times the list is
+ * regenerated in the meantime. Its entity tag only changes when the content of the list does, so clients
+ * can revalidate with If-None-Match.
+ *
+ * @return the snapshot, to be released with wifi_manager_release_json.
+ */
+const struct json_snapshot_t* wifi_manager_acquire_ap_list_json();
+
+/**
+ * @brief Takes a reference on the latest connection status json. Never blocks.
+ * @return the snapshot, to be released with wifi_manager_release_json.
+ */
+const struct json_snapshot_t* wifi_manager_acquire_ip_info_json();
+
+/**
+ * @brief Gives back a snapshot obtained with wifi_manager_acquire_ap_list_json or wifi_manager_acquire_ip_info_json.
+ */
+void wifi_manager_release_json(const struct json_snapshot_t *snapshot);
 
 
 void wifi_manager_scan_async();
@@ -319,64 +525,57 @@ bool wifi_manager_fetch_wifi_sta_config();
 
 wifi_config_t* wifi_manager_get_wifi_sta_config();
 
+/**
+ * @brief saves the DHCP lease currently held by the STA to flash ram storage.
+ * The flash is only written if the address changed or if the saved lease is halfway through its duration.
+ */
+esp_err_t wifi_manager_save_dhcp_lease(const esp_netif_ip_info_t *ip_info);
 
 /**
- * @brief requests a connection to an access point that will be process in the main task thread.
+ * @brief fetch the last DHCP lease saved in the flash ram storage.
+ * @return true if a lease that is not known to be expired was found, false otherwise.
+ * The lease is only reused when reconnecting to the network it was obtained on.
  */
-void wifi_manager_connect_async();
+bool wifi_manager_fetch_dhcp_lease();
 
 /**
- * @brief requests a wifi scan
+ * @brief returns the time in ms it took between the connection order and the STA getting an IP address. 0 if not connected.
  */
-void wifi_manager_scan_awifi_manager_send_messagesync();
+uint32_t wifi_manager_get_got_ip_latency();
+
 
 /**
- * @brief requests to disconnect and forget about the access point.
+ * @brief requests a connection to an access point that will be process in the main task thread.
  */
-void wifi_manager_disconnect_async();
+void wifi_manager_connect_async();
 
 /**
- * @brief Tries to get access to json buffer mutex.
- *
- * The HTTP server can try to access the json to serve clients while the wifi manager thread can try
- * to update it. These two tasks are synchronized through a mutex.
- *
- * The mutex is used by both the access point list json and the connection status json.\n
- * These two resources should technically have their own mutex but we lose some flexibility to save
- * on memory.
- *
- * This is a simple wrapper around freeRTOS function xSemaphoreTake.
- *
- * @param xTicksToWait The time in ticks to wait for the semaphore to become available.
- * @return true in success, false otherwise.
+ * @brief requests a wifi scan
  */
-bool wifi_manager_lock_json_buffer(TickType_t xTicksToWait);
+void wifi_manager_scan_awifi_manager_send_messagesync();
 
 /**
- * @brief Releases the json buffer mutex.
+ * @brief requests to disconnect and forget about the access point.
  */
-void wifi_manager_unlock_json_buffer();
+void wifi_manager_disconnect_async();
 
 /**
- * @brief Generates the connection status json: ssid and IP addresses.
- * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
+ * @brief Generates and publishes the connection status json: ssid and IP addresses.
  */
 void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code);
 /**
- * @brief Clears the connection status json.
- * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
+ * @brief Publishes an empty connection status json.
  */
 void wifi_manager_clear_ip_info_json();
 
 /**
- * @brief Generates the list of access points after a wifi scan.
- * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
+ * @brief Generates and publishes the list of access points after a wifi scan.
+ * @note Must be called from the wifi_manager task, which owns the scan results.
  */
 void wifi_manager_generate_acess_points_json();
 
 /**
- * @brief Clear the list of access points.
- * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
+ * @brief Publishes an empty list of access points.
  */
 void wifi_manager_clear_access_points_json();
 
@@ -387,29 +586,111 @@ void wifi_manager_clear_access_points_json();
 void wifi_manager_initialise_mdns();
 
 
-bool wifi_manager_lock_sta_ip_string(TickType_t xTicksToWait);
-void wifi_manager_unlock_sta_ip_string();
+/**
+ * @brief gets the STA IP address as in esp_ip4_addr_t (network byte order). 0 when the STA has no address.
+ * @note lock-free: can be called from any task.
+ */
+uint32_t wifi_manager_get_sta_ip();
 
 /**
- * @brief gets the string representation of the STA IP address, e.g.: "192.168.1.69"
+ * @brief gets the AP IP address as in esp_ip4_addr_t (network byte order). 0 until the AP is configured.
+ * @note lock-free: can be called from any task.
  */
-char* wifi_manager_get_sta_ip_string();
+uint32_t wifi_manager_get_ap_ip();
 
 /**
- * @brief thread safe char representation of the STA IP update
+ * @brief publishes a new STA IP address, as in esp_ip4_addr_t.
  */
-void wifi_manager_safe_update_sta_ip_string(uint32_t ip);
+void wifi_manager_set_sta_ip(uint32_t ip);
 
 
 /**
  * @brief Register a callback to a custom function when specific event message_code happens.
+ * @note callbacks run on a dedicated task, not on the wifi_manager task. Several callbacks can be registered for the same message.
+ * @see wifi_manager_subscribe
  */
 void wifi_manager_set_callback(message_code_t message_code, void (*func_ptr)(void*) );
 
+/**
+ * @brief Subscribes a callback to a message.
+ *
+ * Callbacks are run asynchronously on the dispatcher task, in the order the messages were processed. A subscriber
+ * falling behind loses messages instead of slowing down the wifi_manager. The param of events carrying data
+ * (e.g. ip_event_got_ip_t for WM_EVENT_STA_GOT_IP) is only valid for the duration of the callback.
+ * wifi_manager_start must have been called first.
+ *
+ * @param name used to report slow callbacks in the console and in the statistics. Can be NULL.
+ */
+esp_err_t wifi_manager_subscribe(message_code_t message_code, void (*func_ptr)(void*), const char *name);
+
+/**
+ * @brief Cancels a subscription made with wifi_manager_subscribe or wifi_manager_set_callback.
+ */
+esp_err_t wifi_manager_unsubscribe(message_code_t message_code, void (*func_ptr)(void*));
+
+/**
+ * @brief Copies the number of calls, drops and execution times of the subscription stored at index.
+ * Iterate from 0 to CONFIG_WIFI_MANAGER_MAX_SUBSCRIBERS-1 to list all subscriptions.
+ * @return false if there is no subscription at index.
+ */
+bool wifi_manager_get_subscriber_stats(uint8_t index, struct wifi_manager_subscriber_stats_t *stats);
+
+
+/**
+ * @brief Copies the counters of the pool holding the event payloads posted to the wifi_manager task.
+ */
+void wifi_manager_get_payload_pool_stats(struct wifi_manager_payload_pool_stats_t *stats);
 
+/**
+ * @brief Posts a message to the wifi_manager task. Never blocks, which makes it safe to call from the event loop.
+ *
+ * Stateless orders posted with a NULL param are coalesced: while one is waiting, identical ones are discarded.
+ * Orders carrying a param are always queued, the param may change what the order does.
+ * @return pdTRUE if the message was queued, or coalesced with an identical order already waiting. pdFALSE if the
+ * queue is full: the message is dropped, counted in wifi_manager_get_queue_stats, and the caller still owns param.
+ */
 BaseType_t wifi_manager_send_message(message_code_t code, void *param);
+
+/**
+ * @brief Kept for compatibility only.
+ * @warning the queue has no front any more: the message is appended like with wifi_manager_send_message, behind
+ * the messages already waiting, and is dropped with a pdFALSE return if the queue is full. Code that relied on
+ * jumping the queue must not assume its message is handled first.
+ */
 BaseType_t wifi_manager_send_message_to_front(message_code_t code, void *param);
 
+/**
+ * @brief Copies the counters of the message queue of the wifi_manager task.
+ */
+void wifi_manager_get_queue_stats(struct wifi_manager_queue_stats_t *stats);
+
+/**
+ * @brief Copies the counters of the roaming engine. All zero when roaming is disabled.
+ */
+void wifi_manager_get_roam_stats(struct wifi_manager_roam_stats_t *stats);
+
+/**
+ * @brief Selects the wifi profile and saves it with the settings.
+ * Bandwidth and power save change straight away, buffers and AMPDU the next time the wifi manager starts.
+ */
+void wifi_manager_set_profile_async(wifi_profile_id_t profile);
+
+/**
+ * @brief Uses a wifi profile for a while without saving it, e.g. the bulk transfer profile during a firmware download.
+ * Overrides do not nest: the latest one wins.
+ */
+void wifi_manager_override_profile_async(wifi_profile_id_t profile);
+
+/**
+ * @brief Ends an override and goes back to the saved wifi profile.
+ */
+void wifi_manager_restore_profile_async();
+
+/**
+ * @brief Returns the wifi profile in use, override included.
+ */
+wifi_profile_id_t wifi_manager_get_profile();
+
 #ifdef __cplusplus
 }
 #endif
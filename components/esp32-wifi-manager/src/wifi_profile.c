@@ -0,0 +1,168 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+@file wifi_profile.c
+@brief Named sets of wifi driver parameters trading throughput, latency and power consumption
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_wifi.h>
+
+#include "wifi_manager.h"
+#include "wifi_profile.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "wifi_profile";
+
+/**
+ * @brief the profiles, indexed by wifi_profile_id_t.
+ *
+ * bulk-transfer: large RX/TX pools and a wide block ack window let AMPDU aggregate, 40 MHz when the AP supports it.
+ * low-latency: no TX aggregation so that small frames leave at once, modem always on.
+ * low-power: few buffers and no aggregation to save RAM, the modem sleeps between DTIM beacons.
+ */
+static const struct wifi_profile_t wifi_profiles[WIFI_PROFILE_COUNT] = {
+	[WIFI_PROFILE_DEFAULT] = {
+		.name = "default",
+		.ampdu_rx_enable = true,
+		.ampdu_tx_enable = true,
+		.from_settings = true,
+		.bandwidth = WIFI_BW_HT40, /* STA only: driver default */
+	},
+	[WIFI_PROFILE_BULK_TRANSFER] = {
+		.name = "bulk-transfer",
+		.static_rx_buf_num = 16,
+		.dynamic_rx_buf_num = 64,
+		.dynamic_tx_buf_num = 64,
+		.rx_ba_win = 32,
+		.ampdu_rx_enable = true,
+		.ampdu_tx_enable = true,
+		.bandwidth = WIFI_BW_HT40,
+		.power_save = WIFI_PS_NONE,
+	},
+	[WIFI_PROFILE_LOW_LATENCY] = {
+		.name = "low-latency",
+		.static_rx_buf_num = 10,
+		.dynamic_rx_buf_num = 32,
+		.dynamic_tx_buf_num = 32,
+		.rx_ba_win = 6,
+		.ampdu_rx_enable = true,
+		.ampdu_tx_enable = false,
+		.bandwidth = WIFI_BW_HT20,
+		.power_save = WIFI_PS_NONE,
+	},
+	[WIFI_PROFILE_LOW_POWER] = {
+		.name = "low-power",
+		.static_rx_buf_num = 4,
+		.dynamic_rx_buf_num = 16,
+		.dynamic_tx_buf_num = 16,
+		.ampdu_rx_enable = false,
+		.ampdu_tx_enable = false,
+		.bandwidth = WIFI_BW_HT20,
+		.power_save = WIFI_PS_MAX_MODEM,
+	},
+};
+
+
+const struct wifi_profile_t* wifi_profile_get(wifi_profile_id_t profile){
+	if((unsigned)profile >= WIFI_PROFILE_COUNT){
+		profile = WIFI_PROFILE_DEFAULT;
+	}
+	return &wifi_profiles[profile];
+}
+
+wifi_profile_id_t wifi_profile_find(const char *name){
+	for(int i=0; i<WIFI_PROFILE_COUNT; i++){
+		if(strcmp(wifi_profiles[i].name, name) == 0){
+			return (wifi_profile_id_t)i;
+		}
+	}
+	return WIFI_PROFILE_COUNT;
+}
+
+void wifi_profile_init_config(wifi_profile_id_t profile, wifi_init_config_t *config){
+
+	const struct wifi_profile_t *p = wifi_profile_get(profile);
+
+	if(p->static_rx_buf_num) config->static_rx_buf_num = p->static_rx_buf_num;
+	if(p->dynamic_rx_buf_num) config->dynamic_rx_buf_num = p->dynamic_rx_buf_num;
+	if(p->dynamic_tx_buf_num) config->dynamic_tx_buf_num = p->dynamic_tx_buf_num;
+
+	/* menuconfig may have compiled AMPDU out: a profile can disable it but never enable it */
+	config->ampdu_rx_enable = config->ampdu_rx_enable && p->ampdu_rx_enable;
+	config->ampdu_tx_enable = config->ampdu_tx_enable && p->ampdu_tx_enable;
+	if(p->rx_ba_win){
+		config->rx_ba_win = p->rx_ba_win;
+	}
+
+	/* the block ack window cannot hold more frames than there are buffers to receive them */
+	if(config->rx_ba_win > config->dynamic_rx_buf_num){
+		config->rx_ba_win = config->dynamic_rx_buf_num;
+	}
+	if(config->rx_ba_win > 2 * config->static_rx_buf_num){
+		config->rx_ba_win = 2 * config->static_rx_buf_num;
+	}
+
+	ESP_LOGI(TAG, "Driver buffers for profile %s: static rx %d, dynamic rx %d, dynamic tx %d, ampdu rx %d tx %d, ba window %d",
+			p->name, config->static_rx_buf_num, config->dynamic_rx_buf_num, config->dynamic_tx_buf_num,
+			config->ampdu_rx_enable, config->ampdu_tx_enable, config->rx_ba_win);
+}
+
+esp_err_t wifi_profile_apply(wifi_profile_id_t profile, const struct wifi_settings_t *settings){
+
+	const struct wifi_profile_t *p = wifi_profile_get(profile);
+	wifi_bandwidth_t ap_bandwidth = p->from_settings ? settings->ap_bandwidth : p->bandwidth;
+	wifi_ps_type_t power_save = p->from_settings ? settings->sta_power_save : p->power_save;
+	wifi_mode_t mode = WIFI_MODE_NULL;
+	esp_err_t err;
+
+	esp_wifi_get_mode(&mode);
+
+	if(mode == WIFI_MODE_AP || mode == WIFI_MODE_APSTA){
+		err = esp_wifi_set_bandwidth(WIFI_IF_AP, ap_bandwidth);
+		if(err != ESP_OK){
+			ESP_LOGW(TAG, "AP bandwidth not set: %s", esp_err_to_name(err));
+		}
+	}
+
+	if(mode == WIFI_MODE_STA || mode == WIFI_MODE_APSTA){
+		err = esp_wifi_set_bandwidth(WIFI_IF_STA, p->bandwidth);
+		if(err != ESP_OK){
+			ESP_LOGW(TAG, "STA bandwidth not set: %s", esp_err_to_name(err));
+		}
+	}
+
+	err = esp_wifi_set_ps(power_save);
+	if(err == ESP_OK){
+		ESP_LOGI(TAG, "Profile %s applied", p->name);
+	}
+
+	return err;
+}
@@ -0,0 +1,92 @@
+/**
+Copyright (c) 2017-2020 Tony Pottier
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file wifi_profile.h
+@brief Named sets of wifi driver parameters trading throughput, latency and power consumption
+
+A profile sets the buffers and AMPDU parameters the driver is initialized with, the bandwidth of both
+interfaces and the power save mode of the STA. Buffers and AMPDU are only read by esp_wifi_init: they follow
+the profile saved when the wifi manager starts. Bandwidth and power save are applied as soon as the profile changes.
+
+@see https://github.com/tonyp7/esp32-wifi-manager
+*/
+
+#ifndef WIFI_MANAGER_WIFI_PROFILE_H_INCLUDED
+#define WIFI_MANAGER_WIFI_PROFILE_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_wifi.h>
+
+#include "wifi_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * @brief Driver parameters of a profile.
+ * A buffer count of 0 keeps the value of WIFI_INIT_CONFIG_DEFAULT, i.e. the one from menuconfig.
+ */
+struct wifi_profile_t{
+	const char *name;
+	uint8_t static_rx_buf_num;		/* RX buffers allocated when the driver starts */
+	uint8_t dynamic_rx_buf_num;		/* upper bound of RX buffers allocated on demand */
+	uint8_t dynamic_tx_buf_num;		/* upper bound of TX buffers allocated on demand */
+	uint8_t rx_ba_win;				/* AMPDU RX block ack window */
+	bool ampdu_rx_enable;
+	bool ampdu_tx_enable;
+	bool from_settings;				/* AP bandwidth and power save come from wifi_settings instead of the fields below */
+	wifi_bandwidth_t bandwidth;		/* of the STA, and of the AP unless from_settings is set */
+	wifi_ps_type_t power_save;
+};
+
+
+/**
+ * @brief returns the parameters of a profile, or those of WIFI_PROFILE_DEFAULT if profile is out of range.
+ */
+const struct wifi_profile_t* wifi_profile_get(wifi_profile_id_t profile);
+
+/**
+ * @brief returns the profile called name, or WIFI_PROFILE_COUNT if there is none.
+ */
+wifi_profile_id_t wifi_profile_find(const char *name);
+
+/**
+ * @brief overrides the buffer and AMPDU fields of a configuration obtained from WIFI_INIT_CONFIG_DEFAULT.
+ */
+void wifi_profile_init_config(wifi_profile_id_t profile, wifi_init_config_t *config);
+
+/**
+ * @brief applies the bandwidth and power save mode of a profile.
+ * The bandwidth of an interface that is not enabled in the current mode is left alone. A new STA bandwidth
+ * is used from the next association.
+ */
+esp_err_t wifi_profile_apply(wifi_profile_id_t profile, const struct wifi_settings_t *settings);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIFI_MANAGER_WIFI_PROFILE_H_INCLUDED */
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Minifies, fingerprints and gzips the web assets of esp32-wifi-manager.
+
+Run by the build for index.html, code.js and style.css. Each asset is written as <name>.gz, ready to be embedded
+and served as is with "Content-Encoding: gzip". code.js and style.css are renamed after a hash of their content in
+index.html, so that browsers can cache them forever. web_assets.h gives the firmware the fingerprinted names and
+the strong ETags of the three assets.
+
+    build_assets.py --src components/esp32-wifi-manager/src --out build/web_assets
+
+The minification only removes what is certainly safe to remove (indentation, blank lines, comments on their own
+line, spaces around CSS punctuation). Gzip does most of the work; the output is deterministic for a given input.
+"""
+
+import argparse
+import gzip
+import hashlib
+import io
+import os
+import re
+
+
+def minify_html(text):
+    text = re.sub(r"<!--.*?-->", "", text, flags=re.S)
+    return "\n".join(line.strip() for line in text.splitlines() if line.strip()) + "\n"
+
+
+def minify_js(text):
+    out = []
+    in_template = False
+    for line in text.splitlines():
+        # lines inside a multi-line template literal are content: keep them untouched
+        if not in_template:
+            stripped = line.strip()
+            if not stripped or stripped.startswith("//"):
+                continue
+            line = stripped
+        out.append(line)
+        if line.count("`") % 2:
+            in_template = not in_template
+    return "\n".join(out) + "\n"
+
+
+def minify_css(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    text = re.sub(r"\s+", " ", text)
+    text = re.sub(r"\s*([{};,])\s*", r"\1", text)
+    text = re.sub(r":\s+", ":", text)
+    return text.replace(";}", "}").strip() + "\n"
+
+
+def gzip_bytes(data):
+    buf = io.BytesIO()
+    # no name and no time in the header: the same input always gives the same output
+    with gzip.GzipFile(filename="", mode="wb", fileobj=buf, compresslevel=9, mtime=0) as f:
+        f.write(data)
+    return buf.getvalue()
+
+
+def digest(data):
+    return hashlib.sha256(data).hexdigest()
+
+
+def write_if_changed(path, data):
+    if os.path.exists(path):
+        with open(path, "rb") as f:
+            if f.read() == data:
+                return
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--src", required=True, help="directory holding index.html, code.js and style.css")
+    parser.add_argument("--out", required=True, help="directory where the gzipped assets and web_assets.h are written")
+    args = parser.parse_args()
+
+    def read(name):
+        with open(os.path.join(args.src, name), encoding="utf-8") as f:
+            return f.read()
+
+    js = minify_js(read("code.js")).encode()
+    css = minify_css(read("style.css")).encode()
+    js_name = "code.%s.js" % digest(js)[:8]
+    css_name = "style.%s.css" % digest(css)[:8]
+
+    html = minify_html(read("index.html"))
+    html = re.sub(r'(src|href)="code\.js"', r'\1="%s"' % js_name, html)
+    html = re.sub(r'(src|href)="style\.css"', r'\1="%s"' % css_name, html)
+    html = html.encode()
+
+    os.makedirs(args.out, exist_ok=True)
+    header = [
+        "/* generated by tools/build_assets.py: do not edit */",
+        "#ifndef WEB_ASSETS_H_INCLUDED",
+        "#define WEB_ASSETS_H_INCLUDED",
+        "",
+    ]
+    for name, macro, data in (("index.html", "INDEX_HTML", html), ("code.js", "CODE_JS", js), ("style.css", "STYLE_CSS", css)):
+        gz = gzip_bytes(data)
+        write_if_changed(os.path.join(args.out, name + ".gz"), gz)
+        header.append('#define WEB_ASSET_%s_ETAG\t"\\"%s\\""' % (macro, digest(data)[:16]))
+        print("%-11s %6d -> %6d bytes" % (name, len(read(name).encode()), len(gz)))
+    header += [
+        '#define WEB_ASSET_CODE_JS_NAME\t"%s"' % js_name,
+        '#define WEB_ASSET_STYLE_CSS_NAME\t"%s"' % css_name,
+        "",
+        "#endif",
+        "",
+    ]
+    write_if_changed(os.path.join(args.out, "web_assets.h"), "\n".join(header).encode())
+
+
+if __name__ == "__main__":
+    main()
@@ -16,10 +16,13 @@
 
 
 #include "ota_core.h"
+#include "ota_upload.h"
 
 #include "wifi_manager.h"
 
 
+static const char *TAGMAIN = "TRUST-POINT MAINTASK: ";
+
 #define ESP_INTR_FLAG_DEFAULT 0
 gpio_num_t gpio_contact_switch_num = GPIO_NUM_0;
 static xQueueHandle gpio_evt_queue = NULL; // Transaktionswarteschlange
@@ -108,6 +111,10 @@ void app_main()
     gpio_evt_queue = xQueueCreate(10, sizeof(uint32_t));
     event_group = xEventGroupCreate();
     wifi_manager_start();
+#ifdef CONFIG_OTA_UPLOAD
+    /* lets tools/ota_push.py push a firmware, on a server of its own next to the one of the wifi manager */
+    ota_upload_register();
+#endif
     /* register a callback as an example to how you can integrate your code with the wifi manager */
     wifi_manager_set_callback(WM_EVENT_STA_GOT_IP, &cb_connection_ok);
     
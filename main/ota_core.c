@@ -13,9 +13,11 @@
 #include "esp_http_client.h"
 #include "esp_flash_partitions.h"
 #include "esp_partition.h"
+#include "esp_timer.h"
 
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "wifi_manager.h"
 
 #include "ota_core.h"
 //#include "wifi_service.h"
@@ -23,11 +25,17 @@
 
 extern const uint8_t server_cert_pem_start[] asm("_binary_ca_cert_pem_start");
 extern const uint8_t server_cert_pem_end[] asm("_binary_ca_cert_pem_end");
+static const char *TAG = "TRUST-POINT OTA: ";
+
 #define BUFFSIZE 1024
 #define OTA_URL_SIZE 256
 /*an ota data write buffer ready to write to the flash*/
 static char ota_write_data[BUFFSIZE + 1] = { 0 };
 
+/*! set while the internet download or the LAN upload is writing the update partition */
+static portMUX_TYPE update_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool update_in_progress = false;
+
 
 /**
  * @brief print_sha256  service function to print the hash value
@@ -102,10 +110,36 @@ static enum STATE connection_state(BaseType_t actual_event, const char *current_
 }
 
 
+static int8_t ota_rssi(void)
+{
+    wifi_ap_record_t ap_info;
+    return esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK ? ap_info.rssi : 0;
+}
+
+bool ota_core_begin_update(void)
+{
+    bool claimed = false;
+    taskENTER_CRITICAL(&update_mux);
+    if (!update_in_progress) {
+        update_in_progress = claimed = true;
+    }
+    taskEXIT_CRITICAL(&update_mux);
+    return claimed;
+}
+
+void ota_core_end_update(void)
+{
+    taskENTER_CRITICAL(&update_mux);
+    update_in_progress = false;
+    taskEXIT_CRITICAL(&update_mux);
+}
+
 static void http_cleanup(esp_http_client_handle_t client)
 {
     esp_http_client_close(client);
     esp_http_client_cleanup(client);
+    // the download is over: back to the wifi profile the user chose
+    wifi_manager_restore_profile_async();
 }
 
 
@@ -113,6 +147,8 @@ static void http_cleanup(esp_http_client_handle_t client)
 static void __attribute__((noreturn)) task_fatal_error(void)
 {
     ESP_LOGE(TAG, "Exiting task due to fatal error...");
+    // the update was aborted: let an upload have the partition
+    ota_core_end_update();
     (void)vTaskDelete(NULL);
 
     while (1) {
@@ -123,6 +159,7 @@ static void __attribute__((noreturn)) task_fatal_error(void)
 static void infinite_loop(void)
 {
     int i = 0;
+    ota_core_end_update();
     ESP_LOGI(TAG, "When a new firmware is available on the server, press the reset button to download it");
     while(1) 
     {
@@ -138,7 +175,15 @@ static void ota_service()
     const esp_partition_t *update_partition = NULL;
     const esp_partition_t *configured = esp_ota_get_boot_partition();
     const esp_partition_t *running = esp_ota_get_running_partition();
-
+    // phase timings, in the units of the throughput self-test (ms, kbit/s) so that both can be compared
+    int64_t time_start = esp_timer_get_time();
+    int64_t time_connected = 0, time_headers = 0;
+    int64_t read_us = 0, write_us = 0;
+
+    if (!ota_core_begin_update()) {
+        ESP_LOGW(TAG, "An update is already in progress, OTA skipped");
+        return;
+    }
     ESP_LOGI(TAG, "Starting OTA");
     if (configured != running) {
         ESP_LOGW(TAG, "Configured OTA boot partition at offset 0x%08x, but running from offset 0x%08x",
@@ -169,7 +214,11 @@ static void ota_service()
         esp_http_client_cleanup(client);
         task_fatal_error();
     }
+    // favour throughput over latency and power for the duration of the download
+    wifi_manager_override_profile_async(WIFI_PROFILE_BULK_TRANSFER);
+    time_connected = esp_timer_get_time();
     esp_http_client_fetch_headers(client);
+    time_headers = esp_timer_get_time();
     update_partition = esp_ota_get_next_update_partition(NULL);
     assert(update_partition != NULL);
     ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x",
@@ -180,7 +229,9 @@ static void ota_service()
 
     while (1) 
     {
+        int64_t time_read = esp_timer_get_time();
         int data_read = esp_http_client_read(client, ota_write_data, BUFFSIZE);
+        read_us += esp_timer_get_time() - time_read;
         if (data_read < 0) 
         {
             ESP_LOGE(TAG, "Error: SSL data read error");
@@ -247,7 +298,9 @@ static void ota_service()
                     task_fatal_error();
                 }
             }
+            int64_t time_write = esp_timer_get_time();
             err = esp_ota_write( update_handle, (const void *)ota_write_data, data_read);
+            write_us += esp_timer_get_time() - time_write;
             if (err != ESP_OK) 
             {
                 http_cleanup(client);
@@ -275,6 +328,17 @@ static void ota_service()
         }
     }
     ESP_LOGI(TAG, "Total Write binary data length: %d", binary_file_length);
+    {
+        uint32_t connect_ms = (uint32_t)((time_connected - time_start) / 1000);
+        uint32_t headers_ms = (uint32_t)((time_headers - time_connected) / 1000);
+        uint32_t transfer_ms = (uint32_t)((esp_timer_get_time() - time_headers) / 1000);
+        uint32_t read_ms = (uint32_t)(read_us / 1000);
+        uint32_t write_ms = (uint32_t)(write_us / 1000);
+        // goodput over the whole transfer, and over the time spent waiting for the network only
+        ESP_LOGI(TAG, "OTA phases: connect %u ms, headers %u ms, transfer %u ms (%u kbit/s), network read %u ms (%u kbit/s), flash write %u ms, rssi %d dBm",
+                 connect_ms, headers_ms, transfer_ms, transfer_ms ? (uint32_t)((uint64_t)binary_file_length * 8 / transfer_ms) : 0,
+                 read_ms, read_ms ? (uint32_t)((uint64_t)binary_file_length * 8 / read_ms) : 0, write_ms, ota_rssi());
+    }
     if (esp_http_client_is_complete_data_received(client) != true) 
     {
         ESP_LOGE(TAG, "Error in receiving complete file");
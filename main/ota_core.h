@@ -3,6 +3,7 @@
 #ifndef PRJ_MAIN_MODULE
 #define PRJ_MAIN_MODULE
 
+#include <stdbool.h>
 #include "freertos/event_groups.h"
 
 #define HASH_LEN 32 /* SHA-256 digest length */
@@ -23,11 +24,6 @@
 
 
 
-static const char *TAG = "TRUST-POINT OTA: ";
-static const char *TAGMAIN = "TRUST-POINT MAINTASK: ";
-
-
-
 /**
  * @brief Set of states for @ref ota_task(void)
  */
@@ -64,6 +60,16 @@ void notify_wifi_disconnected();
 
 
 void diagnostic_partition_table(const char *partTableRunning,uint8_t lenPartTable);
+
+/*!
+ * Claims the update partition for a download or an upload. Both write the same partition and switch the wifi
+ * profile, so only one may run at a time: returns false if another update holds it.
+ */
+bool ota_core_begin_update(void);
+
+/*! Releases the update partition claimed with ota_core_begin_update() */
+void ota_core_end_update(void);
+
 enum STATE ota_core_task(EventGroupHandle_t *p_eventGrpHdl, enum STATE state );
 
 #endif
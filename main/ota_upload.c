@@ -0,0 +1,336 @@
+/**
+ * @file ota_upload.c
+ * @brief POST /ota: firmware pushed from the local network, written to flash while it is received
+ */
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_app_format.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+
+#include "esp_http_server.h"
+
+#include "wifi_manager.h"
+
+#include "ota_core.h"
+#include "ota_upload.h"
+
+#ifdef CONFIG_OTA_UPLOAD
+
+#define HASH_LEN 32 /* SHA-256 digest length */
+
+static const char *TAG = "TRUST-POINT OTA UPLOAD: ";
+
+static const char bearer_prefix[] = "Bearer ";
+
+static httpd_handle_t upload_server = NULL;
+
+static esp_timer_handle_t restart_timer = NULL;
+static bool restart_pending = false;
+
+
+static esp_err_t upload_send(httpd_req_t *req, const char *status, const char *json, int len)
+{
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, json, len);
+}
+
+static esp_err_t upload_reply(httpd_req_t *req, const char *status, const char *error)
+{
+    char json[96];
+    int len = snprintf(json, sizeof(json), "{\"error\":\"%s\"}", error);
+    ESP_LOGE(TAG, "upload refused: %s", error);
+    return upload_send(req, status, json, len);
+}
+
+/**
+ * @brief compares the Authorization header with the configured token, in a time that does not depend on
+ * where they differ. An empty token disables the upload.
+ */
+static bool upload_authorized(httpd_req_t *req)
+{
+    const char *token = CONFIG_OTA_UPLOAD_TOKEN;
+    size_t token_len = strlen(token);
+    char auth[sizeof(bearer_prefix) + sizeof(CONFIG_OTA_UPLOAD_TOKEN)];
+
+    if (token_len == 0) {
+        return false;
+    }
+    if (httpd_req_get_hdr_value_str(req, "Authorization", auth, sizeof(auth)) != ESP_OK ||
+            strlen(auth) != sizeof(bearer_prefix) - 1 + token_len ||
+            strncmp(auth, bearer_prefix, sizeof(bearer_prefix) - 1) != 0) {
+        return false;
+    }
+
+    uint8_t diff = 0;
+    for (size_t i = 0; i < token_len; i++) {
+        diff |= (uint8_t)auth[sizeof(bearer_prefix) - 1 + i] ^ (uint8_t)token[i];
+    }
+    return diff == 0;
+}
+
+static bool parse_sha256(const char *hex, uint8_t *digest)
+{
+    if (strlen(hex) != HASH_LEN * 2) {
+        return false;
+    }
+    for (int i = 0; i < HASH_LEN; i++) {
+        char byte[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+        char *end;
+        digest[i] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief checks the beginning of the image before anything is erased: it must be an app for this chip,
+ * and not the version that already failed to boot.
+ */
+static const char* check_image_header(const uint8_t *data)
+{
+    const esp_image_header_t *image = (const esp_image_header_t *)data;
+    const esp_app_desc_t *app = (const esp_app_desc_t *)(data + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t));
+
+    if (image->magic != ESP_IMAGE_HEADER_MAGIC || app->magic_word != ESP_APP_DESC_MAGIC_WORD) {
+        return "not an application image";
+    }
+    if (image->chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID) {
+        return "image built for another chip";
+    }
+    ESP_LOGI(TAG, "New firmware version: %s", app->version);
+
+    esp_app_desc_t running_app_info;
+    if (esp_ota_get_partition_description(esp_ota_get_running_partition(), &running_app_info) == ESP_OK) {
+        ESP_LOGI(TAG, "Running firmware version: %s", running_app_info.version);
+#ifndef CONFIG_EXAMPLE_SKIP_VERSION_CHECK
+        if (memcmp(app->version, running_app_info.version, sizeof(app->version)) == 0) {
+            return "same version as the running firmware";
+        }
+#endif
+    }
+
+    const esp_partition_t *last_invalid_app = esp_ota_get_last_invalid_partition();
+    esp_app_desc_t invalid_app_info;
+    if (last_invalid_app != NULL && esp_ota_get_partition_description(last_invalid_app, &invalid_app_info) == ESP_OK &&
+            memcmp(invalid_app_info.version, app->version, sizeof(app->version)) == 0) {
+        return "this version already failed to boot";
+    }
+
+    return NULL;
+}
+
+static void restart_cb(void *arg)
+{
+    ESP_LOGI(TAG, "Prepare to restart system!");
+    esp_restart();
+}
+
+/**
+ * @brief receives exactly len bytes, or less at the end of the body. Gives up after a few timeouts in a row.
+ * @return the number of bytes received, or -1 on error.
+ */
+static int upload_recv(httpd_req_t *req, char *buf, size_t len)
+{
+    size_t received = 0;
+    int timeouts = 0;
+
+    while (received < len) {
+        int ret = httpd_req_recv(req, buf + received, len - received);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < OTA_UPLOAD_MAX_TIMEOUTS) {
+            continue;
+        }
+        if (ret <= 0) {
+            return ret == 0 ? (int)received : -1;
+        }
+        timeouts = 0;
+        received += ret;
+    }
+    return (int)received;
+}
+
+static esp_err_t upload_write(httpd_req_t *req, const esp_partition_t *partition, const uint8_t *expected_sha256)
+{
+    const size_t header_len = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t);
+    esp_ota_handle_t update_handle = 0;
+    mbedtls_sha256_context sha;
+    uint8_t sha256[HASH_LEN];
+    size_t remaining = req->content_len;
+    int64_t time_start = esp_timer_get_time();
+    int64_t read_us = 0, write_us = 0;
+    esp_err_t err;
+
+    char *buf = malloc(OTA_UPLOAD_BUFFSIZE);
+    if (buf == NULL) {
+        return upload_reply(req, "503 Service Unavailable", "out of memory");
+    }
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+
+    while (remaining > 0) {
+        int64_t time_read = esp_timer_get_time();
+        int len = upload_recv(req, buf, remaining < OTA_UPLOAD_BUFFSIZE ? remaining : OTA_UPLOAD_BUFFSIZE);
+        read_us += esp_timer_get_time() - time_read;
+        if (len <= 0) {
+            /* the connection is gone: nobody to answer to */
+            ESP_LOGE(TAG, "upload interrupted with %u bytes left", remaining);
+            err = ESP_FAIL;
+            goto cleanup;
+        }
+
+        if (update_handle == 0) {
+            /* the first buffer holds the whole header: nothing is erased before it's checked */
+            const char *error = (size_t)len < header_len ? "image too small" : check_image_header((const uint8_t *)buf);
+            if (error != NULL) {
+                err = upload_reply(req, "400 Bad Request", error);
+                goto cleanup;
+            }
+            err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
+                update_handle = 0;
+                err = upload_reply(req, "500 Internal Server Error", "cannot write the update partition");
+                goto cleanup;
+            }
+            ESP_LOGI(TAG, "Writing %u bytes to partition subtype %d at offset 0x%x", req->content_len, partition->subtype, partition->address);
+        }
+
+        mbedtls_sha256_update_ret(&sha, (const unsigned char *)buf, len);
+        int64_t time_write = esp_timer_get_time();
+        err = esp_ota_write(update_handle, buf, len);
+        write_us += esp_timer_get_time() - time_write;
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "esp_ota_write failed (%s)", esp_err_to_name(err));
+            err = upload_reply(req, "500 Internal Server Error", "flash write failed");
+            goto cleanup;
+        }
+        remaining -= len;
+    }
+
+    mbedtls_sha256_finish_ret(&sha, sha256);
+    if (memcmp(sha256, expected_sha256, HASH_LEN) != 0) {
+        err = upload_reply(req, "400 Bad Request", "SHA-256 mismatch");
+        goto cleanup;
+    }
+
+    /* checksums, and the signature of the image with signed apps */
+    err = esp_ota_end(update_handle);
+    update_handle = 0;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_end failed (%s)", esp_err_to_name(err));
+        err = upload_reply(req, "400 Bad Request", err == ESP_ERR_OTA_VALIDATE_FAILED ? "image validation failed" : "cannot finish the update");
+        goto cleanup;
+    }
+    err = esp_ota_set_boot_partition(partition);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
+        err = upload_reply(req, "500 Internal Server Error", "cannot set the boot partition");
+        goto cleanup;
+    }
+
+    {
+        uint32_t transfer_ms = (uint32_t)((esp_timer_get_time() - time_start) / 1000);
+        uint32_t kbps = transfer_ms ? (uint32_t)((uint64_t)req->content_len * 8 / transfer_ms) : 0;
+        char json[96];
+        int json_len = snprintf(json, sizeof(json), "{\"size\":%u,\"ms\":%u,\"kbps\":%u}", req->content_len, transfer_ms, kbps);
+        // same units as the "OTA phases" line of the download, so that both paths can be compared
+        ESP_LOGI(TAG, "OTA upload: %u bytes in %u ms (%u kbit/s), network read %u ms, flash write %u ms",
+                 req->content_len, transfer_ms, kbps, (uint32_t)(read_us / 1000), (uint32_t)(write_us / 1000));
+        err = upload_send(req, "200 OK", json, json_len);
+    }
+
+    /* the response gets out before the restart */
+    esp_timer_start_once(restart_timer, (uint64_t)OTA_UPLOAD_RESTART_DELAY * 1000);
+    restart_pending = true;
+
+cleanup:
+    if (update_handle != 0) {
+        esp_ota_abort(update_handle);
+    }
+    mbedtls_sha256_free(&sha);
+    free(buf);
+    return err;
+}
+
+static esp_err_t ota_upload_handler(httpd_req_t *req)
+{
+    char sha256_hex[HASH_LEN * 2 + 1];
+    uint8_t expected_sha256[HASH_LEN];
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+
+    if (!upload_authorized(req)) {
+        httpd_resp_set_hdr(req, "WWW-Authenticate", "Bearer");
+        return upload_reply(req, "401 Unauthorized", "bad or missing token");
+    }
+    if (httpd_req_get_hdr_value_str(req, "X-OTA-SHA256", sha256_hex, sizeof(sha256_hex)) != ESP_OK ||
+            !parse_sha256(sha256_hex, expected_sha256)) {
+        return upload_reply(req, "400 Bad Request", "bad or missing X-OTA-SHA256");
+    }
+    if (partition == NULL) {
+        return upload_reply(req, "500 Internal Server Error", "no update partition");
+    }
+    if (req->content_len == 0 || req->content_len > partition->size) {
+        return upload_reply(req, "413 Payload Too Large", "image does not fit in the update partition");
+    }
+    /* shared with the internet download: the upload server runs one handler at a time, but a download may be
+     * writing the same partition */
+    if (!ota_core_begin_update()) {
+        return upload_reply(req, "409 Conflict", "an update is already in progress");
+    }
+
+    // favour throughput over latency and power for the duration of the upload
+    wifi_manager_override_profile_async(WIFI_PROFILE_BULK_TRANSFER);
+
+    esp_err_t err = upload_write(req, partition, expected_sha256);
+
+    wifi_manager_restore_profile_async();
+    /* after a success the device restarts: no other upload until then */
+    if (!restart_pending) {
+        ota_core_end_update();
+    }
+    return err;
+}
+
+
+void ota_upload_register(void)
+{
+    static const httpd_uri_t route = {
+        .uri = "/ota",
+        .method = HTTP_POST,
+        .handler = ota_upload_handler
+    };
+    const esp_timer_create_args_t restart_timer_args = {
+        .callback = &restart_cb,
+        .name = "ota_upload_restart"
+    };
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+    /* the wifi manager's server handles one request at a time: an upload on it would keep the captive portal
+     * and the pages waiting for as long as the transfer lasts, so the upload gets a server of its own */
+    config.server_port = OTA_UPLOAD_PORT;
+    config.ctrl_port = ESP_HTTPD_DEF_CTRL_PORT + 1;
+    config.max_open_sockets = 1;
+    config.max_uri_handlers = 1;
+
+    if (strlen(CONFIG_OTA_UPLOAD_TOKEN) == 0) {
+        ESP_LOGW(TAG, "CONFIG_OTA_UPLOAD_TOKEN is empty: uploads will be refused");
+    }
+    ESP_ERROR_CHECK(esp_timer_create(&restart_timer_args, &restart_timer));
+    ESP_ERROR_CHECK(httpd_start(&upload_server, &config));
+    ESP_ERROR_CHECK(httpd_register_uri_handler(upload_server, &route));
+    ESP_LOGI(TAG, "Waiting for uploads on port %d", OTA_UPLOAD_PORT);
+}
+
+#endif /* CONFIG_OTA_UPLOAD */
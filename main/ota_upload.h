@@ -0,0 +1,36 @@
+#ifndef OTA_UPLOAD_MODULE
+#define OTA_UPLOAD_MODULE
+
+/**
+ * @file ota_upload.h
+ * @brief Firmware update pushed from a computer on the same network, see tools/ota_push.py
+ *
+ * POST /ota streams the request body straight into the next update partition while it is received. It is served
+ * on port OTA_UPLOAD_PORT by a server of its own, so that the captive portal and the pages of the wifi manager
+ * are still answered during an upload. The request must carry:
+ *  - "Authorization: Bearer <CONFIG_OTA_UPLOAD_TOKEN>"
+ *  - "X-OTA-SHA256: <SHA-256 of the image, 64 hex digits>"
+ *  - a Content-Length, which must fit in the update partition
+ *
+ * The image header is checked before anything is erased, the SHA-256 is computed on the fly and compared once
+ * the body is received, and esp_ota_end validates the image (and its signature, with signed apps) before it is
+ * made the boot partition. The device then restarts.
+ */
+
+/*! Port of the upload server */
+#define OTA_UPLOAD_PORT CONFIG_OTA_UPLOAD_PORT
+
+/*! Size of the buffer the body is received into, on the heap during an upload */
+#define OTA_UPLOAD_BUFFSIZE 4096
+
+/*! Number of consecutive receive timeouts before an upload is given up */
+#define OTA_UPLOAD_MAX_TIMEOUTS 3
+
+/*! Time (in ms) between the response to a successful upload and the restart */
+#define OTA_UPLOAD_RESTART_DELAY 1000
+
+
+/*! Starts the upload server. To be called once the wifi manager is started: it initializes the network stack */
+void ota_upload_register(void);
+
+#endif
@@ -26,6 +26,8 @@
 #include "wifi_service.h"
 #include "ota_core.h"
 
+static const char *TAG = "TRUST-POINT OTA: ";
+
 
 /*! Buffer to save ESP32 MAC address */
 uint8_t esp32_mac[6];
@@ -0,0 +1,152 @@
+/*
+Host benchmark of the removal of duplicate SSIDs from a scan (ap_list_filter_unique), against the
+quadratic filter it replaced.
+
+The record count is the size of the scan buffer of the firmware, CONFIG_WIFI_MANAGER_MAX_AP_NUM, so that
+the hash table has the size it has on the device:
+
+    for n in 15 64 256; do
+        gcc -O2 -Wall -Wextra -DCONFIG_WIFI_MANAGER_MAX_AP_NUM=$n -Itools/host -Icomponents/esp32-wifi-manager/src \
+            tools/ap_list_bench.c components/esp32-wifi-manager/src/ap_list.c -o /tmp/ap_list_bench && /tmp/ap_list_bench
+    done
+
+The scans are made up like the ones of an office: networks of one to four access points, a few hidden
+networks, records sorted by RSSI as the driver returns them. The list is copied before each run, like the
+wifi manager copies its per-BSSID list before filtering it for the page, and the copy is part of the time.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "ap_list.h"
+
+#define RECORDS			CONFIG_WIFI_MANAGER_MAX_AP_NUM
+#define SCANS			64
+#define MIN_RUN_NS		200000000ULL
+
+
+/**
+ * @brief The filter of the original wifi manager: every record against every later one, then a compaction
+ * pass that looks for the first free slot from the start of the list after each move.
+ */
+static void quadratic_filter_unique(wifi_ap_record_t *aplist, uint16_t *aps){
+	int total_unique = *aps;
+	wifi_ap_record_t *first_free = NULL;
+
+	for(int i=0; i<*aps-1; i++){
+		wifi_ap_record_t *ap = &aplist[i];
+		if(ap->ssid[0] == 0) continue;
+		for(int j=i+1; j<*aps; j++){
+			wifi_ap_record_t *ap1 = &aplist[j];
+			if(strcmp((const char *)ap->ssid, (const char *)ap1->ssid) == 0 && ap->authmode == ap1->authmode){
+				if(ap1->rssi > ap->rssi) ap->rssi = ap1->rssi;
+				memset(ap1, 0, sizeof(wifi_ap_record_t));
+			}
+		}
+	}
+	for(int i=0; i<*aps; i++){
+		wifi_ap_record_t *ap = &aplist[i];
+		if(ap->ssid[0] == 0){
+			if(first_free == NULL) first_free = ap;
+			total_unique--;
+			continue;
+		}
+		if(first_free != NULL){
+			memcpy(first_free, ap, sizeof(wifi_ap_record_t));
+			memset(ap, 0, sizeof(wifi_ap_record_t));
+			for(int j=0; j<*aps; j++){
+				if(aplist[j].ssid[0] == 0){
+					first_free = &aplist[j];
+					break;
+				}
+			}
+		}
+	}
+	*aps = total_unique;
+}
+
+static int compare_rssi(const void *a, const void *b){
+	return ((const wifi_ap_record_t*)b)->rssi - ((const wifi_ap_record_t*)a)->rssi;
+}
+
+static void make_scan(wifi_ap_record_t *aplist, uint16_t *aps, unsigned seed){
+	srand(seed);
+	uint16_t n = 0;
+	int network = 0;
+
+	memset(aplist, 0, sizeof(wifi_ap_record_t) * RECORDS);
+	while(n < RECORDS){
+		int bssids = 1 + rand() % 4;
+		int hidden = rand() % 10 == 0;
+		wifi_auth_mode_t authmode = (rand() % 5 == 0) ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA2_PSK;
+		for(int b=0; b<bssids && n<RECORDS; b++, n++){
+			wifi_ap_record_t *ap = &aplist[n];
+			if(!hidden){
+				snprintf((char*)ap->ssid, sizeof(ap->ssid), "office-network-%d", network);
+			}
+			ap->bssid[4] = network;
+			ap->bssid[5] = b;
+			ap->primary = 1 + rand() % 13;
+			ap->rssi = -30 - rand() % 65;
+			ap->authmode = authmode;
+		}
+		network++;
+	}
+	qsort(aplist, n, sizeof(wifi_ap_record_t), compare_rssi);
+	*aps = n;
+}
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static wifi_ap_record_t scans[SCANS][RECORDS];
+static uint16_t scan_num[SCANS];
+static wifi_ap_record_t work[RECORDS];
+
+/**
+ * @brief Average time of copy + filter over the scans, in ns. The number of networks found is returned in unique.
+ */
+static double run(void (*filter)(wifi_ap_record_t*, uint16_t*), unsigned *unique){
+	uint64_t iterations = 0, start = now_ns(), elapsed;
+	unsigned total = 0;
+
+	do{
+		for(int s=0; s<SCANS; s++){
+			uint16_t aps = scan_num[s];
+			memcpy(work, scans[s], sizeof(wifi_ap_record_t) * aps);
+			filter(work, &aps);
+			total += aps;
+		}
+		iterations++;
+		elapsed = now_ns() - start;
+	}while(elapsed < MIN_RUN_NS);
+
+	*unique = total / iterations;
+	return (double)elapsed / (iterations * SCANS);
+}
+
+int main(){
+
+	for(int s=0; s<SCANS; s++){
+		make_scan(scans[s], &scan_num[s], s + 1);
+	}
+
+	unsigned unique_hash, unique_quadratic;
+	double hash = run(ap_list_filter_unique, &unique_hash);
+	double quadratic = run(quadratic_filter_unique, &unique_quadratic);
+
+	if(unique_hash != unique_quadratic){
+		fprintf(stderr, "the filters disagree: %u networks against %u\n", unique_hash, unique_quadratic);
+		return 1;
+	}
+
+	printf("%4d records, %5.1f networks: hash %8.0f ns, quadratic %8.0f ns, x%.1f\n",
+			RECORDS, (double)unique_hash / SCANS, hash, quadratic, quadratic / hash);
+	return 0;
+}
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Replays the captive portal probes of the common OSes against the access point.
+
+Connect the host to the access point of the device first: its fake DNS is
+what sends the probes to the device, so they are sent straight to its address
+here, with the Host header and the User-Agent the OSes use. Each probe must be
+answered with something other than the success answer of its OS, which makes
+the OS open its login window, and must lead to the wifi manager. The time to
+portal is the time from the probe to the end of the portal page.
+
+    tools/captive_probe_test.py
+    tools/captive_probe_test.py 10.10.0.1 --rounds 5 --concurrent
+
+--concurrent sends all the probes at once, like a phone joining the network
+while a laptop is already on it.
+"""
+
+import argparse
+import http.client
+import statistics
+import sys
+import threading
+import time
+import urllib.parse
+
+# os, host, path, user agent, success answer: (status, body) or None when any body will do
+PROBES = (
+    ("Android", "connectivitycheck.gstatic.com", "/generate_204",
+     "Dalvik/2.1.0 (Linux; U; Android 13; Pixel 6 Build/TQ3A.230805.001)", (204, None)),
+    ("Android", "clients3.google.com", "/generate_204",
+     "Dalvik/2.1.0 (Linux; U; Android 9; SM-G960F Build/PPR1.180610.011)", (204, None)),
+    ("ChromeOS", "www.gstatic.com", "/gen_204",
+     "Mozilla/5.0 (X11; CrOS x86_64 15437.61.0) AppleWebKit/537.36 (KHTML, like Gecko)", (204, None)),
+    ("iOS/macOS", "captive.apple.com", "/hotspot-detect.html",
+     "CaptiveNetworkSupport-443.40.2 wispr",
+     (200, b"<HTML><HEAD><TITLE>Success</TITLE></HEAD><BODY>Success</BODY></HTML>")),
+    ("iOS (old)", "www.apple.com", "/library/test/success.html",
+     "CaptiveNetworkSupport-355.200.27 wispr",
+     (200, b"<HTML><HEAD><TITLE>Success</TITLE></HEAD><BODY>Success</BODY></HTML>")),
+    ("Windows 10+", "www.msftconnecttest.com", "/connecttest.txt",
+     "Microsoft NCSI", (200, b"Microsoft Connect Test")),
+    ("Windows 7", "www.msftncsi.com", "/ncsi.txt",
+     "Microsoft NCSI", (200, b"Microsoft NCSI")),
+    ("Firefox", "detectportal.firefox.com", "/canonical.html",
+     "Mozilla/5.0 (X11; Linux x86_64; rv:115.0) Gecko/20100101 Firefox/115.0",
+     (200, b'<meta http-equiv="refresh" content="0;url=https://support.mozilla.org/kb/captive-portal"/>')),
+    ("Firefox", "detectportal.firefox.com", "/success.txt",
+     "Mozilla/5.0 (X11; Linux x86_64; rv:115.0) Gecko/20100101 Firefox/115.0", (200, b"success\n")),
+)
+
+
+def get(device, host, path, user_agent, timeout):
+    conn = http.client.HTTPConnection(device, 80, timeout=timeout)
+    conn.request("GET", path, headers={"Host": host, "User-Agent": user_agent, "Accept": "*/*"})
+    resp = conn.getresponse()
+    body = resp.read()
+    conn.close()
+    return resp, body
+
+
+def replay(device, probe, timeout):
+    """Returns (ms to the probe answer, ms to the end of the portal page, error or None)."""
+    os_name, host, path, user_agent, (success_status, success_body) = probe
+    start = time.monotonic()
+    try:
+        resp, body = get(device, host, path, user_agent, timeout)
+        answered = (time.monotonic() - start) * 1000
+
+        if resp.status == success_status and (success_body is None or body.strip() == success_body.strip()):
+            return answered, None, "success answer: no portal"
+
+        location = resp.getheader("Location")
+        if resp.status in (301, 302, 303, 307) and location:
+            url = urllib.parse.urlsplit(location)
+            portal, page = get(url.hostname, url.hostname, url.path or "/", user_agent, timeout)
+            if portal.status != 200 or not page:
+                return answered, None, "portal answered %d" % portal.status
+        elif resp.status != 200 or not body:
+            return answered, None, "neither a redirect nor a page (%d)" % resp.status
+
+        return answered, (time.monotonic() - start) * 1000, None
+    except (OSError, http.client.HTTPException) as e:
+        return None, None, str(e) or e.__class__.__name__
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("device", nargs="?", default="10.10.0.1", help="IP address of the access point")
+    parser.add_argument("--rounds", type=int, default=3, help="times each probe is replayed")
+    parser.add_argument("--concurrent", action="store_true", help="send the probes of a round all at once")
+    parser.add_argument("--timeout", type=float, default=10, help="seconds")
+    args = parser.parse_args()
+
+    results = {i: [] for i in range(len(PROBES))}
+
+    for _ in range(args.rounds):
+        if args.concurrent:
+            def run(i):
+                results[i].append(replay(args.device, PROBES[i], args.timeout))
+            threads = [threading.Thread(target=run, args=(i,)) for i in range(len(PROBES))]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+        else:
+            for i, probe in enumerate(PROBES):
+                results[i].append(replay(args.device, probe, args.timeout))
+
+    failed = 0
+    print("%-12s %-44s %10s %10s %10s" % ("os", "probe", "answer ms", "portal ms", "worst ms"))
+    for i, (os_name, host, path, _, _) in enumerate(PROBES):
+        errors = [e for _, _, e in results[i] if e]
+        answers = [a for a, _, e in results[i] if not e]
+        portals = [p for _, p, e in results[i] if not e]
+        if errors:
+            failed += 1
+            print("%-12s %-44s %s" % (os_name, host + path, errors[0]))
+            continue
+        times = (statistics.median(answers), statistics.median(portals), max(portals))
+        print("%-12s %-44s %10.0f %10.0f %10.0f" % ((os_name, host + path) + times))
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
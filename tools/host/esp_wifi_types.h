@@ -0,0 +1,53 @@
+/* Host stand-in for the ESP-IDF 4.3 esp_wifi_types.h, for the host tools under tools/.
+ * Only the scan record is declared, with the layout and size of the real one. */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+	WIFI_AUTH_OPEN = 0,
+	WIFI_AUTH_WEP,
+	WIFI_AUTH_WPA_PSK,
+	WIFI_AUTH_WPA2_PSK,
+	WIFI_AUTH_WPA_WPA2_PSK,
+	WIFI_AUTH_WPA2_ENTERPRISE,
+	WIFI_AUTH_WPA3_PSK,
+	WIFI_AUTH_WPA2_WPA3_PSK,
+	WIFI_AUTH_WAPI_PSK,
+	WIFI_AUTH_MAX
+} wifi_auth_mode_t;
+
+typedef enum { WIFI_SECOND_CHAN_NONE = 0, WIFI_SECOND_CHAN_ABOVE, WIFI_SECOND_CHAN_BELOW } wifi_second_chan_t;
+typedef enum { WIFI_CIPHER_TYPE_NONE = 0, WIFI_CIPHER_TYPE_CCMP = 4, WIFI_CIPHER_TYPE_UNKNOWN = 9 } wifi_cipher_type_t;
+typedef enum { WIFI_ANT_ANT0, WIFI_ANT_ANT1, WIFI_ANT_MAX } wifi_ant_t;
+typedef enum { WIFI_COUNTRY_POLICY_AUTO, WIFI_COUNTRY_POLICY_MANUAL } wifi_country_policy_t;
+
+typedef struct {
+	char cc[3];
+	uint8_t schan;
+	uint8_t nchan;
+	int8_t max_tx_power;
+	wifi_country_policy_t policy;
+} wifi_country_t;
+
+typedef struct {
+	uint8_t bssid[6];
+	uint8_t ssid[33];
+	uint8_t primary;
+	wifi_second_chan_t second;
+	int8_t rssi;
+	wifi_auth_mode_t authmode;
+	wifi_cipher_type_t pairwise_cipher;
+	wifi_cipher_type_t group_cipher;
+	wifi_ant_t ant;
+	uint32_t phy_11b:1;
+	uint32_t phy_11g:1;
+	uint32_t phy_11n:1;
+	uint32_t phy_lr:1;
+	uint32_t wps:1;
+	uint32_t ftm_responder:1;
+	uint32_t ftm_initiator:1;
+	uint32_t reserved:25;
+	wifi_country_t country;
+} wifi_ap_record_t;
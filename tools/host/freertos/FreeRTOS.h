@@ -0,0 +1,17 @@
+/* Host stand-in for FreeRTOS.h, for the host tools under tools/: the types and constants only.
+ * One tick is one millisecond. */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef struct host_task_t* TaskHandle_t;
+
+#define pdTRUE				((BaseType_t)1)
+#define pdFALSE				((BaseType_t)0)
+#define portMAX_DELAY		((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS	((TickType_t)1)
+#define pdMS_TO_TICKS(ms)	((TickType_t)(ms))
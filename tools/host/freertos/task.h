@@ -0,0 +1,61 @@
+/* Host stand-in for freertos/task.h, for the host tools under tools/: task notifications only.
+ * Any pthread is a task. Its handle is created the first time the thread asks for it, and the notification
+ * value is a counter guarded by a mutex, with the semantics of xTaskNotifyGive / ulTaskNotifyTake. */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+
+struct host_task_t{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t notified;
+};
+
+static __thread TaskHandle_t host_task_current = NULL;
+
+static inline TaskHandle_t xTaskGetCurrentTaskHandle(void){
+	if(host_task_current == NULL){
+		host_task_current = (TaskHandle_t)calloc(1, sizeof(struct host_task_t));
+		pthread_mutex_init(&host_task_current->lock, NULL);
+		pthread_cond_init(&host_task_current->cond, NULL);
+	}
+	return host_task_current;
+}
+
+static inline BaseType_t xTaskNotifyGive(TaskHandle_t task){
+	pthread_mutex_lock(&task->lock);
+	task->notified++;
+	pthread_cond_signal(&task->cond);
+	pthread_mutex_unlock(&task->lock);
+	return pdTRUE;
+}
+
+static inline uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait){
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += xTicksToWait / 1000;
+	deadline.tv_nsec += (long)(xTicksToWait % 1000) * 1000000L;
+	if(deadline.tv_nsec >= 1000000000L){
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&task->lock);
+	while(task->notified == 0 && xTicksToWait != 0){
+		int err = xTicksToWait == portMAX_DELAY ? pthread_cond_wait(&task->cond, &task->lock) : pthread_cond_timedwait(&task->cond, &task->lock, &deadline);
+		if(err == ETIMEDOUT) break;
+	}
+	uint32_t value = task->notified;
+	if(value != 0){
+		task->notified = xClearCountOnExit ? 0 : value - 1;
+	}
+	pthread_mutex_unlock(&task->lock);
+	return value;
+}
@@ -0,0 +1,8 @@
+/* Host stand-in for the sdkconfig.h generated by the ESP-IDF build, for the host tools under tools/.
+ * Options are set on the compiler command line; the defaults are the ones of the component Kconfig. */
+
+#pragma once
+
+#ifndef CONFIG_WIFI_MANAGER_MAX_AP_NUM
+#define CONFIG_WIFI_MANAGER_MAX_AP_NUM 15
+#endif
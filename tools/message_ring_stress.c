@@ -0,0 +1,221 @@
+/*
+Host stress test of the message ring of the wifi manager (components/esp32-wifi-manager/src/message_ring.c).
+
+Producers are pthreads hammering the ring the way the event loop, the timers and the http server do on the
+device, with the wifi manager task as the single consumer. tools/host stands in for FreeRTOS and the ring's
+C11 atomics are the real ones, so the interleavings are those of a multicore host: more than an ESP32 ever
+produces.
+
+    gcc -O2 -Wall -pthread -Itools/host -Icomponents/esp32-wifi-manager/src \
+        tools/message_ring_stress.c -o /tmp/message_ring_stress && /tmp/message_ring_stress
+
+Build it with -fsanitize=thread as well when changing the ring.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/* wifi_manager.h pulls in the whole of ESP-IDF: the ring only needs these, which must match their definitions there */
+#define WIFI_MANAGER_H_INCLUDED
+typedef enum message_code_t{
+	HOST_MESSAGE_CODE_MAX = 31
+}message_code_t;
+typedef struct{
+	message_code_t code;
+	void *param;
+}queue_message;
+struct wifi_manager_queue_stats_t{
+	uint32_t capacity;
+	uint32_t pushed;
+	uint32_t coalesced;
+	uint32_t dropped;
+	uint32_t high_water_mark;
+	uint32_t deferred;
+};
+
+#include "message_ring.c"
+
+
+#define PRODUCERS			4
+#define MESSAGES			200000
+#define COALESCED_CODES		4
+#define COALESCED_FIRST		(32 - COALESCED_CODES)
+
+#define CHECK(cond, ...)	do{ if(!(cond)){ fprintf(stderr, "FAILED %s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); exit(1); } }while(0)
+
+static message_ring_t *ring;
+static atomic_uint refused;
+static atomic_uint producers_done;
+
+
+/**
+ * @brief Every message is pushed until the ring takes it: the consumer must see each producer's messages in order.
+ */
+static void* fifo_producer(void *arg){
+	long id = (long)arg;
+	for(long i=0; i<MESSAGES; i++){
+		queue_message msg = { .code = (message_code_t)id, .param = (void*)i };
+		while(!message_ring_push(ring, &msg, false)){
+			atomic_fetch_add(&refused, 1);
+			sched_yield();
+		}
+	}
+	atomic_fetch_add(&producers_done, 1);
+	return NULL;
+}
+
+static void test_fifo(){
+	pthread_t threads[PRODUCERS];
+	long last[PRODUCERS];
+	ring = message_ring_create(16);
+	atomic_store(&refused, 0);
+
+	for(long i=0; i<PRODUCERS; i++){
+		last[i] = -1;
+		pthread_create(&threads[i], NULL, fifo_producer, (void*)i);
+	}
+
+	queue_message msg;
+	for(long received=0; received<(long)PRODUCERS * MESSAGES; received++){
+		CHECK(message_ring_pop(ring, &msg, 2000), "no message for 2s after %ld: lost wake up", received);
+		long id = msg.code, seq = (long)msg.param;
+		CHECK(id >= 0 && id < PRODUCERS, "unknown producer %ld", id);
+		CHECK(seq == last[id] + 1, "producer %ld: got %ld after %ld", id, seq, last[id]);
+		last[id] = seq;
+	}
+	for(int i=0; i<PRODUCERS; i++){
+		pthread_join(threads[i], NULL);
+	}
+	CHECK(!message_ring_pop(ring, &msg, 0), "message left in the ring");
+
+	struct wifi_manager_queue_stats_t stats;
+	message_ring_get_stats(ring, &stats);
+	CHECK(stats.pushed == PRODUCERS * MESSAGES, "pushed %u", stats.pushed);
+	CHECK(stats.dropped == atomic_load(&refused), "dropped %u, refused %u", stats.dropped, atomic_load(&refused));
+	CHECK(stats.high_water_mark <= stats.capacity, "high water mark %u over %u", stats.high_water_mark, stats.capacity);
+	printf("fifo:      %d x %d messages in order, %u refused while full, high water mark %u/%u\n",
+			PRODUCERS, MESSAGES, stats.dropped, stats.high_water_mark, stats.capacity);
+	message_ring_delete(ring);
+}
+
+
+/* @brief per coalesced code: requests made, and the highest request a push accepted */
+static atomic_uint requests[COALESCED_CODES];
+static atomic_uint accepted[COALESCED_CODES];
+static atomic_uint attempts;
+
+/**
+ * @brief Coalesced orders mixed with plain messages. A request is counted before its push: the consumer
+ * handling an order serves every request counted before it popped that order.
+ */
+static void* coalesce_producer(void *arg){
+	unsigned seed = (unsigned)(uintptr_t)arg;
+	for(long i=0; i<MESSAGES; i++){
+		atomic_fetch_add(&attempts, 1);
+		if(rand_r(&seed) % 4 == 0){
+			queue_message msg = { .code = (message_code_t)0, .param = NULL };
+			message_ring_push(ring, &msg, false);
+			continue;
+		}
+		int c = rand_r(&seed) % COALESCED_CODES;
+		unsigned request = atomic_fetch_add(&requests[c], 1) + 1;
+		queue_message msg = { .code = (message_code_t)(COALESCED_FIRST + c), .param = NULL };
+		if(message_ring_push(ring, &msg, true)){
+			unsigned prev = atomic_load(&accepted[c]);
+			while(request > prev && !atomic_compare_exchange_weak(&accepted[c], &prev, request));
+		}
+	}
+	atomic_fetch_add(&producers_done, 1);
+	return NULL;
+}
+
+static void test_coalesce(){
+	pthread_t threads[PRODUCERS];
+	unsigned served[COALESCED_CODES] = { 0 };
+	unsigned popped = 0;
+	ring = message_ring_create(8);
+	atomic_store(&producers_done, 0);
+
+	for(long i=0; i<PRODUCERS; i++){
+		pthread_create(&threads[i], NULL, coalesce_producer, (void*)(i + 1));
+	}
+
+	queue_message msg;
+	for(;;){
+		bool done = atomic_load(&producers_done) == PRODUCERS;
+		if(!message_ring_pop(ring, &msg, done ? 0 : 100)){
+			if(done) break;
+			continue;
+		}
+		popped++;
+		if(msg.code >= COALESCED_FIRST){
+			int c = msg.code - COALESCED_FIRST;
+			served[c] = atomic_load(&requests[c]);
+		}
+		/* a slow consumer, so that orders wait in the ring and get coalesced */
+		if(popped % 64 == 0){
+			usleep(10);
+		}
+	}
+	for(int i=0; i<PRODUCERS; i++){
+		pthread_join(threads[i], NULL);
+	}
+
+	struct wifi_manager_queue_stats_t stats;
+	message_ring_get_stats(ring, &stats);
+	for(int c=0; c<COALESCED_CODES; c++){
+		CHECK(served[c] >= atomic_load(&accepted[c]), "code %d: request %u accepted but only %u served",
+				COALESCED_FIRST + c, atomic_load(&accepted[c]), served[c]);
+	}
+	CHECK(stats.pushed == popped, "pushed %u, popped %u", stats.pushed, popped);
+	CHECK(stats.pushed + stats.coalesced + stats.dropped == atomic_load(&attempts), "pushed %u + coalesced %u + dropped %u != %u",
+			stats.pushed, stats.coalesced, stats.dropped, atomic_load(&attempts));
+	CHECK(atomic_load(&ring->pending) == 0, "pending bits 0x%08x left on an empty ring", atomic_load(&ring->pending));
+	printf("coalesce:  %u messages, %u coalesced, %u dropped, no accepted order lost\n",
+			stats.pushed, stats.coalesced, stats.dropped);
+	message_ring_delete(ring);
+}
+
+
+/**
+ * @brief A full ring refuses messages, and a refused coalesced order does not block the next ones.
+ */
+static void test_full(){
+	const message_code_t coalesced = (message_code_t)COALESCED_FIRST;
+	queue_message msg = { .code = (message_code_t)1, .param = NULL };
+	ring = message_ring_create(3);
+
+	for(int i=0; i<4; i++){
+		CHECK(message_ring_push(ring, &msg, false), "push %d refused by a ring of 4", i);
+	}
+	CHECK(!message_ring_push(ring, &msg, false), "push accepted by a full ring");
+	msg.code = coalesced;
+	CHECK(!message_ring_push(ring, &msg, true), "coalesced push accepted by a full ring");
+
+	CHECK(message_ring_pop(ring, &msg, 0), "nothing to pop from a full ring");
+	msg.code = coalesced;
+	CHECK(message_ring_push(ring, &msg, true), "coalesced push refused after a refused one");
+	CHECK(message_ring_push(ring, &msg, true), "identical order not coalesced");
+
+	struct wifi_manager_queue_stats_t stats;
+	message_ring_get_stats(ring, &stats);
+	CHECK(stats.dropped == 2 && stats.coalesced == 1 && stats.pushed == 5, "dropped %u, coalesced %u, pushed %u",
+			stats.dropped, stats.coalesced, stats.pushed);
+	printf("full:      refused while full, coalescing resumes once there is room\n");
+	message_ring_delete(ring);
+}
+
+
+int main(){
+	test_full();
+	test_fifo();
+	test_coalesce();
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Pushes a firmware to a device on the same network, through POST /ota on the
+upload server of the device (CONFIG_OTA_UPLOAD_PORT).
+
+The image is streamed to the device, which writes it to the update partition
+while it is received, checks its SHA-256 and its signature, then restarts on
+it. Throughput is in kbit/s and times are in ms, like the "OTA upload" line
+logged by the firmware.
+
+    tools/ota_push.py 192.168.1.42 build/OTABasic.bin --token s3cret
+    OTA_TOKEN=s3cret tools/ota_push.py 192.168.1.42 build/OTABasic.bin
+
+The token is CONFIG_OTA_UPLOAD_TOKEN of the running firmware. It is sent in
+clear: only push over a network you trust.
+"""
+
+import argparse
+import hashlib
+import http.client
+import json
+import os
+import sys
+import time
+
+CHUNK = 16384
+
+
+def sha256_of(path):
+    digest = hashlib.sha256()
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(CHUNK), b""):
+            digest.update(chunk)
+    return digest.hexdigest()
+
+
+def push(args, size, sha256):
+    conn = http.client.HTTPConnection(args.device, args.port, timeout=args.timeout)
+    conn.putrequest("POST", "/ota")
+    conn.putheader("Content-Type", "application/octet-stream")
+    conn.putheader("Content-Length", str(size))
+    conn.putheader("Authorization", "Bearer " + args.token)
+    conn.putheader("X-OTA-SHA256", sha256)
+    conn.endheaders()
+
+    sent = 0
+    start = time.monotonic()
+    try:
+        with open(args.firmware, "rb") as f:
+            for chunk in iter(lambda: f.read(CHUNK), b""):
+                conn.send(chunk)
+                sent += len(chunk)
+                elapsed = time.monotonic() - start
+                kbps = sent * 8 / 1000 / elapsed if elapsed > 0 else 0
+                sys.stderr.write("\r%3d%% %9d bytes %7.0f kbit/s" % (sent * 100 // size, sent, kbps))
+    except OSError:
+        # the device answers and closes when it refuses the image: its reply says why
+        pass
+    sys.stderr.write("\n")
+
+    resp = conn.getresponse()
+    body = resp.read().decode(errors="replace")
+    conn.close()
+    try:
+        reply = json.loads(body)
+    except ValueError:
+        reply = {"error": body.strip() or resp.reason}
+    return resp.status, reply, time.monotonic() - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("device", help="IP address of the device")
+    parser.add_argument("firmware", help="application image, e.g. build/OTABasic.bin")
+    parser.add_argument("--token", default=os.environ.get("OTA_TOKEN"), help="defaults to $OTA_TOKEN")
+    parser.add_argument("--port", type=int, default=8032, help="CONFIG_OTA_UPLOAD_PORT")
+    parser.add_argument("--timeout", type=float, default=30, help="seconds")
+    args = parser.parse_args()
+
+    if not args.token:
+        parser.error("a token is required (--token or $OTA_TOKEN)")
+
+    size = os.path.getsize(args.firmware)
+    sha256 = sha256_of(args.firmware)
+    print("%s: %d bytes, sha256 %s" % (args.firmware, size, sha256))
+
+    try:
+        status, reply, elapsed = push(args, size, sha256)
+    except (OSError, http.client.HTTPException) as e:
+        print("upload failed: %s" % e)
+        return 1
+
+    if status != 200:
+        print("upload refused (%d): %s" % (status, reply.get("error", reply)))
+        return 1
+
+    print("device: %d bytes in %d ms (%d kbit/s)" % (reply["size"], reply["ms"], reply["kbps"]))
+    print("host:   %.0f ms, the device restarts on the new firmware" % (elapsed * 1000))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
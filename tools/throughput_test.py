@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+"""Host side of the wifi manager throughput self-test.
+
+Starts a test on the device through POST /throughput.json, runs the transfer
+and prints the measures of both ends. Goodput is in kbit/s and times are in ms,
+like the "OTA phases" line logged by the firmware, so a slow update can be
+traced either to the link or to the update code.
+
+    tools/throughput_test.py 192.168.1.42
+    tools/throughput_test.py 192.168.1.42 --proto udp --bitrate 8000
+    tools/throughput_test.py 192.168.1.42 --direction upload --duration 20
+    tools/throughput_test.py 192.168.1.42 --duration 30 --scan channel
+
+"download" goes from the host to the device, the direction of an OTA update.
+--scan makes the device order a scan every 5 s during the transfer, of all
+channels at once ("full") or one channel at a time ("channel"), so that the
+cost of each kind of scan can be compared with a run without scans.
+"""
+
+import argparse
+import json
+import socket
+import struct
+import sys
+import time
+import urllib.request
+
+UDP_PAYLOAD = 1470
+UDP_HEADER = struct.Struct("!III")  # seq, sec, usec of the sender clock
+UDP_FIN = 0xFFFFFFFF
+TCP_CHUNK = 16384
+
+
+def http(method, url, headers=None):
+    req = urllib.request.Request(url, method=method, headers=headers or {})
+    with urllib.request.urlopen(req, timeout=5) as resp:
+        return json.loads(resp.read().decode())
+
+
+class UdpReceiver:
+    """Loss, reordering and RFC 3550 interarrival jitter of a datagram stream."""
+
+    def __init__(self):
+        self.packets = 0
+        self.bytes = 0
+        self.lost = 0
+        self.out_of_order = 0
+        self.next_seq = 0
+        self.jitter = 0.0
+        self.prev_transit = None
+        self.first = None
+        self.last = None
+
+    def feed(self, data, now):
+        seq, sec, usec = UDP_HEADER.unpack_from(data)
+        if seq == UDP_FIN:
+            return False
+        if self.first is None:
+            self.first = now
+        self.last = now
+        self.packets += 1
+        self.bytes += len(data)
+        if seq >= self.next_seq:
+            self.lost += seq - self.next_seq
+            self.next_seq = seq + 1
+        else:
+            self.out_of_order += 1
+            self.lost = max(0, self.lost - 1)
+        transit = now * 1e6 - (sec * 1e6 + usec)
+        if self.prev_transit is not None:
+            self.jitter += (abs(transit - self.prev_transit) - self.jitter) / 16
+        self.prev_transit = transit
+        return True
+
+
+def measures(nbytes, first, last, **extra):
+    duration = int((last - first) * 1000) if first is not None and last is not None else 0
+    goodput = nbytes * 8 // duration if duration > 0 else 0
+    return dict(bytes=nbytes, duration=duration, goodput=goodput, **extra)
+
+
+def tcp_download(host, port, duration):
+    chunk = b"\x55" * TCP_CHUNK
+    sent = 0
+    with socket.create_connection((host, port), timeout=10) as s:
+        first = time.monotonic()
+        end = first + duration
+        try:
+            while time.monotonic() < end:
+                s.sendall(chunk)
+                sent += len(chunk)
+        except (ConnectionResetError, BrokenPipeError):
+            pass  # the device stops reading once its own clock says the test is over
+        last = time.monotonic()
+    return measures(sent, first, last)
+
+
+def tcp_upload(host, port, duration):
+    received = 0
+    first = last = None
+    with socket.create_connection((host, port), timeout=10) as s:
+        s.settimeout(duration + 5)
+        while True:
+            try:
+                data = s.recv(65536)
+            except (ConnectionResetError, socket.timeout):
+                break
+            if not data:
+                break
+            now = time.monotonic()
+            if first is None:
+                first = now
+            last = now
+            received += len(data)
+    return measures(received, first, last)
+
+
+def udp_download(host, port, duration, bitrate):
+    interval = UDP_PAYLOAD * 8 / (bitrate * 1000)
+    padding = b"\x55" * (UDP_PAYLOAD - UDP_HEADER.size)
+    sent = 0
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        first = time.monotonic()
+        next_send = first
+        seq = 0
+        while time.monotonic() < first + duration:
+            now = time.time()
+            s.sendto(UDP_HEADER.pack(seq, int(now), int((now % 1) * 1e6)) + padding, (host, port))
+            seq += 1
+            sent += UDP_PAYLOAD
+            next_send += interval
+            delay = next_send - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+        last = time.monotonic()
+        for _ in range(3):
+            s.sendto(UDP_HEADER.pack(UDP_FIN, 0, 0), (host, port))
+    return measures(sent, first, last, packets=seq)
+
+
+def udp_upload(host, port, duration):
+    rx = UdpReceiver()
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        s.sendto(b"hello", (host, port))
+        s.settimeout(2)
+        deadline = time.monotonic() + duration + 10
+        while time.monotonic() < deadline:
+            try:
+                data = s.recv(65536)
+            except socket.timeout:
+                break
+            if len(data) >= UDP_HEADER.size and not rx.feed(data, time.time()):
+                break  # FIN
+    return measures(rx.bytes, rx.first, rx.last, packets=rx.packets, lost=rx.lost,
+                    out_of_order=rx.out_of_order, jitter=int(rx.jitter))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("device", help="IP address of the device")
+    parser.add_argument("--proto", choices=("tcp", "udp"), default="tcp")
+    parser.add_argument("--direction", choices=("download", "upload"), default="download")
+    parser.add_argument("--duration", type=float, default=10, help="seconds, 60 at most")
+    parser.add_argument("--bitrate", type=int, default=1000, help="kbit/s of an UDP test, at most 100000")
+    parser.add_argument("--scan", choices=("none", "full", "channel"), default="none",
+                        help="scans the device orders during the transfer")
+    parser.add_argument("--root", default="/", help="URL where the wifi manager is located")
+    parser.add_argument("--json", action="store_true", help="print the measures as JSON")
+    args = parser.parse_args()
+
+    url = "http://%s%sthroughput.json" % (args.device, args.root)
+    state = http("POST", url, {
+        "X-Custom-proto": args.proto,
+        "X-Custom-direction": args.direction,
+        "X-Custom-duration": str(int(args.duration * 1000)),
+        "X-Custom-bitrate": str(args.bitrate),
+        "X-Custom-scan": args.scan,
+    })
+    port = state["port"]
+
+    if args.proto == "tcp" and args.direction == "download":
+        host = tcp_download(args.device, port, args.duration)
+    elif args.proto == "tcp":
+        host = tcp_upload(args.device, port, args.duration)
+    elif args.direction == "download":
+        host = udp_download(args.device, port, args.duration, args.bitrate)
+    else:
+        host = udp_upload(args.device, port, args.duration)
+
+    device = state
+    deadline = time.monotonic() + 15
+    while device["state"] in ("waiting", "running") and time.monotonic() < deadline:
+        time.sleep(0.5)
+        device = http("GET", url)
+
+    if args.json:
+        print(json.dumps({"host": host, "device": device}, indent=2))
+        return 0 if device["state"] == "done" else 1
+
+    print("%s %s, %.0f s, device state: %s" % (args.proto, args.direction, args.duration, device["state"]))
+    print("%-14s %12s %12s" % ("", "host", "device"))
+    for key, unit in (("bytes", ""), ("duration", "ms"), ("goodput", "kbit/s"), ("packets", ""),
+                      ("lost", ""), ("out_of_order", ""), ("jitter", "us")):
+        if key in host or (args.proto == "udp" and key in device):
+            print("%-14s %12s %12s" % ("%s %s" % (key, unit), host.get(key, "-"), device.get(key, "-")))
+    print("rssi           %d dBm at start, %d dBm at end" % (device.get("rssi_start", 0), device.get("rssi_end", 0)))
+    if args.scan != "none":
+        print("scans          %d %s scan(s) ordered" % (device.get("scans", 0), args.scan))
+    return 0 if device["state"] == "done" else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())